@@ -645,7 +645,7 @@ parse_skip_access(struct snmp_toolinfo *snmptoolctx) {
 
 char *
 snmp_parse_suboid(char *str, asn_oid_t *oid) {
-    char *endptr;
+    const char *endptr;
     asn_subid_t suboid;
 
     if (*str == '.')
@@ -655,17 +655,16 @@ snmp_parse_suboid(char *str, asn_oid_t *oid) {
         return (str);
 
     do {
-        suboid = strtoul(str, &endptr, 10);
-        if ((asn_subid_t) suboid > ASN_MAXID) {
-            warnx("Suboid %u > ASN_MAXID", suboid);
+        if (asn_str2subid(str, &suboid, &endptr) != ASN_ERR_OK) {
+            warnx("Suboid %.*s > ASN_MAXID", (int)(endptr - str), str);
             return (NULL);
         }
         if (snmp_suboid_append(oid, suboid) < 0)
             return (NULL);
-        str = endptr + 1;
+        str = (char *)endptr + 1;
     } while (*endptr == '.');
 
-    return (endptr);
+    return ((char *)endptr);
 }
 
 static char *
@@ -907,7 +906,7 @@ snmp_parse_index(struct snmp_toolinfo *snmptoolctx, char *str,
 */
 int32_t
 snmp_parse_numoid(char *argv, asn_oid_t *var) {
-    char *endptr, *str;
+    const char *endptr, *str;
     asn_subid_t suboid;
 
     str = argv;
@@ -921,9 +920,8 @@ snmp_parse_numoid(char *argv, asn_oid_t *var) {
             return (-1);
         }
 
-        suboid = strtoul(str, &endptr, 10);
-        if (suboid > ASN_MAXID) {
-            warnx("Oid too long - %u", var->len);
+        if (asn_str2subid(str, &suboid, &endptr) != ASN_ERR_OK) {
+            warnx("Suboid %.*s > ASN_MAXID", (int)(endptr - str), str);
             return (-1);
         }
 
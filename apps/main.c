@@ -463,6 +463,11 @@ snmptool_add_vbind(snmp_pdu_t *pdu, struct snmp_object *obj) {
     if (obj->error > 0)
         return (0);
 
+    if (snmp_pdu_reserve(pdu, pdu->nbindings + 1) < 0) {
+        warn("snmp_pdu_reserve failed");
+        return (-1);
+    }
+
     asn_append_oid(&(pdu->bindings[pdu->nbindings].oid), &(obj->val.oid));
     pdu->nbindings++;
 
@@ -546,9 +551,10 @@ snmptool_get(struct snmp_toolinfo *snmptoolctx) {
 
         fprintf(stderr, "Retrying...\n");
         snmp_pdu_free(&resp);
-        snmp_pdu_create(&snmptoolctx->client, &req, GET_PDUTYPE(snmptoolctx));
+        snmp_pdu_reset(&snmptoolctx->client, &req, GET_PDUTYPE(snmptoolctx));
     }
 
+    snmp_pdu_free(&req);
     snmp_pdu_free(&resp);
 
     return (0);
@@ -575,7 +581,9 @@ snmpwalk_add_default(struct snmp_toolinfo *snmptoolctx,
  */
 static void
 snmpwalk_nextpdu_create(struct snmp_client* client, uint32_t op, asn_oid_t *var, snmp_pdu_t *pdu) {
-    snmp_pdu_create(client, pdu, op);
+    snmp_pdu_reset(client, pdu, op);
+    if (snmp_pdu_reserve(pdu, 1) < 0)
+        err(1, "snmp_pdu_reserve failed");
     asn_append_oid(&(pdu->bindings[0].oid), var);
     pdu->nbindings = 1;
 }
@@ -586,6 +594,7 @@ snmptool_walk(struct snmp_toolinfo *snmptoolctx) {
     asn_oid_t root;	/* Keep the inital oid. */
     int32_t outputs, rc;
 
+    snmp_pdu_init(&resp);
     snmp_pdu_create(&snmptoolctx->client, &req, SNMP_PDU_GETNEXT);
 
     while ((rc = snmp_pdu_add_bindings(snmptoolctx, NULL,
@@ -650,9 +659,12 @@ snmptool_walk(struct snmp_toolinfo *snmptoolctx) {
             break;
         }
 
-        snmp_pdu_create(&snmptoolctx->client, &req, SNMP_PDU_GETNEXT);
+        snmp_pdu_reset(&snmptoolctx->client, &req, SNMP_PDU_GETNEXT);
     }
 
+    snmp_pdu_free(&req);
+    snmp_pdu_free(&resp);
+
     if (rc == 0)
         return (0);
     else
@@ -665,28 +677,18 @@ snmptool_walk(struct snmp_toolinfo *snmptoolctx) {
 
 static int32_t
 parse_oid_numeric(snmp_value_t *value, char *val) {
-    char *endptr;
-    int32_t saved_errno;
+    const char *endptr;
     asn_subid_t suboid;
 
     do {
-        saved_errno = errno;
-        errno = 0;
-        suboid = strtoul(val, &endptr, 10);
-        if (errno != 0) {
+        if (asn_str2subid(val, &suboid, &endptr) != ASN_ERR_OK) {
             warnx("Value %s not supported - %s", val,
-                  strerror(errno));
-            errno = saved_errno;
-            return (-1);
-        }
-        errno = saved_errno;
-        if ((asn_subid_t) suboid > ASN_MAXID) {
-            warnx("Suboid %u > ASN_MAXID", suboid);
+                  strerror(ERANGE));
             return (-1);
         }
         if (snmp_suboid_append(&(value->v.oid), suboid) < 0)
             return (-1);
-        val = endptr + 1;
+        val = (char *)endptr + 1;
     } while (*endptr == '.');
 
     if (*endptr != '\0')
@@ -1162,6 +1164,11 @@ snmpset_add_vbind(snmp_pdu_t *pdu, struct snmp_object *obj) {
     if (obj->error > 0)
         return (0);
 
+    if (snmp_pdu_reserve(pdu, pdu->nbindings + 1) < 0) {
+        warn("snmp_pdu_reserve failed");
+        return (-1);
+    }
+
     if (snmpset_add_value(&(pdu->bindings[pdu->nbindings]), &(obj->val))
             < 0)
         return (-1);
@@ -1176,6 +1183,7 @@ static int
 snmptool_set(struct snmp_toolinfo *snmptoolctx) {
     snmp_pdu_t req, resp;
 
+    snmp_pdu_init(&resp);
     snmp_pdu_create(&snmptoolctx->client, &req, SNMP_PDU_SET);
 
     while ((snmp_pdu_add_bindings(snmptoolctx, snmpset_verify_vbind,
@@ -1206,6 +1214,7 @@ snmptool_set(struct snmp_toolinfo *snmptoolctx) {
         snmp_pdu_create(&snmptoolctx->client, &req, SNMP_PDU_SET);
     }
 
+    snmp_pdu_free(&req);
     snmp_pdu_free(&resp);
 
     return (0);
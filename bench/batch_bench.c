@@ -0,0 +1,354 @@
+/*
+ * Request rate of one client with and without batched I/O on loopback.
+ *
+ * The client keeps a window of GET requests outstanding in an snmp_loop;
+ * each response sends the next request. With batching the requests are
+ * sent with sendmmsg and the responses received with recvmmsg, batch of
+ * them per call. The agent answering them runs in the same thread and
+ * uses recvmmsg and sendmmsg in all cases. Results are reported like
+ * codec_bench:
+ *
+ *	case,iterations,ns_per_op,allocs_per_op
+ *
+ * where an operation is one request and response and allocs_per_op
+ * counts the heap allocations of the client side after warm-up. The
+ * benchmark fails if a request is not answered or the client side
+ * allocates. It needs epoll, sendmmsg and recvmmsg.
+ */
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE	/* sendmmsg, recvmmsg */
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "bsnmp/config.h"
+#if defined(HAVE_EPOLL) && defined(HAVE_SENDMMSG)
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include "bsnmp/asn1.h"
+#include "bsnmp/snmp.h"
+#include "bsnmp/client.h"
+#include "bsnmp/loop.h"
+
+#define BENCH_MIN_NS	500000000.0
+#define BENCH_WARMUP	2
+#define BENCH_BUFSIZ	2048
+#define BENCH_AGENT	64	/* messages per agent call */
+
+/*
+ * Allocation counting, see codec_bench.
+ */
+#ifdef __GLIBC__
+extern void *__libc_malloc(size_t);
+extern void *__libc_calloc(size_t, size_t);
+extern void *__libc_realloc(void *, size_t);
+
+static unsigned long allocs;
+static int in_agent;
+
+void *
+malloc(size_t size) {
+    if (!in_agent)
+        allocs++;
+    return (__libc_malloc(size));
+}
+
+void *
+calloc(size_t n, size_t size) {
+    if (!in_agent)
+        allocs++;
+    return (__libc_calloc(n, size));
+}
+
+void *
+realloc(void *ptr, size_t size) {
+    if (!in_agent)
+        allocs++;
+    return (__libc_realloc(ptr, size));
+}
+#define ALLOCS()	((double)allocs)
+#define AGENT(x)	(in_agent = (x))
+#else
+#define ALLOCS()	(-1.0)
+#define AGENT(x)
+#endif
+
+static double
+now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((double)ts.tv_sec * 1e9 + (double)ts.tv_nsec);
+}
+
+static const asn_subid_t if_descr[] = { 1, 3, 6, 1, 2, 1, 2, 2, 1, 2, 1 };
+
+static struct snmp_loop loop;
+static struct snmp_client client;
+static snmp_pdu_t req;
+static int sending;
+static u_long answered, timeouts;
+
+/*
+ * The agent. It answers every binding with the same interface name.
+ */
+static int agent_fd = -1;
+static u_char agent_rxbuf[BENCH_AGENT][BENCH_BUFSIZ];
+static u_char agent_txbuf[BENCH_AGENT][BENCH_BUFSIZ];
+static struct sockaddr_in agent_from[BENCH_AGENT];
+static struct iovec agent_rxiov[BENCH_AGENT], agent_txiov[BENCH_AGENT];
+static struct mmsghdr agent_rx[BENCH_AGENT], agent_tx[BENCH_AGENT];
+static snmp_pdu_t agent_pdu;
+static snmp_arena_t agent_arena;
+
+static int
+agent_open(char *port, size_t size) {
+    struct sockaddr_in sin;
+    socklen_t len;
+    int rcvbuf = 4 << 20;
+
+    if ((agent_fd = socket(AF_INET, SOCK_DGRAM, 0)) == -1)
+        return (-1);
+    (void)setsockopt(agent_fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf,
+                     sizeof(rcvbuf));
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    len = sizeof(sin);
+    if (bind(agent_fd, (struct sockaddr *)&sin, sizeof(sin)) == -1 ||
+            getsockname(agent_fd, (struct sockaddr *)&sin, &len) == -1)
+        return (-1);
+    snprintf(port, size, "%u", ntohs(sin.sin_port));
+    return (0);
+}
+
+static int
+agent_answer(u_int i) {
+    static u_char descr[] = "GigabitEthernet0/0/17";
+    asn_buf_t b;
+    int32_t ip;
+    u_int j;
+
+    snmp_pdu_clear(&agent_pdu);
+    b.asn_ptr = agent_rxbuf[i];
+    b.asn_len = agent_rx[i].msg_len;
+    if (snmp_pdu_decode(&b, &agent_pdu, &ip) != SNMP_CODE_OK)
+        return (-1);
+
+    agent_pdu.pdu_type = SNMP_PDU_RESPONSE;
+    for (j = 0; j < agent_pdu.nbindings; j++) {
+        agent_pdu.bindings[j].syntax = SNMP_SYNTAX_OCTETSTRING;
+        agent_pdu.bindings[j].v.octetstring.octets = descr;
+        agent_pdu.bindings[j].v.octetstring.len = sizeof(descr) - 1;
+    }
+    b.asn_ptr = agent_txbuf[i];
+    b.asn_len = sizeof(agent_txbuf[i]);
+    if (snmp_pdu_encode_rev(&agent_pdu, &b) != SNMP_CODE_OK)
+        return (-1);
+    for (j = 0; j < agent_pdu.nbindings; j++)
+        agent_pdu.bindings[j].syntax = SNMP_SYNTAX_NULL;
+
+    agent_txiov[i].iov_base = agent_pdu.outer_ptr;
+    agent_txiov[i].iov_len = agent_pdu.outer_len;
+    agent_tx[i].msg_hdr.msg_iov = &agent_txiov[i];
+    agent_tx[i].msg_hdr.msg_iovlen = 1;
+    agent_tx[i].msg_hdr.msg_name = &agent_from[i];
+    agent_tx[i].msg_hdr.msg_namelen = agent_rx[i].msg_hdr.msg_namelen;
+    return (0);
+}
+
+static int
+agent_serve(void) {
+    int i, n, k;
+
+    AGENT(1);
+    for (;;) {
+        for (i = 0; i < BENCH_AGENT; i++) {
+            agent_rxiov[i].iov_base = agent_rxbuf[i];
+            agent_rxiov[i].iov_len = sizeof(agent_rxbuf[i]);
+            agent_rx[i].msg_hdr.msg_iov = &agent_rxiov[i];
+            agent_rx[i].msg_hdr.msg_iovlen = 1;
+            agent_rx[i].msg_hdr.msg_name = &agent_from[i];
+            agent_rx[i].msg_hdr.msg_namelen = sizeof(agent_from[i]);
+        }
+        if ((n = recvmmsg(agent_fd, agent_rx, BENCH_AGENT, MSG_DONTWAIT,
+                          NULL)) == -1)
+            break;
+        for (i = 0; i < n; i++)
+            if (agent_answer(i) != 0)
+                goto fail;
+        for (i = 0; i < n; i += k)
+            if ((k = sendmmsg(agent_fd, &agent_tx[i], n - i, 0)) == -1)
+                goto fail;
+    }
+    AGENT(0);
+    return (errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1);
+
+  fail:
+    AGENT(0);
+    return (-1);
+}
+
+/*
+ * The client.
+ */
+static void
+response(struct snmp_client *c, snmp_pdu_t *pdu, snmp_pdu_t *resp,
+         void *arg) {
+    (void)arg;
+    if (resp == NULL) {
+        timeouts++;
+        return;
+    }
+    if (resp->nbindings == pdu->nbindings &&
+            resp->bindings[0].syntax == SNMP_SYNTAX_OCTETSTRING)
+        answered++;
+    if (sending && snmp_pdu_send(c, pdu, response, NULL) == -1)
+        fprintf(stderr, "send: %s\n", c->error);
+}
+
+static int
+client_open(u_int batch) {
+    snmp_value_t *v;
+    char port[16];
+    int rcvbuf = 4 << 20;
+
+    if (agent_open(port, sizeof(port)) != 0)
+        return (-1);
+    snmp_client_init(&client);
+    client.dump_pdus = 0;
+    client.timeout.tv_sec = 5;
+    client.retries = 0;
+    client.txbuflen = client.rxbuflen = BENCH_BUFSIZ;
+    client.batch = batch;
+    if (snmp_open(&client, "127.0.0.1", port, NULL, NULL) != 0) {
+        fprintf(stderr, "open: %s\n", client.error);
+        return (-1);
+    }
+    (void)setsockopt(client.fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf,
+                     sizeof(rcvbuf));
+    if (snmp_loop_add(&loop, &client) != 0)
+        return (-1);
+
+    snmp_pdu_create(&client, &req, SNMP_PDU_GET);
+    if (snmp_pdu_reserve(&req, 1) != 0)
+        return (-1);
+    v = &req.bindings[req.nbindings++];
+    v->oid.len = sizeof(if_descr) / sizeof(if_descr[0]);
+    memcpy(v->oid.subs, if_descr, sizeof(if_descr));
+    v->syntax = SNMP_SYNTAX_NULL;
+    return (0);
+}
+
+static void
+client_close(void) {
+    snmp_close(&client);
+    snmp_pdu_free(&req);
+    if (agent_fd != -1)
+        (void)close(agent_fd);
+    agent_fd = -1;
+}
+
+/*
+ * Fill the window, run for a while, then let the outstanding requests
+ * drain. Returns the number of requests answered in the time taken.
+ */
+static int
+run_window(u_int window, double *t, u_long *n) {
+    double start;
+    u_int w;
+
+    answered = timeouts = 0;
+    start = now_ns();
+    sending = 1;
+    for (w = 0; w < window; w++)
+        if (snmp_pdu_send(&client, &req, response, NULL) == -1)
+            return (-1);
+    while (sending) {
+        if (snmp_loop_run_once(&loop, 0) == -1 || agent_serve() != 0)
+            return (-1);
+        if (now_ns() - start >= BENCH_MIN_NS)
+            sending = 0;
+    }
+    while (loop.timers.count > 0)
+        if (snmp_loop_run_once(&loop, 0) == -1 || agent_serve() != 0)
+            return (-1);
+    *t = now_ns() - start;
+    *n = answered;
+    return (timeouts == 0 ? 0 : -1);
+}
+
+static int
+run(u_int batch, u_int window) {
+    double t, a;
+    u_long ops;
+    u_int i;
+
+    if (client_open(batch) != 0) {
+        perror("client");
+        client_close();
+        return (-1);
+    }
+    for (i = 0; i < BENCH_WARMUP; i++)
+        if (run_window(window, &t, &ops) != 0)
+            goto fail;
+    a = ALLOCS();
+    if (run_window(window, &t, &ops) != 0)
+        goto fail;
+    a = ALLOCS() < 0 ? -1.0 : (ALLOCS() - a) / ops;
+
+    printf("batch_b%u_w%u,%lu,%.1f,%.2f\n", batch, window, ops, t / ops, a);
+    client_close();
+    if (a > 0) {
+        fprintf(stderr, "batch_b%u_w%u: steady state allocates\n", batch,
+                window);
+        return (-1);
+    }
+    return (0);
+
+  fail:
+    fprintf(stderr, "batch_b%u_w%u: %lu timeouts, %s\n", batch, window,
+            timeouts, client.error);
+    client_close();
+    return (-1);
+}
+
+int
+main(void) {
+    int err = 0;
+
+    if (snmp_loop_init(&loop) != 0) {
+        perror("epoll");
+        return (1);
+    }
+    snmp_pdu_init(&agent_pdu);
+    snmp_arena_init(&agent_arena, NULL, 0);
+    agent_pdu.arena = &agent_arena;
+
+    printf("case,iterations,ns_per_op,allocs_per_op\n");
+
+    err |= run(1, 16);
+    err |= run(16, 16);
+    err |= run(1, 64);
+    err |= run(32, 64);
+    err |= run(1, 256);
+    err |= run(64, 256);
+
+    snmp_loop_close(&loop);
+    snmp_pdu_free(&agent_pdu);
+    snmp_arena_free(&agent_arena);
+    return (err ? 1 : 0);
+}
+
+#else /* !HAVE_EPOLL || !HAVE_SENDMMSG */
+
+int
+main(void) {
+    printf("batch_bench: no epoll or sendmmsg\n");
+    return (0);
+}
+
+#endif
@@ -0,0 +1,327 @@
+/*
+ * Request/response benchmark for the client over the loopback interface.
+ *
+ * The agent side is a plain UDP socket served from the same thread: each
+ * operation sends a request with snmp_pdu_send, lets the agent answer it
+ * and receives the answer with snmp_receive. Results are reported like
+ * codec_bench:
+ *
+ *	case,iterations,ns_per_op,allocs_per_op
+ *
+ * allocs_per_op counts the heap allocations of the client side only and
+ * must be 0 after warm-up, otherwise the benchmark fails; make test checks
+ * the same with tests/alloc_test.c. Counting is only available with glibc
+ * and is -1 elsewhere.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "bsnmp/config.h"
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#endif
+#include "bsnmp/asn1.h"
+#include "bsnmp/snmp.h"
+#include "bsnmp/client.h"
+
+#define BENCH_MIN_NS	200000000.0
+#define BENCH_WARMUP	100
+#define BENCH_BUFSIZ	65536
+
+/*
+ * Allocation counting.
+ */
+#ifdef __GLIBC__
+extern void *__libc_malloc(size_t);
+extern void *__libc_calloc(size_t, size_t);
+extern void *__libc_realloc(void *, size_t);
+
+static unsigned long allocs;
+static int in_agent;
+
+void *
+malloc(size_t size) {
+    if (!in_agent)
+        allocs++;
+    return (__libc_malloc(size));
+}
+
+void *
+calloc(size_t n, size_t size) {
+    if (!in_agent)
+        allocs++;
+    return (__libc_calloc(n, size));
+}
+
+void *
+realloc(void *ptr, size_t size) {
+    if (!in_agent)
+        allocs++;
+    return (__libc_realloc(ptr, size));
+}
+#define ALLOCS()	((double)allocs)
+#else
+#define ALLOCS()	(-1.0)
+#endif
+
+static double
+now_ns(void) {
+#ifdef _WIN32
+    LARGE_INTEGER c, f;
+
+    QueryPerformanceCounter(&c);
+    QueryPerformanceFrequency(&f);
+    return ((double)c.QuadPart * 1e9 / (double)f.QuadPart);
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((double)ts.tv_sec * 1e9 + (double)ts.tv_nsec);
+#endif
+}
+
+static const asn_subid_t if_descr[] = { 1, 3, 6, 1, 2, 1, 2, 2, 1, 2 };
+
+static struct snmp_client client;
+static snmp_pdu_t req;
+static struct snmp_pdu_tmpl tmpl;
+static u_long answered;
+
+/*
+ * The agent. It answers every binding with the same interface name.
+ */
+static socket_t agent_fd = -1;
+static u_char agent_rxbuf[BENCH_BUFSIZ];
+static u_char agent_txbuf[BENCH_BUFSIZ];
+static snmp_pdu_t agent_pdu;
+static snmp_arena_t agent_arena;
+
+static int
+agent_open(char *port, size_t size) {
+    struct sockaddr_in sin;
+    socklen_t len;
+
+    if ((agent_fd = socket(AF_INET, SOCK_DGRAM, 0)) == -1)
+        return (-1);
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    len = sizeof(sin);
+    if (bind(agent_fd, (struct sockaddr *)&sin, sizeof(sin)) == -1 ||
+            getsockname(agent_fd, (struct sockaddr *)&sin, &len) == -1)
+        return (-1);
+    snprintf(port, size, "%u", ntohs(sin.sin_port));
+
+    snmp_pdu_init(&agent_pdu);
+    snmp_arena_init(&agent_arena, NULL, 0);
+    agent_pdu.arena = &agent_arena;
+    return (0);
+}
+
+static int
+agent_serve(void) {
+    static u_char descr[] = "GigabitEthernet0/0/17";
+    struct sockaddr_in from;
+    socklen_t fromlen;
+    asn_buf_t b;
+    int32_t ip;
+    ssize_t n;
+    u_int i;
+
+    fromlen = sizeof(from);
+    if ((n = recvfrom(agent_fd, (char *)agent_rxbuf, sizeof(agent_rxbuf), 0,
+                      (struct sockaddr *)&from, &fromlen)) <= 0)
+        return (-1);
+
+    snmp_pdu_clear(&agent_pdu);
+    b.asn_ptr = agent_rxbuf;
+    b.asn_len = n;
+    if (snmp_pdu_decode(&b, &agent_pdu, &ip) != SNMP_CODE_OK)
+        return (-1);
+
+    agent_pdu.pdu_type = SNMP_PDU_RESPONSE;
+    for (i = 0; i < agent_pdu.nbindings; i++) {
+        agent_pdu.bindings[i].syntax = SNMP_SYNTAX_OCTETSTRING;
+        agent_pdu.bindings[i].v.octetstring.octets = descr;
+        agent_pdu.bindings[i].v.octetstring.len = sizeof(descr) - 1;
+    }
+    b.asn_ptr = agent_txbuf;
+    b.asn_len = sizeof(agent_txbuf);
+    if (snmp_pdu_encode_rev(&agent_pdu, &b) != SNMP_CODE_OK)
+        return (-1);
+    /* the values belong to us, not to the PDU */
+    for (i = 0; i < agent_pdu.nbindings; i++)
+        agent_pdu.bindings[i].syntax = SNMP_SYNTAX_NULL;
+
+    if (sendto(agent_fd, (const char *)agent_pdu.outer_ptr,
+               agent_pdu.outer_len, 0, (struct sockaddr *)&from,
+               fromlen) == -1)
+        return (-1);
+    return (0);
+}
+
+/*
+ * The client side. Requests are answered right away, so the timers are
+ * never fired.
+ */
+static void *
+timeout_start(struct timeval *tv, snmp_timeout_cb_f cb, void *arg) {
+    static int id;
+
+    (void)tv;
+    (void)cb;
+    (void)arg;
+    return (&id);
+}
+
+static void
+timeout_stop(void *id) {
+    (void)id;
+}
+
+static void
+response(struct snmp_client *c, snmp_pdu_t *pdu, snmp_pdu_t *resp,
+         void *arg) {
+    (void)c;
+    (void)pdu;
+    (void)arg;
+    if (resp != NULL && resp->nbindings == req.nbindings &&
+            resp->bindings[0].syntax == SNMP_SYNTAX_OCTETSTRING)
+        answered++;
+}
+
+static int
+op_get(int use_tmpl) {
+    int32_t id;
+    int ret;
+
+    if (use_tmpl)
+        id = snmp_pdu_send_tmpl(&client, &tmpl, response, NULL);
+    else
+        id = snmp_pdu_send(&client, &req, response, NULL);
+    if (id == -1)
+        return (-1);
+#ifdef __GLIBC__
+    in_agent = 1;
+#endif
+    ret = agent_serve();
+#ifdef __GLIBC__
+    in_agent = 0;
+#endif
+    if (ret != 0)
+        return (-1);
+    return (snmp_receive(&client, 1));
+}
+
+static void
+make_get(u_int nbindings) {
+    snmp_value_t *v;
+    u_int i;
+
+    snmp_pdu_reset(&client, &req, SNMP_PDU_GET);
+    if (snmp_pdu_reserve(&req, nbindings) != 0)
+        abort();
+    for (i = 0; i < nbindings; i++) {
+        v = &req.bindings[req.nbindings++];
+        v->oid.len = sizeof(if_descr) / sizeof(if_descr[0]);
+        memcpy(v->oid.subs, if_descr, sizeof(if_descr));
+        v->oid.subs[v->oid.len++] = i + 1;
+        v->syntax = SNMP_SYNTAX_NULL;
+    }
+}
+
+static int
+run(const char *name, int use_tmpl) {
+    double start, a, t;
+    u_long n, i, batch;
+
+    answered = 0;
+    for (i = 0; i < BENCH_WARMUP; i++)
+        if (op_get(use_tmpl) != 0)
+            goto fail;
+
+    n = 0;
+    a = ALLOCS();
+    start = now_ns();
+    for (batch = 100;; batch *= 2) {
+        for (i = 0; i < batch; i++)
+            if (op_get(use_tmpl) != 0)
+                goto fail;
+        n += batch;
+        if ((t = now_ns() - start) >= BENCH_MIN_NS)
+            break;
+    }
+    a = ALLOCS() < 0 ? -1.0 : (ALLOCS() - a) / n;
+
+    if (answered != n + BENCH_WARMUP) {
+        fprintf(stderr, "%s: %lu of %lu requests answered\n", name,
+                answered, n + BENCH_WARMUP);
+        return (-1);
+    }
+    printf("%s,%lu,%.1f,%.2f\n", name, n, t / n, a);
+    if (a > 0) {
+        fprintf(stderr, "%s: steady state allocates\n", name);
+        return (-1);
+    }
+    return (0);
+
+  fail:
+    fprintf(stderr, "%s: %s\n", name, client.error);
+    return (-1);
+}
+
+int
+main(void) {
+    static const u_int sizes[] = { 1, 20, 100 };
+    char port[16], name[64];
+    int err = 0;
+    u_int i;
+
+#ifdef _WIN32
+    WSADATA wsa;
+
+    WSAStartup(MAKEWORD(2, 2), &wsa);
+#endif
+    if (agent_open(port, sizeof(port)) != 0) {
+        perror("agent");
+        return (1);
+    }
+
+    snmp_client_init(&client);
+    client.dump_pdus = 0;
+    client.timeout_start = timeout_start;
+    client.timeout_stop = timeout_stop;
+    if (snmp_open(&client, "127.0.0.1", port, NULL, NULL) != 0) {
+        fprintf(stderr, "open: %s\n", client.error);
+        return (1);
+    }
+    snmp_pdu_init(&req);
+
+    printf("case,iterations,ns_per_op,allocs_per_op\n");
+
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        make_get(sizes[i]);
+        sprintf(name, "get_%u", sizes[i]);
+        err |= run(name, 0);
+
+        if (snmp_pdu_compile(&client, &req, &tmpl) != 0) {
+            fprintf(stderr, "compile: %s\n", client.error);
+            return (1);
+        }
+        sprintf(name, "get_tmpl_%u", sizes[i]);
+        err |= run(name, 1);
+        snmp_pdu_tmpl_free(&tmpl);
+    }
+
+    snmp_pdu_free(&req);
+    snmp_close(&client);
+    (void)closesocket(agent_fd);
+    snmp_pdu_free(&agent_pdu);
+    snmp_arena_free(&agent_arena);
+    return (err ? 1 : 0);
+}
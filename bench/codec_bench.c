@@ -0,0 +1,387 @@
+/*
+ * Microbenchmarks for the ASN.1 and SNMP codec.
+ *
+ * Every case is run until it has taken at least BENCH_MIN_NS and is
+ * reported as one CSV line:
+ *
+ *	case,iterations,ns_per_op,allocs_per_op
+ *
+ * allocs_per_op counts calls to malloc, calloc and realloc. It is only
+ * available with glibc and is -1 elsewhere.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+#include "bsnmp/config.h"
+#include "bsnmp/asn1.h"
+#include "bsnmp/snmp.h"
+
+#define BENCH_MIN_NS	200000000.0
+#define BENCH_BUFSIZ	65536
+
+/*
+ * Allocation counting.
+ */
+#ifdef __GLIBC__
+extern void *__libc_malloc(size_t);
+extern void *__libc_calloc(size_t, size_t);
+extern void *__libc_realloc(void *, size_t);
+
+static unsigned long allocs;
+
+void *
+malloc(size_t size) {
+    allocs++;
+    return (__libc_malloc(size));
+}
+
+void *
+calloc(size_t n, size_t size) {
+    allocs++;
+    return (__libc_calloc(n, size));
+}
+
+void *
+realloc(void *ptr, size_t size) {
+    allocs++;
+    return (__libc_realloc(ptr, size));
+}
+#define ALLOCS()	((double)allocs)
+#else
+#define ALLOCS()	(-1.0)
+#endif
+
+static double
+now_ns(void) {
+#ifdef _WIN32
+    LARGE_INTEGER c, f;
+
+    QueryPerformanceCounter(&c);
+    QueryPerformanceFrequency(&f);
+    return ((double)c.QuadPart * 1e9 / (double)f.QuadPart);
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((double)ts.tv_sec * 1e9 + (double)ts.tv_nsec);
+#endif
+}
+
+/*
+ * Test data.
+ */
+static const asn_subid_t if_entry[] = { 1, 3, 6, 1, 2, 1, 2, 2, 1 };
+static const asn_subid_t ip_net_to_media[] = {
+    1, 3, 6, 1, 2, 1, 4, 22, 1, 2, 1000012, 10, 128, 17, 203, 254
+};
+
+static u_char txbuf[BENCH_BUFSIZ];
+static u_char rxbuf[BENCH_BUFSIZ];
+static size_t rxlen;
+static snmp_pdu_t req, resp;
+static snmp_arena_t arena;
+static snmp_user_t usm_user;
+
+static void
+set_oid(asn_oid_t *oid, const asn_subid_t *subs, u_int len) {
+    oid->len = len;
+    memcpy(oid->subs, subs, len * sizeof(subs[0]));
+}
+
+static void
+add_column(snmp_pdu_t *pdu, asn_subid_t column, asn_subid_t row,
+           enum snmp_syntax syntax) {
+    snmp_value_t *v;
+    static u_char descr[] = "GigabitEthernet0/0/17";
+    static u_char phys[] = { 0x00, 0x1b, 0x21, 0x3c, 0x4d, 0x5e };
+
+    if (snmp_pdu_reserve(pdu, pdu->nbindings + 1) != 0)
+        abort();
+    v = &pdu->bindings[pdu->nbindings++];
+
+    set_oid(&v->oid, if_entry, sizeof(if_entry) / sizeof(if_entry[0]));
+    v->oid.subs[v->oid.len++] = column;
+    v->oid.subs[v->oid.len++] = row;
+    v->syntax = syntax;
+
+    switch (syntax) {
+    case SNMP_SYNTAX_OCTETSTRING:
+        if (column == 6) {
+            v->v.octetstring.octets = phys;
+            v->v.octetstring.len = sizeof(phys);
+        } else {
+            v->v.octetstring.octets = descr;
+            v->v.octetstring.len = sizeof(descr) - 1;
+        }
+        break;
+    case SNMP_SYNTAX_INTEGER:
+        v->v.integer = (int32_t)row;
+        break;
+    case SNMP_SYNTAX_COUNTER64:
+        v->v.counter64 = 0x123456789aULL * row;
+        break;
+    default:
+        v->v.uint32 = 0x9abcdef0 + row;
+        break;
+    }
+}
+
+/* the values point to static data, so drop them before the clear */
+static void
+reset_pdu(snmp_pdu_t *pdu) {
+    pdu->nbindings = 0;
+    snmp_pdu_clear(pdu);
+}
+
+static void
+init_pdu(snmp_pdu_t *pdu, enum snmp_version version, u_int type) {
+    reset_pdu(pdu);
+    pdu->version = version;
+    pdu->pdu_type = type;
+    pdu->request_id = 0x1234567;
+    strcpy(pdu->community, "public");
+}
+
+/* single GET, v1 */
+static void
+make_get(snmp_pdu_t *pdu) {
+    init_pdu(pdu, SNMP_V1, SNMP_PDU_GET);
+    add_column(pdu, 10, 1, SNMP_SYNTAX_NULL);
+}
+
+/* GETBULK response with 50 counters, v2c */
+static void
+make_bulk(snmp_pdu_t *pdu) {
+    u_int i;
+
+    init_pdu(pdu, SNMP_V2c, SNMP_PDU_RESPONSE);
+    for (i = 0; i < 50; i++)
+        add_column(pdu, 10, 1 + i, SNMP_SYNTAX_COUNTER);
+}
+
+/* ifTable rows with descriptions and addresses, v2c */
+static void
+make_rows(snmp_pdu_t *pdu) {
+    u_int i;
+
+    init_pdu(pdu, SNMP_V2c, SNMP_PDU_RESPONSE);
+    for (i = 0; i < 10; i++) {
+        add_column(pdu, 2, 1 + i, SNMP_SYNTAX_OCTETSTRING);
+        add_column(pdu, 3, 1 + i, SNMP_SYNTAX_INTEGER);
+        add_column(pdu, 5, 1 + i, SNMP_SYNTAX_GAUGE);
+        add_column(pdu, 6, 1 + i, SNMP_SYNTAX_OCTETSTRING);
+        add_column(pdu, 10, 1 + i, SNMP_SYNTAX_COUNTER);
+    }
+}
+
+/* GETBULK response with 20 counters, v3 authPriv SHA/AES */
+static void
+make_usm(snmp_pdu_t *pdu) {
+    u_int i;
+
+    reset_pdu(pdu);
+    memcpy(pdu->engine.engine_id, "\x80\x00\x1f\x88\x80\x12\x34\x56\x78"
+           "\x9a\xbc\xde", 12);
+    pdu->engine.engine_len = 12;
+    pdu->engine.engine_boots = 7;
+    pdu->engine.engine_time = 123456;
+    pdu->engine.max_msg_size = 65507;
+    pdu->security_model = SNMP_SECMODEL_USM;
+    pdu->user = usm_user;
+    snmp_pdu_init_secparams(pdu);
+    memcpy(pdu->context_engine, pdu->engine.engine_id,
+           pdu->engine.engine_len);
+    pdu->context_engine_len = pdu->engine.engine_len;
+    pdu->version = SNMP_V3;
+    pdu->pdu_type = SNMP_PDU_RESPONSE;
+    pdu->request_id = 0x1234567;
+    pdu->identifier = 4711;
+    for (i = 0; i < 20; i++)
+        add_column(pdu, 6, 1 + i, SNMP_SYNTAX_COUNTER64);
+}
+
+static void
+init_usm(void) {
+    memset(&usm_user, 0, sizeof(usm_user));
+    strcpy(usm_user.sec_name, "bench");
+    usm_user.auth_proto = SNMP_AUTH_HMAC_SHA;
+    usm_user.priv_proto = SNMP_PRIV_AES;
+    snmp_set_auth_passphrase(&usm_user, "authpassphrase", 14);
+    snmp_set_priv_passphrase(&usm_user, "privpassphrase", 14);
+    snmp_auth_to_localization_keys(&usm_user,
+                                   (const uint8_t *)"\x80\x00\x1f\x88\x80\x12\x34\x56\x78\x9a\xbc\xde", 12);
+    snmp_priv_to_localization_keys(&usm_user,
+                                   (const uint8_t *)"\x80\x00\x1f\x88\x80\x12\x34\x56\x78\x9a\xbc\xde", 12);
+}
+
+/*
+ * Benchmark bodies. Each one does a single operation and returns
+ * non-zero on failure.
+ */
+static int
+op_encode(void) {
+    asn_buf_t b;
+
+    b.asn_ptr = txbuf;
+    b.asn_len = sizeof(txbuf);
+    return (snmp_pdu_encode(&req, &b) != SNMP_CODE_OK);
+}
+
+static int
+op_decode(void) {
+    asn_buf_t b;
+    int32_t ip;
+
+    b.asn_ptr = txbuf;
+    b.asn_len = rxlen;
+    if (snmp_pdu_decode(&b, &resp, &ip) != SNMP_CODE_OK)
+        return (1);
+    snmp_pdu_clear(&resp);
+    return (0);
+}
+
+/* the USM decoder works in place, so start from a fresh copy */
+static int
+op_decode_usm(void) {
+    memcpy(txbuf, rxbuf, rxlen);
+    resp.user = usm_user;
+    return (op_decode());
+}
+
+static asn_oid_t oid1, oid2;
+static u_char oidbuf[ASN_MAXOIDLEN * 5 + 4];
+static size_t oidlen;
+
+static int
+op_put_objid(void) {
+    asn_buf_t b;
+
+    b.asn_ptr = oidbuf;
+    b.asn_len = sizeof(oidbuf);
+    return (asn_put_objid(&b, &oid1) != ASN_ERR_OK);
+}
+
+static int
+op_get_objid(void) {
+    asn_buf_t b;
+
+    b.asn_ptr = oidbuf + 2;
+    b.asn_len = oidlen - 2;
+    return (asn_get_objid_raw(&b, (asn_len_t)(oidlen - 2), &oid2) !=
+            ASN_ERR_OK);
+}
+
+static int
+op_compare_oid(void) {
+    return (asn_compare_oid(&oid1, &oid2) >= 0);
+}
+
+static int
+run(const char *name, int (*op)(void)) {
+    double start, elapsed, a0;
+    unsigned long n, iter, batch;
+
+    /* warm up */
+    for (n = 0; n < 100; n++)
+        if (op()) {
+            fprintf(stderr, "%s: operation failed\n", name);
+            return (-1);
+        }
+
+    iter = 0;
+    batch = 100;
+    a0 = ALLOCS();
+    start = now_ns();
+    do {
+        for (n = 0; n < batch; n++)
+            (void)op();
+        iter += batch;
+        if (batch < 1000000)
+            batch *= 2;
+        elapsed = now_ns() - start;
+    } while (elapsed < BENCH_MIN_NS);
+
+    printf("%s,%lu,%.1f,%.2f\n", name, iter, elapsed / (double)iter,
+           a0 < 0 ? -1.0 : (ALLOCS() - a0) / (double)iter);
+    return (0);
+}
+
+/*
+ * Encode the request once and keep the result for the decode cases. The
+ * second decode case puts the strings into an arena.
+ */
+static int
+run_codec(const char *name, void (*make)(snmp_pdu_t *), int usm) {
+    char cname[64];
+    asn_buf_t b;
+
+    make(&req);
+    b.asn_ptr = rxbuf;
+    b.asn_len = sizeof(rxbuf);
+    if (snmp_pdu_encode(&req, &b) != SNMP_CODE_OK) {
+        fprintf(stderr, "%s: cannot encode\n", name);
+        return (-1);
+    }
+    rxlen = b.asn_ptr - rxbuf;
+    memcpy(txbuf, rxbuf, rxlen);
+
+    sprintf(cname, "encode_%s", name);
+    if (run(cname, op_encode) < 0)
+        return (-1);
+
+    /* the encoder overwrote txbuf */
+    memcpy(txbuf, rxbuf, rxlen);
+    snmp_pdu_clear(&resp);
+    sprintf(cname, "decode_%s", name);
+    if (run(cname, usm ? op_decode_usm : op_decode) < 0)
+        return (-1);
+
+    memcpy(txbuf, rxbuf, rxlen);
+    snmp_pdu_clear(&resp);
+    resp.arena = &arena;
+    sprintf(cname, "decode_arena_%s", name);
+    if (run(cname, usm ? op_decode_usm : op_decode) < 0)
+        return (-1);
+    snmp_pdu_clear(&resp);
+    resp.arena = NULL;
+    return (0);
+}
+
+int
+main(void) {
+    asn_buf_t b;
+    int err = 0;
+
+    init_usm();
+    snmp_arena_init(&arena, NULL, 0);
+
+    printf("case,iterations,ns_per_op,allocs_per_op\n");
+
+    err |= run_codec("v1_get", make_get, 0);
+    err |= run_codec("v2c_bulk50", make_bulk, 0);
+    err |= run_codec("v2c_iftable_rows", make_rows, 0);
+    err |= run_codec("v3_authpriv_bulk20", make_usm, 1);
+
+    set_oid(&oid1, ip_net_to_media,
+            sizeof(ip_net_to_media) / sizeof(ip_net_to_media[0]));
+    oid1.subs[oid1.len++] = 4000000000u;
+    oid1.subs[oid1.len++] = 7;
+    oid1.subs[oid1.len++] = 300;
+    oid1.subs[oid1.len++] = 5;
+    b.asn_ptr = oidbuf;
+    b.asn_len = sizeof(oidbuf);
+    (void)asn_put_objid(&b, &oid1);
+    oidlen = b.asn_ptr - oidbuf;
+
+    err |= run("asn_put_objid", op_put_objid);
+    err |= run("asn_get_objid_raw", op_get_objid);
+    oid2.subs[oid2.len - 1]++;
+    err |= run("asn_compare_oid", op_compare_oid);
+
+    return (err ? 1 : 0);
+}
@@ -0,0 +1,233 @@
+/*
+ * Latency and CPU time of synchronous requests on loopback.
+ *
+ * snmp_dialog_reuse sends a GET and waits for the response of an agent
+ * that runs in a child process, so every operation includes a real wait
+ * in the client. receive_poll measures snmp_receive polling a socket with
+ * nothing to receive. Results are reported as
+ *
+ *	case,iterations,ns_per_op,cpu_ns_per_op
+ *
+ * where cpu_ns_per_op is the user and system time of the client process
+ * per operation.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "bsnmp/config.h"
+#ifndef _WIN32
+#include <time.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <arpa/inet.h>
+#include "bsnmp/asn1.h"
+#include "bsnmp/snmp.h"
+#include "bsnmp/client.h"
+
+#define BENCH_MIN_NS	500000000.0
+#define BENCH_WARMUP	1000
+#define BENCH_BUFSIZ	65536
+
+static double
+now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((double)ts.tv_sec * 1e9 + (double)ts.tv_nsec);
+}
+
+static double
+cpu_ns(void) {
+    struct rusage ru;
+
+    getrusage(RUSAGE_SELF, &ru);
+    return (((double)ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1e9 +
+            ((double)ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1e3);
+}
+
+static const asn_subid_t if_descr[] = { 1, 3, 6, 1, 2, 1, 2, 2, 1, 2 };
+
+/*
+ * The agent. It answers every binding with the same interface name.
+ */
+static void
+agent_run(int fd) {
+    static u_char rxbuf[BENCH_BUFSIZ], txbuf[BENCH_BUFSIZ];
+    static u_char descr[] = "GigabitEthernet0/0/17";
+    struct sockaddr_in from;
+    socklen_t fromlen;
+    snmp_pdu_t pdu;
+    snmp_arena_t arena;
+    asn_buf_t b;
+    int32_t ip;
+    ssize_t n;
+    u_int i;
+
+    snmp_pdu_init(&pdu);
+    snmp_arena_init(&arena, NULL, 0);
+    pdu.arena = &arena;
+    for (;;) {
+        fromlen = sizeof(from);
+        if ((n = recvfrom(fd, rxbuf, sizeof(rxbuf), 0,
+                          (struct sockaddr *)&from, &fromlen)) <= 0)
+            continue;
+
+        snmp_pdu_clear(&pdu);
+        b.asn_ptr = rxbuf;
+        b.asn_len = n;
+        if (snmp_pdu_decode(&b, &pdu, &ip) != SNMP_CODE_OK)
+            continue;
+
+        pdu.pdu_type = SNMP_PDU_RESPONSE;
+        for (i = 0; i < pdu.nbindings; i++) {
+            pdu.bindings[i].syntax = SNMP_SYNTAX_OCTETSTRING;
+            pdu.bindings[i].v.octetstring.octets = descr;
+            pdu.bindings[i].v.octetstring.len = sizeof(descr) - 1;
+        }
+        b.asn_ptr = txbuf;
+        b.asn_len = sizeof(txbuf);
+        if (snmp_pdu_encode_rev(&pdu, &b) != SNMP_CODE_OK)
+            continue;
+        for (i = 0; i < pdu.nbindings; i++)
+            pdu.bindings[i].syntax = SNMP_SYNTAX_NULL;
+
+        (void)sendto(fd, pdu.outer_ptr, pdu.outer_len, 0,
+                     (struct sockaddr *)&from, fromlen);
+    }
+}
+
+static pid_t
+agent_start(char *port, size_t size) {
+    struct sockaddr_in sin;
+    socklen_t len;
+    pid_t pid;
+    int fd;
+
+    if ((fd = socket(AF_INET, SOCK_DGRAM, 0)) == -1)
+        return (-1);
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    len = sizeof(sin);
+    if (bind(fd, (struct sockaddr *)&sin, sizeof(sin)) == -1 ||
+            getsockname(fd, (struct sockaddr *)&sin, &len) == -1)
+        return (-1);
+    snprintf(port, size, "%u", ntohs(sin.sin_port));
+
+    if ((pid = fork()) == 0) {
+        agent_run(fd);
+        _exit(0);
+    }
+    (void)close(fd);
+    return (pid);
+}
+
+static void
+report(const char *name, u_long n, double t, double cpu) {
+    printf("%s,%lu,%.1f,%.1f\n", name, n, t / n, cpu / n);
+}
+
+static int
+bench_dialog(struct snmp_client *client, u_int nbindings) {
+    snmp_pdu_t req, resp;
+    snmp_value_t *v;
+    double start, cpu;
+    char name[32];
+    u_long n;
+    u_int i;
+
+    snmp_pdu_init(&resp);
+    snmp_pdu_create(client, &req, SNMP_PDU_GET);
+    if (snmp_pdu_reserve(&req, nbindings) != 0)
+        return (-1);
+    for (i = 0; i < nbindings; i++) {
+        v = &req.bindings[req.nbindings++];
+        v->oid.len = sizeof(if_descr) / sizeof(if_descr[0]);
+        memcpy(v->oid.subs, if_descr, sizeof(if_descr));
+        v->oid.subs[v->oid.len++] = i + 1;
+        v->syntax = SNMP_SYNTAX_NULL;
+    }
+
+    for (i = 0; i < BENCH_WARMUP; i++)
+        if (snmp_dialog_reuse(client, &req, &resp) != 0)
+            goto fail;
+    start = now_ns();
+    cpu = cpu_ns();
+    for (n = 0; now_ns() - start < BENCH_MIN_NS; n++)
+        if (snmp_dialog_reuse(client, &req, &resp) != 0 ||
+                resp.nbindings != nbindings)
+            goto fail;
+    snprintf(name, sizeof(name), "dialog_get_%u", nbindings);
+    report(name, n, now_ns() - start, cpu_ns() - cpu);
+
+    snmp_pdu_free(&req);
+    snmp_pdu_free(&resp);
+    return (0);
+
+  fail:
+    fprintf(stderr, "dialog_get_%u: %s\n", nbindings, client->error);
+    snmp_pdu_free(&req);
+    snmp_pdu_free(&resp);
+    return (-1);
+}
+
+static int
+bench_poll(struct snmp_client *client) {
+    double start, cpu;
+    u_long n;
+
+    start = now_ns();
+    cpu = cpu_ns();
+    for (n = 0; now_ns() - start < BENCH_MIN_NS; n++)
+        if (snmp_receive(client, 0) != 0) {
+            fprintf(stderr, "receive_poll: %s\n", client->error);
+            return (-1);
+        }
+    report("receive_poll", n, now_ns() - start, cpu_ns() - cpu);
+    return (0);
+}
+
+int
+main(void) {
+    struct snmp_client client;
+    char port[16];
+    pid_t agent;
+    int err = 0;
+
+    if ((agent = agent_start(port, sizeof(port))) == -1) {
+        perror("agent");
+        return (1);
+    }
+    snmp_client_init(&client);
+    client.dump_pdus = 0;
+    client.retries = 0;
+    if (snmp_open(&client, "127.0.0.1", port, NULL, NULL) != 0) {
+        fprintf(stderr, "open: %s\n", client.error);
+        (void)kill(agent, SIGTERM);
+        return (1);
+    }
+
+    printf("case,iterations,ns_per_op,cpu_ns_per_op\n");
+
+    err |= bench_dialog(&client, 1);
+    err |= bench_dialog(&client, 20);
+    err |= bench_poll(&client);
+
+    snmp_close(&client);
+    (void)kill(agent, SIGTERM);
+    (void)waitpid(agent, NULL, 0);
+    return (err ? 1 : 0);
+}
+
+#else /* _WIN32 */
+
+int
+main(void) {
+    printf("dialog_bench: not on Windows\n");
+    return (0);
+}
+
+#endif
@@ -0,0 +1,370 @@
+/*
+ * Throughput of the event loop with many sessions and many outstanding
+ * requests.
+ *
+ * Every session is a snmp_client in one snmp_loop that keeps a window of
+ * GET requests outstanding; each response sends the next request. The
+ * agents answering them run in the same thread, one UDP socket per
+ * session. Results are reported like codec_bench:
+ *
+ *	case,iterations,ns_per_op,allocs_per_op
+ *
+ * where an operation is one request and response and allocs_per_op
+ * counts the heap allocations of the client side after warm-up. The
+ * benchmark fails if a request is not answered or the client side
+ * allocates. It needs epoll.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "bsnmp/config.h"
+#ifdef HAVE_EPOLL
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <arpa/inet.h>
+#include "bsnmp/asn1.h"
+#include "bsnmp/snmp.h"
+#include "bsnmp/client.h"
+#include "bsnmp/loop.h"
+
+#define BENCH_MIN_NS	500000000.0
+#define BENCH_WARMUP	2
+#define BENCH_BUFSIZ	65536
+
+/*
+ * Allocation counting, see codec_bench.
+ */
+#ifdef __GLIBC__
+extern void *__libc_malloc(size_t);
+extern void *__libc_calloc(size_t, size_t);
+extern void *__libc_realloc(void *, size_t);
+
+static unsigned long allocs;
+static int in_agent;
+
+void *
+malloc(size_t size) {
+    if (!in_agent)
+        allocs++;
+    return (__libc_malloc(size));
+}
+
+void *
+calloc(size_t n, size_t size) {
+    if (!in_agent)
+        allocs++;
+    return (__libc_calloc(n, size));
+}
+
+void *
+realloc(void *ptr, size_t size) {
+    if (!in_agent)
+        allocs++;
+    return (__libc_realloc(ptr, size));
+}
+#define ALLOCS()	((double)allocs)
+#define AGENT(x)	(in_agent = (x))
+#else
+#define ALLOCS()	(-1.0)
+#define AGENT(x)
+#endif
+
+static double
+now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((double)ts.tv_sec * 1e9 + (double)ts.tv_nsec);
+}
+
+static const asn_subid_t if_descr[] = { 1, 3, 6, 1, 2, 1, 2, 2, 1, 2 };
+
+struct session {
+    struct snmp_client	client;
+    snmp_pdu_t		req;
+    int			agent_fd;
+};
+
+static struct snmp_loop loop;
+static struct session *sessions;
+static u_int nsessions;
+static int sending;
+static u_long answered, timeouts;
+
+/*
+ * The agents. They answer every binding with the same interface name.
+ */
+static int agent_ep = -1;
+static u_char agent_rxbuf[BENCH_BUFSIZ];
+static u_char agent_txbuf[BENCH_BUFSIZ];
+static snmp_pdu_t agent_pdu;
+static snmp_arena_t agent_arena;
+
+static int
+agent_open(struct session *s, char *port, size_t size) {
+    struct sockaddr_in sin;
+    struct epoll_event ev;
+    socklen_t len;
+    int rcvbuf = 4 << 20;
+
+    if ((s->agent_fd = socket(AF_INET, SOCK_DGRAM, 0)) == -1)
+        return (-1);
+    (void)setsockopt(s->agent_fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf,
+                     sizeof(rcvbuf));
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    len = sizeof(sin);
+    if (bind(s->agent_fd, (struct sockaddr *)&sin, sizeof(sin)) == -1 ||
+            getsockname(s->agent_fd, (struct sockaddr *)&sin, &len) == -1)
+        return (-1);
+    snprintf(port, size, "%u", ntohs(sin.sin_port));
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = s->agent_fd;
+    return (epoll_ctl(agent_ep, EPOLL_CTL_ADD, s->agent_fd, &ev));
+}
+
+static int
+agent_answer(int fd) {
+    static u_char descr[] = "GigabitEthernet0/0/17";
+    struct sockaddr_in from;
+    socklen_t fromlen;
+    asn_buf_t b;
+    int32_t ip;
+    ssize_t n;
+    u_int i;
+
+    fromlen = sizeof(from);
+    if ((n = recvfrom(fd, agent_rxbuf, sizeof(agent_rxbuf), MSG_DONTWAIT,
+                      (struct sockaddr *)&from, &fromlen)) <= 0)
+        return (errno == EAGAIN ? 0 : -1);
+
+    snmp_pdu_clear(&agent_pdu);
+    b.asn_ptr = agent_rxbuf;
+    b.asn_len = n;
+    if (snmp_pdu_decode(&b, &agent_pdu, &ip) != SNMP_CODE_OK)
+        return (-1);
+
+    agent_pdu.pdu_type = SNMP_PDU_RESPONSE;
+    for (i = 0; i < agent_pdu.nbindings; i++) {
+        agent_pdu.bindings[i].syntax = SNMP_SYNTAX_OCTETSTRING;
+        agent_pdu.bindings[i].v.octetstring.octets = descr;
+        agent_pdu.bindings[i].v.octetstring.len = sizeof(descr) - 1;
+    }
+    b.asn_ptr = agent_txbuf;
+    b.asn_len = sizeof(agent_txbuf);
+    if (snmp_pdu_encode_rev(&agent_pdu, &b) != SNMP_CODE_OK)
+        return (-1);
+    for (i = 0; i < agent_pdu.nbindings; i++)
+        agent_pdu.bindings[i].syntax = SNMP_SYNTAX_NULL;
+
+    if (sendto(fd, agent_pdu.outer_ptr, agent_pdu.outer_len, 0,
+               (struct sockaddr *)&from, fromlen) == -1)
+        return (-1);
+    return (1);
+}
+
+static int
+agent_serve(void) {
+    struct epoll_event ev[256];
+    int i, n, ret;
+
+    AGENT(1);
+    n = epoll_wait(agent_ep, ev, 256, 0);
+    for (i = 0; i < n; i++)
+        while ((ret = agent_answer(ev[i].data.fd)) > 0)
+            ;
+    AGENT(0);
+    return (n < 0 ? -1 : 0);
+}
+
+/*
+ * The sessions.
+ */
+static void
+response(struct snmp_client *c, snmp_pdu_t *pdu, snmp_pdu_t *resp,
+         void *arg) {
+    (void)arg;
+    if (resp == NULL) {
+        timeouts++;
+        return;
+    }
+    if (resp->nbindings == pdu->nbindings &&
+            resp->bindings[0].syntax == SNMP_SYNTAX_OCTETSTRING)
+        answered++;
+    if (sending && snmp_pdu_send(c, pdu, response, NULL) == -1)
+        fprintf(stderr, "send: %s\n", c->error);
+}
+
+static int
+sessions_open(u_int n, u_int nbindings) {
+    struct session *s;
+    snmp_value_t *v;
+    char port[16];
+    int rcvbuf = 4 << 20;
+    u_int i, j;
+
+    if ((sessions = calloc(n, sizeof(*sessions))) == NULL)
+        return (-1);
+    for (i = 0; i < n; i++) {
+        s = &sessions[i];
+        if (agent_open(s, port, sizeof(port)) != 0)
+            return (-1);
+        snmp_client_init(&s->client);
+        s->client.dump_pdus = 0;
+        s->client.timeout.tv_sec = 5;
+        s->client.retries = 0;
+        if (snmp_open(&s->client, "127.0.0.1", port, NULL, NULL) != 0) {
+            fprintf(stderr, "open: %s\n", s->client.error);
+            return (-1);
+        }
+        nsessions++;
+        (void)setsockopt(s->client.fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf,
+                         sizeof(rcvbuf));
+        if (snmp_loop_add(&loop, &s->client) != 0)
+            return (-1);
+
+        snmp_pdu_create(&s->client, &s->req, SNMP_PDU_GET);
+        if (snmp_pdu_reserve(&s->req, nbindings) != 0)
+            return (-1);
+        for (j = 0; j < nbindings; j++) {
+            v = &s->req.bindings[s->req.nbindings++];
+            v->oid.len = sizeof(if_descr) / sizeof(if_descr[0]);
+            memcpy(v->oid.subs, if_descr, sizeof(if_descr));
+            v->oid.subs[v->oid.len++] = j + 1;
+            v->syntax = SNMP_SYNTAX_NULL;
+        }
+    }
+    return (0);
+}
+
+static void
+sessions_close(void) {
+    u_int i;
+
+    for (i = 0; i < nsessions; i++) {
+        snmp_close(&sessions[i].client);
+        snmp_pdu_free(&sessions[i].req);
+        (void)close(sessions[i].agent_fd);
+    }
+    free(sessions);
+    sessions = NULL;
+    nsessions = 0;
+}
+
+/*
+ * Fill the windows, run for a while, then let the outstanding requests
+ * drain. Returns the number of requests answered in the time taken.
+ */
+static int
+run_window(u_int window, double *t, u_long *n) {
+    double start;
+    u_int i, w;
+
+    answered = timeouts = 0;
+    start = now_ns();
+    sending = 1;
+    for (w = 0; w < window; w++) {
+        for (i = 0; i < nsessions; i++)
+            if (snmp_pdu_send(&sessions[i].client, &sessions[i].req,
+                              response, NULL) == -1)
+                return (-1);
+        if (agent_serve() != 0)
+            return (-1);
+    }
+    while (sending) {
+        if (agent_serve() != 0 || snmp_loop_run_once(&loop, 0) == -1)
+            return (-1);
+        if (now_ns() - start >= BENCH_MIN_NS)
+            sending = 0;
+    }
+    while (loop.timers.count > 0)
+        if (agent_serve() != 0 || snmp_loop_run_once(&loop, 0) == -1)
+            return (-1);
+    *t = now_ns() - start;
+    *n = answered;
+    return (timeouts == 0 ? 0 : -1);
+}
+
+static int
+run(u_int n, u_int window, u_int nbindings) {
+    double t, a;
+    u_long ops;
+    u_int i;
+
+    if (sessions_open(n, nbindings) != 0) {
+        perror("sessions");
+        return (-1);
+    }
+    for (i = 0; i < BENCH_WARMUP; i++)
+        if (run_window(window, &t, &ops) != 0)
+            goto fail;
+    a = ALLOCS();
+    if (run_window(window, &t, &ops) != 0)
+        goto fail;
+    a = ALLOCS() < 0 ? -1.0 : (ALLOCS() - a) / ops;
+
+    printf("loop_s%u_w%u_b%u,%lu,%.1f,%.2f\n", n, window, nbindings, ops,
+           t / ops, a);
+    sessions_close();
+    if (a > 0) {
+        fprintf(stderr, "loop_s%u_w%u_b%u: steady state allocates\n", n,
+                window, nbindings);
+        return (-1);
+    }
+    return (0);
+
+  fail:
+    fprintf(stderr, "loop_s%u_w%u_b%u: %lu timeouts, %s\n", n, window,
+            nbindings, timeouts, loop.error);
+    sessions_close();
+    return (-1);
+}
+
+int
+main(void) {
+    struct rlimit rl;
+    int err = 0;
+
+    /* two descriptors per session */
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        (void)setrlimit(RLIMIT_NOFILE, &rl);
+    }
+    if ((agent_ep = epoll_create(256)) == -1 || snmp_loop_init(&loop) != 0) {
+        perror("epoll");
+        return (1);
+    }
+    snmp_pdu_init(&agent_pdu);
+    snmp_arena_init(&agent_arena, NULL, 0);
+    agent_pdu.arena = &agent_arena;
+
+    printf("case,iterations,ns_per_op,allocs_per_op\n");
+
+    err |= run(1, 1, 1);
+    err |= run(100, 10, 1);
+    err |= run(250, 80, 1);
+    err |= run(250, 80, 20);
+    err |= run(1, 2000, 1);
+
+    snmp_loop_close(&loop);
+    snmp_pdu_free(&agent_pdu);
+    snmp_arena_free(&agent_arena);
+    (void)close(agent_ep);
+    return (err ? 1 : 0);
+}
+
+#else /* !HAVE_EPOLL */
+
+int
+main(void) {
+    printf("loop_bench: no epoll\n");
+    return (0);
+}
+
+#endif
@@ -0,0 +1,394 @@
+/*
+ * Request rate of many sessions sharing one socket.
+ *
+ * Every session is a snmp_client on one snmp_mux talking to an address
+ * of its own in 127/8; all of them are in one snmp_loop. A window of GET
+ * requests is kept outstanding over all sessions: each response sends
+ * the next request on the next session, so all sessions are used in
+ * turn like in a poller. The agent answering them runs in the same
+ * thread on one socket and answers from the address asked. Results are
+ * reported like codec_bench:
+ *
+ *	case,iterations,ns_per_op,allocs_per_op
+ *
+ * where an operation is one request and response and allocs_per_op
+ * counts the heap allocations of the client side after every session has
+ * been used once. The benchmark fails if a request is not answered or
+ * the client side allocates. It needs epoll and IP_PKTINFO.
+ */
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE	/* struct in_pktinfo */
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "bsnmp/config.h"
+#ifdef HAVE_EPOLL
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "bsnmp/asn1.h"
+#include "bsnmp/snmp.h"
+#include "bsnmp/client.h"
+#include "bsnmp/loop.h"
+#include "bsnmp/mux.h"
+
+#define BENCH_MIN_NS	500000000.0
+#define BENCH_WARMUP	2
+#define BENCH_BUFSIZ	2048
+
+/*
+ * Allocation counting, see codec_bench.
+ */
+#ifdef __GLIBC__
+extern void *__libc_malloc(size_t);
+extern void *__libc_calloc(size_t, size_t);
+extern void *__libc_realloc(void *, size_t);
+
+static unsigned long allocs;
+static int in_agent;
+
+void *
+malloc(size_t size) {
+    if (!in_agent)
+        allocs++;
+    return (__libc_malloc(size));
+}
+
+void *
+calloc(size_t n, size_t size) {
+    if (!in_agent)
+        allocs++;
+    return (__libc_calloc(n, size));
+}
+
+void *
+realloc(void *ptr, size_t size) {
+    if (!in_agent)
+        allocs++;
+    return (__libc_realloc(ptr, size));
+}
+#define ALLOCS()	((double)allocs)
+#define AGENT(x)	(in_agent = (x))
+#else
+#define ALLOCS()	(-1.0)
+#define AGENT(x)
+#endif
+
+static double
+now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((double)ts.tv_sec * 1e9 + (double)ts.tv_nsec);
+}
+
+static const asn_subid_t if_descr[] = { 1, 3, 6, 1, 2, 1, 2, 2, 1, 2, 1 };
+
+static struct snmp_loop loop;
+static struct snmp_mux mux;
+static struct snmp_client *sessions;
+static u_int nsessions, next;
+static snmp_pdu_t req;
+static int sending;
+static u_long answered, timeouts;
+
+/*
+ * The agent. It answers every binding with the same interface name from
+ * the address the request was sent to.
+ */
+static int agent_fd = -1;
+static u_char agent_rxbuf[BENCH_BUFSIZ];
+static u_char agent_txbuf[BENCH_BUFSIZ];
+static snmp_pdu_t agent_pdu;
+static snmp_arena_t agent_arena;
+
+static int
+agent_open(char *port, size_t size) {
+    struct sockaddr_in sin;
+    socklen_t len;
+    int on = 1, rcvbuf = 4 << 20;
+
+    if ((agent_fd = socket(AF_INET, SOCK_DGRAM, 0)) == -1)
+        return (-1);
+    (void)setsockopt(agent_fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf,
+                     sizeof(rcvbuf));
+    if (setsockopt(agent_fd, IPPROTO_IP, IP_PKTINFO, &on, sizeof(on)) == -1)
+        return (-1);
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    len = sizeof(sin);
+    if (bind(agent_fd, (struct sockaddr *)&sin, sizeof(sin)) == -1 ||
+            getsockname(agent_fd, (struct sockaddr *)&sin, &len) == -1)
+        return (-1);
+    snprintf(port, size, "%u", ntohs(sin.sin_port));
+    return (0);
+}
+
+static int
+agent_answer(void) {
+    static u_char descr[] = "GigabitEthernet0/0/17";
+    struct sockaddr_in from;
+    union {
+        struct cmsghdr	hdr;
+        u_char		buf[CMSG_SPACE(sizeof(struct in_pktinfo))];
+    } ctl;
+    struct cmsghdr *cm;
+    struct msghdr msg;
+    struct iovec iov;
+    asn_buf_t b;
+    int32_t ip;
+    ssize_t n;
+    u_int i;
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = agent_rxbuf;
+    iov.iov_len = sizeof(agent_rxbuf);
+    msg.msg_name = &from;
+    msg.msg_namelen = sizeof(from);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctl.buf;
+    msg.msg_controllen = sizeof(ctl.buf);
+    if ((n = recvmsg(agent_fd, &msg, MSG_DONTWAIT)) <= 0)
+        return (errno == EAGAIN ? 0 : -1);
+
+    snmp_pdu_clear(&agent_pdu);
+    b.asn_ptr = agent_rxbuf;
+    b.asn_len = n;
+    if (snmp_pdu_decode(&b, &agent_pdu, &ip) != SNMP_CODE_OK)
+        return (-1);
+
+    agent_pdu.pdu_type = SNMP_PDU_RESPONSE;
+    for (i = 0; i < agent_pdu.nbindings; i++) {
+        agent_pdu.bindings[i].syntax = SNMP_SYNTAX_OCTETSTRING;
+        agent_pdu.bindings[i].v.octetstring.octets = descr;
+        agent_pdu.bindings[i].v.octetstring.len = sizeof(descr) - 1;
+    }
+    b.asn_ptr = agent_txbuf;
+    b.asn_len = sizeof(agent_txbuf);
+    if (snmp_pdu_encode_rev(&agent_pdu, &b) != SNMP_CODE_OK)
+        return (-1);
+    for (i = 0; i < agent_pdu.nbindings; i++)
+        agent_pdu.bindings[i].syntax = SNMP_SYNTAX_NULL;
+
+    /* reply from the address asked */
+    for (cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm))
+        if (cm->cmsg_level == IPPROTO_IP && cm->cmsg_type == IP_PKTINFO) {
+            ((struct in_pktinfo *)CMSG_DATA(cm))->ipi_spec_dst =
+                ((struct in_pktinfo *)CMSG_DATA(cm))->ipi_addr;
+            ((struct in_pktinfo *)CMSG_DATA(cm))->ipi_ifindex = 0;
+        }
+    iov.iov_base = agent_pdu.outer_ptr;
+    iov.iov_len = agent_pdu.outer_len;
+    if (sendmsg(agent_fd, &msg, 0) == -1)
+        return (-1);
+    return (1);
+}
+
+static int
+agent_serve(void) {
+    int ret;
+
+    AGENT(1);
+    while ((ret = agent_answer()) > 0)
+        ;
+    AGENT(0);
+    return (ret);
+}
+
+/*
+ * The sessions.
+ */
+static void response(struct snmp_client *, snmp_pdu_t *, snmp_pdu_t *,
+                     void *);
+
+static void
+send_next(void) {
+    struct snmp_client *c = &sessions[next++ % nsessions];
+
+    if (snmp_pdu_send(c, &req, response, NULL) == -1)
+        fprintf(stderr, "send: %s\n", c->error);
+}
+
+static void
+response(struct snmp_client *c, snmp_pdu_t *pdu, snmp_pdu_t *resp,
+         void *arg) {
+    (void)c;
+    (void)arg;
+    if (resp == NULL) {
+        timeouts++;
+        return;
+    }
+    if (resp->nbindings == pdu->nbindings &&
+            resp->bindings[0].syntax == SNMP_SYNTAX_OCTETSTRING)
+        answered++;
+    if (sending)
+        send_next();
+}
+
+static int
+sessions_open(u_int n) {
+    struct snmp_client *c;
+    struct in_addr addr;
+    char host[INET_ADDRSTRLEN], port[16];
+    int rcvbuf = 4 << 20;
+    u_int i;
+
+    if (agent_open(port, sizeof(port)) != 0 ||
+            snmp_mux_open(&mux, AF_INET) != 0)
+        return (-1);
+    (void)setsockopt(mux.fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf,
+                     sizeof(rcvbuf));
+    if ((sessions = calloc(n, sizeof(*sessions))) == NULL)
+        return (-1);
+    for (i = 0; i < n; i++) {
+        c = &sessions[i];
+        addr.s_addr = htonl(INADDR_LOOPBACK + i);
+        inet_ntop(AF_INET, &addr, host, sizeof(host));
+        snmp_client_init(c);
+        c->dump_pdus = 0;
+        c->timeout.tv_sec = 5;
+        c->retries = 0;
+        c->txbuflen = c->rxbuflen = BENCH_BUFSIZ;
+        c->mux = &mux;
+        if (snmp_open(c, host, port, NULL, NULL) != 0) {
+            fprintf(stderr, "open: %s\n", c->error);
+            return (-1);
+        }
+        nsessions++;
+        if (snmp_loop_add(&loop, c) != 0)
+            return (-1);
+    }
+    next = 0;
+
+    snmp_pdu_reset(&sessions[0], &req, SNMP_PDU_GET);
+    if (snmp_pdu_reserve(&req, 1) != 0)
+        return (-1);
+    req.bindings[0].oid.len = sizeof(if_descr) / sizeof(if_descr[0]);
+    memcpy(req.bindings[0].oid.subs, if_descr, sizeof(if_descr));
+    req.bindings[0].syntax = SNMP_SYNTAX_NULL;
+    req.nbindings = 1;
+    return (0);
+}
+
+static void
+sessions_close(void) {
+    u_int i;
+
+    for (i = 0; i < nsessions; i++)
+        snmp_close(&sessions[i]);
+    free(sessions);
+    sessions = NULL;
+    nsessions = 0;
+    snmp_mux_close(&mux);
+    if (agent_fd != -1)
+        (void)close(agent_fd);
+    agent_fd = -1;
+}
+
+/*
+ * Fill the window, run for a while, then let the outstanding requests
+ * drain. Returns the number of requests answered in the time taken.
+ */
+static int
+run_window(u_int window, double *t, u_long *n) {
+    double start;
+    u_int w;
+
+    answered = timeouts = 0;
+    start = now_ns();
+    sending = 1;
+    for (w = 0; w < window; w++) {
+        send_next();
+        if (w % 64 == 63 && agent_serve() != 0)
+            return (-1);
+    }
+    while (sending) {
+        if (agent_serve() != 0 || snmp_loop_run_once(&loop, 0) == -1)
+            return (-1);
+        if (now_ns() - start >= BENCH_MIN_NS)
+            sending = 0;
+    }
+    while (loop.timers.count > 0)
+        if (agent_serve() != 0 || snmp_loop_run_once(&loop, 0) == -1)
+            return (-1);
+    *t = now_ns() - start;
+    *n = answered;
+    return (timeouts == 0 ? 0 : -1);
+}
+
+static int
+run(u_int n, u_int window) {
+    double t, a;
+    u_long ops;
+    u_int i;
+
+    if (sessions_open(n) != 0) {
+        perror("sessions");
+        sessions_close();
+        return (-1);
+    }
+    /* until every session has sent */
+    for (i = 0; i < BENCH_WARMUP || next < n; i++)
+        if (run_window(window, &t, &ops) != 0)
+            goto fail;
+    a = ALLOCS();
+    if (run_window(window, &t, &ops) != 0)
+        goto fail;
+    a = ALLOCS() < 0 ? -1.0 : (ALLOCS() - a) / ops;
+
+    printf("mux_s%u_w%u,%lu,%.1f,%.2f\n", n, window, ops, t / ops, a);
+    sessions_close();
+    if (a > 0) {
+        fprintf(stderr, "mux_s%u_w%u: steady state allocates\n", n, window);
+        return (-1);
+    }
+    return (0);
+
+  fail:
+    fprintf(stderr, "mux_s%u_w%u: %lu timeouts, %s\n", n, window, timeouts,
+            loop.error);
+    sessions_close();
+    return (-1);
+}
+
+int
+main(void) {
+    int err = 0;
+
+    if (snmp_loop_init(&loop) != 0) {
+        perror("epoll");
+        return (1);
+    }
+    snmp_pdu_init(&req);
+    snmp_pdu_init(&agent_pdu);
+    snmp_arena_init(&agent_arena, NULL, 0);
+    agent_pdu.arena = &agent_arena;
+
+    mux.fd = -1;
+    printf("case,iterations,ns_per_op,allocs_per_op\n");
+
+    err |= run(1, 1);
+    err |= run(1000, 100);
+    err |= run(100000, 2000);
+
+    snmp_loop_close(&loop);
+    snmp_pdu_free(&req);
+    snmp_pdu_free(&agent_pdu);
+    snmp_arena_free(&agent_arena);
+    return (err ? 1 : 0);
+}
+
+#else /* !HAVE_EPOLL */
+
+int
+main(void) {
+    printf("mux_bench: no epoll\n");
+    return (0);
+}
+
+#endif
@@ -0,0 +1,118 @@
+/*
+ * Microbenchmark for asn_compare_oid and asn_is_suboid.
+ *
+ * The OIDs look like ifTable and ipNetToMediaTable instances: a common
+ * table prefix followed by an index, 10 to 30 subidentifiers in total.
+ * Each library function is timed against the plain subidentifier loop
+ * it replaces. make bench builds the library for the benchmarks with the
+ * flags of the benchmarks, so both are compiled alike.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "bsnmp/config.h"
+#include "bsnmp/asn1.h"
+
+#define NOIDS	1024
+#define ROUNDS	2000
+
+static const asn_subid_t prefix[] = { 1, 3, 6, 1, 2, 1, 4, 22, 1, 2 };
+
+static asn_oid_t oids[NOIDS];
+
+static int
+ref_compare_oid(const asn_oid_t *o1, const asn_oid_t *o2) {
+    u_long i;
+
+    for (i = 0; i < o1->len && i < o2->len; i++) {
+        if (o1->subs[i] < o2->subs[i])
+            return (-1);
+        if (o1->subs[i] > o2->subs[i])
+            return (+1);
+    }
+    if (o1->len < o2->len)
+        return (-1);
+    if (o1->len > o2->len)
+        return (+1);
+    return (0);
+}
+
+static int
+ref_is_suboid(const asn_oid_t *o1, const asn_oid_t *o2) {
+    u_long i;
+
+    for (i = 0; i < o1->len; i++)
+        if (i >= o2->len || o1->subs[i] != o2->subs[i])
+            return (0);
+    return (1);
+}
+
+/*
+ * Build OIDs of the given length. Neighbours differ only in the last
+ * few subidentifiers, like the rows of a table.
+ */
+static void
+make_oids(u_int len) {
+    u_int i, j;
+
+    for (i = 0; i < NOIDS; i++) {
+        oids[i].len = len;
+        memcpy(oids[i].subs, prefix, sizeof(prefix));
+        for (j = sizeof(prefix) / sizeof(prefix[0]); j < len; j++)
+            oids[i].subs[j] = (j + 4 < len) ? 10 + j : rand() % 4;
+    }
+}
+
+static double
+run(int (*f)(const asn_oid_t *, const asn_oid_t *), long *sum) {
+    clock_t start;
+    u_int r, i;
+
+    *sum = 0;
+    start = clock();
+    for (r = 0; r < ROUNDS; r++)
+        for (i = 0; i + 1 < NOIDS; i++)
+            *sum += f(&oids[i], &oids[i + 1]);
+    return ((double)(clock() - start) / CLOCKS_PER_SEC);
+}
+
+int
+main(void) {
+    static const u_int lens[] = { 10, 14, 18, 22, 26, 30 };
+    double tref, tlib;
+    long sref, slib;
+    u_int l;
+
+    srand(1);
+    printf("%-12s %4s %10s %10s %8s\n", "function", "len",
+           "ref ns/op", "lib ns/op", "speedup");
+
+    for (l = 0; l < sizeof(lens) / sizeof(lens[0]); l++) {
+        make_oids(lens[l]);
+
+        tref = run(ref_compare_oid, &sref);
+        tlib = run(asn_compare_oid, &slib);
+        if (sref != slib) {
+            fprintf(stderr, "asn_compare_oid: result mismatch\n");
+            return (1);
+        }
+        printf("%-12s %4u %10.2f %10.2f %7.2fx\n", "compare_oid",
+               lens[l], tref * 1e9 / ((double)ROUNDS * (NOIDS - 1)),
+               tlib * 1e9 / ((double)ROUNDS * (NOIDS - 1)),
+               tlib > 0 ? tref / tlib : 0.0);
+
+        tref = run(ref_is_suboid, &sref);
+        tlib = run(asn_is_suboid, &slib);
+        if (sref != slib) {
+            fprintf(stderr, "asn_is_suboid: result mismatch\n");
+            return (1);
+        }
+        printf("%-12s %4u %10.2f %10.2f %7.2fx\n", "is_suboid",
+               lens[l], tref * 1e9 / ((double)ROUNDS * (NOIDS - 1)),
+               tlib * 1e9 / ((double)ROUNDS * (NOIDS - 1)),
+               tlib > 0 ? tref / tlib : 0.0);
+    }
+
+    return (0);
+}
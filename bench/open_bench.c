@@ -0,0 +1,131 @@
+/*
+ * Cost of opening sessions by name and by address.
+ *
+ * BENCH_SESSIONS sessions on one snmp_mux, so that no socket is created,
+ * are opened to localhost and closed again, over and over:
+ *
+ *	open_name	snmp_open, which resolves the name every time
+ *	open_cached	snmp_open with a snmp_resolver filled beforehand
+ *	open_addr	snmp_open_addr with the address resolved once
+ *
+ * Results are reported as
+ *
+ *	case,iterations,ns_per_op
+ *
+ * where an operation is one open and close. localhost is in the hosts
+ * file; names that need the name servers make open_name much slower
+ * still, the other two do not change.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "bsnmp/config.h"
+#include <time.h>
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <netinet/in.h>
+#endif
+#include "bsnmp/asn1.h"
+#include "bsnmp/snmp.h"
+#include "bsnmp/client.h"
+#include "bsnmp/mux.h"
+#include "bsnmp/resolve.h"
+
+#define BENCH_MIN_NS	500000000.0
+#define BENCH_SESSIONS	1000
+#define BENCH_HOST	"localhost"
+#define BENCH_PORT	"161"
+
+enum how { BY_NAME, BY_CACHE, BY_ADDR };
+
+static double
+now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((double)ts.tv_sec * 1e9 + (double)ts.tv_nsec);
+}
+
+static struct snmp_client sessions[BENCH_SESSIONS];
+
+/* open and close all sessions once */
+static int
+round_trip(enum how how, struct snmp_mux *mux, struct snmp_resolver *res,
+           const struct sockaddr_storage *addr, socklen_t addrlen) {
+    struct snmp_client *c;
+    u_int i;
+    int ret;
+
+    for (i = 0; i < BENCH_SESSIONS; i++) {
+        c = &sessions[i];
+        snmp_client_init(c);
+        c->dump_pdus = 0;
+        c->mux = mux;
+        if (how == BY_ADDR)
+            ret = snmp_open_addr(c, (const struct sockaddr *)addr, addrlen,
+                                 NULL, NULL);
+        else {
+            c->resolver = how == BY_CACHE ? res : NULL;
+            ret = snmp_open(c, BENCH_HOST, BENCH_PORT, NULL, NULL);
+        }
+        if (ret != 0) {
+            fprintf(stderr, "open: %s\n", c->error);
+            return (-1);
+        }
+    }
+    for (i = 0; i < BENCH_SESSIONS; i++)
+        snmp_close(&sessions[i]);
+    return (0);
+}
+
+static int
+bench(const char *name, enum how how, struct snmp_mux *mux,
+      struct snmp_resolver *res, const struct sockaddr_storage *addr,
+      socklen_t addrlen) {
+    double start, t;
+    u_long iter = 0;
+
+    start = now_ns();
+    do {
+        if (round_trip(how, mux, res, addr, addrlen) == -1)
+            return (-1);
+        iter += BENCH_SESSIONS;
+    } while ((t = now_ns() - start) < BENCH_MIN_NS);
+    printf("%s,%lu,%.1f\n", name, iter, t / iter);
+    return (0);
+}
+
+int
+main(void) {
+    static const char *const hosts[] = { BENCH_HOST };
+    struct snmp_resolver res;
+    struct sockaddr_storage addr;
+    struct snmp_mux mux;
+    socklen_t addrlen;
+    int err = 0;
+
+    if (snmp_mux_open(&mux, AF_INET) != 0) {
+        fprintf(stderr, "mux: %s\n", mux.error);
+        return (1);
+    }
+    if (snmp_resolver_init(&res, 300) != 0) {
+        fprintf(stderr, "resolver: %s\n", res.error);
+        return (1);
+    }
+    if (snmp_resolver_fill(&res, hosts, 1, BENCH_PORT, AF_INET, 1) != 0 ||
+            snmp_resolver_lookup(&res, BENCH_HOST, BENCH_PORT, AF_INET,
+                                 &addr, &addrlen) != 0) {
+        fprintf(stderr, "cannot resolve %s\n", BENCH_HOST);
+        return (1);
+    }
+
+    printf("case,iterations,ns_per_op\n");
+    err |= bench("open_name", BY_NAME, &mux, &res, &addr, addrlen);
+    err |= bench("open_cached", BY_CACHE, &mux, &res, &addr, addrlen);
+    err |= bench("open_addr", BY_ADDR, &mux, &res, &addr, addrlen);
+
+    snmp_resolver_close(&res);
+    snmp_mux_close(&mux);
+    return (err ? 1 : 0);
+}
@@ -0,0 +1,303 @@
+/*
+ * Fetching a large set of scalars over a link with latency.
+ *
+ * The agent runs in a child process and holds every response back for
+ * BENCH_RTT_US, like a WAN link would, without serializing the requests.
+ * One operation fetches BENCH_OIDS variables in GETs of BENCH_PER_PDU
+ * bindings: dialog sends them one after another with snmp_dialog_reuse,
+ * pipelined_wN with snmp_dialog_pipelined and a window of N. Results are
+ * reported as
+ *
+ *	case,iterations,ns_per_op,cpu_ns_per_op
+ *
+ * where cpu_ns_per_op is the user and system time of the client process
+ * per operation.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "bsnmp/config.h"
+#ifndef _WIN32
+#include <time.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <arpa/inet.h>
+#include "bsnmp/asn1.h"
+#include "bsnmp/snmp.h"
+#include "bsnmp/client.h"
+
+#define BENCH_MIN_NS	1000000000.0
+#define BENCH_MIN_ITER	5
+#define BENCH_OIDS	5000
+#define BENCH_PER_PDU	50
+#define BENCH_RTT_US	2000
+#define BENCH_BUFSIZ	65536
+#define BENCH_QUEUE	256	/* responses held back */
+#define BENCH_MSGSIZ	8192
+
+static double
+now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((double)ts.tv_sec * 1e9 + (double)ts.tv_nsec);
+}
+
+static double
+cpu_ns(void) {
+    struct rusage ru;
+
+    getrusage(RUSAGE_SELF, &ru);
+    return (((double)ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1e9 +
+            ((double)ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1e3);
+}
+
+static const asn_subid_t sys_descr[] = { 1, 3, 6, 1, 2, 1, 1, 1 };
+
+/*
+ * A response waiting to be sent.
+ */
+struct held {
+    double			due;
+    struct sockaddr_in	to;
+    socklen_t		tolen;
+    size_t			len;
+    u_char			msg[BENCH_MSGSIZ];
+};
+
+/*
+ * The agent. It answers every binding with the same string and sends the
+ * responses when they are due, in the order the requests came in.
+ */
+static void
+agent_run(int fd) {
+    static u_char rxbuf[BENCH_BUFSIZ];
+    static u_char descr[] = "GigabitEthernet0/0/17";
+    static struct held queue[BENCH_QUEUE];
+    struct held *h;
+    struct sockaddr_in from;
+    socklen_t fromlen;
+    struct pollfd pfd;
+    snmp_pdu_t pdu;
+    snmp_arena_t arena;
+    asn_buf_t b;
+    u_int head = 0, tail = 0, i;
+    int32_t ip;
+    ssize_t n;
+    double now;
+    int ms;
+
+    snmp_pdu_init(&pdu);
+    snmp_arena_init(&arena, NULL, 0);
+    pdu.arena = &arena;
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    for (;;) {
+        ms = -1;
+        if (head != tail) {
+            now = now_ns();
+            h = &queue[head % BENCH_QUEUE];
+            ms = h->due > now ? (int)((h->due - now) / 1e6) + 1 : 0;
+        }
+        fromlen = sizeof(from);
+        if (tail - head < BENCH_QUEUE && poll(&pfd, 1, ms) > 0 &&
+                (n = recvfrom(fd, rxbuf, sizeof(rxbuf), 0,
+                              (struct sockaddr *)&from, &fromlen)) > 0) {
+            h = &queue[tail % BENCH_QUEUE];
+            snmp_pdu_clear(&pdu);
+            b.asn_ptr = rxbuf;
+            b.asn_len = n;
+            if (snmp_pdu_decode(&b, &pdu, &ip) == SNMP_CODE_OK) {
+                pdu.pdu_type = SNMP_PDU_RESPONSE;
+                for (i = 0; i < pdu.nbindings; i++) {
+                    pdu.bindings[i].syntax = SNMP_SYNTAX_OCTETSTRING;
+                    pdu.bindings[i].v.octetstring.octets = descr;
+                    pdu.bindings[i].v.octetstring.len = sizeof(descr) - 1;
+                }
+                b.asn_ptr = h->msg;
+                b.asn_len = sizeof(h->msg);
+                if (snmp_pdu_encode(&pdu, &b) == SNMP_CODE_OK) {
+                    h->to = from;
+                    h->tolen = fromlen;
+                    h->len = b.asn_ptr - h->msg;
+                    h->due = now_ns() + BENCH_RTT_US * 1e3;
+                    tail++;
+                }
+                for (i = 0; i < pdu.nbindings; i++)
+                    pdu.bindings[i].syntax = SNMP_SYNTAX_NULL;
+            }
+        }
+        for (now = now_ns(); head != tail &&
+                queue[head % BENCH_QUEUE].due <= now; head++) {
+            h = &queue[head % BENCH_QUEUE];
+            (void)sendto(fd, h->msg, h->len, 0,
+                         (struct sockaddr *)&h->to, h->tolen);
+        }
+    }
+}
+
+static pid_t
+agent_start(char *port, size_t size) {
+    struct sockaddr_in sin;
+    socklen_t len;
+    pid_t pid;
+    int fd, rcvbuf = 4 * 1024 * 1024;
+
+    if ((fd = socket(AF_INET, SOCK_DGRAM, 0)) == -1)
+        return (-1);
+    /* a full window must not overflow the socket buffer */
+    (void)setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    len = sizeof(sin);
+    if (bind(fd, (struct sockaddr *)&sin, sizeof(sin)) == -1 ||
+            getsockname(fd, (struct sockaddr *)&sin, &len) == -1)
+        return (-1);
+    snprintf(port, size, "%u", ntohs(sin.sin_port));
+
+    if ((pid = fork()) == 0) {
+        agent_run(fd);
+        _exit(0);
+    }
+    (void)close(fd);
+    return (pid);
+}
+
+static void
+report(const char *name, u_long n, double t, double cpu) {
+    printf("%s,%lu,%.1f,%.1f\n", name, n, t / n, cpu / n);
+}
+
+static void
+add_oids(snmp_pdu_t *pdu, u_int first, u_int n) {
+    snmp_value_t *v;
+    u_int i;
+
+    for (i = first; i < first + n; i++) {
+        v = &pdu->bindings[pdu->nbindings++];
+        v->oid.len = sizeof(sys_descr) / sizeof(sys_descr[0]);
+        memcpy(v->oid.subs, sys_descr, sizeof(sys_descr));
+        v->oid.subs[v->oid.len++] = i + 1;
+        v->oid.subs[v->oid.len++] = 0;
+        v->syntax = SNMP_SYNTAX_NULL;
+    }
+}
+
+/*
+ * All the OIDs with one snmp_dialog_reuse per PDU.
+ */
+static int
+fetch_dialog(struct snmp_client *client, snmp_pdu_t *req, snmp_pdu_t *resp,
+             u_int window) {
+    u_int i;
+
+    (void)window;
+    for (i = 0; i < BENCH_OIDS; i += BENCH_PER_PDU) {
+        snmp_pdu_reset(client, req, SNMP_PDU_GET);
+        add_oids(req, i, BENCH_PER_PDU);
+        if (snmp_dialog_reuse(client, req, resp) != 0 ||
+                resp->nbindings != BENCH_PER_PDU)
+            return (-1);
+    }
+    return (0);
+}
+
+static int
+fetch_pipelined(struct snmp_client *client, snmp_pdu_t *req,
+                snmp_pdu_t *resp, u_int window) {
+    if (req->nbindings != BENCH_OIDS) {
+        snmp_pdu_reset(client, req, SNMP_PDU_GET);
+        add_oids(req, 0, BENCH_OIDS);
+    }
+    if (snmp_dialog_pipelined(client, req, resp, BENCH_PER_PDU, window,
+                              NULL) != 0 || resp->nbindings != BENCH_OIDS)
+        return (-1);
+    return (0);
+}
+
+static int
+bench(struct snmp_client *client, const char *name,
+      int (*fetch)(struct snmp_client *, snmp_pdu_t *, snmp_pdu_t *, u_int),
+      u_int window) {
+    snmp_pdu_t req, resp;
+    snmp_arena_t arena;
+    double start, cpu;
+    u_long n;
+    int ret = -1;
+
+    snmp_pdu_init(&req);
+    snmp_pdu_init(&resp);
+    snmp_arena_init(&arena, NULL, 0);
+    resp.arena = &arena;
+    if (snmp_pdu_reserve(&req, BENCH_OIDS) != 0)
+        goto out;
+
+    if (fetch(client, &req, &resp, window) != 0)
+        goto out;
+    start = now_ns();
+    cpu = cpu_ns();
+    for (n = 0; n < BENCH_MIN_ITER || now_ns() - start < BENCH_MIN_NS; n++)
+        if (fetch(client, &req, &resp, window) != 0)
+            goto out;
+    report(name, n, now_ns() - start, cpu_ns() - cpu);
+    ret = 0;
+
+  out:
+    if (ret != 0)
+        fprintf(stderr, "%s: %s\n", name, client->error);
+    snmp_pdu_free(&req);
+    snmp_pdu_free(&resp);
+    snmp_arena_free(&arena);
+    return (ret);
+}
+
+int
+main(void) {
+    struct snmp_client client;
+    char port[16];
+    pid_t agent;
+    int err = 0, rcvbuf = 4 * 1024 * 1024;
+
+    if ((agent = agent_start(port, sizeof(port))) == -1) {
+        perror("agent");
+        return (1);
+    }
+    snmp_client_init(&client);
+    client.dump_pdus = 0;
+    client.retries = 0;
+    if (snmp_open(&client, "127.0.0.1", port, NULL, NULL) != 0) {
+        fprintf(stderr, "open: %s\n", client.error);
+        (void)kill(agent, SIGTERM);
+        return (1);
+    }
+    (void)setsockopt(client.fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf,
+                     sizeof(rcvbuf));
+
+    printf("case,iterations,ns_per_op,cpu_ns_per_op\n");
+
+    err |= bench(&client, "dialog", fetch_dialog, 1);
+    err |= bench(&client, "pipelined_w1", fetch_pipelined, 1);
+    err |= bench(&client, "pipelined_w8", fetch_pipelined, 8);
+    err |= bench(&client, "pipelined_w32", fetch_pipelined, 32);
+    err |= bench(&client, "pipelined_w100", fetch_pipelined, 100);
+
+    snmp_close(&client);
+    (void)kill(agent, SIGTERM);
+    (void)waitpid(agent, NULL, 0);
+    return (err ? 1 : 0);
+}
+
+#else /* _WIN32 */
+
+int
+main(void) {
+    printf("pipeline_bench: not on Windows\n");
+    return (0);
+}
+
+#endif
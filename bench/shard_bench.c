@@ -0,0 +1,293 @@
+/*
+ * Throughput of sessions spread over shards.
+ *
+ * BENCH_SESSIONS sessions keep BENCH_WINDOW GETs each in flight to
+ * agents in child processes, one per CPU, which turn every request into
+ * its response by rewriting the PDU tag. Every callback sends the next
+ * request of its session with snmp_shards_send. shards_N runs them on N
+ * shards for BENCH_NS; results are reported as
+ *
+ *	case,iterations,ns_per_op,cpu_ns_per_op
+ *
+ * where an operation is one response and cpu_ns_per_op the user and
+ * system time of the client process per response. With enough CPUs
+ * ns_per_op should fall about linearly with N.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "bsnmp/config.h"
+#ifdef HAVE_EPOLL
+#include <time.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <arpa/inet.h>
+#include "bsnmp/asn1.h"
+#include "bsnmp/snmp.h"
+#include "bsnmp/client.h"
+#include "bsnmp/shard.h"
+
+#define BENCH_NS	1000000000.0
+#define BENCH_SESSIONS	1000
+#define BENCH_WINDOW	4
+#define BENCH_MAXAGENTS	64
+#define BENCH_BUFSIZ	2048
+
+static double
+now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((double)ts.tv_sec * 1e9 + (double)ts.tv_nsec);
+}
+
+static double
+cpu_ns(void) {
+    struct rusage ru;
+
+    getrusage(RUSAGE_SELF, &ru);
+    return (((double)ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1e9 +
+            ((double)ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1e3);
+}
+
+static const asn_subid_t sys_uptime[] = { 1, 3, 6, 1, 2, 1, 1, 3, 0 };
+
+/*
+ * Skip the header and, with skip set, the contents of the element at p.
+ * NULL if it does not fit into end.
+ */
+static u_char *
+ber_next(u_char *p, u_char *end, int skip) {
+    size_t len, n;
+
+    if (end - p < 2)
+        return (NULL);
+    p++;
+    if ((len = *p++) & 0x80) {
+        n = len & 0x7f;
+        for (len = 0; n > 0 && p < end; n--)
+            len = len << 8 | *p++;
+    }
+    if (!skip)
+        return (p);
+    return ((size_t)(end - p) < len ? NULL : p + len);
+}
+
+/*
+ * An agent, it answers the request with its own bindings: message,
+ * version and community are skipped and the GET tag becomes a RESPONSE.
+ */
+static void
+agent_run(int fd) {
+    static u_char buf[BENCH_BUFSIZ];
+    struct sockaddr_in from;
+    socklen_t fromlen;
+    u_char *p, *end;
+    ssize_t n;
+
+    for (;;) {
+        fromlen = sizeof(from);
+        if ((n = recvfrom(fd, buf, sizeof(buf), 0,
+                          (struct sockaddr *)&from, &fromlen)) <= 0)
+            continue;
+        end = buf + n;
+        if ((p = ber_next(buf, end, 0)) == NULL ||
+                (p = ber_next(p, end, 1)) == NULL ||
+                (p = ber_next(p, end, 1)) == NULL ||
+                *p != (ASN_CLASS_CONTEXT | ASN_TYPE_CONSTRUCTED |
+                       SNMP_PDU_GET))
+            continue;
+        *p = ASN_CLASS_CONTEXT | ASN_TYPE_CONSTRUCTED | SNMP_PDU_RESPONSE;
+        (void)sendto(fd, buf, n, 0, (struct sockaddr *)&from, fromlen);
+    }
+}
+
+static pid_t
+agent_start(char *port, size_t size) {
+    struct sockaddr_in sin;
+    socklen_t len;
+    pid_t pid;
+    int fd, rcvbuf = 4 << 20;
+
+    if ((fd = socket(AF_INET, SOCK_DGRAM, 0)) == -1)
+        return (-1);
+    (void)setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    len = sizeof(sin);
+    if (bind(fd, (struct sockaddr *)&sin, sizeof(sin)) == -1 ||
+            getsockname(fd, (struct sockaddr *)&sin, &len) == -1)
+        return (-1);
+    snprintf(port, size, "%u", ntohs(sin.sin_port));
+
+    if ((pid = fork()) == 0) {
+        agent_run(fd);
+        _exit(0);
+    }
+    (void)close(fd);
+    return (pid);
+}
+
+/*
+ * A session and its requests, only used by the shard of the session.
+ */
+struct session {
+    struct snmp_client	client;
+    snmp_pdu_t		req[BENCH_WINDOW];
+    u_long			answered;
+    u_long			failed;
+};
+
+static void
+answer(struct snmp_client *client, snmp_pdu_t *req, snmp_pdu_t *resp,
+       void *arg) {
+    struct session *s = arg;
+
+    if (resp == NULL) {
+        s->failed++;
+        return;
+    }
+    s->answered++;
+    if (snmp_shards_send(client, req, answer, s) == -1)
+        s->failed++;
+}
+
+static int
+bench(u_int nshards, struct session *sessions, char ports[][16],
+      u_int nagents) {
+    struct snmp_shards shards;
+    struct session *s;
+    char name[32];
+    double start, cpu, t;
+    u_long answered = 0, failed = 0;
+    u_int i, j, nopen = 0;
+    int rcvbuf = 4 << 20, ret = -1;
+
+    if (snmp_shards_init(&shards, nshards, AF_INET, 0) == -1) {
+        fprintf(stderr, "shards: %s\n", shards.error);
+        return (-1);
+    }
+    for (i = 0; i < BENCH_SESSIONS; i++) {
+        s = &sessions[i];
+        snmp_client_init(&s->client);
+        s->client.dump_pdus = 0;
+        s->client.retries = 0;
+        s->answered = s->failed = 0;
+        if (snmp_shards_open(&shards, &s->client, "127.0.0.1",
+                             ports[i % nagents], NULL, NULL) == -1) {
+            fprintf(stderr, "open: %s\n", shards.error);
+            goto out;
+        }
+        nopen++;
+        /* the first session of each shard has the socket of the shard */
+        if (i < nshards)
+            (void)setsockopt(s->client.fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf,
+                             sizeof(rcvbuf));
+        for (j = 0; j < BENCH_WINDOW; j++) {
+            snmp_pdu_reset(&s->client, &s->req[j], SNMP_PDU_GET);
+            s->req[j].bindings[0].oid.len =
+                sizeof(sys_uptime) / sizeof(sys_uptime[0]);
+            memcpy(s->req[j].bindings[0].oid.subs, sys_uptime,
+                   sizeof(sys_uptime));
+            s->req[j].bindings[0].syntax = SNMP_SYNTAX_NULL;
+            s->req[j].nbindings = 1;
+        }
+    }
+
+    if (snmp_shards_start(&shards) == -1) {
+        fprintf(stderr, "start: %s\n", shards.error);
+        goto out;
+    }
+    start = now_ns();
+    cpu = cpu_ns();
+    for (i = 0; i < BENCH_SESSIONS; i++)
+        for (j = 0; j < BENCH_WINDOW; j++)
+            if (snmp_shards_send(&sessions[i].client, &sessions[i].req[j],
+                                 answer, &sessions[i]) == -1)
+                sessions[i].failed++;
+    do {
+        (void)usleep(10000);
+    } while ((t = now_ns() - start) < BENCH_NS);
+    snmp_shards_stop(&shards);
+    cpu = cpu_ns() - cpu;
+
+    for (i = 0; i < BENCH_SESSIONS; i++) {
+        answered += sessions[i].answered;
+        failed += sessions[i].failed;
+    }
+    snprintf(name, sizeof(name), "shards_%u", nshards);
+    if (answered == 0) {
+        fprintf(stderr, "%s: no responses\n", name);
+        goto out;
+    }
+    printf("%s,%lu,%.1f,%.1f\n", name, answered, t / answered,
+           cpu / answered);
+    if (failed != 0)
+        fprintf(stderr, "%s: %lu requests failed\n", name, failed);
+    ret = 0;
+
+  out:
+    snmp_shards_close(&shards);
+    for (i = 0; i < nopen; i++)
+        snmp_close(&sessions[i].client);
+    return (ret);
+}
+
+int
+main(void) {
+    static char ports[BENCH_MAXAGENTS][16];
+    struct session *sessions;
+    pid_t agents[BENCH_MAXAGENTS];
+    long ncpu;
+    u_int nagents, n, i, j;
+    int err = 0;
+
+    if ((ncpu = sysconf(_SC_NPROCESSORS_ONLN)) < 1)
+        ncpu = 1;
+    nagents = ncpu > BENCH_MAXAGENTS ? BENCH_MAXAGENTS : (u_int)ncpu;
+    for (i = 0; i < nagents; i++)
+        if ((agents[i] = agent_start(ports[i], sizeof(ports[i]))) == -1) {
+            perror("agent");
+            return (1);
+        }
+    if ((sessions = calloc(BENCH_SESSIONS, sizeof(*sessions))) == NULL) {
+        perror("sessions");
+        return (1);
+    }
+    for (i = 0; i < BENCH_SESSIONS; i++)
+        for (j = 0; j < BENCH_WINDOW; j++) {
+            snmp_pdu_init(&sessions[i].req[j]);
+            if (snmp_pdu_reserve(&sessions[i].req[j], 1) != 0) {
+                perror("pdu");
+                return (1);
+            }
+        }
+
+    printf("case,iterations,ns_per_op,cpu_ns_per_op\n");
+    for (n = 1; n <= 2 * (u_int)ncpu && n <= 16; n *= 2)
+        err |= bench(n, sessions, ports, nagents);
+
+    for (i = 0; i < BENCH_SESSIONS; i++)
+        for (j = 0; j < BENCH_WINDOW; j++)
+            snmp_pdu_free(&sessions[i].req[j]);
+    free(sessions);
+    for (i = 0; i < nagents; i++) {
+        (void)kill(agents[i], SIGTERM);
+        (void)waitpid(agents[i], NULL, 0);
+    }
+    return (err ? 1 : 0);
+}
+
+#else /* !HAVE_EPOLL */
+
+int
+main(void) {
+    printf("shard_bench: no event loop here\n");
+    return (0);
+}
+
+#endif
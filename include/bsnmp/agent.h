@@ -129,6 +129,7 @@ extern u_int snmp_trace;
 /* called to write the trace */
 extern void (*snmp_debug)(const char *fmt, ...);
 
+/* resp is initialized here and must be released with snmp_pdu_free */
 enum snmp_ret snmp_get(snmp_pdu_t *pdu, asn_buf_t *resp_b,
                        snmp_pdu_t *resp, void *);
 enum snmp_ret snmp_getnext(snmp_pdu_t *pdu, asn_buf_t *resp_b,
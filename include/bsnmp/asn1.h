@@ -70,6 +70,23 @@ typedef struct asn_oid {
     asn_subid_t subs[ASN_MAXOIDLEN];
 } asn_oid_t;
 
+/*
+ * Compact OID. Up to ASN_COID_INLINE subids are stored in the structure
+ * itself, longer OIDs are allocated. Use the asn_coid functions to set,
+ * copy and free it.
+ */
+#define ASN_COID_INLINE	14
+
+typedef struct asn_coid {
+    u_int	len;
+    union {
+        asn_subid_t	inl[ASN_COID_INLINE];
+        asn_subid_t	*ext;
+    } u;
+} asn_coid_t;
+#define asn_coid_subs(C) \
+	((C)->len > ASN_COID_INLINE ? (C)->u.ext : (C)->u.inl)
+
 enum asn_err {
     /* conversion was ok */
     ASN_ERR_OK	= 0,
@@ -110,6 +127,7 @@ enum asn_err asn_get_integer(asn_buf_t *, int32_t *);
 enum asn_err asn_put_integer(asn_buf_t *, int32_t);
 
 enum asn_err asn_get_octetstring_raw(asn_buf_t *, asn_len_t, u_char *, u_int *);
+enum asn_err asn_get_octetstring_ref(asn_buf_t *, asn_len_t, u_char **);
 enum asn_err asn_get_octetstring(asn_buf_t *, u_char *, u_int *);
 enum asn_err asn_put_octetstring(asn_buf_t *, const u_char *, u_int);
 
@@ -141,6 +159,23 @@ enum asn_err asn_put_timeticks(asn_buf_t *, uint32_t);
 enum asn_err asn_skip(asn_buf_t *, asn_len_t);
 enum asn_err asn_pad(asn_buf_t *, asn_len_t);
 
+/*
+ * Tail-first encoding: the buffer is filled from its end, asn_ptr points
+ * to the first encoded byte and asn_len is the space left in front of it.
+ * Values must be put in reverse order.
+ */
+enum asn_err asn_rput_header(asn_buf_t *, u_char, asn_len_t);
+enum asn_err asn_rput_seqhdr(asn_buf_t *, u_char, const u_char *);
+enum asn_err asn_rput_integer(asn_buf_t *, int32_t);
+enum asn_err asn_rput_octetstring(asn_buf_t *, const u_char *, u_int);
+enum asn_err asn_rput_null(asn_buf_t *);
+enum asn_err asn_rput_exception(asn_buf_t *, u_int);
+enum asn_err asn_rput_objid(asn_buf_t *, const asn_oid_t *);
+enum asn_err asn_rput_ipaddress(asn_buf_t *, const u_char *);
+enum asn_err asn_rput_uint32(asn_buf_t *, u_char, uint32_t);
+enum asn_err asn_rput_counter64(asn_buf_t *, uint64_t);
+enum asn_err asn_rput_timeticks(asn_buf_t *, uint32_t);
+
 /*
  * Utility functions for OIDs
  */
@@ -156,12 +191,28 @@ int asn_compare_oid(const asn_oid_t *, const asn_oid_t *);
 /* check whether the first is a suboid of the second one */
 int asn_is_suboid(const asn_oid_t *, const asn_oid_t *);
 
+/* compact OIDs */
+int asn_coid_set(asn_coid_t *, const asn_subid_t *, u_int);
+int asn_oid2coid(asn_coid_t *, const asn_oid_t *);
+void asn_coid2oid(asn_oid_t *, const asn_coid_t *);
+int asn_coid_copy(asn_coid_t *, const asn_coid_t *);
+void asn_coid_free(asn_coid_t *);
+int asn_compare_coid(const asn_coid_t *, const asn_coid_t *);
+int asn_is_subcoid(const asn_coid_t *, const asn_coid_t *);
+
 /* format an OID into a user buffer of size ASN_OIDSTRLEN */
 char *asn_oid2str_r(const asn_oid_t *, char *);
 
-/* format an OID into a private static buffer */
+/* format an OID into a static buffer of the calling thread */
 char *asn_oid2str(const asn_oid_t *);
 
+/* format many OIDs, each followed by a separator, into one buffer */
+u_int asn_oids2str(const asn_oid_t *, u_int, char, char *, size_t *);
+
+/* decimal conversion of single subidentifiers */
+u_int asn_subid2str(asn_subid_t, char *);
+enum asn_err asn_str2subid(const char *, asn_subid_t *, const char **);
+
 enum {
     ASN_TYPE_BOOLEAN	= 0x01,
     ASN_TYPE_INTEGER	= 0x02,
@@ -61,26 +61,48 @@
 #define	SNMP_TRANS_LOC_STREAM	2
 
 struct snmp_client;
+struct snmp_loop;
+struct snmp_timer_wheel;
+struct snmp_batch;
+struct snmp_mux;
+struct snmp_mux_peer;
+struct snmp_resolver;
 
 /* type of callback function for responses
  * this callback function is responsible for free() any memory associated with
- * any of the PDUs. Therefor it may call snmp_pdu_free() */
+ * any of the PDUs. Therefor it may call snmp_pdu_free(). A response
+ * delivered by snmp_receive() is cleared and kept for the next receive
+ * after the callback returns, freeing it only gives up its buffers. */
 typedef void (*snmp_send_cb_f)(struct snmp_client *, snmp_pdu_t *, snmp_pdu_t *, void *);
 
 /* type of callback function for timeouts */
 typedef void (*snmp_timeout_cb_f)(struct snmp_client *, void * );
 
-/* timeout start function */
+/*
+ * timeout start function. The hooks are optional; without them the
+ * client runs its timers itself from snmp_receive.
+ */
 typedef void *(*snmp_timeout_start_f)(struct timeval *timeout, snmp_timeout_cb_f, void *);
 
 /* timeout stop function */
 typedef void (*snmp_timeout_stop_f)(void *);
 
+/*
+ * A request whose variable bindings have been encoded once by
+ * snmp_pdu_compile. Sending it only encodes the header fields.
+ */
+struct snmp_pdu_tmpl {
+    snmp_pdu_t	*pdu;
+    u_char		*vars;	/* encoded variable bindings list */
+    size_t		vars_len;
+};
+
 /* List of all outstanding requests */
 struct sent_pdu {
     int		reqid;
     snmp_pdu_t	*pdu;
-    struct timeval	time;
+    struct snmp_pdu_tmpl *tmpl;	/* NULL if not sent from a template */
+    struct timeval	time;	/* sent, on the monotonic clock */
     u_int		retrycount;
     snmp_send_cb_f	callback;
     void		*arg;
@@ -117,6 +139,26 @@ struct snmp_client {
     struct timeval		timeout;
     u_int			retries;
 
+    /*
+     * With adaptive_rto set the retransmission timeout follows the
+     * measured round trip times like RFC 6298 has it for TCP, and doubles
+     * with each retry. It is kept between rto_min and rto_max; timeout is
+     * used until there is a measurement. The estimates are kept always.
+     */
+    int			adaptive_rto;
+    struct timeval		rto_min;
+    struct timeval		rto_max;
+    uint64_t		srtt;	/* in microseconds, 0 for none yet */
+    uint64_t		rttvar;
+
+    /*
+     * Learned from the responses, see snmp_client_fit: the size of the
+     * largest response the agent sends, and the average size of a
+     * binding in its responses in 1/16 bytes; 0 while unknown.
+     */
+    size_t			resp_limit;
+    size_t			binding_size;
+
     int			dump_pdus;
 
     size_t			txbuflen;
@@ -135,6 +177,45 @@ struct snmp_client {
 
     struct sent_pdu_list sent_pdus;
 
+    /* the same requests by request id, an open addressing hash table */
+    struct sent_pdu		**reqtab;
+    u_int			reqtab_size;	/* power of 2 */
+    u_int			reqtab_used;
+
+    /* kept for reuse so that polling does not allocate, see snmp_close */
+    struct sent_pdu_list free_pdus;	/* unused sent_pdu records */
+    snmp_pdu_t		*free_resp;	/* response PDU of snmp_receive */
+    u_char			*txbuf;	/* encoding buffer of txbuflen bytes */
+    size_t			txbuf_size;
+
+    /* event loop driving this client, see bsnmp/loop.h */
+    struct snmp_loop	*loop;
+    LIST_ENTRY(snmp_client) loop_entries;
+
+    /* timers without a loop and hooks, see bsnmp/timer.h */
+    struct snmp_timer_wheel	*wheel;
+
+    /*
+     * Messages sent and received with one system call on datagram
+     * sockets where sendmmsg and recvmmsg exist; 0 or 1 for none. Each
+     * message has buffers of txbuflen and rxbuflen bytes. Requests are
+     * queued until there are batch of them or snmp_flush is called;
+     * snmp_receive, snmp_dialog and the loop flush before they wait.
+     */
+    u_int			batch;
+    struct snmp_batch	*batch_io;
+    LIST_ENTRY(snmp_client) flush_entries;	/* queued on the loop */
+
+    /* shared socket to use instead of one of its own, see bsnmp/mux.h */
+    struct snmp_mux		*mux;
+    struct snmp_mux_peer	*mux_peer;
+
+    /* for threads sharing the client, see snmp_client_lock */
+    struct snmp_mutex	*lock;
+
+    /* address cache used by snmp_open, see bsnmp/resolve.h */
+    struct snmp_resolver	*resolver;
+
     char			local_path[sizeof(SNMP_LOCAL_PATH)];
 };
 
@@ -151,23 +232,77 @@ int snmp_open(struct snmp_client *client, const char *_hostname,
               const char *_portname, const char *_read_community,
               const char *_write_community);
 
+/*
+ * Open a UDP session to an address that is already resolved, without
+ * looking up any name. chost and cport are left as they are.
+ */
+int snmp_open_addr(struct snmp_client *client, const struct sockaddr *_addr,
+                   socklen_t _addrlen, const char *_read_community,
+                   const char *_write_community);
+
 /* close connection */
 void snmp_close(struct snmp_client *client);
 
 /* initialize a snmp_pdu structure */
 void snmp_pdu_create(struct snmp_client *client, snmp_pdu_t *, u_int _op);
 
+/*
+ * start a new request in a PDU that was initialized before, with
+ * snmp_pdu_init or snmp_pdu_create. Its bindings array is reused.
+ */
+void snmp_pdu_reset(struct snmp_client *client, snmp_pdu_t *, u_int _op);
+
 /* add pairs of (asn_oid_t *, enum snmp_syntax) to an existing pdu */
 int snmp_add_binding(snmp_pdu_t *, ...);
 
 int32_t snmp_pdu_send(struct snmp_client *client, snmp_pdu_t *_pdu, snmp_send_cb_f _func, void *_arg);
 
+/* pre-encode the bindings of a request that is sent over and over */
+int snmp_pdu_compile(struct snmp_client *client, snmp_pdu_t *_pdu, struct snmp_pdu_tmpl *_tmpl);
+void snmp_pdu_tmpl_free(struct snmp_pdu_tmpl *_tmpl);
+int32_t snmp_pdu_send_tmpl(struct snmp_client *client, struct snmp_pdu_tmpl *_tmpl, snmp_send_cb_f _func, void *_arg);
+
 /*  append an index to an oid */
 int snmp_oid_append(asn_oid_t *_oid, const char *_fmt, ...);
 
-/* receive a packet */
+/*
+ * receive a packet. If the client runs its own timers, this also runs the
+ * expired ones and a blocking call returns 0 when the next one is due.
+ */
 int snmp_receive(struct snmp_client *client, int _blocking);
 
+/* send the requests queued for batching */
+int snmp_flush(struct snmp_client *client);
+
+/*
+ * Threads. The codec keeps no state between calls apart from buffers of
+ * the calling thread, see also snmp_set_sinks, and different clients can
+ * be used in parallel without locking. A client in a loop is used only by
+ * the thread running the loop.
+ *
+ * A client shared by several threads, a worker pool for instance, gets a
+ * lock with snmp_client_lock_init before it is shared. Every use is then
+ * between snmp_client_lock and snmp_client_unlock, from snmp_pdu_create
+ * to the end of the call that waits for the response; request ids are
+ * handed out under the lock too. Calls are serialized: a thread waiting
+ * in snmp_dialog or a blocking snmp_receive keeps the others out until
+ * it returns. The lock is recursive, so callbacks may take it again.
+ * Clients of a mux share the lock of the mux. snmp_close frees the lock
+ * and is called without holding it, when no other thread uses the client.
+ */
+int snmp_client_lock_init(struct snmp_client *client);
+void snmp_client_lock(struct snmp_client *client);
+void snmp_client_unlock(struct snmp_client *client);
+
+/*
+ * Limit n to the number of bindings that should fit into a response of
+ * the agent, from its maxMsgSize with SNMPv3, the sizes of its responses
+ * and its tooBig errors. n while nothing is known. GETBULK requests are
+ * sent with no more repetitions than fit, and snmp_dialog halves them
+ * when the agent still answers tooBig.
+ */
+u_int snmp_client_fit(const struct snmp_client *client, u_int n);
+
 /*
  * This structure is used to describe an SNMP table that is to be fetched.
  * The C-structure that is produced by the fetch function must start with
@@ -214,6 +349,32 @@ int snmp_table_fetch_async(struct snmp_client* client, const struct snmp_table *
 /* send a request and wait for the response */
 int snmp_dialog(struct snmp_client *client, snmp_pdu_t *_req, snmp_pdu_t *_resp);
 
+/*
+ * The same for a response PDU that was initialized before and is used
+ * again: it is cleared with snmp_pdu_clear, and its bindings and receive
+ * buffer are kept, so that no memory is allocated once they are large
+ * enough.
+ */
+int snmp_dialog_reuse(struct snmp_client *client, snmp_pdu_t *_req,
+                      snmp_pdu_t *_resp);
+
+/*
+ * Send the bindings of a GET or GETNEXT in requests of at most
+ * _max_bindings each (0 for SNMP_MAX_BINDINGS) and no more than fit, see
+ * snmp_client_fit, keep up to _window of them outstanding and wait for
+ * all responses. Each request is retried on its own, and sent again in
+ * halves if it was too big. _resp gets the bindings in the order of _req; those whose
+ * request failed keep the OID and a NULL value, and the first error
+ * status is set in _resp. _status, if not NULL, gets per binding the
+ * error status of its response or -1 when there was none. Returns the
+ * number of bindings without value or -1 on errors. A wide window may
+ * need a socket receive buffer larger than the default. _resp must be
+ * initialized, it is reused as by snmp_dialog_reuse.
+ */
+int snmp_dialog_pipelined(struct snmp_client *client, snmp_pdu_t *_req,
+                          snmp_pdu_t *_resp, u_int _max_bindings,
+                          u_int _window, int32_t *_status);
+
 /* discover an authorative snmpEngineId */
 int snmp_discover_engine(struct snmp_client *client, char *, char *, char *);
 
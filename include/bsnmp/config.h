@@ -46,6 +46,12 @@
 #define MAXPATHLEN 1024
 #endif
 #define HAVE_INET_NTOP 1
+#define HAVE_GETADDRINFO 1
+
+#ifdef __linux__
+#define HAVE_EPOLL 1
+#define HAVE_SENDMMSG 1
+#endif
 #endif
 
 #ifdef __GNUC__
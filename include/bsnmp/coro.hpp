@@ -0,0 +1,570 @@
+/*
+ * C++20 coroutines over the asynchronous client.
+ *
+ * A request is awaited instead of given a snmp_send_cb_f callback:
+ *
+ *	bsnmp::task<> poll(snmp_client *c) {
+ *	    const asn_oid_t uptime = bsnmp::oid({1, 3, 6, 1, 2, 1, 1, 3, 0});
+ *	    const asn_oid_t ifs = bsnmp::oid({1, 3, 6, 1, 2, 1, 2});
+ *
+ *	    bsnmp::pdu resp = co_await bsnmp::get(c, uptime);
+ *	    ...
+ *	    co_await bsnmp::walk(c, ifs, [](const snmp_value_t &v) { ... });
+ *	}
+ *
+ * There is no event loop here. The coroutine is resumed from the
+ * response callback, so whatever drives the client drives the coroutine:
+ * snmp_loop_run, snmp_receive, a snmp_shards thread or the application.
+ * bsnmp::run does that until one task is done; bsnmp::spawn starts a task
+ * that runs on its own, any number of them per thread.
+ *
+ * The response is the PDU the client decoded into, it is taken over
+ * rather than copied. A coroutine that hands the same response PDU to
+ * each of its requests, as walk does, runs without allocations once the
+ * PDUs have grown. A failed send or a request that timed out throws
+ * bsnmp::error in the coroutine; a response with an error status is
+ * returned like any other.
+ *
+ * Everything runs on the thread of the client. A client must not be
+ * closed while coroutines wait for it.
+ */
+#ifndef _BSNMP_CORO_HPP
+#define _BSNMP_CORO_HPP
+
+#if !defined(__cpp_impl_coroutine)
+#error "bsnmp/coro.hpp needs C++20 coroutines"
+#endif
+
+#include <cerrno>
+#include <coroutine>
+#include <cstdlib>
+#include <exception>
+#include <initializer_list>
+#include <new>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+extern "C" {
+#include "bsnmp/asn1.h"
+#include "bsnmp/snmp.h"
+#include "bsnmp/client.h"
+#include "bsnmp/loop.h"
+}
+
+namespace bsnmp {
+
+/* a request failed; what() is the error of the client */
+class error : public std::runtime_error {
+public:
+    explicit error(const char *msg) : std::runtime_error(msg) {}
+};
+
+/* an OID from its sub identifiers */
+inline asn_oid_t oid(std::initializer_list<asn_subid_t> subs) {
+    asn_oid_t o;
+
+    if (subs.size() > ASN_MAXOIDLEN)
+        throw std::length_error("OID too long");
+    o.len = 0;
+    for (asn_subid_t s : subs)
+        o.subs[o.len++] = s;
+    return (o);
+}
+
+/*
+ * A snmp_pdu_t that owns its bindings and buffers. It can be moved but
+ * not copied.
+ */
+class pdu {
+public:
+    pdu() noexcept { snmp_pdu_init(&p_); }
+    ~pdu() { snmp_pdu_free(&p_); }
+
+    pdu(pdu &&o) noexcept : p_(o.p_) { snmp_pdu_init(&o.p_); }
+    pdu &operator=(pdu &&o) noexcept {
+        if (this != &o) {
+            snmp_pdu_free(&p_);
+            p_ = o.p_;
+            snmp_pdu_init(&o.p_);
+        }
+        return (*this);
+    }
+    pdu(const pdu &) = delete;
+    pdu &operator=(const pdu &) = delete;
+
+    snmp_pdu_t *get() noexcept { return (&p_); }
+    const snmp_pdu_t *get() const noexcept { return (&p_); }
+    snmp_pdu_t *operator->() noexcept { return (&p_); }
+    const snmp_pdu_t *operator->() const noexcept { return (&p_); }
+
+    std::span<snmp_value_t> bindings() noexcept {
+        return (std::span<snmp_value_t>(p_.bindings, p_.nbindings));
+    }
+    std::span<const snmp_value_t> bindings() const noexcept {
+        return (std::span<const snmp_value_t>(p_.bindings, p_.nbindings));
+    }
+
+    /* append a binding with a NULL value, for the GET family */
+    void add(const asn_oid_t &o) {
+        snmp_value_t *b = next();
+
+        b->oid = o;
+        b->syntax = SNMP_SYNTAX_NULL;
+        p_.nbindings++;
+    }
+
+    /* append a copy of a binding, for SET */
+    void add(const snmp_value_t &v) {
+        if (snmp_value_copy(next(), &v) != 0)
+            throw std::bad_alloc();
+        p_.nbindings++;
+    }
+
+private:
+    snmp_value_t *next() {
+        if (snmp_pdu_reserve(&p_, p_.nbindings + 1) != 0)
+            throw std::bad_alloc();
+        return (&p_.bindings[p_.nbindings]);
+    }
+
+    snmp_pdu_t p_;
+};
+
+namespace detail {
+
+/*
+ * Take the response from the client, which gets the storage of dst in
+ * exchange. Its receive buffer is made as large as the one taken, the
+ * client receives into it right away.
+ */
+inline bool take(snmp_pdu_t *dst, snmp_pdu_t *src) noexcept {
+    u_char *buf;
+
+    snmp_pdu_clear(dst);
+    if (dst->rxbuf_size < src->rxbuf_size) {
+        buf = static_cast<u_char *>(malloc(src->rxbuf_size));
+        if (buf == nullptr)
+            return (false);
+        free(dst->rxbuf);
+        dst->rxbuf = buf;
+        dst->rxbuf_size = src->rxbuf_size;
+    }
+    std::swap(*dst, *src);
+    /* an arena stays where it was attached */
+    std::swap(dst->arena, src->arena);
+    return (true);
+}
+
+} /* namespace detail */
+
+/*
+ * Send a request and resume with its response. The request is either
+ * owned by the awaitable or borrowed; it must stay until the response is
+ * in. With resp the response is put there, and the storage it had goes
+ * back to the client to decode the next response into, so a coroutine
+ * that sends over and over does not allocate. co_await yields the
+ * response as an rvalue either way.
+ */
+class request {
+public:
+    request(snmp_client *client, pdu &&req)
+        : client_(client), own_(std::move(req)), req_(&own_), resp_(&in_) {}
+    request(snmp_client *client, pdu &req)
+        : client_(client), req_(&req), resp_(&in_) {}
+    request(snmp_client *client, pdu &req, pdu &resp)
+        : client_(client), req_(&req), resp_(&resp) {}
+
+    request(const request &) = delete;
+    request &operator=(const request &) = delete;
+
+    bool await_ready() const noexcept { return (false); }
+
+    bool await_suspend(std::coroutine_handle<> h) noexcept {
+        waiter_ = h;
+        if (snmp_pdu_send(client_, req_->get(), done, this) == -1) {
+            failed_ = true;
+            return (false);
+        }
+        return (true);
+    }
+
+    pdu &&await_resume() {
+        if (failed_)
+            throw error(client_->error);
+        if (timedout_)
+            throw error("no response");
+        if (nomem_)
+            throw std::bad_alloc();
+        return (std::move(*resp_));
+    }
+
+private:
+    static void done(snmp_client *, snmp_pdu_t *, snmp_pdu_t *resp,
+                     void *arg) {
+        request *r = static_cast<request *>(arg);
+
+        if (resp == nullptr)
+            r->timedout_ = true;
+        else if (!detail::take(r->resp_->get(), resp))
+            r->nomem_ = true;
+        r->waiter_.resume();
+    }
+
+    snmp_client *client_;
+    pdu own_;
+    pdu *req_;
+    pdu in_;
+    pdu *resp_;
+    std::coroutine_handle<> waiter_;
+    bool failed_ = false;
+    bool timedout_ = false;
+    bool nomem_ = false;
+};
+
+namespace detail {
+
+template <class V>
+inline pdu make(snmp_client *client, u_int op, std::span<const V> vals) {
+    pdu p;
+
+    snmp_pdu_create(client, p.get(), op);
+    for (const V &v : vals)
+        p.add(v);
+    return (p);
+}
+
+template <class V, class... Vs>
+constexpr bool all = (std::is_same_v<Vs, V> && ...);
+
+} /* namespace detail */
+
+/*
+ * The OIDs or values of a request are given as a span or one by one.
+ * GCC 12 rejects temporary OIDs that live across a co_await ("array used
+ * as initializer"), so in a coroutine they are best kept in variables.
+ */
+inline request get(snmp_client *client, std::span<const asn_oid_t> oids) {
+    return (request(client, detail::make(client, SNMP_PDU_GET, oids)));
+}
+template <class... O> requires detail::all<asn_oid_t, O...>
+inline request get(snmp_client *client, const O &...oids) {
+    const asn_oid_t a[] = { oids... };
+
+    return (get(client, std::span<const asn_oid_t>(a)));
+}
+
+inline request getnext(snmp_client *client,
+                       std::span<const asn_oid_t> oids) {
+    return (request(client, detail::make(client, SNMP_PDU_GETNEXT, oids)));
+}
+template <class... O> requires detail::all<asn_oid_t, O...>
+inline request getnext(snmp_client *client, const O &...oids) {
+    const asn_oid_t a[] = { oids... };
+
+    return (getnext(client, std::span<const asn_oid_t>(a)));
+}
+
+/*
+ * The first non_repeaters OIDs are asked once, the others up to
+ * max_repetitions times; the client lowers that to what fits into a
+ * response of the agent.
+ */
+inline request getbulk(snmp_client *client, int32_t non_repeaters,
+                       int32_t max_repetitions,
+                       std::span<const asn_oid_t> oids) {
+    pdu p = detail::make(client, SNMP_PDU_GETBULK, oids);
+
+    p->error_status = non_repeaters;
+    p->error_index = max_repetitions;
+    return (request(client, std::move(p)));
+}
+template <class... O> requires detail::all<asn_oid_t, O...>
+inline request getbulk(snmp_client *client, int32_t non_repeaters,
+                       int32_t max_repetitions, const O &...oids) {
+    const asn_oid_t a[] = { oids... };
+
+    return (getbulk(client, non_repeaters, max_repetitions,
+                    std::span<const asn_oid_t>(a)));
+}
+
+/* the values are copied into the request */
+inline request set(snmp_client *client,
+                   std::span<const snmp_value_t> values) {
+    return (request(client, detail::make(client, SNMP_PDU_SET, values)));
+}
+template <class... V> requires detail::all<snmp_value_t, V...>
+inline request set(snmp_client *client, const V &...values) {
+    const snmp_value_t a[] = { values... };
+
+    return (set(client, std::span<const snmp_value_t>(a)));
+}
+
+/*
+ * Fetch a table with snmp_table_fetch_async; list is the TAILQ_HEAD of
+ * the rows as with snmp_table_fetch.
+ */
+class table {
+public:
+    table(snmp_client *client, const snmp_table *descr, void *list)
+        : client_(client), descr_(descr), list_(list) {}
+
+    table(const table &) = delete;
+    table &operator=(const table &) = delete;
+
+    bool await_ready() const noexcept { return (false); }
+
+    bool await_suspend(std::coroutine_handle<> h) noexcept {
+        waiter_ = h;
+        if (snmp_table_fetch_async(client_, descr_, list_, done,
+                                   this) == -1) {
+            res_ = -1;
+            return (false);
+        }
+        return (true);
+    }
+
+    void await_resume() const {
+        if (res_ == -1)
+            throw error(client_->error);
+    }
+
+private:
+    static void done(void *, void *arg, int res) {
+        table *t = static_cast<table *>(arg);
+
+        t->res_ = res;
+        t->waiter_.resume();
+    }
+
+    snmp_client *client_;
+    const snmp_table *descr_;
+    void *list_;
+    std::coroutine_handle<> waiter_;
+    int res_ = 0;
+};
+
+/*
+ * A coroutine returning T. It starts when it is awaited, or by spawn or
+ * run, and resumes its awaiter when it returns.
+ */
+template <class T = void>
+class task;
+
+namespace detail {
+
+class promise_base {
+public:
+    std::suspend_always initial_suspend() const noexcept { return {}; }
+
+    struct final_awaiter {
+        bool await_ready() const noexcept { return (false); }
+        template <class P>
+        std::coroutine_handle<>
+        await_suspend(std::coroutine_handle<P> h) const noexcept {
+            std::coroutine_handle<> cont = h.promise().cont_;
+
+            return (cont ? cont : std::noop_coroutine());
+        }
+        void await_resume() const noexcept {}
+    };
+    final_awaiter final_suspend() const noexcept { return {}; }
+
+    void unhandled_exception() noexcept {
+        exc_ = std::current_exception();
+    }
+
+    std::coroutine_handle<> cont_;
+    std::exception_ptr exc_;
+};
+
+template <class T>
+class promise : public promise_base {
+public:
+    task<T> get_return_object() noexcept;
+
+    template <class U>
+    void return_value(U &&v) { value_.emplace(std::forward<U>(v)); }
+
+    T result() {
+        if (exc_)
+            std::rethrow_exception(exc_);
+        return (std::move(*value_));
+    }
+
+private:
+    std::optional<T> value_;
+};
+
+template <>
+class promise<void> : public promise_base {
+public:
+    task<void> get_return_object() noexcept;
+
+    void return_void() noexcept {}
+
+    void result() {
+        if (exc_)
+            std::rethrow_exception(exc_);
+    }
+};
+
+} /* namespace detail */
+
+template <class T>
+class task {
+public:
+    using promise_type = detail::promise<T>;
+
+    explicit task(std::coroutine_handle<promise_type> h) noexcept : h_(h) {}
+    task(task &&o) noexcept : h_(std::exchange(o.h_, nullptr)) {}
+    task &operator=(task &&o) noexcept {
+        if (this != &o) {
+            if (h_)
+                h_.destroy();
+            h_ = std::exchange(o.h_, nullptr);
+        }
+        return (*this);
+    }
+    task(const task &) = delete;
+    task &operator=(const task &) = delete;
+    ~task() {
+        if (h_)
+            h_.destroy();
+    }
+
+    bool done() const noexcept { return (!h_ || h_.done()); }
+
+    /* start a task that nobody awaits, see run */
+    void start() { h_.resume(); }
+
+    /* the result of a finished task */
+    T result() { return (h_.promise().result()); }
+
+    struct awaiter {
+        bool await_ready() const noexcept { return (false); }
+        std::coroutine_handle<>
+        await_suspend(std::coroutine_handle<> cont) noexcept {
+            h_.promise().cont_ = cont;
+            return (h_);
+        }
+        T await_resume() { return (h_.promise().result()); }
+
+        std::coroutine_handle<promise_type> h_;
+    };
+    awaiter operator co_await() && noexcept { return (awaiter{h_}); }
+    awaiter operator co_await() & noexcept { return (awaiter{h_}); }
+
+private:
+    std::coroutine_handle<promise_type> h_;
+};
+
+namespace detail {
+
+template <class T>
+inline task<T> promise<T>::get_return_object() noexcept {
+    return (task<T>(std::coroutine_handle<promise<T>>::from_promise(*this)));
+}
+
+inline task<void> promise<void>::get_return_object() noexcept {
+    return (task<void>(
+        std::coroutine_handle<promise<void>>::from_promise(*this)));
+}
+
+/* a coroutine that frees itself when it is done */
+struct detached {
+    struct promise_type {
+        detached get_return_object() const noexcept { return {}; }
+        std::suspend_never initial_suspend() const noexcept { return {}; }
+        std::suspend_never final_suspend() const noexcept { return {}; }
+        void return_void() const noexcept {}
+        void unhandled_exception() const noexcept { std::terminate(); }
+    };
+};
+
+inline detached spawn(task<void> t) {
+    co_await std::move(t);
+}
+
+} /* namespace detail */
+
+/*
+ * Start a task that runs on its own and is freed when it returns. An
+ * exception leaving it terminates the program.
+ */
+inline void spawn(task<void> t) {
+    detail::spawn(std::move(t));
+}
+
+/* run the loop until the task is done and return its result */
+template <class T>
+T run(snmp_loop *loop, task<T> t) {
+    t.start();
+    while (!t.done())
+        if (snmp_loop_run_once(loop, -1) == -1)
+            throw error(loop->error);
+    return (t.result());
+}
+
+/*
+ * The same for a client outside of a loop, with snmp_receive. That fails
+ * as well for packets it drops: late and duplicated responses and those
+ * it cannot decode. The requests time out if need be, so only a stream
+ * that was closed ends the run, which is EPIPE as in snmp_dialog.
+ */
+template <class T>
+T run(snmp_client *client, task<T> t) {
+    t.start();
+    while (!t.done()) {
+        errno = 0;
+        if (snmp_receive(client, 1) == -1 && errno == EPIPE)
+            throw error(client->error);
+    }
+    return (t.result());
+}
+
+/*
+ * Walk the subtree below root with GETBULK, or GETNEXT for SNMPv1, and
+ * call f with every binding in it. Returns the number of bindings.
+ */
+template <class F>
+task<u_int> walk(snmp_client *client, asn_oid_t root, F f) {
+    const bool bulk = client->version != SNMP_V1;
+    asn_oid_t last = root;
+    pdu req, resp;
+    u_int n = 0;
+
+    for (;;) {
+        snmp_pdu_reset(client, req.get(),
+                        bulk ? SNMP_PDU_GETBULK : SNMP_PDU_GETNEXT);
+        if (bulk) {
+            req->error_status = 0;
+            req->error_index = 64;
+        }
+        req.add(last);
+        co_await request(client, req, resp);
+
+        if (!bulk && resp->error_status == SNMP_ERR_NOSUCHNAME)
+            co_return (n);
+        if (resp->error_status != SNMP_ERR_NOERROR)
+            throw error("walk: error status in response");
+        if (resp->nbindings == 0)
+            co_return (n);
+        for (const snmp_value_t &b : resp.bindings()) {
+            if (b.syntax == SNMP_SYNTAX_ENDOFMIBVIEW ||
+                    !asn_is_suboid(&root, &b.oid))
+                co_return (n);
+            if (asn_compare_oid(&b.oid, &last) <= 0)
+                throw error("walk: OIDs not increasing");
+            f(b);
+            last = b.oid;
+            n++;
+        }
+    }
+}
+
+} /* namespace bsnmp */
+
+#endif /* _BSNMP_CORO_HPP */
@@ -0,0 +1,79 @@
+/*
+ * Event loop for many client sessions.
+ *
+ * A loop owns any number of opened snmp_client structures and runs them
+ * from one thread. Requests are sent with snmp_pdu_send or
+ * snmp_pdu_send_tmpl as usual; the loop receives the responses, calls the
+ * snmp_send_cb_f callbacks and runs the retransmission timers of all its
+ * clients, so the timeout_start and timeout_stop hooks of those clients
+ * are not used. Clients sharing the socket of a snmp_mux are added one
+ * by one like the others, the socket is waited on once for all of them.
+ *
+ * The loop is built on epoll and is only available where that exists;
+ * elsewhere snmp_loop_init fails with ENOSYS.
+ */
+#ifndef _BSNMP_LOOP_H
+#define _BSNMP_LOOP_H
+
+#include "bsnmp/client.h"
+#include "bsnmp/timer.h"
+
+struct snmp_loop {
+    int			fd;		/* epoll descriptor */
+    int			wakefd;		/* eventfd, see snmp_loop_wakeup */
+    LIST_HEAD(snmp_loop_clients, snmp_client) clients;
+    u_int			nclients;
+    struct snmp_loop_clients	flush;	/* with batched requests */
+
+    void			*events;	/* result of the last wait */
+    int			maxevents;
+    int			nevents;
+
+    /* retransmission timers of all clients */
+    struct snmp_timer_wheel	timers;
+
+    int			stop;
+
+    char			error[SNMP_STRERROR_LEN];
+};
+
+/* initialize a loop, returns -1 and sets errno on failure */
+int snmp_loop_init(struct snmp_loop *);
+
+/* release a loop. Its clients are removed but not closed. */
+void snmp_loop_close(struct snmp_loop *);
+
+/*
+ * Let the loop drive an opened client. snmp_close removes a client from
+ * its loop; requests still outstanding on a removed client are not
+ * retransmitted.
+ */
+int snmp_loop_add(struct snmp_loop *, struct snmp_client *);
+void snmp_loop_remove(struct snmp_loop *, struct snmp_client *);
+
+/*
+ * Wait at most timeout milliseconds (-1 for no limit) for responses,
+ * deliver them and run expired timers. Returns -1 on errors.
+ */
+int snmp_loop_run_once(struct snmp_loop *, int _timeout);
+
+/* run until no timer is left or snmp_loop_break was called */
+int snmp_loop_run(struct snmp_loop *);
+void snmp_loop_break(struct snmp_loop *);
+
+/*
+ * Make a wait in snmp_loop_run_once of another thread return, or the
+ * next one if the loop is not waiting. This is the only loop function
+ * that may be called from any thread.
+ */
+int snmp_loop_wakeup(struct snmp_loop *);
+
+/*
+ * Timers on the wheel of the loop. The callback is called once from
+ * snmp_loop_run_once; the timer is gone when it runs.
+ */
+void *snmp_loop_timer_start(struct snmp_loop *, const struct timeval *,
+                            snmp_timeout_cb_f, struct snmp_client *, void *);
+void snmp_loop_timer_stop(struct snmp_loop *, void *);
+
+#endif /* _BSNMP_LOOP_H */
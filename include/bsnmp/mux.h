@@ -0,0 +1,90 @@
+/*
+ * Unconnected UDP socket shared by many client sessions.
+ *
+ * A client whose mux field points to an opened snmp_mux before
+ * snmp_open does not get a socket of its own. Its requests are sent with
+ * sendto on the socket of the mux, and responses are handed to the
+ * client by their source address and request id, so any number of
+ * targets can be polled through one descriptor and socket buffer. The
+ * client keeps all of its session state and is used as usual; the
+ * address of the target is looked up once in snmp_open.
+ *
+ * Whoever reads the socket delivers the responses of all its clients:
+ * snmp_loop when the clients are in one, snmp_receive and snmp_dialog of
+ * any client otherwise, or snmp_mux_input. The timers of a client that is
+ * not in a loop still run only from its own snmp_receive.
+ *
+ * Several clients may talk to the same address; their responses are told
+ * apart by request id and decoded with the security parameters of the
+ * first of them. The mux hands out the request ids, so they are unique
+ * among its clients and min_reqid and max_reqid are not used. Clients of
+ * a mux send one message at a time, the batch field is ignored. With
+ * threads they share one lock, see snmp_client_lock.
+ */
+#ifndef _BSNMP_MUX_H
+#define _BSNMP_MUX_H
+
+#include "bsnmp/client.h"
+
+/* the address of a client, see snmp_mux_lookup */
+struct snmp_mux_peer {
+    struct snmp_mux_peer	*next;		/* in the same bucket */
+    struct snmp_client	*client;
+    uint32_t		hash;
+    socklen_t		addrlen;
+    struct sockaddr_storage	addr;
+};
+
+struct snmp_mux {
+    socket_t		fd;
+    int			family;
+
+    /* clients by address, a hash table with chaining */
+    struct snmp_mux_peer	**peers;
+    u_int			size;		/* power of 2 */
+    u_int			npeers;
+
+    /* event loop reading the socket and how many clients are in it */
+    struct snmp_loop	*loop;
+    u_int			nloop;
+
+    /* shared by the clients, they only need them for one message */
+    u_char			*txbuf;
+    size_t			txbuf_size;
+    snmp_pdu_t		*resp;		/* of snmp_mux_input */
+
+    int32_t			next_reqid;	/* of all clients */
+
+    struct snmp_mutex	*lock;		/* of all clients */
+
+    char			error[SNMP_STRERROR_LEN];
+};
+
+/*
+ * Open a non-blocking UDP socket for the given address family (AF_INET
+ * or AF_INET6) on an unused port. Returns -1 and sets errno on failure.
+ */
+int snmp_mux_open(struct snmp_mux *, int _family);
+
+/*
+ * The same on the given local port, 0 for any. With reuse set the port
+ * is shared through SO_REUSEPORT with other sockets that set it, and the
+ * kernel decides which of them gets a datagram.
+ */
+int snmp_mux_open_port(struct snmp_mux *, int _family, u_short _port,
+                       int _reuse);
+
+/*
+ * Close the socket and free the lock. Its clients lose their descriptor
+ * and have to be closed still.
+ */
+void snmp_mux_close(struct snmp_mux *);
+
+/*
+ * Receive and deliver the responses that are waiting without blocking,
+ * at most a few hundred. Returns the number of packets received or -1
+ * on errors.
+ */
+int snmp_mux_input(struct snmp_mux *);
+
+#endif /* _BSNMP_MUX_H */
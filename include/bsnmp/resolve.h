@@ -0,0 +1,61 @@
+/*
+ * Cache of resolved agent addresses.
+ *
+ * snmp_open resolves the host and port of a client with getaddrinfo,
+ * which waits for the name servers. A client whose resolver field points
+ * to a snmp_resolver looks them up there instead: a name that is not in
+ * the cache or has expired is resolved and stored, later opens of it do
+ * not resolve at all. snmp_resolver_fill resolves a list of hosts on
+ * several threads at once, so a poller can do all its lookups at startup
+ * and open its sessions without waiting. Sessions to addresses resolved
+ * otherwise are opened with snmp_open_addr.
+ *
+ * getaddrinfo does not tell how long the records are valid, entries are
+ * kept for the ttl given to snmp_resolver_init. Names that cannot be
+ * resolved are cached as well, so a dead name does not stall every
+ * open. The cache may be used by any number of threads.
+ */
+#ifndef _BSNMP_RESOLVE_H
+#define _BSNMP_RESOLVE_H
+
+#include "bsnmp/client.h"
+
+struct snmp_resolve_entry;
+
+struct snmp_resolver {
+    /* by host, port and family, an open addressing hash table */
+    struct snmp_resolve_entry	**tab;
+    u_int			size;		/* power of 2 */
+    u_int			used;
+
+    uint64_t		ttl;		/* in microseconds */
+    struct snmp_mutex	*lock;
+
+    char			error[SNMP_STRERROR_LEN];
+};
+
+/* an empty cache whose entries live ttl seconds, -1 on failure */
+int snmp_resolver_init(struct snmp_resolver *, u_int _ttl);
+
+/* release the cache, it must not be in use by a client any more */
+void snmp_resolver_close(struct snmp_resolver *);
+
+/*
+ * The first address of host and port for the family (AF_INET, AF_INET6
+ * or AF_UNSPEC), from the cache or resolved and then cached. Returns 0 or
+ * the getaddrinfo error, for gai_strerror.
+ */
+int snmp_resolver_lookup(struct snmp_resolver *, const char *_host,
+                         const char *_port, int _family,
+                         struct sockaddr_storage *, socklen_t *);
+
+/*
+ * Resolve n hosts with up to nthreads threads in parallel, the calling
+ * one among them. Names that are cached and not expired are skipped.
+ * Returns the number of names that could not be resolved.
+ */
+int snmp_resolver_fill(struct snmp_resolver *, const char *const *_hosts,
+                       u_int _n, const char *_port, int _family,
+                       u_int _nthreads);
+
+#endif /* _BSNMP_RESOLVE_H */
@@ -0,0 +1,107 @@
+/*
+ * Client sessions spread over several threads.
+ *
+ * A snmp_shards runs n shards, each a thread with an event loop and a
+ * snmp_mux of its own: its sessions share the socket, the timers and the
+ * buffers of the shard and are never touched by another thread. Sessions
+ * are given to a shard by snmp_shards_open before snmp_shards_start,
+ * round robin or, with a common local port, by the address of the agent.
+ *
+ * Requests are submitted from any thread with snmp_shards_send. They go
+ * through a lock-free queue to the shard of the session, which sends them
+ * and calls the snmp_send_cb_f callback on its thread when the response
+ * is in or the request timed out. A callback, like anything else running
+ * on the shard, may use its session and the other sessions of the shard
+ * directly. snmp_shards_call runs any function on the shard of a session.
+ *
+ * With a local port all shards bind it with SO_REUSEPORT, and a socket
+ * filter has the kernel give every response to the shard whose sessions
+ * talk to its source address. This is for agents that only answer a
+ * known port; otherwise each shard has a port of its own.
+ *
+ * The shards are built on the event loop and are only available where
+ * that exists; elsewhere snmp_shards_init fails with ENOSYS.
+ */
+#ifndef _BSNMP_SHARD_H
+#define _BSNMP_SHARD_H
+
+#include "bsnmp/client.h"
+
+struct snmp_shards {
+    struct snmp_shard	*shard;		/* n of them, see shard.c */
+    u_int			n;
+    u_int			next;		/* for round robin */
+    int			family;
+    u_short			port;		/* common local port or 0 */
+
+    /* set before snmp_shards_start: run shard i on CPU i modulo CPUs */
+    int			pin;
+    int			started;
+
+    char			error[SNMP_STRERROR_LEN];
+};
+
+/* function run on the shard of a client by snmp_shards_call */
+typedef void (*snmp_shards_call_f)(struct snmp_client *, void *);
+
+/*
+ * Create n shards for the given address family. port is the local port
+ * of all of them or 0 for one each. Returns -1 on failure.
+ */
+int snmp_shards_init(struct snmp_shards *, u_int _n, int _family,
+                     u_short _port);
+
+/*
+ * Open an initialized client like snmp_open on one of the shards. This
+ * is done before snmp_shards_start. With a common port the address of
+ * the agent is looked up to pick the shard, through the resolver of the
+ * client if it has one.
+ */
+int snmp_shards_open(struct snmp_shards *, struct snmp_client *,
+                     const char *_host, const char *_port,
+                     const char *_read_community,
+                     const char *_write_community);
+
+/* the same for an address that is already resolved, see snmp_open_addr */
+int snmp_shards_open_addr(struct snmp_shards *, struct snmp_client *,
+                          const struct sockaddr *, socklen_t,
+                          const char *_read_community,
+                          const char *_write_community);
+
+/* start the threads */
+int snmp_shards_start(struct snmp_shards *);
+
+/*
+ * Send a request of an opened client on its shard, from any thread. Only
+ * pdu_type and the bindings of the PDU need to be set; the header is
+ * filled in from the client on the shard, as snmp_pdu_create does, which
+ * other threads do not call once the shards run. The PDU belongs to the
+ * shard until the callback, which gets a NULL response also when the
+ * request could not be sent; the error is then in the client. On the
+ * shard itself the request is sent at once. Returns -1 with errno EAGAIN
+ * when the queue of the shard is full, or on the shard when the request
+ * cannot be sent.
+ */
+int snmp_shards_send(struct snmp_client *, snmp_pdu_t *, snmp_send_cb_f,
+                     void *);
+
+/*
+ * Run func on the shard of the client, for instance to close it or to
+ * change its settings. Returns -1 with errno EAGAIN when the queue of
+ * the shard is full.
+ */
+int snmp_shards_call(struct snmp_client *, snmp_shards_call_f, void *);
+
+/*
+ * Stop the threads. Requests still queued are dropped without calling
+ * their callbacks.
+ */
+void snmp_shards_stop(struct snmp_shards *);
+
+/*
+ * Stop the threads if they run and release the shards. Their clients
+ * lose their socket and have to be closed still.
+ */
+void snmp_shards_close(struct snmp_shards *);
+
+#endif /* _BSNMP_SHARD_H */
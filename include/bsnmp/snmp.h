@@ -84,6 +84,30 @@ typedef struct snmp_value {
     snmp_values_t   v;
 } snmp_value_t;
 
+/*
+ * Compact variants of snmp_value_t and snmp_pdu_t for applications that
+ * keep many requests or values around. The OIDs are asn_coid_t and the
+ * bindings are allocated, so they are a fraction of the size of the full
+ * structures.
+ */
+typedef union snmp_cvalues {
+    int32_t		integer;
+    struct {
+        u_int		len;
+        u_char		*octets;
+    }			octetstring;
+    asn_coid_t	oid;
+    u_char		ipaddress[4];
+    uint32_t		uint32;
+    uint64_t		counter64;
+} snmp_cvalues_t;
+
+typedef struct snmp_cvalue {
+    asn_coid_t		oid;
+    enum snmp_syntax	syntax;
+    snmp_cvalues_t	v;
+} snmp_cvalue_t;
+
 enum snmp_version {
     SNMP_Verr = 0,
     SNMP_V1 = 1,
@@ -150,6 +174,23 @@ typedef struct snmp_user {
     char				sec_name[SNMP_ADM_STR32_SIZ];
 } snmp_user_t;
 
+/*
+ * Bump allocator for the variable length values of decoded PDUs. Memory
+ * is handed out from one block and released all at once by
+ * snmp_arena_reset. When a message does not fit, overflow blocks are used
+ * and the next reset grows the first block to the size needed, so a
+ * steady stream of messages decodes without allocations.
+ */
+typedef struct snmp_arena {
+    u_char			*base;		/* first block, kept on reset */
+    size_t			size;
+    int			owned;		/* base was allocated here */
+    u_char			*cur;		/* free space of the current block */
+    size_t			left;
+    size_t			used;		/* handed out since the last reset */
+    void			*blocks;	/* overflow blocks */
+} snmp_arena_t;
+
 typedef struct snmp_pdu {
     char        community[SNMP_COMMUNITY_MAXLEN + 1];
     enum snmp_version	version;
@@ -195,11 +236,48 @@ typedef struct snmp_pdu {
     u_char			*vars_ptr;
 
 
+    /*
+     * The bindings array grows on demand and is kept across
+     * snmp_pdu_clear, so a PDU that is reused does not allocate once it
+     * has seen its largest message. Entries past nbindings have an
+     * empty OID and NULL syntax.
+     */
     u_int			nbindings;
-    snmp_value_t	bindings[SNMP_MAX_BINDINGS];
+    u_int			maxbindings;	/* allocated entries */
+    snmp_value_t	*bindings;
+
+    /*
+     * If set, the decoder puts the octet strings into this arena rather
+     * than malloc'ing each one. They are released by resetting the arena
+     * in snmp_pdu_clear and snmp_pdu_free, never with snmp_value_free.
+     * Octet strings put into the PDU otherwise, as by snmp_value_copy,
+     * are freed as without an arena. The arena belongs to the caller and
+     * stays attached.
+     */
+    snmp_arena_t	*arena;
+
+    /*
+     * Receive buffer owned by the PDU. Octet strings decoded from a
+     * message in this buffer point into it rather than being copied, so
+     * they are only valid until the PDU is cleared or freed. The buffer
+     * is kept across snmp_pdu_clear and freed by snmp_pdu_free.
+     */
+    u_char			*rxbuf;
+    size_t			rxbuf_size;
 } snmp_pdu_t;
 #define snmp_v1_pdu snmp_pdu
 
+typedef struct snmp_cpdu {
+    enum snmp_version	version;
+    u_int			pdu_type;
+    int32_t			request_id;
+    int32_t			error_status;
+    int32_t			error_index;
+
+    u_int			nbindings;
+    snmp_cvalue_t	*bindings;
+} snmp_cpdu_t;
+
 #define SNMP_PDU_GET		0
 #define SNMP_PDU_GETNEXT	1
 #define SNMP_PDU_RESPONSE	2
@@ -294,13 +372,51 @@ int snmp_value_parse(const char *, enum snmp_syntax, snmp_values_t *);
 int snmp_value_copy(snmp_value_t *, const snmp_value_t *);
 
 void snmp_pdu_free(snmp_pdu_t *);
+void snmp_pdu_clear(snmp_pdu_t *);
+int snmp_pdu_reserve(snmp_pdu_t *, u_int);
+
+void snmp_arena_init(snmp_arena_t *, void *, size_t);
+void *snmp_arena_alloc(snmp_arena_t *, size_t);
+void snmp_arena_reset(snmp_arena_t *);
+void snmp_arena_free(snmp_arena_t *);
+
+int snmp_value2cvalue(snmp_cvalue_t *, const snmp_value_t *);
+int snmp_cvalue2value(snmp_value_t *, const snmp_cvalue_t *);
+void snmp_cvalue_free(snmp_cvalue_t *);
+int snmp_pdu2cpdu(snmp_cpdu_t *, const snmp_pdu_t *);
+int snmp_cpdu2pdu(snmp_pdu_t *, const snmp_cpdu_t *);
+void snmp_cpdu_free(snmp_cpdu_t *);
 void snmp_pdu_init_secparams(snmp_pdu_t *);
 enum snmp_code snmp_pdu_decode(asn_buf_t *b, snmp_pdu_t *pdu, int32_t *);
 enum snmp_code snmp_pdu_decode_header(asn_buf_t *, snmp_pdu_t *);
 enum snmp_code snmp_pdu_decode_scoped(asn_buf_t *, snmp_pdu_t *, int32_t *);
 enum snmp_code snmp_pdu_encode(snmp_pdu_t *, asn_buf_t *);
+enum snmp_code snmp_pdu_encode_rev(snmp_pdu_t *, asn_buf_t *);
 enum snmp_code snmp_pdu_decode_secmode(asn_buf_t *, snmp_pdu_t *);
 
+/*
+ * Cursor over the still encoded variable bindings of a message decoded
+ * with snmp_pdu_decode_lazy. snmp_varbind_next returns the bindings one
+ * by one as slices of the receive buffer.
+ */
+typedef struct snmp_varbind_cursor {
+    asn_buf_t		vars;		/* bindings not yet returned */
+} snmp_varbind_cursor_t;
+
+typedef struct snmp_varbind_raw {
+    const u_char	*oid;		/* contents of the name */
+    asn_len_t		oid_len;
+    u_char			type;		/* tag of the value */
+    const u_char	*value;		/* contents of the value */
+    asn_len_t		value_len;
+} snmp_varbind_raw_t;
+
+enum snmp_code snmp_pdu_decode_lazy(asn_buf_t *, snmp_pdu_t *,
+                                    snmp_varbind_cursor_t *);
+int snmp_varbind_next(snmp_varbind_cursor_t *, snmp_varbind_raw_t *);
+enum asn_err snmp_varbind_get_oid(const snmp_varbind_raw_t *, asn_oid_t *);
+enum asn_err snmp_varbind_decode(const snmp_varbind_raw_t *, snmp_value_t *);
+
 int snmp_pdu_snoop(const asn_buf_t *);
 
 void snmp_pdu_dump(const snmp_pdu_t *pdu);
@@ -320,6 +436,24 @@ enum snmp_code snmp_calc_keychange(snmp_user_t *, uint8_t *);
 
 extern void (*snmp_error)(const char *, ...);
 extern void (*snmp_printf)(const char *, ...);
+
+/*
+ * Where the default snmp_error, snmp_printf, asn_error and snmp_debug
+ * functions write in one thread instead of stderr. error gets each
+ * message without the newline, print the pieces of PDU dumps as they are
+ * formatted. A NULL function drops that output.
+ */
+struct snmp_sinks {
+    void	(*error)(void *_arg, const char *_msg);
+    void	(*print)(void *_arg, const char *_msg);
+    void	*arg;
+};
+
+/*
+ * Set the sinks of the calling thread, NULL for stderr again. Returns
+ * the ones set before. The sinks must stay valid while they are set.
+ */
+const struct snmp_sinks *snmp_set_sinks(const struct snmp_sinks *);
 const char* snmp_get_error(enum snmp_code code);
 
 
@@ -0,0 +1,65 @@
+/*
+ * Hierarchical timer wheel for request retransmissions.
+ *
+ * Timers are kept in four levels of 64 slots each. A level 0 slot holds
+ * the timers of one tick of a millisecond on the monotonic clock, a slot
+ * of the next level the timers of 64 ticks of the level below and so
+ * on; timers further out than the wheel reaches wait in the last level.
+ * Starting and stopping a timer is a list operation, and timers are
+ * moved to the level below when the wheel comes round to their slot.
+ *
+ * The wheel is used by snmp_loop and by clients without a loop that do
+ * not set the timeout_start/timeout_stop hooks.
+ */
+#ifndef _BSNMP_TIMER_H
+#define _BSNMP_TIMER_H
+
+#include "bsnmp/client.h"
+
+#define SNMP_TIMER_BITS		6
+#define SNMP_TIMER_SLOTS	(1 << SNMP_TIMER_BITS)
+#define SNMP_TIMER_LEVELS	4
+
+struct snmp_timer {
+    uint64_t		expires;	/* tick to run in */
+    snmp_timeout_cb_f	func;
+    struct snmp_client	*client;
+    void		*arg;
+    LIST_ENTRY(snmp_timer) link;
+};
+LIST_HEAD(snmp_timer_list, snmp_timer);
+
+struct snmp_timer_wheel {
+    uint64_t		now;		/* next tick to run */
+    u_int		count;		/* timers started */
+    int			busy;		/* snmp_timer_expire running */
+    struct snmp_timer_list	slots[SNMP_TIMER_LEVELS][SNMP_TIMER_SLOTS];
+    struct snmp_timer_list	free;	/* records for reuse */
+};
+
+void snmp_timer_init(struct snmp_timer_wheel *);
+
+/* stop all timers and release the records */
+void snmp_timer_fini(struct snmp_timer_wheel *);
+
+/*
+ * Run func(client, arg) after the given time, rounded up to the next
+ * tick. Returns the timer or NULL if there is no memory.
+ */
+void *snmp_timer_start(struct snmp_timer_wheel *, const struct timeval *,
+                       snmp_timeout_cb_f, struct snmp_client *, void *);
+void snmp_timer_stop(struct snmp_timer_wheel *, void *);
+
+/* stop all timers of a client */
+void snmp_timer_stop_client(struct snmp_timer_wheel *, struct snmp_client *);
+
+/*
+ * Time until the wheel has to be run again. This can be earlier than
+ * the next timer. Returns -1 if there are no timers.
+ */
+int snmp_timer_next(const struct snmp_timer_wheel *, struct timeval *);
+
+/* run all expired timers, returns how many */
+u_int snmp_timer_expire(struct snmp_timer_wheel *);
+
+#endif /* _BSNMP_TIMER_H */
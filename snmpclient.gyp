@@ -10,6 +10,11 @@
         'src/snmp.c',
         'src/agent.c',
         'src/client.c',
+        'src/loop.c',
+        'src/timer.c',
+        'src/mux.c',
+        'src/shard.c',
+        'src/resolve.c',
         'src/crypto.c',
         'src/support.c',
         'src/support.h',
@@ -18,6 +23,12 @@
         'include/bsnmp/asn1.h',
         'include/bsnmp/snmp.h',
         'include/bsnmp/client.h',
+        'include/bsnmp/loop.h',
+        'include/bsnmp/timer.h',
+        'include/bsnmp/mux.h',
+        'include/bsnmp/shard.h',
+        'include/bsnmp/resolve.h',
+        'include/bsnmp/coro.hpp',
         'include/bsnmp/agent.h',
       ],
       'direct_dependent_settings': {
@@ -157,5 +168,328 @@
       ],
       'defines': [ 'BUNDLE=1' ]
     }, # dump_pdu
+    {
+      'target_name': 'oid_bench',
+      'type': 'executable',
+      'dependencies': [
+        'libsnmpclient',
+      ],
+      'sources': [
+        'bench/oid_bench.c',
+      ],
+      'msvs-settings': {
+        'VCLinkerTool': {
+          'SubSystem': 1, # /subsystem:console
+        },
+      },
+      'conditions': [
+        ['OS=="linux" or OS=="freebsd" or OS=="openbsd" or OS=="solaris"', {
+          'cflags': [ '--std=c89' ],
+          'defines': [ '_GNU_SOURCE' ]
+        }],
+      ],
+    }, # oid_bench
+    {
+      'target_name': 'codec_bench',
+      'type': 'executable',
+      'dependencies': [
+        'libsnmpclient',
+      ],
+      'sources': [
+        'bench/codec_bench.c',
+      ],
+      'msvs-settings': {
+        'VCLinkerTool': {
+          'SubSystem': 1, # /subsystem:console
+        },
+      },
+      'conditions': [
+        ['OS=="linux" or OS=="freebsd" or OS=="openbsd" or OS=="solaris"', {
+          'cflags': [ '--std=c89' ],
+          'defines': [ '_GNU_SOURCE' ]
+        }],
+      ],
+    }, # codec_bench
+    {
+      'target_name': 'client_bench',
+      'type': 'executable',
+      'dependencies': [
+        'libsnmpclient',
+      ],
+      'sources': [
+        'bench/client_bench.c',
+      ],
+      'msvs-settings': {
+        'VCLinkerTool': {
+          'SubSystem': 1, # /subsystem:console
+        },
+      },
+      'conditions': [
+        ['OS=="linux" or OS=="freebsd" or OS=="openbsd" or OS=="solaris"', {
+          'cflags': [ '--std=c89' ],
+          'defines': [ '_GNU_SOURCE' ]
+        }],
+      ],
+    }, # client_bench
+    {
+      'target_name': 'loop_bench',
+      'type': 'executable',
+      'dependencies': [
+        'libsnmpclient',
+      ],
+      'sources': [
+        'bench/loop_bench.c',
+      ],
+      'msvs-settings': {
+        'VCLinkerTool': {
+          'SubSystem': 1, # /subsystem:console
+        },
+      },
+      'conditions': [
+        ['OS=="linux" or OS=="freebsd" or OS=="openbsd" or OS=="solaris"', {
+          'cflags': [ '--std=c89' ],
+          'defines': [ '_GNU_SOURCE' ]
+        }],
+      ],
+    }, # loop_bench
+    {
+      'target_name': 'batch_bench',
+      'type': 'executable',
+      'dependencies': [
+        'libsnmpclient',
+      ],
+      'sources': [
+        'bench/batch_bench.c',
+      ],
+      'msvs-settings': {
+        'VCLinkerTool': {
+          'SubSystem': 1, # /subsystem:console
+        },
+      },
+      'conditions': [
+        ['OS=="linux" or OS=="freebsd" or OS=="openbsd" or OS=="solaris"', {
+          'cflags': [ '--std=c89' ],
+          'defines': [ '_GNU_SOURCE' ]
+        }],
+      ],
+    }, # batch_bench
+    {
+      'target_name': 'dialog_bench',
+      'type': 'executable',
+      'dependencies': [
+        'libsnmpclient',
+      ],
+      'sources': [
+        'bench/dialog_bench.c',
+      ],
+      'msvs-settings': {
+        'VCLinkerTool': {
+          'SubSystem': 1, # /subsystem:console
+        },
+      },
+      'conditions': [
+        ['OS=="linux" or OS=="freebsd" or OS=="openbsd" or OS=="solaris"', {
+          'cflags': [ '--std=c89' ],
+          'defines': [ '_GNU_SOURCE' ]
+        }],
+      ],
+    }, # dialog_bench
+    {
+      'target_name': 'mux_bench',
+      'type': 'executable',
+      'dependencies': [
+        'libsnmpclient',
+      ],
+      'sources': [
+        'bench/mux_bench.c',
+      ],
+      'msvs-settings': {
+        'VCLinkerTool': {
+          'SubSystem': 1, # /subsystem:console
+        },
+      },
+      'conditions': [
+        ['OS=="linux" or OS=="freebsd" or OS=="openbsd" or OS=="solaris"', {
+          'cflags': [ '--std=c89' ],
+          'defines': [ '_GNU_SOURCE' ]
+        }],
+      ],
+    }, # mux_bench
+    {
+      'target_name': 'pipeline_bench',
+      'type': 'executable',
+      'dependencies': [
+        'libsnmpclient',
+      ],
+      'sources': [
+        'bench/pipeline_bench.c',
+      ],
+      'msvs-settings': {
+        'VCLinkerTool': {
+          'SubSystem': 1, # /subsystem:console
+        },
+      },
+      'conditions': [
+        ['OS=="linux" or OS=="freebsd" or OS=="openbsd" or OS=="solaris"', {
+          'cflags': [ '--std=c89' ],
+          'defines': [ '_GNU_SOURCE' ]
+        }],
+      ],
+    }, # pipeline_bench
+    {
+      'target_name': 'thread_stress',
+      'type': 'executable',
+      'dependencies': [
+        'libsnmpclient',
+      ],
+      'sources': [
+        'tests/thread_stress.c',
+      ],
+      'msvs-settings': {
+        'VCLinkerTool': {
+          'SubSystem': 1, # /subsystem:console
+        },
+      },
+      'conditions': [
+        ['OS=="linux" or OS=="freebsd" or OS=="openbsd" or OS=="solaris"', {
+          'cflags': [ '--std=c89', '-fsanitize=thread' ],
+          'ldflags': [ '-fsanitize=thread' ],
+          'defines': [ '_GNU_SOURCE' ]
+        }],
+      ],
+    }, # thread_stress
+    {
+      'target_name': 'codec_test',
+      'type': 'executable',
+      'dependencies': [
+        'libsnmpclient',
+      ],
+      'sources': [
+        'tests/codec_test.c',
+      ],
+      'msvs-settings': {
+        'VCLinkerTool': {
+          'SubSystem': 1, # /subsystem:console
+        },
+      },
+      'conditions': [
+        ['OS=="linux" or OS=="freebsd" or OS=="openbsd" or OS=="solaris"', {
+          'cflags': [ '--std=c89' ],
+          'defines': [ '_GNU_SOURCE' ]
+        }],
+      ],
+    }, # codec_test
+    {
+      'target_name': 'client_test',
+      'type': 'executable',
+      'dependencies': [
+        'libsnmpclient',
+      ],
+      'sources': [
+        'tests/client_test.c',
+      ],
+      'msvs-settings': {
+        'VCLinkerTool': {
+          'SubSystem': 1, # /subsystem:console
+        },
+      },
+      'conditions': [
+        ['OS=="linux" or OS=="freebsd" or OS=="openbsd" or OS=="solaris"', {
+          'cflags': [ '--std=c89', '-pthread' ],
+          'ldflags': [ '-pthread' ],
+          'defines': [ '_GNU_SOURCE' ]
+        }],
+      ],
+    }, # client_test
+    {
+      'target_name': 'alloc_test',
+      'type': 'executable',
+      'dependencies': [
+        'libsnmpclient',
+      ],
+      'sources': [
+        'tests/alloc_test.c',
+      ],
+      'msvs-settings': {
+        'VCLinkerTool': {
+          'SubSystem': 1, # /subsystem:console
+        },
+      },
+      'conditions': [
+        ['OS=="linux" or OS=="freebsd" or OS=="openbsd" or OS=="solaris"', {
+          'cflags': [ '--std=c89' ],
+          'defines': [ '_GNU_SOURCE' ]
+        }],
+      ],
+    }, # alloc_test
+    {
+      'target_name': 'coro_test',
+      'type': 'executable',
+      'dependencies': [
+        'libsnmpclient',
+      ],
+      'sources': [
+        'tests/coro_test.cpp',
+      ],
+      'msvs-settings': {
+        'VCCLCompilerTool': {
+          'AdditionalOptions': [ '/std:c++20' ],
+        },
+        'VCLinkerTool': {
+          'SubSystem': 1, # /subsystem:console
+        },
+      },
+      'conditions': [
+        ['OS=="linux" or OS=="freebsd" or OS=="openbsd" or OS=="solaris"', {
+          'cflags_cc': [ '-std=c++20', '-pthread' ],
+          'ldflags': [ '-pthread' ],
+          'defines': [ '_GNU_SOURCE' ]
+        }],
+      ],
+    }, # coro_test
+    {
+      'target_name': 'shard_bench',
+      'type': 'executable',
+      'dependencies': [
+        'libsnmpclient',
+      ],
+      'sources': [
+        'bench/shard_bench.c',
+      ],
+      'msvs-settings': {
+        'VCLinkerTool': {
+          'SubSystem': 1, # /subsystem:console
+        },
+      },
+      'conditions': [
+        ['OS=="linux" or OS=="freebsd" or OS=="openbsd" or OS=="solaris"', {
+          'cflags': [ '--std=c89', '-pthread' ],
+          'ldflags': [ '-pthread' ],
+          'defines': [ '_GNU_SOURCE' ]
+        }],
+      ],
+    }, # shard_bench
+    {
+      'target_name': 'open_bench',
+      'type': 'executable',
+      'dependencies': [
+        'libsnmpclient',
+      ],
+      'sources': [
+        'bench/open_bench.c',
+      ],
+      'msvs-settings': {
+        'VCLinkerTool': {
+          'SubSystem': 1, # /subsystem:console
+        },
+      },
+      'conditions': [
+        ['OS=="linux" or OS=="freebsd" or OS=="openbsd" or OS=="solaris"', {
+          'cflags': [ '--std=c89', '-pthread' ],
+          'ldflags': [ '-pthread' ],
+          'defines': [ '_GNU_SOURCE' ]
+        }],
+      ],
+    }, # open_bench
   ] # end targets
 }
@@ -93,7 +93,7 @@ struct context {
 #define	TR(W)	(snmp_trace & SNMP_TRACE_##W)
 u_int snmp_trace = 0;
 
-static char oidbuf[ASN_OIDSTRLEN];
+static SNMP_THREAD_LOCAL char oidbuf[ASN_OIDSTRLEN];
 
 /*
  * Allocate a context
@@ -170,7 +170,7 @@ find_subnode(const snmp_value_t *value) {
 
 static void
 snmp_pdu_create_response(snmp_pdu_t *pdu, snmp_pdu_t *resp) {
-    memset(resp, 0, sizeof(*resp));
+    snmp_pdu_init(resp);
     strcpy(resp->community, pdu->community);
     resp->version = pdu->version;
     resp->pdu_type = SNMP_PDU_RESPONSE;
@@ -216,6 +216,12 @@ snmp_get(snmp_pdu_t *pdu, asn_buf_t *resp_b,
         /* cannot even encode header - very bad */
         return (SNMP_RET_IGN);
 
+    if (snmp_pdu_reserve(resp, pdu->nbindings) != 0) {
+        pdu->error_status = SNMP_ERR_GENERR;
+        pdu->error_index = 0;
+        return (SNMP_RET_ERR);
+    }
+
     for (i = 0; i < pdu->nbindings; i++) {
         resp->bindings[i].oid = pdu->bindings[i].oid;
         if ((tp = find_node(&pdu->bindings[i], &except)) == NULL) {
@@ -407,6 +413,12 @@ snmp_getnext(snmp_pdu_t *pdu, asn_buf_t *resp_b,
     if (snmp_pdu_encode_header(resp_b, resp))
         return (SNMP_RET_IGN);
 
+    if (snmp_pdu_reserve(resp, pdu->nbindings) != 0) {
+        pdu->error_status = SNMP_ERR_GENERR;
+        pdu->error_index = 0;
+        return (SNMP_RET_ERR);
+    }
+
     for (i = 0; i < pdu->nbindings; i++) {
         result = do_getnext(&context, &pdu->bindings[i],
                             &resp->bindings[i], pdu);
@@ -464,6 +476,8 @@ snmp_getbulk(snmp_pdu_t *pdu, asn_buf_t *resp_b,
 
     /* non-repeaters */
     for (i = 0; i < non_rep; i++) {
+        if (snmp_pdu_reserve(resp, resp->nbindings + 1) != 0)
+            goto done;
         result = do_getnext(&context, &pdu->bindings[i],
                             &resp->bindings[resp->nbindings], pdu);
 
@@ -496,6 +510,8 @@ snmp_getbulk(snmp_pdu_t *pdu, asn_buf_t *resp_b,
     for (cnt = 0; cnt < pdu->error_index; cnt++) {
         eomib = 1;
         for (i = non_rep; i < pdu->nbindings; i++) {
+            if (snmp_pdu_reserve(resp, resp->nbindings + 1) != 0)
+                goto done;
             if (cnt == 0)
                 result = do_getnext(&context, &pdu->bindings[i],
                                     &resp->bindings[resp->nbindings], pdu);
@@ -660,6 +676,18 @@ snmp_set(snmp_pdu_t *pdu, asn_buf_t *resp_b,
     if (snmp_pdu_encode_header(resp_b, resp))
         return (SNMP_RET_IGN);
 
+    /* the per-binding SET state is a fixed array */
+    if (pdu->nbindings > SNMP_MAX_BINDINGS) {
+        pdu->error_status = SNMP_ERR_TOOBIG;
+        pdu->error_index = 0;
+        return (SNMP_RET_ERR);
+    }
+    if (snmp_pdu_reserve(resp, pdu->nbindings) != 0) {
+        pdu->error_status = SNMP_ERR_GENERR;
+        pdu->error_index = 0;
+        return (SNMP_RET_ERR);
+    }
+
     /*
      * 1. Find all nodes, check that they are writeable and
      *    that the syntax is ok, copy over the binding to the response.
@@ -990,7 +1018,9 @@ snmp_debug_func(const char *fmt, ...) {
     va_list ap;
 
     va_start(ap, fmt);
-    vfprintf(stderr, fmt, ap);
+    if (!snmp_sink_vprintf(1, fmt, ap)) {
+        vfprintf(stderr, fmt, ap);
+        fprintf(stderr, "\n");
+    }
     va_end(ap);
-    fprintf(stderr, "\n");
 }
@@ -267,16 +267,15 @@ asn_get_real_integer(asn_buf_t *b, asn_len_t len, int64_t *vp) {
 }
 
 /*
- * Write a signed integer with the given type. The caller has to ensure
- * that the actual value is ok for this type.
+ * Split a signed integer into its minimal two's complement octets. The
+ * octets are placed at the end of buf (INT_OCTETS long), the return value
+ * is the index of the first octet to encode.
  */
-static enum asn_err
-asn_put_real_integer(asn_buf_t *b, u_char type, int64_t ival) {
+#define INT_OCTETS 8
+static int
+asn_split_integer(int64_t ival, u_char *buf) {
     int i, neg = 0;
-# define OCTETS 8
-    u_char buf[OCTETS];
     uint64_t val;
-    enum asn_err ret;
 
     if (ival < 0) {
         /* this may fail if |INT64_MIN| > |INT64_MAX| and
@@ -287,28 +286,41 @@ asn_put_real_integer(asn_buf_t *b, u_char type, int64_t ival) {
         val = (uint64_t)ival;
 
     /* split the value into octets */
-    for (i = OCTETS - 1; i >= 0; i--) {
+    for (i = INT_OCTETS - 1; i >= 0; i--) {
         buf[i] = val & 0xff;
         if (neg)
             buf[i] = ~buf[i];
         val >>= 8;
     }
     /* no leading 9 zeroes or ones */
-    for (i = 0; i < OCTETS - 1; i++)
+    for (i = 0; i < INT_OCTETS - 1; i++)
         if (!((buf[i] == 0xff && (buf[i + 1] & 0x80) != 0) ||
                 (buf[i] == 0x00 && (buf[i + 1] & 0x80) == 0)))
             break;
-    if ((ret = asn_put_header(b, type, OCTETS - i)))
+    return (i);
+}
+
+/*
+ * Write a signed integer with the given type. The caller has to ensure
+ * that the actual value is ok for this type.
+ */
+static enum asn_err
+asn_put_real_integer(asn_buf_t *b, u_char type, int64_t ival) {
+    int i;
+    u_char buf[INT_OCTETS];
+    enum asn_err ret;
+
+    i = asn_split_integer(ival, buf);
+    if ((ret = asn_put_header(b, type, INT_OCTETS - i)))
         return (ret);
-    if (OCTETS - (u_int)i > b->asn_len)
+    if (INT_OCTETS - (u_int)i > b->asn_len)
         return (ASN_ERR_EOBUF);
 
-    while (i < OCTETS) {
+    while (i < INT_OCTETS) {
         *b->asn_ptr++ = buf[i++];
         b->asn_len--;
     }
     return (ASN_ERR_OK);
-# undef OCTETS
 }
 
 
@@ -351,34 +363,42 @@ asn_get_real_unsigned(asn_buf_t *b, asn_len_t len, uint64_t *vp) {
 
 
 /*
- * Values with the msb on need 9 octets.
+ * Values with the msb on need 9 octets. Like asn_split_integer this
+ * returns the index of the first octet to encode.
  */
+#define UINT_OCTETS 9
 static int
-asn_put_real_unsigned(asn_buf_t *b, u_char type, uint64_t val) {
+asn_split_unsigned(uint64_t val, u_char *buf) {
     int i;
-# define OCTETS 9
-    u_char buf[OCTETS];
-    enum asn_err ret;
 
     /* split the value into octets */
-    for (i = OCTETS - 1; i >= 0; i--) {
+    for (i = UINT_OCTETS - 1; i >= 0; i--) {
         buf[i] = val & 0xff;
         val >>= 8;
     }
     /* no leading 9 zeroes */
-    for (i = 0; i < OCTETS - 1; i++)
+    for (i = 0; i < UINT_OCTETS - 1; i++)
         if (!(buf[i] == 0x00 && (buf[i + 1] & 0x80) == 0))
             break;
-    if ((ret = asn_put_header(b, type, OCTETS - i)))
+    return (i);
+}
+
+static int
+asn_put_real_unsigned(asn_buf_t *b, u_char type, uint64_t val) {
+    int i;
+    u_char buf[UINT_OCTETS];
+    enum asn_err ret;
+
+    i = asn_split_unsigned(val, buf);
+    if ((ret = asn_put_header(b, type, UINT_OCTETS - i)))
         return (ret);
-    if (OCTETS - (u_int)i > b->asn_len)
+    if (UINT_OCTETS - (u_int)i > b->asn_len)
         return (ASN_ERR_EOBUF);
 
-    while (i < OCTETS) {
+    while (i < UINT_OCTETS) {
         *b->asn_ptr++ = buf[i++];
         b->asn_len--;
     }
-#undef OCTETS
     return (ASN_ERR_OK);
 }
 
@@ -454,6 +474,22 @@ asn_get_octetstring_raw(asn_buf_t *b, asn_len_t len, u_char *octets,
     return (err);
 }
 
+/*
+ * Get the contents of an octetstring without copying them. On return
+ * *octets points into the buffer.
+ */
+enum asn_err
+asn_get_octetstring_ref(asn_buf_t *b, asn_len_t len, u_char **octets) {
+    if (b->asn_len < len) {
+        asn_error(b, "truncatet octetstring");
+        return (ASN_ERR_EOBUF);
+    }
+    *octets = b->asn_ptr;
+    b->asn_cptr += len;
+    b->asn_len -= len;
+    return (ASN_ERR_OK);
+}
+
 enum asn_err
 asn_get_octetstring(asn_buf_t *b, u_char *octets, u_int *noctets) {
     enum asn_err err;
@@ -534,10 +570,70 @@ asn_put_exception(asn_buf_t *b, u_int except) {
  *
  * <0x06> <len> <subid...>
  */
+#if defined(__GNUC__) || defined(__clang__)
+#define ASN_CTZ64(X)	((u_int)__builtin_ctzll(X))
+#else
+static u_int
+asn_ctz64(uint64_t x) {
+    u_int n = 0;
+
+    while ((x & 1) == 0) {
+        x >>= 1;
+        n++;
+    }
+    return (n);
+}
+#define ASN_CTZ64(X)	asn_ctz64(X)
+#endif
+
+/*
+ * Decode the subids in the 8 bytes at p that are one or two bytes long.
+ * All 8 bytes are stored as one byte subids first, the continuation bits
+ * of the word give the number of those that are real. If the next subid
+ * is two bytes long and ends in the word it is added. subs must have room
+ * for 8 subids. Returns the number of bytes used, which is 0 if the first
+ * subid is longer, and the number of subids in *np.
+ */
+static u_int
+asn_get_subids8(const u_char *p, asn_subid_t *subs, u_int *np) {
+    uint64_t w, m;
+    u_int k;
+
+    w = (uint64_t)p[0] | ((uint64_t)p[1] << 8) |
+        ((uint64_t)p[2] << 16) | ((uint64_t)p[3] << 24) |
+        ((uint64_t)p[4] << 32) | ((uint64_t)p[5] << 40) |
+        ((uint64_t)p[6] << 48) | ((uint64_t)p[7] << 56);
+
+    subs[0] = p[0];
+    subs[1] = p[1];
+    subs[2] = p[2];
+    subs[3] = p[3];
+    subs[4] = p[4];
+    subs[5] = p[5];
+    subs[6] = p[6];
+    subs[7] = p[7];
+
+    if ((m = w & 0x8080808080808080ULL) == 0) {
+        *np = 8;
+        return (8);
+    }
+
+    /* index of the first byte with the continuation bit */
+    k = ASN_CTZ64(m) >> 3;
+    *np = k;
+    if (k < 7 && (p[k + 1] & 0x80) == 0) {
+        subs[k] = ((asn_subid_t)(p[k] & 0x7f) << 7) | p[k + 1];
+        *np = k + 1;
+        return (k + 2);
+    }
+    return (k);
+}
+
 enum asn_err
 asn_get_objid_raw(asn_buf_t *b, asn_len_t len, asn_oid_t *oid) {
     asn_subid_t subid;
     enum asn_err err;
+    u_int used, n;
 
     if (b->asn_len < len) {
         asn_error(b, "truncated OBJID");
@@ -552,6 +648,17 @@ asn_get_objid_raw(asn_buf_t *b, asn_len_t len, asn_oid_t *oid) {
     }
     err = ASN_ERR_OK;
     while (len != 0) {
+        /* fast path for short subids in the middle of the oid */
+        if (oid->len != 0 && len >= 8 && oid->len <= ASN_MAXOIDLEN - 8) {
+            used = asn_get_subids8(b->asn_cptr, &oid->subs[oid->len], &n);
+            if (used != 0) {
+                oid->len += n;
+                b->asn_cptr += used;
+                b->asn_len -= used;
+                len -= used;
+                continue;
+            }
+        }
         if (oid->len == ASN_MAXOIDLEN) {
             asn_error(b, "OID too long (%u)", oid->len);
             b->asn_cptr += len;
@@ -603,10 +710,16 @@ asn_get_objid(asn_buf_t *b, asn_oid_t *oid) {
     return (asn_get_objid_raw(b, len, oid));
 }
 
-enum asn_err
-asn_put_objid(asn_buf_t *b, const asn_oid_t *oid) {
+/*
+ * Check an OID for encoding and compute the length of its encoded value.
+ * The first two subids are combined into *firstp, *oidlenp is the number
+ * of subids to walk (starting at 1). Range errors do not stop the encoding.
+ */
+static enum asn_err
+asn_objid_len(const asn_oid_t *oid, asn_subid_t *firstp, u_int *oidlenp,
+              asn_len_t *lenp) {
     asn_subid_t first, sub;
-    enum asn_err err, err1;
+    enum asn_err err;
     u_int i, oidlen;
     asn_len_t len;
 
@@ -619,7 +732,7 @@ asn_put_objid(asn_buf_t *b, const asn_oid_t *oid) {
         oidlen = 2;
     } else if (oid->len == 1) {
         /* illegal */
-        asn_error(b, "short oid");
+        asn_error(NULL, "short oid");
         if (oid->subs[0] > 2)
             asn_error(NULL, "oid[0] too large (%u)", oid->subs[0]);
         err = ASN_ERR_RANGE;
@@ -652,6 +765,20 @@ asn_put_objid(asn_buf_t *b, const asn_oid_t *oid) {
                : (sub <= 0xfffffff) ? 4
                : 5;
     }
+    *firstp = first;
+    *oidlenp = oidlen;
+    *lenp = len;
+    return (err);
+}
+
+enum asn_err
+asn_put_objid(asn_buf_t *b, const asn_oid_t *oid) {
+    asn_subid_t first, sub;
+    enum asn_err err, err1;
+    u_int i, oidlen;
+    asn_len_t len;
+
+    err = asn_objid_len(oid, &first, &oidlen, &len);
     if ((err1 = asn_put_header(b, ASN_TYPE_OBJID, len)) != ASN_ERR_OK)
         return (err1);
     if (b->asn_len < len)
@@ -844,6 +971,161 @@ asn_put_timeticks(asn_buf_t *b, uint32_t val) {
                                   ASN_CLASS_APPLICATION | ASN_APP_TIMETICKS, v));
 }
 
+/*
+ * Tail-first encoding.
+ *
+ * These functions fill the buffer from its end towards its start. asn_ptr
+ * points to the first byte encoded so far and asn_len is the space left in
+ * front of it. Values are put in reverse order, so that the length of each
+ * constructed value is known when its header is written and nothing needs
+ * to be moved. The output is the same as the one of the asn_put_*
+ * functions. All errors stop the encoding.
+ */
+static enum asn_err
+asn_rput_octets(asn_buf_t *b, const u_char *octets, asn_len_t len) {
+    if (b->asn_len < len)
+        return (ASN_ERR_EOBUF);
+    b->asn_ptr -= len;
+    b->asn_len -= len;
+    memcpy(b->asn_ptr, octets, len);
+    return (ASN_ERR_OK);
+}
+
+enum asn_err
+asn_rput_header(asn_buf_t *b, u_char type, asn_len_t len) {
+    u_int lenlen;
+
+    /* tag field */
+    if ((type & ASN_TYPE_MASK) > 0x30) {
+        asn_error(NULL, "types > 0x30 not supported (%u)",
+                  type & ASN_TYPE_MASK);
+        return (ASN_ERR_FAILED);
+    }
+
+    /* length field */
+    if ((lenlen = asn_put_len(NULL, len)) == 0)
+        return (ASN_ERR_FAILED);
+    if (b->asn_len < lenlen + 1)
+        return (ASN_ERR_EOBUF);
+
+    b->asn_ptr -= lenlen;
+    (void)asn_put_len(b->asn_ptr, len);
+    *--b->asn_ptr = type;
+    b->asn_len -= lenlen + 1;
+    return (ASN_ERR_OK);
+}
+
+/*
+ * Put the header of a constructed value whose contents start at the
+ * current position and end at end.
+ */
+enum asn_err
+asn_rput_seqhdr(asn_buf_t *b, u_char type, const u_char *end) {
+    return (asn_rput_header(b, type, end - b->asn_ptr));
+}
+
+static enum asn_err
+asn_rput_real_integer(asn_buf_t *b, u_char type, int64_t ival) {
+    int i;
+    u_char buf[INT_OCTETS];
+    enum asn_err ret;
+
+    i = asn_split_integer(ival, buf);
+    if ((ret = asn_rput_octets(b, buf + i, INT_OCTETS - i)) != ASN_ERR_OK)
+        return (ret);
+    return (asn_rput_header(b, type, INT_OCTETS - i));
+}
+
+static enum asn_err
+asn_rput_real_unsigned(asn_buf_t *b, u_char type, uint64_t val) {
+    int i;
+    u_char buf[UINT_OCTETS];
+    enum asn_err ret;
+
+    i = asn_split_unsigned(val, buf);
+    if ((ret = asn_rput_octets(b, buf + i, UINT_OCTETS - i)) != ASN_ERR_OK)
+        return (ret);
+    return (asn_rput_header(b, type, UINT_OCTETS - i));
+}
+
+enum asn_err
+asn_rput_integer(asn_buf_t *b, int32_t val) {
+    return (asn_rput_real_integer(b, ASN_TYPE_INTEGER, val));
+}
+
+enum asn_err
+asn_rput_octetstring(asn_buf_t *b, const u_char *octets, u_int noctets) {
+    enum asn_err ret;
+
+    if ((ret = asn_rput_octets(b, octets, noctets)) != ASN_ERR_OK)
+        return (ret);
+    return (asn_rput_header(b, ASN_TYPE_OCTETSTRING, noctets));
+}
+
+enum asn_err
+asn_rput_null(asn_buf_t *b) {
+    return (asn_rput_header(b, ASN_TYPE_NULL, 0));
+}
+
+enum asn_err
+asn_rput_exception(asn_buf_t *b, u_int except) {
+    return (asn_rput_header(b, ASN_CLASS_CONTEXT | except, 0));
+}
+
+/*
+ * Range errors are reported like in asn_put_objid: the value is encoded
+ * anyway and the error is returned.
+ */
+enum asn_err
+asn_rput_objid(asn_buf_t *b, const asn_oid_t *oid) {
+    asn_subid_t first, sub;
+    enum asn_err err, err1;
+    u_int i, oidlen;
+    asn_len_t len;
+
+    err = asn_objid_len(oid, &first, &oidlen, &len);
+    if (b->asn_len < len)
+        return (ASN_ERR_EOBUF);
+
+    for (i = oidlen - 1; i >= 1; i--) {
+        sub = (i == 1) ? first : oid->subs[i];
+        *--b->asn_ptr = sub & 0x7f;
+        while ((sub >>= 7) != 0)
+            *--b->asn_ptr = (sub & 0x7f) | 0x80;
+    }
+    b->asn_len -= len;
+
+    if ((err1 = asn_rput_header(b, ASN_TYPE_OBJID, len)) != ASN_ERR_OK)
+        return (err1);
+    return (err);
+}
+
+enum asn_err
+asn_rput_ipaddress(asn_buf_t *b, const u_char *addr) {
+    enum asn_err err;
+
+    if ((err = asn_rput_octets(b, addr, 4)) != ASN_ERR_OK)
+        return (err);
+    return (asn_rput_header(b, ASN_CLASS_APPLICATION|ASN_APP_IPADDRESS, 4));
+}
+
+enum asn_err
+asn_rput_uint32(asn_buf_t *b, u_char type, uint32_t val) {
+    return (asn_rput_real_unsigned(b, ASN_CLASS_APPLICATION|type, val));
+}
+
+enum asn_err
+asn_rput_counter64(asn_buf_t *b, uint64_t val) {
+    return (asn_rput_real_unsigned(b,
+                                   ASN_CLASS_APPLICATION | ASN_APP_COUNTER64, val));
+}
+
+enum asn_err
+asn_rput_timeticks(asn_buf_t *b, uint32_t val) {
+    return (asn_rput_real_unsigned(b,
+                                   ASN_CLASS_APPLICATION | ASN_APP_TIMETICKS, val));
+}
+
 /*
  * Construct a new OID by taking a range of sub ids of the original oid.
  */
@@ -893,6 +1175,135 @@ asn_pad(asn_buf_t *b, asn_len_t len) {
     return (ASN_ERR_OK);
 }
 
+/*
+ * Find the first of n subidentifiers in which s1 and s2 differ. Returns
+ * n if they are all equal. The scalar version is the fallback for the
+ * vector versions below, which are selected at runtime.
+ */
+static u_int
+asn_oid_mismatch_scalar(const asn_subid_t *s1, const asn_subid_t *s2, u_int n) {
+    u_int i;
+
+    for (i = 0; i < n; i++)
+        if (s1[i] != s2[i])
+            break;
+    return (i);
+}
+
+#if ((defined(__GNUC__) && __GNUC__ >= 5) || defined(__clang__)) && \
+    (defined(__i386__) || defined(__x86_64__))
+#define ASN_OID_SIMD
+#include <immintrin.h>
+#define ASN_TARGET(T)	__attribute__((target(T)))
+#define ASN_HAVE_SSE2()	__builtin_cpu_supports("sse2")
+#define ASN_HAVE_AVX2()	__builtin_cpu_supports("avx2")
+
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#define ASN_OID_SIMD
+#include <intrin.h>
+#define ASN_TARGET(T)
+
+static int
+asn_cpuid_bit(int leaf, int reg, int bit) {
+    int regs[4];
+
+    __cpuid(regs, 0);
+    if (regs[0] < leaf)
+        return (0);
+    __cpuidex(regs, leaf, 0);
+    return ((regs[reg] >> bit) & 1);
+}
+
+static int
+asn_have_avx2(void) {
+    /* the OS must save the YMM registers (OSXSAVE and XCR0) */
+    if (!asn_cpuid_bit(1, 2, 27) || (_xgetbv(0) & 6) != 6)
+        return (0);
+    return (asn_cpuid_bit(7, 1, 5));
+}
+#define ASN_HAVE_SSE2()	asn_cpuid_bit(1, 3, 26)
+#define ASN_HAVE_AVX2()	asn_have_avx2()
+#endif
+
+#ifdef ASN_OID_SIMD
+/*
+ * Compare 4 subidentifiers per step. On a mismatch the scalar code finds
+ * the lane.
+ */
+static ASN_TARGET("sse2") u_int
+asn_oid_mismatch_sse2(const asn_subid_t *s1, const asn_subid_t *s2, u_int n) {
+    u_int i;
+    __m128i a, b;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        a = _mm_loadu_si128((const __m128i *)(s1 + i));
+        b = _mm_loadu_si128((const __m128i *)(s2 + i));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(a, b)) != 0xffff)
+            return (i + asn_oid_mismatch_scalar(s1 + i, s2 + i, 4));
+    }
+    return (i + asn_oid_mismatch_scalar(s1 + i, s2 + i, n - i));
+}
+
+/*
+ * Compare 8 subidentifiers per step.
+ */
+static ASN_TARGET("avx2") u_int
+asn_oid_mismatch_avx2(const asn_subid_t *s1, const asn_subid_t *s2, u_int n) {
+    u_int i;
+    __m256i a, b;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        a = _mm256_loadu_si256((const __m256i *)(s1 + i));
+        b = _mm256_loadu_si256((const __m256i *)(s2 + i));
+        if ((u_int)_mm256_movemask_epi8(_mm256_cmpeq_epi32(a, b)) !=
+                0xffffffffU)
+            return (i + asn_oid_mismatch_scalar(s1 + i, s2 + i, 8));
+    }
+    return (i + asn_oid_mismatch_scalar(s1 + i, s2 + i, n - i));
+}
+
+static u_int asn_oid_mismatch_init(const asn_subid_t *, const asn_subid_t *,
+                                   u_int);
+
+static u_int (*asn_oid_mismatch)(const asn_subid_t *, const asn_subid_t *,
+                                 u_int) = asn_oid_mismatch_init;
+
+/*
+ * Select the implementation on the first call. Racing threads all store
+ * the same pointer.
+ */
+static u_int
+asn_oid_mismatch_init(const asn_subid_t *s1, const asn_subid_t *s2, u_int n) {
+    if (ASN_HAVE_AVX2())
+        asn_oid_mismatch = asn_oid_mismatch_avx2;
+    else if (ASN_HAVE_SSE2())
+        asn_oid_mismatch = asn_oid_mismatch_sse2;
+    else
+        asn_oid_mismatch = asn_oid_mismatch_scalar;
+    return (asn_oid_mismatch(s1, s2, n));
+}
+#else
+#define asn_oid_mismatch asn_oid_mismatch_scalar
+#endif
+
+/*
+ * Compare two subid arrays like two OIDs.
+ */
+static int
+asn_compare_subs(const asn_subid_t *s1, u_int len1, const asn_subid_t *s2,
+                 u_int len2) {
+    u_int n, i;
+
+    n = len1 < len2 ? len1 : len2;
+    if ((i = asn_oid_mismatch(s1, s2, n)) < n)
+        return (s1[i] < s2[i] ? -1 : +1);
+    if (len1 < len2)
+        return (-1);
+    if (len1 > len2)
+        return (+1);
+    return (0);
+}
+
 /*
  * Compare two OIDs.
  *
@@ -902,19 +1313,7 @@ asn_pad(asn_buf_t *b, asn_len_t len) {
  */
 int
 asn_compare_oid(const asn_oid_t *o1, const asn_oid_t *o2) {
-    u_long i;
-
-    for (i = 0; i < o1->len && i < o2->len; i++) {
-        if (o1->subs[i] < o2->subs[i])
-            return (-1);
-        if (o1->subs[i] > o2->subs[i])
-            return (+1);
-    }
-    if (o1->len < o2->len)
-        return (-1);
-    if (o1->len > o2->len)
-        return (+1);
-    return (0);
+    return (asn_compare_subs(o1->subs, o1->len, o2->subs, o2->len));
 }
 
 /*
@@ -922,42 +1321,214 @@ asn_compare_oid(const asn_oid_t *o1, const asn_oid_t *o2) {
  */
 int
 asn_is_suboid(const asn_oid_t *o1, const asn_oid_t *o2) {
-    u_long i;
+    if (o1->len > o2->len)
+        return (0);
+    return (asn_oid_mismatch(o1->subs, o2->subs, o1->len) == o1->len);
+}
 
-    for (i = 0; i < o1->len; i++)
-        if (i >= o2->len || o1->subs[i] != o2->subs[i])
-            return (0);
-    return (1);
+/*
+ * Set a compact OID from an array of subids. The previous contents must
+ * have been freed. Returns -1 if the overflow storage cannot be allocated.
+ */
+int
+asn_coid_set(asn_coid_t *c, const asn_subid_t *subs, u_int len) {
+    if (len > ASN_MAXOIDLEN)
+        return (-1);
+    if (len > ASN_COID_INLINE) {
+        if ((c->u.ext = malloc(len * sizeof(subs[0]))) == NULL) {
+            c->len = 0;
+            return (-1);
+        }
+        memcpy(c->u.ext, subs, len * sizeof(subs[0]));
+    } else
+        memcpy(c->u.inl, subs, len * sizeof(subs[0]));
+    c->len = len;
+    return (0);
+}
+
+int
+asn_oid2coid(asn_coid_t *c, const asn_oid_t *oid) {
+    return (asn_coid_set(c, oid->subs, oid->len));
+}
+
+void
+asn_coid2oid(asn_oid_t *oid, const asn_coid_t *c) {
+    oid->len = c->len;
+    memcpy(oid->subs, asn_coid_subs(c), c->len * sizeof(oid->subs[0]));
+}
+
+int
+asn_coid_copy(asn_coid_t *to, const asn_coid_t *from) {
+    return (asn_coid_set(to, asn_coid_subs(from), from->len));
+}
+
+void
+asn_coid_free(asn_coid_t *c) {
+    if (c->len > ASN_COID_INLINE)
+        free(c->u.ext);
+    c->len = 0;
+}
+
+int
+asn_compare_coid(const asn_coid_t *c1, const asn_coid_t *c2) {
+    return (asn_compare_subs(asn_coid_subs(c1), c1->len,
+                             asn_coid_subs(c2), c2->len));
+}
+
+int
+asn_is_subcoid(const asn_coid_t *c1, const asn_coid_t *c2) {
+    if (c1->len > c2->len)
+        return (0);
+    return (asn_oid_mismatch(asn_coid_subs(c1), asn_coid_subs(c2),
+                             c1->len) == c1->len);
 }
 
+/* "00" "01" ... "99" */
+static const char asn_digit_pairs[201] =
+    "0001020304050607080910111213141516171819"
+    "2021222324252627282930313233343536373839"
+    "4041424344454647484950515253545556575859"
+    "6061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
 /*
- * Put a string representation of an oid into a user buffer. This buffer
- * is assumed to be at least ASN_OIDSTRLEN characters long.
- *
- * sprintf is assumed not to fail here.
+ * Format a subidentifier in decimal. Two digits are produced per step
+ * from the pair table. The string is not terminated, the number of
+ * characters (at most 10) is returned.
  */
-char *
-asn_oid2str_r(const asn_oid_t *oid, char *buf) {
+u_int
+asn_subid2str(asn_subid_t sub, char *buf) {
+    char tmp[10], *p;
+    u_int r, n;
+
+    if (sub < 10) {
+        buf[0] = (char)('0' + sub);
+        return (1);
+    }
+
+    p = tmp + sizeof(tmp);
+    while (sub >= 100) {
+        r = (sub % 100) * 2;
+        sub /= 100;
+        *--p = asn_digit_pairs[r + 1];
+        *--p = asn_digit_pairs[r];
+    }
+    if (sub >= 10) {
+        *--p = asn_digit_pairs[sub * 2 + 1];
+        *--p = asn_digit_pairs[sub * 2];
+    } else
+        *--p = (char)('0' + sub);
+
+    n = (u_int)(tmp + sizeof(tmp) - p);
+    memcpy(buf, p, n);
+    return (n);
+}
+
+/*
+ * Parse the decimal digits at str into a subidentifier. Like strtoul the
+ * value is 0 if there are no digits and *endp points to the first
+ * character that is not a digit. Returns ASN_ERR_RANGE if the value is
+ * larger than ASN_MAXID, the value is then ASN_MAXID.
+ */
+enum asn_err
+asn_str2subid(const char *str, asn_subid_t *sub, const char **endp) {
+    const u_char *p = (const u_char *)str;
+    uint64_t v = 0;
+    u_int d0, d1;
+
+    while ((d0 = (u_int)(p[0] - '0')) < 10) {
+        if ((d1 = (u_int)(p[1] - '0')) < 10) {
+            v = v * 100 + d0 * 10 + d1;
+            p += 2;
+        } else {
+            v = v * 10 + d0;
+            p++;
+        }
+        /* keep v from wrapping on long digit strings */
+        if (v > ASN_MAXID)
+            v = (uint64_t)ASN_MAXID + 1;
+    }
+    if (endp != NULL)
+        *endp = (const char *)p;
+
+    if (v > ASN_MAXID) {
+        *sub = ASN_MAXID;
+        return (ASN_ERR_RANGE);
+    }
+    *sub = (asn_subid_t)v;
+    return (ASN_ERR_OK);
+}
+
+/*
+ * Format an oid without the terminating NUL, return the length.
+ */
+static size_t
+asn_oid_fmt(const asn_oid_t *oid, char *buf) {
     u_int len, i;
-    char *ptr;
+    char *ptr = buf;
 
     if ((len = oid->len) > ASN_MAXOIDLEN)
         len = ASN_MAXOIDLEN;
-    buf[0] = '\0';
-    for (i = 0, ptr = buf; i < len; i++) {
+    for (i = 0; i < len; i++) {
         if (i > 0)
             *ptr++ = '.';
-        ptr += sprintf(ptr, "%u", oid->subs[i]);
+        ptr += asn_subid2str(oid->subs[i], ptr);
     }
+    return ((size_t)(ptr - buf));
+}
+
+/*
+ * Put a string representation of an oid into a user buffer. This buffer
+ * is assumed to be at least ASN_OIDSTRLEN characters long.
+ */
+char *
+asn_oid2str_r(const asn_oid_t *oid, char *buf) {
+    buf[asn_oid_fmt(oid, buf)] = '\0';
     return (buf);
 }
 
 /*
- * Make a string from an OID in a private buffer.
+ * Format a number of oids into one buffer, each one followed by sep. On
+ * entry *lenp is the size of buf, on return the number of characters
+ * used without the terminating NUL. Returns the number of oids that
+ * fitted into the buffer.
+ */
+u_int
+asn_oids2str(const asn_oid_t *oids, u_int n, char sep, char *buf, size_t *lenp) {
+    char tmp[ASN_OIDSTRLEN];
+    size_t size = *lenp, used = 0, len, worst;
+    u_int i;
+
+    for (i = 0; i < n; i++) {
+        /*
+         * The text has at most 10 digits and a dot per subid; the
+         * separator and the NUL come after it.
+         */
+        worst = (oids[i].len > ASN_MAXOIDLEN ? ASN_MAXOIDLEN :
+                 oids[i].len) * 11 + 2;
+        if (size - used >= worst) {
+            len = asn_oid_fmt(&oids[i], buf + used);
+        } else {
+            len = asn_oid_fmt(&oids[i], tmp);
+            if (size - used < len + 2)
+                break;
+            memcpy(buf + used, tmp, len);
+        }
+        used += len;
+        buf[used++] = sep;
+    }
+    if (size > 0)
+        buf[used] = '\0';
+    *lenp = used;
+    return (i);
+}
+
+/*
+ * Make a string from an OID in a buffer private to the calling thread.
  */
 char *
 asn_oid2str(const asn_oid_t *oid) {
-    static char str[ASN_OIDSTRLEN];
+    static SNMP_THREAD_LOCAL char str[ASN_OIDSTRLEN];
 
     return (asn_oid2str_r(oid, str));
 }
@@ -968,8 +1539,12 @@ asn_error_func(const asn_buf_t *b, const char *err, ...) {
     va_list ap;
     u_long i;
 
-    fprintf(stderr, "ASN.1: ");
     va_start(ap, err);
+    if (snmp_sink_vprintf(1, err, ap)) {
+        va_end(ap);
+        return;
+    }
+    fprintf(stderr, "ASN.1: ");
     vfprintf(stderr, err, ap);
     va_end(ap);
 
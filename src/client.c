@@ -34,6 +34,9 @@
 *
 * Support functions for SNMP clients.
 */
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE	/* sendmmsg, recvmmsg */
+#endif
 #include "bsnmp/config.h"
 #include <sys/types.h>
 #ifdef _WIN32
@@ -58,6 +61,7 @@
 #include <fcntl.h>
 #ifndef _WIN32
 #include <netdb.h>
+#include <poll.h>
 #endif
 #ifdef HAVE_STDINT_H
 #include <stdint.h>
@@ -72,6 +76,10 @@
 #include "bsnmp/asn1.h"
 #include "bsnmp/snmp.h"
 #include "bsnmp/client.h"
+#include "bsnmp/loop.h"
+#include "bsnmp/mux.h"
+#include "bsnmp/resolve.h"
+#include "bsnmp/timer.h"
 #include "support.h"
 #include "priv.h"
 
@@ -79,6 +87,20 @@
 #define ETIMEDOUT WSAETIMEDOUT
 #endif
 
+/* the socket does not block and has nothing to do */
+#ifdef _WIN32
+#define SOCKET_AGAIN()	(WSAGetLastError() == WSAEWOULDBLOCK)
+#else
+#define SOCKET_AGAIN()	(errno == EAGAIN || errno == EWOULDBLOCK || \
+			 errno == EINTR)
+#endif
+
+/* smallest variance term of the retransmission timeout, a timer tick */
+#define RTO_GRANULARITY	1000
+
+/* bytes of a response that are not bindings, about */
+#define SIZE_OVERHEAD	64
+
 /*
 * Prototype table entry. All C-structure produced by the table function must
 * start with these two fields. This relies on the fact, that all TAILQ_ENTRY
@@ -115,6 +137,29 @@ struct tabwork {
     snmp_pdu_t	pdu;
 };
 
+#ifdef HAVE_SENDMMSG
+/*
+* Messages queued for sendmmsg and received by recvmmsg, see the batch
+* field of the client. Each message has a buffer of its own.
+*/
+struct snmp_batch {
+    u_int		size;		/* messages per call */
+
+    u_char		**txbufs;
+    size_t		txsize;
+    struct iovec	*txiov;
+    struct mmsghdr	*txmsgs;
+    u_int		ntx;		/* queued */
+
+    u_char		**rxbufs;
+    size_t		rxsize;
+    struct iovec	*rxiov;
+    struct mmsghdr	*rxmsgs;
+    u_int		nrx;		/* received */
+    u_int		rxnext;		/* next to decode */
+};
+#endif
+
 /*
 * Set the error string
 */
@@ -158,6 +203,14 @@ static void table_free(struct tabwork *work, int all) {
     }
 }
 
+/*
+* Free the table work data of an asynchronous fetch.
+*/
+static void table_work_free(struct tabwork *work) {
+    snmp_pdu_free(&work->pdu);
+    free(work);
+}
+
 /*
 * Find the correct table entry for the given variable. If non exists,
 * create one.
@@ -423,14 +476,28 @@ static int table_value(struct snmp_client* client, const struct snmp_table *desc
 }
 
 /*
-* Initialize the first PDU to send
+* Ask for as many rows as fit into a response once the agent is known.
+* The repetitions are cut down to that when the request is sent.
 */
-static void table_init_pdu(struct snmp_client* client, const struct snmp_table *descr, snmp_pdu_t *pdu) {
+static void table_repetitions(struct snmp_client *client, snmp_pdu_t *pdu) {
+    if (pdu->pdu_type == SNMP_PDU_GETBULK)
+        pdu->error_index = client->binding_size != 0 ?
+                           SNMP_MAX_BINDINGS : 10;
+}
+
+/*
+* Initialize the first PDU to send. Returns 0 if ok, -1 if out of memory.
+*/
+static int table_init_pdu(struct snmp_client* client, const struct snmp_table *descr, snmp_pdu_t *pdu) {
     if (client->version == SNMP_V1)
-        snmp_pdu_create(client, pdu, SNMP_PDU_GETNEXT);
+        snmp_pdu_reset(client, pdu, SNMP_PDU_GETNEXT);
     else {
-        snmp_pdu_create(client, pdu, SNMP_PDU_GETBULK);
-        pdu->error_index = 10;
+        snmp_pdu_reset(client, pdu, SNMP_PDU_GETBULK);
+        table_repetitions(client, pdu);
+    }
+    if (snmp_pdu_reserve(pdu, 2) != 0) {
+        seterr(client, "%s", strerror(errno));
+        return (-1);
     }
     if (descr->last_change.len != 0) {
         pdu->bindings[pdu->nbindings].syntax = SNMP_SYNTAX_NULL;
@@ -442,6 +509,7 @@ static void table_init_pdu(struct snmp_client* client, const struct snmp_table *
     pdu->bindings[pdu->nbindings].oid = descr->table;
     pdu->bindings[pdu->nbindings].syntax = SNMP_SYNTAX_NULL;
     pdu->nbindings++;
+    return (0);
 }
 
 /*
@@ -550,6 +618,8 @@ int snmp_table_fetch(struct snmp_client* client, const struct snmp_table *descr,
     TAILQ_INIT(&work.worklist);
     work.callback = NULL;
     work.arg = NULL;
+    snmp_pdu_init(&work.pdu);
+    snmp_pdu_init(&resp);
 
 again:
     /*
@@ -558,37 +628,32 @@ again:
     */
     work.first = 1;
     work.last_change = 0;
-    table_init_pdu(client, descr, &work.pdu);
+    if (table_init_pdu(client, descr, &work.pdu) == -1)
+        goto err;
 
     for (;;) {
-        if (snmp_dialog(client, &work.pdu, &resp)) {
-            table_free(&work, 1);
-            return (-1);
-        }
+        if (snmp_dialog_reuse(client, &work.pdu, &resp))
+            goto err;
         if ((ret = table_check_response(client, &work, &resp)) == 0) {
-            snmp_pdu_free(&resp);
+            snmp_pdu_clear(&resp);
             break;
         }
-        if (ret == -1) {
-            snmp_pdu_free(&resp);
-            table_free(&work, 1);
-            return (-1);
-        }
+        if (ret == -1)
+            goto err;
         if (ret == -2) {
-            snmp_pdu_free(&resp);
+            snmp_pdu_clear(&resp);
             goto again;
         }
 
         work.pdu.bindings[work.pdu.nbindings - 1].oid =
             resp.bindings[resp.nbindings - 1].oid;
+        table_repetitions(client, &work.pdu);
 
-        snmp_pdu_free(&resp);
+        snmp_pdu_clear(&resp);
     }
 
-    if ((ret = table_check_cons(client, &work)) == -1) {
-        table_free(&work, 1);
-        return (-1);
-    }
+    if ((ret = table_check_cons(client, &work)) == -1)
+        goto err;
     if (ret == -2) {
         table_free(&work, 1);
         goto again;
@@ -597,11 +662,19 @@ again:
     * Free index list
     */
     table_free(&work, 0);
+    snmp_pdu_free(&work.pdu);
+    snmp_pdu_free(&resp);
     return (0);
+
+err:
+    table_free(&work, 1);
+    snmp_pdu_free(&work.pdu);
+    snmp_pdu_free(&resp);
+    return (-1);
 }
 
 /*
-* Callback for table
+* Callback for table. The response is cleared by the client afterwards.
 */
 static void table_cb(struct snmp_client *client, snmp_pdu_t *req __unused, snmp_pdu_t *resp, void *arg) {
     struct tabwork *work = (struct tabwork *)arg;
@@ -612,19 +685,17 @@ static void table_cb(struct snmp_client *client, snmp_pdu_t *req __unused, snmp_
         seterr(client, "no response to fetch table request");
         table_free(work, 1);
         work->callback(work->table, work->arg, -1);
-        free(work);
+        table_work_free(work);
         return;
     }
 
     if ((ret = table_check_response(client, work, resp)) == 0) {
         /* EOT */
-        snmp_pdu_free(resp);
-
         if ((ret = table_check_cons(client, work)) == -1) {
             /* error happend */
             table_free(work, 1);
             work->callback(work->table, work->arg, -1);
-            free(work);
+            table_work_free(work);
             return;
         }
         if (ret == -2) {
@@ -633,10 +704,10 @@ again:
             table_free(work, 1);
             work->first = 1;
             work->last_change = 0;
-            table_init_pdu(client, work->descr, &work->pdu);
-            if (snmp_pdu_send(client, &work->pdu, table_cb, work) == -1) {
+            if (table_init_pdu(client, work->descr, &work->pdu) == -1 ||
+                    snmp_pdu_send(client, &work->pdu, table_cb, work) == -1) {
                 work->callback(work->table, work->arg, -1);
-                free(work);
+                table_work_free(work);
                 return;
             }
             return;
@@ -646,22 +717,20 @@ again:
         */
         table_free(work, 0);
         work->callback(work->table, work->arg, 0);
-        free(work);
+        table_work_free(work);
         return;
     }
 
     if (ret == -1) {
         /* error */
-        snmp_pdu_free(resp);
         table_free(work, 1);
         work->callback(work->table, work->arg, -1);
-        free(work);
+        table_work_free(work);
         return;
     }
 
     if (ret == -2) {
         /* again */
-        snmp_pdu_free(resp);
         goto again;
     }
 
@@ -669,13 +738,12 @@ again:
 
     work->pdu.bindings[work->pdu.nbindings - 1].oid =
         resp->bindings[resp->nbindings - 1].oid;
-
-    snmp_pdu_free(resp);
+    table_repetitions(client, &work->pdu);
 
     if (snmp_pdu_send(client, &work->pdu, table_cb, work) == -1) {
         table_free(work, 1);
         work->callback(work->table, work->arg, -1);
-        free(work);
+        table_work_free(work);
         return;
     }
 }
@@ -697,16 +765,18 @@ int snmp_table_fetch_async(struct snmp_client* client, const struct snmp_table *
 
     work->callback = func;
     work->arg = arg;
+    snmp_pdu_init(&work->pdu);
 
     /*
     * Start by sending the first PDU
     */
     work->first = 1;
     work->last_change = 0;
-    table_init_pdu(client, descr, &work->pdu);
-
-    if (snmp_pdu_send(client, &work->pdu, table_cb, work) == -1)
+    if (table_init_pdu(client, descr, &work->pdu) == -1 ||
+            snmp_pdu_send(client, &work->pdu, table_cb, work) == -1) {
+        table_work_free(work);
         return (-1);
+    }
     return (0);
 }
 
@@ -832,10 +902,15 @@ void snmp_client_init(struct snmp_client *c) {
     c->timeout.tv_sec = 3;
     c->timeout.tv_usec = 0;
     c->retries = 3;
+    c->rto_min.tv_sec = 0;
+    c->rto_min.tv_usec = 100000;
+    c->rto_max.tv_sec = 60;
+    c->rto_max.tv_usec = 0;
     c->dump_pdus = 1;
     c->txbuflen = c->rxbuflen = 10000;
 
     c->fd = -1;
+    LIST_INIT(&c->free_pdus);
 
     c->max_reqid = INT32_MAX;
     c->min_reqid = 0;
@@ -845,14 +920,52 @@ void snmp_client_init(struct snmp_client *c) {
 }
 
 
+/*
+* Open a UDP session to a resolved address: attach it to its mux or
+* connect a socket of its own.
+*/
+static int open_client_addr(struct snmp_client *client,
+                            const struct sockaddr *addr, socklen_t addrlen) {
+    if (client->mux != NULL) {
+        if (client->mux->fd == -1) {
+            seterr(client, "mux not open");
+            return (-1);
+        }
+        if (addr->sa_family != client->mux->family) {
+            errno = EAFNOSUPPORT;
+            seterr(client, "%s", strerror(errno));
+            return (-1);
+        }
+        /* no socket of its own, see bsnmp/mux.h */
+        if (snmp_mux_attach(client->mux, client, addr, addrlen) == -1) {
+            seterr(client, "%s", strerror(errno));
+            return (-1);
+        }
+        return (0);
+    }
+    if ((client->fd = socket(addr->sa_family, SOCK_DGRAM, 0)) == -1) {
+        seterr(client, "%s", strerror(errno));
+        return (-1);
+    }
+    if (connect(client->fd, addr, addrlen) == -1) {
+        seterr(client, "%s", strerror(errno));
+        (void)closesocket(client->fd);
+        client->fd = -1;
+        return (-1);
+    }
+    return (0);
+}
+
 /*
 * Open UDP client socket
 */
 static int open_client_udp(struct snmp_client *client, const char *host,
                            const char *port) {
-    int error;
+    int error, family, ret;
     char *ptr;
     struct addrinfo hints, *res0, *res;
+    struct sockaddr_storage addr;
+    socklen_t addrlen;
 
     /* copy host- and portname */
     if (client->chost == NULL) {
@@ -890,10 +1003,21 @@ static int open_client_udp(struct snmp_client *client, const char *host,
         strcpy(client->cport, port);
     }
 
+    family = client->mux != NULL ? client->mux->family : AF_INET;
+    if (client->resolver != NULL) {
+        if ((error = snmp_resolver_lookup(client->resolver, client->chost,
+                                          client->cport, family, &addr,
+                                          &addrlen)) != 0) {
+            seterr(client, "%s: %s", client->chost, gai_strerror(error));
+            return (-1);
+        }
+        return (open_client_addr(client, (struct sockaddr *)&addr,
+                                 addrlen));
+    }
+
     /* open connection */
     memset(&hints, 0, sizeof(hints));
-    hints.ai_flags = AI_CANONNAME;
-    hints.ai_family = AF_INET;
+    hints.ai_family = family;
     hints.ai_socktype = SOCK_DGRAM;
     hints.ai_protocol = 0;
     error = getaddrinfo(client->chost, client->cport, &hints, &res0);
@@ -902,27 +1026,16 @@ static int open_client_udp(struct snmp_client *client, const char *host,
                gai_strerror(error));
         return (-1);
     }
-    res = res0;
-    for (;;) {
-        if ((client->fd = socket(res->ai_family, res->ai_socktype,
-                                 res->ai_protocol)) == -1) {
-            if ((res = res->ai_next) == NULL) {
-                seterr(client, "%s", strerror(errno));
-                freeaddrinfo(res0);
-                return (-1);
-            }
-        } else if (connect(client->fd, res->ai_addr,
-                           res->ai_addrlen) == -1) {
-            if ((res = res->ai_next) == NULL) {
-                seterr(client, "%s", strerror(errno));
-                freeaddrinfo(res0);
-                return (-1);
-            }
-        } else
+    ret = -1;
+    for (res = res0; res != NULL && ret == -1; res = res->ai_next) {
+        ret = open_client_addr(client, res->ai_addr,
+                               (socklen_t)res->ai_addrlen);
+        /* a mux takes the first address only */
+        if (client->mux != NULL)
             break;
     }
     freeaddrinfo(res0);
-    return (0);
+    return (ret);
 }
 
 #ifndef _WIN32
@@ -1035,18 +1148,22 @@ static int open_client_local(struct snmp_client *client, const char *path) {
 #endif
 
 /*
-* SNMP_OPEN
+* Start opening: the client must be closed, and nothing is known about
+* the new target yet.
 */
-int snmp_open(struct snmp_client *client, const char *host, const char *port, const char *readcomm,
-              const char *writecomm) {
-    struct timeval tout;
-
+static int open_start(struct snmp_client *client, const char *readcomm,
+                      const char *writecomm) {
     /* still open ? */
     if (client->fd != -1) {
         errno = EBUSY;
         seterr(client, "%s", strerror(errno));
         return (-1);
     }
+    /* nothing is known about the new target */
+    client->srtt = 0;
+    client->rttvar = 0;
+    client->resp_limit = 0;
+    client->binding_size = 0;
 
     /* copy community strings */
     if (readcomm != NULL)
@@ -1055,6 +1172,34 @@ int snmp_open(struct snmp_client *client, const char *host, const char *port, co
     if (writecomm != NULL)
         strlcpy(client->write_community, writecomm,
                 sizeof(client->write_community));
+    return (0);
+}
+
+static int open_finish(struct snmp_client *client) {
+    /* waits are done with poll, see client_wait */
+    if (client->mux_peer == NULL &&
+            socket_set_blocking(client->fd, 0) == -1) {
+        seterr(client, "set blocking: %s", strerror(errno));
+        (void)closesocket(client->fd);
+        client->fd = -1;
+        if (client->local_path[0] != '\0')
+            (void)remove(client->local_path);
+        return (-1);
+    }
+
+    /* initialize list */
+    LIST_INIT(&client->sent_pdus);
+
+    return (0);
+}
+
+/*
+* SNMP_OPEN
+*/
+int snmp_open(struct snmp_client *client, const char *host, const char *port, const char *readcomm,
+              const char *writecomm) {
+    if (open_start(client, readcomm, writecomm) == -1)
+        return (-1);
 
     switch (client->trans) {
 
@@ -1074,22 +1219,426 @@ int snmp_open(struct snmp_client *client, const char *host, const char *port, co
         seterr(client, "bad transport mapping");
         return (-1);
     }
-    tout.tv_sec = 0;
-    tout.tv_usec = 0;
-    if (setsockopt(client->fd, SOL_SOCKET, SO_SNDTIMEO,
-                   (char*)&tout, sizeof(struct timeval)) == -1) {
-        seterr(client, "%s", strerror(errno));
-        (void)closesocket(client->fd);
-        client->fd = -1;
-        if (client->local_path[0] != '\0')
-            (void)remove(client->local_path);
+    return (open_finish(client));
+}
+
+int snmp_open_addr(struct snmp_client *client, const struct sockaddr *addr,
+                   socklen_t addrlen, const char *readcomm,
+                   const char *writecomm) {
+    if (open_start(client, readcomm, writecomm) == -1)
+        return (-1);
+    if (client->trans != SNMP_TRANS_UDP) {
+        seterr(client, "bad transport mapping");
         return (-1);
     }
+    if (open_client_addr(client, addr, addrlen) == -1)
+        return (-1);
+    return (open_finish(client));
+}
 
-    /* initialize list */
-    LIST_INIT(&client->sent_pdus);
 
+/*
+* Wait until the socket is readable or, with out set, writable. deadline
+* is on snmp_clock, NULL waits for ever. Returns 1 when the socket is
+* ready, 0 when the deadline has passed and -1 on errors.
+*/
+static int client_wait(struct snmp_client *client, int out,
+                       const uint64_t *deadline) {
+    uint64_t now;
+    int ms, ret;
+#ifdef _WIN32
+    fd_set fds;
+    struct timeval tv;
+#else
+    struct pollfd pfd;
+#endif
+
+    for (;;) {
+        ms = -1;
+        if (deadline != NULL) {
+            if ((now = snmp_clock()) >= *deadline)
+                return (0);
+            /* round up, a shorter wait would spin */
+            if (*deadline - now > (uint64_t)INT_MAX * 1000)
+                ms = INT_MAX;
+            else
+                ms = (int)((*deadline - now + 999) / 1000);
+        }
+#ifdef _WIN32
+        FD_ZERO(&fds);
+        FD_SET(client->fd, &fds);
+        tv.tv_sec = ms / 1000;
+        tv.tv_usec = (ms % 1000) * 1000;
+        ret = select(0, out ? NULL : &fds, out ? &fds : NULL, NULL,
+                     ms < 0 ? NULL : &tv);
+        if (ret == SOCKET_ERROR) {
+            seterr(client, "select: %s", gai_strerror(WSAGetLastError()));
+            return (-1);
+        }
+#else
+        pfd.fd = client->fd;
+        pfd.events = out ? POLLOUT : POLLIN;
+        pfd.revents = 0;
+        if ((ret = poll(&pfd, 1, ms)) == -1) {
+            if (errno == EINTR)
+                continue;
+            seterr(client, "poll: %s", strerror(errno));
+            return (-1);
+        }
+#endif
+        if (ret > 0)
+            return (1);
+    }
+}
+
+#ifdef HAVE_SENDMMSG
+static void batch_free(struct snmp_batch *b) {
+    u_int i;
+
+    for (i = 0; i < b->size; i++) {
+        if (b->txbufs != NULL)
+            free(b->txbufs[i]);
+        if (b->rxbufs != NULL)
+            free(b->rxbufs[i]);
+    }
+    free(b->txbufs);
+    free(b->txiov);
+    free(b->txmsgs);
+    free(b->rxbufs);
+    free(b->rxiov);
+    free(b->rxmsgs);
+    free(b);
+}
+
+static struct snmp_batch *batch_alloc(u_int size, size_t txsize,
+                                      size_t rxsize) {
+    struct snmp_batch *b;
+    u_int i;
+
+    if ((b = calloc(1, sizeof(*b))) == NULL)
+        return (NULL);
+    b->size = size;
+    b->txsize = txsize;
+    b->rxsize = rxsize;
+    if ((b->txbufs = calloc(size, sizeof(*b->txbufs))) == NULL ||
+            (b->txiov = calloc(size, sizeof(*b->txiov))) == NULL ||
+            (b->txmsgs = calloc(size, sizeof(*b->txmsgs))) == NULL ||
+            (b->rxbufs = calloc(size, sizeof(*b->rxbufs))) == NULL ||
+            (b->rxiov = calloc(size, sizeof(*b->rxiov))) == NULL ||
+            (b->rxmsgs = calloc(size, sizeof(*b->rxmsgs))) == NULL) {
+        batch_free(b);
+        return (NULL);
+    }
+    for (i = 0; i < size; i++) {
+        if ((b->txbufs[i] = malloc(txsize)) == NULL ||
+                (b->rxbufs[i] = malloc(rxsize)) == NULL) {
+            batch_free(b);
+            return (NULL);
+        }
+        b->txmsgs[i].msg_hdr.msg_iov = &b->txiov[i];
+        b->txmsgs[i].msg_hdr.msg_iovlen = 1;
+        b->rxmsgs[i].msg_hdr.msg_iov = &b->rxiov[i];
+        b->rxmsgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    return (b);
+}
+
+/*
+* The batch of the client or NULL if messages are sent one by one. It is
+* allocated on first use and again when the sizes have changed while
+* nothing was queued or waiting to be decoded.
+*/
+static struct snmp_batch *client_batch(struct snmp_client *client) {
+    struct snmp_batch *b = client->batch_io;
+
+    if (b != NULL && (b->ntx > 0 || b->rxnext < b->nrx))
+        return (b);
+    if (client->batch <= 1 || client->trans == SNMP_TRANS_LOC_STREAM ||
+            client->mux_peer != NULL) {
+        if (b != NULL) {
+            batch_free(b);
+            client->batch_io = NULL;
+        }
+        return (NULL);
+    }
+    if (b != NULL && b->size == client->batch &&
+            b->txsize == client->txbuflen && b->rxsize == client->rxbuflen)
+        return (b);
+
+    if (b != NULL)
+        batch_free(b);
+    /* without memory messages are sent one by one */
+    client->batch_io = batch_alloc(client->batch, client->txbuflen,
+                                   client->rxbuflen);
+    return (client->batch_io);
+}
+
+/*
+* Take the next message received by recvmmsg. Its buffer is swapped with
+* the one of the PDU, so the decoded octet strings stay valid when the
+* ring is filled again. Returns -1 if there is none.
+*/
+static int batch_take(struct snmp_client *client, snmp_pdu_t *pdu) {
+    struct snmp_batch *b = client->batch_io;
+    u_char *buf;
+    size_t len;
+    u_int i;
+
+    if (b == NULL || b->rxnext == b->nrx)
+        return (-1);
+    i = b->rxnext++;
+    len = b->rxmsgs[i].msg_len;
+    if (pdu->rxbuf_size < b->rxsize) {
+        /* rxbuflen was lowered, the ring keeps its larger buffers */
+        if (len > pdu->rxbuf_size)
+            len = pdu->rxbuf_size;
+        memcpy(pdu->rxbuf, b->rxbufs[i], len);
+    } else {
+        buf = pdu->rxbuf;
+        pdu->rxbuf = b->rxbufs[i];
+        pdu->rxbuf_size = b->rxsize;
+        b->rxbufs[i] = buf;
+    }
+    return ((int)len);
+}
+
+/*
+* Receive as many messages as there are and the ring holds with one
+* recvmmsg and take the first.
+*/
+static int batch_fill(struct snmp_client *client, struct snmp_batch *b,
+                      snmp_pdu_t *pdu) {
+    int n;
+    u_int i;
+
+    for (i = 0; i < b->size; i++) {
+        b->rxiov[i].iov_base = b->rxbufs[i];
+        b->rxiov[i].iov_len = b->rxsize;
+    }
+    if ((n = recvmmsg(client->fd, b->rxmsgs, b->size, MSG_WAITFORONE,
+                      NULL)) == -1)
+        return (-1);
+    b->nrx = n;
+    b->rxnext = 0;
+    return (batch_take(client, pdu));
+}
+#endif
+
+/*
+* Send the requests queued for batching.
+*/
+int snmp_flush(struct snmp_client *client) {
+#ifdef HAVE_SENDMMSG
+    struct snmp_batch *b = client->batch_io;
+    u_int i;
+    int n, ret = 0;
+
+    if (b == NULL || b->ntx == 0)
+        return (0);
+    if (client->loop != NULL)
+        LIST_REMOVE(client, flush_entries);
+    for (i = 0; i < b->ntx; i += n)
+        if ((n = sendmmsg(client->fd, &b->txmsgs[i], b->ntx - i, 0)) == -1) {
+            n = 0;
+            if (SOCKET_AGAIN() && client_wait(client, 1, NULL) == 1)
+                continue;
+            /* the requests are sent again when they time out */
+            seterr(client, "sendmmsg: %s", strerror(errno));
+            ret = -1;
+            break;
+        }
+    b->ntx = 0;
+    return (ret);
+#else
+    (void)client;
     return (0);
+#endif
+}
+
+/*
+* Take a round trip time sample in microseconds, see RFC 6298. Requests
+* are retried with a new request id, so each response tells which send
+* it answers and samples of retries can be taken too.
+*/
+static void rtt_sample(struct snmp_client *client, uint64_t rtt) {
+    uint64_t delta;
+
+    if (client->srtt == 0) {
+        client->srtt = rtt;
+        client->rttvar = rtt / 2;
+    } else {
+        delta = client->srtt > rtt ? client->srtt - rtt : rtt - client->srtt;
+        client->rttvar = (3 * client->rttvar + delta) / 4;
+        client->srtt = (7 * client->srtt + rtt) / 8;
+    }
+    if (client->srtt == 0)
+        client->srtt = 1;
+}
+
+/*
+* The retransmission timeout in microseconds for the given retry, 0 for
+* the first send.
+*/
+static uint64_t client_rto(const struct snmp_client *client, u_int retry) {
+    uint64_t rto, min, max;
+
+    rto = (uint64_t)client->timeout.tv_sec * 1000000 +
+          client->timeout.tv_usec;
+    if (!client->adaptive_rto)
+        return (rto);
+
+    min = (uint64_t)client->rto_min.tv_sec * 1000000 +
+          client->rto_min.tv_usec;
+    max = (uint64_t)client->rto_max.tv_sec * 1000000 +
+          client->rto_max.tv_usec;
+    if (client->srtt != 0)
+        rto = client->srtt + (4 * client->rttvar > RTO_GRANULARITY ?
+                              4 * client->rttvar : RTO_GRANULARITY);
+    if (rto < min)
+        rto = min;
+    for (; retry > 0 && rto < max; retry--)
+        rto *= 2;
+    if (rto > max)
+        rto = max;
+    return (rto);
+}
+
+/*
+* The number of bindings a response to pdu carries at most.
+*/
+static u_int resp_bindings(const snmp_pdu_t *pdu) {
+    u_int nonrep;
+
+    if (pdu->pdu_type != SNMP_PDU_GETBULK)
+        return (pdu->nbindings);
+    nonrep = pdu->error_status < 0 ? 0 : (u_int)pdu->error_status;
+    if (nonrep > pdu->nbindings)
+        nonrep = pdu->nbindings;
+    return (nonrep + (pdu->nbindings - nonrep) *
+            (pdu->error_index < 0 ? 0 : (u_int)pdu->error_index));
+}
+
+/*
+* A response with n bindings was too big for the agent. The limit is put
+* somewhat below the size it would have had.
+*/
+static void size_limit(struct snmp_client *client, u_int n) {
+    size_t size;
+
+    if (client->binding_size == 0 || n < 2)
+        return;
+    size = SIZE_OVERHEAD + n * client->binding_size / 16;
+    size -= size / 8;
+    if (client->resp_limit == 0 || size < client->resp_limit)
+        client->resp_limit = size;
+}
+
+/*
+* Learn the message sizes of the agent from a response with up to n
+* bindings. The average size of a binding comes from the responses, the
+* largest response from tooBig errors and is raised by larger responses.
+*/
+static void size_learn(struct snmp_client *client, u_int n,
+                       const snmp_pdu_t *resp) {
+    size_t size;
+
+    if (resp->error_status == SNMP_ERR_TOOBIG) {
+        size_limit(client, n);
+        return;
+    }
+    if (resp->error_status != SNMP_ERR_NOERROR || resp->nbindings == 0)
+        return;
+    size = 16;
+    if (resp->outer_len > SIZE_OVERHEAD)
+        size = (resp->outer_len - SIZE_OVERHEAD) * 16 / resp->nbindings;
+    if (size == 0)
+        size = 1;
+    if (client->binding_size == 0)
+        client->binding_size = size;
+    else
+        client->binding_size = (7 * client->binding_size + size) / 8;
+    if (client->binding_size == 0)
+        client->binding_size = 1;
+    if (client->resp_limit != 0 && resp->outer_len > client->resp_limit)
+        client->resp_limit = resp->outer_len;
+}
+
+u_int snmp_client_fit(const struct snmp_client *client, u_int n) {
+    size_t limit, fit;
+
+    if (client->binding_size == 0)
+        return (n);
+    limit = client->rxbuflen;
+    if (client->version == SNMP_V3 && client->engine.max_msg_size > 0 &&
+            (size_t)client->engine.max_msg_size < limit)
+        limit = client->engine.max_msg_size;
+    if (client->resp_limit != 0 && client->resp_limit < limit)
+        limit = client->resp_limit;
+    fit = 1;
+    if (limit > SIZE_OVERHEAD)
+        fit = (limit - SIZE_OVERHEAD) * 16 / client->binding_size;
+    if (fit == 0)
+        fit = 1;
+    return (fit < n ? (u_int)fit : n);
+}
+
+/*
+* Ask for no more repetitions than should fit into a response.
+*/
+static void bulk_fit(struct snmp_client *client, snmp_pdu_t *pdu) {
+    u_int nonrep, fit;
+    int32_t reps;
+
+    nonrep = pdu->error_status < 0 ? 0 : (u_int)pdu->error_status;
+    if (nonrep >= pdu->nbindings)
+        return;
+    fit = snmp_client_fit(client, resp_bindings(pdu));
+    reps = 1;
+    if (fit > nonrep)
+        reps = (int32_t)((fit - nonrep) / (pdu->nbindings - nonrep));
+    if (reps < 1)
+        reps = 1;
+    if (reps < pdu->error_index)
+        pdu->error_index = reps;
+}
+
+/*
+* Retransmission timers run on the event loop of the client if it is in
+* one, on the timeout hooks of the application if it set them and on a
+* timer wheel of the client that snmp_receive runs otherwise.
+*/
+static void *timer_start(struct snmp_client *client, u_int retry,
+                         snmp_timeout_cb_f func, void *arg) {
+    struct timeval tv;
+    uint64_t rto;
+
+    rto = client_rto(client, retry);
+    tv.tv_sec = (long)(rto / 1000000);
+    tv.tv_usec = (long)(rto % 1000000);
+    if (client->loop != NULL)
+        return (snmp_loop_timer_start(client->loop, &tv, func, client,
+                                      arg));
+    if (client->timeout_start != NULL)
+        return (client->timeout_start(&tv, func, arg));
+    if (client->wheel == NULL) {
+        if ((client->wheel = malloc(sizeof(*client->wheel))) == NULL) {
+            seterr(client, "no memory for timers");
+            return (NULL);
+        }
+        snmp_timer_init(client->wheel);
+    }
+    return (snmp_timer_start(client->wheel, &tv, func, client, arg));
+}
+
+static void timer_stop(struct snmp_client *client, void *id) {
+    if (id == NULL)
+        return;
+    if (client->loop != NULL)
+        snmp_loop_timer_stop(client->loop, id);
+    else if (client->timeout_stop != NULL)
+        client->timeout_stop(id);
+    else if (client->wheel != NULL)
+        snmp_timer_stop(client->wheel, id);
 }
 
 
@@ -1100,6 +1649,7 @@ int snmp_open(struct snmp_client *client, const char *host, const char *port, co
 * - function cannot fail
 * - clears connection
 * - clears list of sent pdus
+* - releases the buffers and records kept for reuse
 *
 * input:
 *  void
@@ -1109,7 +1659,13 @@ int snmp_open(struct snmp_client *client, const char *host, const char *port, co
 void snmp_close(struct snmp_client *client) {
     struct sent_pdu *p1;
 
-    if (client->fd != -1) {
+    if (client->loop != NULL)
+        snmp_loop_remove(client->loop, client);
+    if (client->mux_peer != NULL) {
+        /* the socket stays with the mux */
+        snmp_mux_detach(client);
+        client->fd = -1;
+    } else if (client->fd != -1) {
         (void)closesocket(client->fd);
         client->fd = -1;
         if (client->local_path[0] != '\0')
@@ -1117,33 +1673,95 @@ void snmp_close(struct snmp_client *client) {
     }
     while(!LIST_EMPTY(&client->sent_pdus)) {
         p1 = LIST_FIRST(&client->sent_pdus);
-        if (p1->timeout_id != NULL)
-            client->timeout_stop(p1->timeout_id);
+        timer_stop(client, p1->timeout_id);
+        LIST_REMOVE(p1, entries);
+        free(p1);
+    }
+    if (client->wheel != NULL) {
+        /* snmp_receive releases a wheel that is running */
+        if (client->wheel->busy == 0) {
+            snmp_timer_fini(client->wheel);
+            free(client->wheel);
+        }
+        client->wheel = NULL;
+    }
+    free(client->reqtab);
+    client->reqtab = NULL;
+    client->reqtab_size = 0;
+    client->reqtab_used = 0;
+    while(!LIST_EMPTY(&client->free_pdus)) {
+        p1 = LIST_FIRST(&client->free_pdus);
         LIST_REMOVE(p1, entries);
         free(p1);
     }
+    if (client->free_resp != NULL) {
+        snmp_pdu_free(client->free_resp);
+        free(client->free_resp);
+        client->free_resp = NULL;
+    }
+    free(client->txbuf);
+    client->txbuf = NULL;
+    client->txbuf_size = 0;
+#ifdef HAVE_SENDMMSG
+    /* queued requests are dropped */
+    if (client->batch_io != NULL) {
+        batch_free(client->batch_io);
+        client->batch_io = NULL;
+    }
+#endif
+    /* the client may be opened again */
     free(client->chost);
+    client->chost = NULL;
     free(client->cport);
+    client->cport = NULL;
+    snmp_mutex_free(client->lock);
+    client->lock = NULL;
 }
 
 /*
-* initialize a snmp_pdu structure
+* The lock of the client, the one of its mux if it has one.
 */
-void snmp_pdu_create(struct snmp_client *client, snmp_pdu_t *pdu, u_int op) {
-    memset(pdu, 0, sizeof(snmp_pdu_t));
+static struct snmp_mutex **client_lock(struct snmp_client *client) {
+    return (client->mux != NULL ? &client->mux->lock : &client->lock);
+}
 
-    if (op == SNMP_PDU_SET)
-        strlcpy(pdu->community, client->write_community,
-                sizeof(pdu->community));
-    else
-        strlcpy(pdu->community, client->read_community,
-                sizeof(pdu->community));
+int snmp_client_lock_init(struct snmp_client *client) {
+    struct snmp_mutex **lock = client_lock(client);
 
-    pdu->pdu_type = op;
-    pdu->version = client->version;
-    pdu->error_status = 0;
-    pdu->error_index = 0;
-    pdu->nbindings = 0;
+    if (*lock == NULL && (*lock = snmp_mutex_new()) == NULL) {
+        seterr(client, "cannot create lock: %s", strerror(errno));
+        return (-1);
+    }
+    return (0);
+}
+
+void snmp_client_lock(struct snmp_client *client) {
+    struct snmp_mutex *lock = *client_lock(client);
+
+    if (lock != NULL)
+        snmp_mutex_lock(lock);
+}
+
+void snmp_client_unlock(struct snmp_client *client) {
+    struct snmp_mutex *lock = *client_lock(client);
+
+    if (lock != NULL)
+        snmp_mutex_unlock(lock);
+}
+
+/*
+* Fill in the header fields of a pdu that come from the client: community,
+* version and for SNMPv3 the message and security parameters.
+*/
+void snmp_pdu_set_header(struct snmp_client *client, snmp_pdu_t *pdu) {
+    if (pdu->pdu_type == SNMP_PDU_SET)
+        strlcpy(pdu->community, client->write_community,
+                sizeof(pdu->community));
+    else
+        strlcpy(pdu->community, client->read_community,
+                sizeof(pdu->community));
+
+    pdu->version = client->version;
 
     if (client->version != SNMP_V3)
         return;
@@ -1174,8 +1792,44 @@ void snmp_pdu_create(struct snmp_client *client, snmp_pdu_t *pdu, u_int op) {
             sizeof(pdu->context_name));
 }
 
+void snmp_pdu_create(struct snmp_client *client, snmp_pdu_t *pdu, u_int op) {
+    snmp_pdu_init(pdu);
+    snmp_pdu_reset(client, pdu, op);
+}
+
+/*
+* Like snmp_pdu_create, but the bindings array, arena and receive buffer
+* of the PDU are kept. The bindings are not freed, the old values are not
+* ours.
+*/
+void snmp_pdu_reset(struct snmp_client *client, snmp_pdu_t *pdu, u_int op) {
+    snmp_value_t *bindings = pdu->bindings;
+    u_int maxbindings = pdu->maxbindings;
+    snmp_arena_t *arena = pdu->arena;
+    u_char *rxbuf = pdu->rxbuf;
+    size_t rxbuf_size = pdu->rxbuf_size;
+    u_int i;
+
+    for (i = 0; i < pdu->nbindings; i++) {
+        bindings[i].oid.len = 0;
+        bindings[i].syntax = SNMP_SYNTAX_NULL;
+    }
+    memset(pdu, 0, sizeof(snmp_pdu_t));
+    pdu->bindings = bindings;
+    pdu->maxbindings = maxbindings;
+    pdu->arena = arena;
+    pdu->rxbuf = rxbuf;
+    pdu->rxbuf_size = rxbuf_size;
+
+    pdu->pdu_type = op;
+    pdu->error_status = 0;
+    pdu->error_index = 0;
+    pdu->nbindings = 0;
+
+    snmp_pdu_set_header(client, pdu);
+}
+
 /* add pairs of (asn_oid_t, enum snmp_syntax) to an existing pdu */
-/* added 10/04/02 by kek: check for MAX_BINDINGS */
 int snmp_add_binding(struct snmp_v1_pdu *pdu, ...) {
     va_list ap;
     const asn_oid_t *oid;
@@ -1185,7 +1839,7 @@ int snmp_add_binding(struct snmp_v1_pdu *pdu, ...) {
 
     ret = pdu->nbindings;
     while ((oid = va_arg(ap, const asn_oid_t *)) != NULL) {
-        if (pdu->nbindings >= SNMP_MAX_BINDINGS) {
+        if (snmp_pdu_reserve(pdu, pdu->nbindings + 1) != 0) {
             va_end(ap);
             return (-1);
         }
@@ -1202,6 +1856,12 @@ int snmp_add_binding(struct snmp_v1_pdu *pdu, ...) {
 static int32_t snmp_next_reqid(struct snmp_client * c) {
     int32_t i;
 
+    if (c->mux_peer != NULL) {
+        /* unique among the clients of the mux */
+        i = c->mux->next_reqid;
+        c->mux->next_reqid = i == INT32_MAX ? 0 : i + 1;
+        return (i);
+    }
     i = c->next_reqid;
     if (c->next_reqid >= c->max_reqid)
         c->next_reqid = c->min_reqid;
@@ -1224,49 +1884,253 @@ static __inline void dump_hex(const char* s, const u_char* octets, u_int len) {
     snmp_printf("\n");
 }
 
+/*
+* Return the encoding buffer of the client. It is allocated on first use
+* and when txbuflen has grown and is only needed until the message is sent.
+* With batching it is the buffer of the next message queued, on a shared
+* socket the one of the mux.
+*/
+static u_char *client_txbuf(struct snmp_client *client) {
+    u_char *buf;
+#ifdef HAVE_SENDMMSG
+    struct snmp_batch *b;
+
+    if ((b = client_batch(client)) != NULL)
+        return (b->txbufs[b->ntx]);
+#endif
+    if (client->mux_peer != NULL) {
+        if ((buf = snmp_mux_txbuf(client->mux, client->txbuflen)) == NULL)
+            seterr(client, "%s", strerror(errno));
+        return (buf);
+    }
+    if (client->txbuf_size < client->txbuflen) {
+        free(client->txbuf);
+        client->txbuf_size = 0;
+        if ((client->txbuf = (u_char*)malloc(client->txbuflen)) == NULL) {
+            seterr(client, "%s", strerror(errno));
+            return (NULL);
+        }
+        client->txbuf_size = client->txbuflen;
+    }
+    return (client->txbuf);
+}
+
+/*
+* Send the message encoded into pdu->outer_ptr. With batching it is only
+* queued here.
+*/
+static int32_t snmp_send_encoded(struct snmp_client *client, snmp_pdu_t *pdu) {
+    ssize_t ret;
+#ifdef HAVE_SENDMMSG
+    struct snmp_batch *b;
+#endif
+
+    if (client->dump_pdus) {
+		dump_hex("SEND PDU:", pdu->outer_ptr, pdu->outer_len);
+        snmp_pdu_dump(pdu);
+	}
+
+#ifdef HAVE_SENDMMSG
+    if ((b = client_batch(client)) != NULL) {
+        b->txiov[b->ntx].iov_base = pdu->outer_ptr;
+        b->txiov[b->ntx].iov_len = pdu->outer_len;
+        if (b->ntx++ == 0 && client->loop != NULL)
+            LIST_INSERT_HEAD(&client->loop->flush, client, flush_entries);
+        if (b->ntx == b->size && snmp_flush(client) == -1)
+            return (-1);
+        return (pdu->request_id);
+    }
+#endif
+
+    for (;;) {
+        if (client->mux_peer != NULL)
+            ret = sendto(client->fd, (const char*)pdu->outer_ptr,
+                         pdu->outer_len, 0,
+                         (struct sockaddr *)&client->mux_peer->addr,
+                         client->mux_peer->addrlen);
+        else
+            ret = send(client->fd, (const char*)pdu->outer_ptr,
+                       pdu->outer_len, 0);
+        if (ret != -1)
+            break;
+        if (SOCKET_AGAIN()) {
+            /* the socket buffer is full */
+            if (client_wait(client, 1, NULL) == -1)
+                return (-1);
+            continue;
+        }
+#ifdef _WIN32
+        seterr(client, "%s", gai_strerror(WSAGetLastError()));
+#else
+        seterr(client, "%s", strerror(errno));
+#endif
+        return (-1);
+    }
+
+    return pdu->request_id;
+}
+
 /*
 * Send request and return request id.
 */
 static int32_t snmp_send_packet(struct snmp_client *client, snmp_pdu_t * pdu) {
     u_char *buf;
     asn_buf_t b;
-    ssize_t ret;
 
-    if ((buf = (u_char*)malloc(client->txbuflen)) == NULL) {
+    if ((buf = client_txbuf(client)) == NULL)
+        return (-1);
+
+    pdu->request_id = snmp_next_reqid(client);
+
+    b.asn_ptr = buf;
+    b.asn_len = client->txbuflen;
+    if (snmp_pdu_encode_rev(pdu, &b)) {
         seterr(client, "%s", strerror(errno));
         return (-1);
     }
 
+    return (snmp_send_encoded(client, pdu));
+}
+
+/*
+* Send a compiled request. Only the header fields are filled in and
+* encoded, the variable bindings are copied from the template.
+*/
+static int32_t snmp_send_tmpl_packet(struct snmp_client *client,
+                                     struct snmp_pdu_tmpl *tmpl) {
+    snmp_pdu_t *pdu = tmpl->pdu;
+    u_char *buf, *end;
+    asn_buf_t b;
+
+    if ((buf = client_txbuf(client)) == NULL)
+        return (-1);
+
+    snmp_pdu_set_header(client, pdu);
     pdu->request_id = snmp_next_reqid(client);
 
     b.asn_ptr = buf;
     b.asn_len = client->txbuflen;
-    if (snmp_pdu_encode(pdu, &b)) {
-        seterr(client, "%s", strerror(errno));
-        free(buf);
+    if (snmp_pdu_encode_rev_start(pdu, &b, &end) != SNMP_CODE_OK ||
+            b.asn_len < tmpl->vars_len) {
+        seterr(client, "cannot encode PDU");
         return (-1);
     }
+    b.asn_ptr -= tmpl->vars_len;
+    b.asn_len -= tmpl->vars_len;
+    memcpy(b.asn_ptr, tmpl->vars, tmpl->vars_len);
 
-    if (client->dump_pdus) {
-		dump_hex("SEND PDU:", buf, b.asn_ptr - buf);
-        snmp_pdu_dump(pdu);
-	}
+    if (snmp_pdu_encode_rev_finish(pdu, &b, end) != SNMP_CODE_OK) {
+        seterr(client, "cannot encode PDU");
+        return (-1);
+    }
 
-		dump_hex("send   :", (const u_char*)buf, (u_int)(b.asn_ptr - buf));
-	}
+    return (snmp_send_encoded(client, pdu));
+}
 
-    if ((ret = send(client->fd, (const char*)buf, b.asn_ptr - buf, 0)) == -1) {
-#ifdef _WIN32
-        seterr(client, "%s", gai_strerror(WSAGetLastError()));
-#else
+/*
+* Records of sent PDUs are put on the free list of the client when the
+* request is done and taken from there for the next one.
+*/
+static struct sent_pdu *sent_pdu_get(struct snmp_client *client) {
+    struct sent_pdu *p;
+
+    if ((p = LIST_FIRST(&client->free_pdus)) != NULL) {
+        LIST_REMOVE(p, entries);
+        return (p);
+    }
+    if ((p = (struct sent_pdu*)malloc(sizeof(*p))) == NULL)
         seterr(client, "%s", strerror(errno));
-#endif
-        free(buf);
+    return (p);
+}
+
+static void sent_pdu_put(struct snmp_client *client, struct sent_pdu *p) {
+    LIST_INSERT_HEAD(&client->free_pdus, p, entries);
+}
+
+/*
+* Outstanding requests are found by request id in a hash table with
+* linear probing that is kept at most half full. Request ids are handed
+* out consecutively, so their low bits make a good hash.
+*/
+#define REQTAB_MIN	16
+
+#define REQTAB_HASH(c, id)	((uint32_t)(id) & ((c)->reqtab_size - 1))
+
+static void reqtab_insert(struct snmp_client *client, struct sent_pdu *p) {
+    u_int mask = client->reqtab_size - 1;
+    u_int i = REQTAB_HASH(client, p->reqid);
+
+    while (client->reqtab[i] != NULL)
+        i = (i + 1) & mask;
+    client->reqtab[i] = p;
+    client->reqtab_used++;
+}
+
+/*
+* Make room for one more request, so that the insert cannot fail.
+*/
+static int reqtab_reserve(struct snmp_client *client) {
+    struct sent_pdu **old = client->reqtab;
+    u_int i, oldsize = client->reqtab_size;
+    u_int size;
+
+    if (2 * (client->reqtab_used + 1) <= oldsize)
+        return (0);
+    size = oldsize == 0 ? REQTAB_MIN : 2 * oldsize;
+    if ((client->reqtab = (struct sent_pdu**)calloc(size,
+                          sizeof(*old))) == NULL) {
+        seterr(client, "%s", strerror(errno));
+        client->reqtab = old;
         return (-1);
     }
-    free(buf);
+    client->reqtab_size = size;
+    client->reqtab_used = 0;
+    for (i = 0; i < oldsize; i++)
+        if (old[i] != NULL)
+            reqtab_insert(client, old[i]);
+    free(old);
+    return (0);
+}
 
-    return pdu->request_id;
+static struct sent_pdu *reqtab_find(struct snmp_client *client,
+                                    int32_t reqid) {
+    u_int mask = client->reqtab_size - 1;
+    u_int i;
+
+    if (client->reqtab_size == 0)
+        return (NULL);
+    for (i = REQTAB_HASH(client, reqid); client->reqtab[i] != NULL;
+            i = (i + 1) & mask)
+        if (client->reqtab[i]->reqid == reqid)
+            return (client->reqtab[i]);
+    return (NULL);
+}
+
+/*
+* Remove a request under the id it was inserted with. The entries behind
+* it are moved up so that no probe sequence is broken.
+*/
+static void reqtab_remove(struct snmp_client *client, struct sent_pdu *p) {
+    u_int mask = client->reqtab_size - 1;
+    u_int i, j, k;
+
+    if (client->reqtab_size == 0)
+        return;
+    for (i = REQTAB_HASH(client, p->reqid); client->reqtab[i] != p;
+            i = (i + 1) & mask)
+        if (client->reqtab[i] == NULL)
+            return;
+
+    for (j = (i + 1) & mask; client->reqtab[j] != NULL; j = (j + 1) & mask) {
+        k = REQTAB_HASH(client, client->reqtab[j]->reqid);
+        /* move the entry if its home slot is not between i and j */
+        if ((j > i && (k <= i || k > j)) || (j < i && k <= i && k > j)) {
+            client->reqtab[i] = client->reqtab[j];
+            i = j;
+        }
+    }
+    client->reqtab[i] = NULL;
+    client->reqtab_used--;
 }
 
 /*
@@ -1274,6 +2138,7 @@ static int32_t snmp_send_packet(struct snmp_client *client, snmp_pdu_t * pdu) {
 */
 static void snmp_timeout(struct snmp_client *client, void * listentry_ptr) {
     struct sent_pdu *listentry = (struct sent_pdu *)listentry_ptr;
+    uint64_t now;
 
 #if 0
     warnx("snmp request %i timed out, attempt (%i/%i)",
@@ -1281,62 +2146,205 @@ static void snmp_timeout(struct snmp_client *client, void * listentry_ptr) {
 #endif
 
     listentry->retrycount++;
+    reqtab_remove(client, listentry);
     if (listentry->retrycount > client->retries) {
         /* there is no answer at all */
         LIST_REMOVE(listentry, entries);
         listentry->callback(client, listentry->pdu, NULL, listentry->arg);
-        free(listentry);
+        sent_pdu_put(client, listentry);
     } else {
         /* try again */
         /* new request with new request ID */
-        listentry->reqid = snmp_send_packet(client, listentry->pdu);
-        listentry->timeout_id =
-            client->timeout_start(&client->timeout,
-                                  snmp_timeout, listentry);
+        if (listentry->tmpl != NULL)
+            listentry->reqid = snmp_send_tmpl_packet(client,
+                               listentry->tmpl);
+        else
+            listentry->reqid = snmp_send_packet(client, listentry->pdu);
+        if (listentry->reqid != -1)
+            reqtab_insert(client, listentry);
+        now = snmp_clock();
+        listentry->time.tv_sec = (long)(now / 1000000);
+        listentry->time.tv_usec = (long)(now % 1000000);
+        listentry->timeout_id = timer_start(client,
+                                            listentry->retrycount - 1,
+                                            snmp_timeout, listentry);
     }
 }
 
-int32_t snmp_pdu_send(struct snmp_client *client, snmp_pdu_t *pdu, snmp_send_cb_f func, void *arg) {
+static int32_t snmp_send_request(struct snmp_client *client, snmp_pdu_t *pdu,
+                                 struct snmp_pdu_tmpl *tmpl, snmp_send_cb_f func, void *arg) {
     struct sent_pdu *listentry;
+    uint64_t now;
     int32_t id;
 
-    if ((listentry = malloc(sizeof(struct sent_pdu))) == NULL) {
-        seterr(client, "%s", strerror(errno));
+    if (reqtab_reserve(client) == -1 ||
+            (listentry = sent_pdu_get(client)) == NULL)
         return (-1);
-    }
+    if (pdu->pdu_type == SNMP_PDU_GETBULK)
+        bulk_fit(client, pdu);
 
     /* here we really send */
-    if ((id = snmp_send_packet(client, pdu)) == -1) {
-        free(listentry);
+    if (tmpl != NULL)
+        id = snmp_send_tmpl_packet(client, tmpl);
+    else
+        id = snmp_send_packet(client, pdu);
+    if (id == -1) {
+        sent_pdu_put(client, listentry);
         return (-1);
     }
 
     /* add entry to list of sent PDUs */
     listentry->pdu = pdu;
-    if (gettimeofday(&listentry->time, NULL) == -1) {
-        snmp_printf("gettimeofday() failed");
-    }
+    listentry->tmpl = tmpl;
+    now = snmp_clock();
+    listentry->time.tv_sec = (long)(now / 1000000);
+    listentry->time.tv_usec = (long)(now % 1000000);
 
     listentry->reqid = pdu->request_id;
     listentry->callback = func;
     listentry->arg = arg;
     listentry->retrycount=1;
-    listentry->timeout_id =
-        client->timeout_start(&client->timeout, snmp_timeout,
-                              listentry);
+    listentry->timeout_id = timer_start(client, 0, snmp_timeout, listentry);
 
     LIST_INSERT_HEAD(&client->sent_pdus, listentry, entries);
+    reqtab_insert(client, listentry);
 
     return (id);
 }
 
+int32_t snmp_pdu_send(struct snmp_client *client, snmp_pdu_t *pdu, snmp_send_cb_f func, void *arg) {
+    return (snmp_send_request(client, pdu, NULL, func, arg));
+}
+
+/*
+* Encode the variable bindings of pdu once. The pdu must stay valid as long
+* as the template is used, its header fields are overwritten on each send.
+*/
+int snmp_pdu_compile(struct snmp_client *client, snmp_pdu_t *pdu,
+                     struct snmp_pdu_tmpl *tmpl) {
+    u_char *buf;
+    asn_buf_t b;
+
+    if ((buf = client_txbuf(client)) == NULL)
+        return (-1);
+
+    b.asn_ptr = buf + client->txbuflen;
+    b.asn_len = client->txbuflen;
+    if (snmp_pdu_encode_vars_rev(&b, pdu) != SNMP_CODE_OK) {
+        seterr(client, "cannot encode bindings");
+        return (-1);
+    }
+
+    tmpl->vars_len = client->txbuflen - b.asn_len;
+    if ((tmpl->vars = (u_char*)malloc(tmpl->vars_len)) == NULL) {
+        seterr(client, "%s", strerror(errno));
+        return (-1);
+    }
+    memcpy(tmpl->vars, b.asn_ptr, tmpl->vars_len);
+    tmpl->pdu = pdu;
+
+    return (0);
+}
+
+void snmp_pdu_tmpl_free(struct snmp_pdu_tmpl *tmpl) {
+    free(tmpl->vars);
+    tmpl->vars = NULL;
+    tmpl->vars_len = 0;
+}
+
+int32_t snmp_pdu_send_tmpl(struct snmp_client *client, struct snmp_pdu_tmpl *tmpl,
+                           snmp_send_cb_f func, void *arg) {
+    return (snmp_send_request(client, tmpl->pdu, tmpl, func, arg));
+}
+
+/*
+* Receive a datagram, on a shared socket from any address.
+*/
+static int client_recv(struct snmp_client *client, u_char *buf,
+                       struct sockaddr_storage *from) {
+    socklen_t fromlen = sizeof(*from);
+
+    if (client->mux_peer != NULL)
+        return (recvfrom(client->fd, (char*)buf, client->rxbuflen, 0,
+                         (struct sockaddr *)from, &fromlen));
+    return (recv(client->fd, (char*)buf, client->rxbuflen, 0));
+}
+
+/*
+* Decode a packet received into the buffer of pdu with the security
+* parameters of sec. Errors are left in client.
+*/
+static int client_decode(struct snmp_client *client,
+                         struct snmp_client *sec, snmp_pdu_t *pdu, int len) {
+    asn_buf_t abuf;
+    int32_t ip;
+    int ret;
+
+    if (client->dump_pdus) {
+		dump_hex("recv   :", (const u_char*)pdu->rxbuf, (u_int)(len));
+	}
+
+    abuf.asn_ptr = pdu->rxbuf;
+    abuf.asn_len = len;
+	
+    if (client->dump_pdus) {
+		dump_hex("RECV PDU:", pdu->rxbuf, len);
+	}
+
+    if (sec->security_model == SNMP_SECMODEL_USM) {
+        memcpy(&pdu->engine, &sec->engine, sizeof(pdu->engine));
+        memcpy(&pdu->user, &sec->user, sizeof(pdu->user));
+        snmp_pdu_init_secparams(pdu);
+    }
+
+    if (SNMP_CODE_OK != (ret = snmp_pdu_decode(&abuf, pdu, &ip))) {
+        seterr(client, "snmp_decode_pdu: failed %d", ret);
+
+		if (client->dump_pdus) {
+			snmp_printf("snmp_decode_pdu: failed %d\n", ret);
+		}
+        return (-1);
+    }
+	
+    if (client->dump_pdus) {
+        snmp_pdu_dump(pdu);
+	}
+
+    sec->engine.engine_time = pdu->engine.engine_time;
+    sec->engine.engine_boots = pdu->engine.engine_boots;
+
+    return (+1);
+}
+
+/*
+* The client a response on a shared socket is for: the one that has the
+* request outstanding, else self if it talks to the address, else the
+* first that does. Request ids are unique on a mux.
+*/
+static struct snmp_client *mux_owner(struct snmp_mux *mux,
+                                     struct snmp_client *first,
+                                     struct snmp_client *self,
+                                     const struct sockaddr *from,
+                                     int32_t reqid) {
+    struct snmp_client *c, *owner = first;
+
+    for (c = first; c != NULL; c = snmp_mux_lookup(mux, from, c)) {
+        if (reqtab_find(c, reqid) != NULL)
+            return (c);
+        if (c == self)
+            owner = self;
+    }
+    return (owner);
+}
+
 /*
 * Receive an SNMP packet.
 *
 * tv controls how we wait for a packet: if tv is a NULL pointer,
 * the receive blocks forever, if tv points to a structure with all
 * members 0 the socket is polled, in all other cases tv specifies the
-* maximum time to wait for a packet.
+* maximum time to wait for a packet. *ownerp is set to the client the
+* packet is for, which is another one only on a shared socket.
 *
 * Return:
 *	-1 on errors
@@ -1344,138 +2352,97 @@ int32_t snmp_pdu_send(struct snmp_client *client, snmp_pdu_t *pdu, snmp_send_cb_
 *	+1 if packet received
 */
 static int snmp_receive_packet(struct snmp_client* client,
-                               snmp_pdu_t *pdu, struct timeval *tv) {
-    int dopoll, setpoll;
-    int flags;
-    int saved_errno;
-    u_char *buf;
+                               snmp_pdu_t *pdu, struct timeval *tv,
+                               struct snmp_client **ownerp) {
+    int dowait;
     int ret;
-    asn_buf_t abuf;
-    int32_t ip;
-#ifdef bsdi
-    int optlen;
-#else
-    socklen_t optlen;
+    uint64_t deadline;
+    struct sockaddr_storage from;
+    struct snmp_client *first;
+#ifdef HAVE_SENDMMSG
+    struct snmp_batch *b;
 #endif
 
-    if ((buf = (u_char*)malloc(client->rxbuflen)) == NULL) {
-        seterr(client, "%s", strerror(errno));
-        return (-1);
-    }
-    dopoll = setpoll = 0;
-    flags = 0;
-    if (tv != NULL) {
-        /* poll or timeout */
-        if (tv->tv_sec != 0 || tv->tv_usec != 0) {
-            /* wait with timeout */
-            if (setsockopt(client->fd, SOL_SOCKET, SO_RCVTIMEO,
-                           (char*)tv, sizeof(*tv)) == -1) {
-                seterr(client, "setsockopt: %s",
-                       strerror(errno));
-                free(buf);
-                return (-1);
-            }
-            optlen = sizeof(*tv);
-            if (getsockopt(client->fd, SOL_SOCKET, SO_RCVTIMEO,
-                           (char*)tv, &optlen) == -1) {
-                seterr(client, "getsockopt: %s",
-                       strerror(errno));
-                free(buf);
-                return (-1);
-            }
-            /* at this point tv_sec and tv_usec may appear
-            * as 0. This happens for timeouts lesser than
-            * the clock granularity. The kernel rounds these to
-            * 0 and this would result in a blocking receive.
-            * Instead of an else we check tv_sec and tv_usec
-            * again below and if this rounding happens,
-            * switch to a polling receive. */
-        }
-        if (tv->tv_sec == 0 && tv->tv_usec == 0) {
-            /* poll */
-            dopoll = 1;
-            if (-1 == socket_set_blocking(client->fd, 0)) {
-                seterr(client, "set blocking: %s",
-                       strerror(errno));
-                free(buf);
-                return (-1);
-            }
+    *ownerp = client;
+
+    /*
+    * Receive into the buffer of the PDU. The decoded octet strings point
+    * into it, so the PDU must be cleared first.
+    */
+    snmp_pdu_clear(pdu);
+    if (pdu->rxbuf_size < client->rxbuflen) {
+        free(pdu->rxbuf);
+        pdu->rxbuf_size = 0;
+        if ((pdu->rxbuf = (u_char*)malloc(client->rxbuflen)) == NULL) {
+            seterr(client, "%s", strerror(errno));
+            return (-1);
         }
+        pdu->rxbuf_size = client->rxbuflen;
     }
-    ret = recv(client->fd, (char*)buf, client->rxbuflen, 0);
-    saved_errno = errno;
+#ifdef HAVE_SENDMMSG
+    /* received with others before */
+    if ((ret = batch_take(client, pdu)) != -1)
+        return (client_decode(client, client, pdu, ret));
+#endif
+
+    /*
+    * The socket does not block. Unless polling, wait until it is
+    * readable and receive then; wake-ups without a packet wait again
+    * for the rest of the time.
+    */
+    dowait = 1;
+    deadline = 0;
     if (tv != NULL) {
-        if (dopoll) {
-            socket_set_blocking(client->fd, 1);
-        } else {
-            tv->tv_sec = 0;
-            tv->tv_usec = 0;
-            (void)setsockopt(client->fd, SOL_SOCKET, SO_RCVTIMEO,
-                             (char*)tv, sizeof(*tv));
-        }
+        if (tv->tv_sec == 0 && tv->tv_usec == 0)
+            dowait = 0;
+        else
+            deadline = snmp_clock() + (uint64_t)tv->tv_sec * 1000000 +
+                       tv->tv_usec;
     }
-    if (ret == -1) {
-        free(buf);
+    for (;;) {
+        if (dowait && (ret = client_wait(client, 0,
+                                         tv != NULL ? &deadline : NULL)) <= 0)
+            return (ret);
+#ifdef HAVE_SENDMMSG
+        if ((b = client_batch(client)) != NULL)
+            ret = batch_fill(client, b, pdu);
+        else
+#endif
+            ret = client_recv(client, pdu->rxbuf, &from);
+        if (ret != -1)
+            break;
+        if (!SOCKET_AGAIN()) {
 #ifdef _WIN32
-        {
-            int err = WSAGetLastError();
-            if (err == WSATRY_AGAIN || err == WSAEWOULDBLOCK)
-                return (0);
-            seterr(client, "recv: %s", gai_strerror(err));
-        }
+            seterr(client, "recv: %s", gai_strerror(WSAGetLastError()));
 #else
-        if (errno == EAGAIN || errno == EWOULDBLOCK)
-            return (0);
-        seterr(client, "recv: %s", strerror(saved_errno));
+            seterr(client, "recv: %s", strerror(errno));
 #endif
-        return (-1);
+            return (-1);
+        }
+        if (!dowait)
+            return (0);
     }
     if (ret == 0) {
         /* this happens when we have a streaming socket and the
         * remote side has closed it */
-        free(buf);
         seterr(client, "recv: socket closed by peer");
         errno = EPIPE;
         return (-1);
     }
 
-	
-    if (client->dump_pdus) {
-		dump_hex("recv   :", (const u_char*)buf, (u_int)(ret));
-	}
-
-    abuf.asn_ptr = buf;
-    abuf.asn_len = ret;
-	
-    if (client->dump_pdus) {
-		dump_hex("RECV PDU:", buf, ret);
-	}
-
-    memset(pdu, 0, sizeof(*pdu));
-    if (client->security_model == SNMP_SECMODEL_USM) {
-        memcpy(&pdu->engine, &client->engine, sizeof(pdu->engine));
-        memcpy(&pdu->user, &client->user, sizeof(pdu->user));
-        snmp_pdu_init_secparams(pdu);
-    }
-
-    if (SNMP_CODE_OK != (ret = snmp_pdu_decode(&abuf, pdu, &ip))) {
-        seterr(client, "snmp_decode_pdu: failed %d", ret);
-        free(buf);
+    if (client->mux_peer == NULL)
+        return (client_decode(client, client, pdu, ret));
 
-		if (client->dump_pdus) {
-			printf("snmp_decode_pdu: failed %d", ret);
-		}
+    /* decoded for the clients talking to the sender */
+    if ((first = snmp_mux_lookup(client->mux, (struct sockaddr *)&from,
+                                 NULL)) == NULL) {
+        seterr(client, "recv: packet from unknown address");
         return (-1);
     }
-	
-    free(buf);
-    if (client->dump_pdus) {
-        snmp_pdu_dump(pdu);
-	}
-
-    client->engine.engine_time = pdu->engine.engine_time;
-    client->engine.engine_boots = pdu->engine.engine_boots;
-
+    if (client_decode(client, first, pdu, ret) == -1)
+        return (-1);
+    *ownerp = mux_owner(client->mux, first, client,
+                        (struct sockaddr *)&from, pdu->request_id);
     return (+1);
 }
 
@@ -1487,100 +2454,581 @@ static int snmp_deliver_packet(struct snmp_client* client, snmp_pdu_t * resp) {
         return (-1);
     }
 
-    LIST_FOREACH(listentry, &client->sent_pdus, entries)
-    if (listentry->reqid == resp->request_id)
-        break;
-    if (listentry == NULL)
+    /* late and duplicate responses are not found */
+    if ((listentry = reqtab_find(client, resp->request_id)) == NULL)
         return (-1);
 
+    rtt_sample(client, snmp_clock() -
+               ((uint64_t)listentry->time.tv_sec * 1000000 +
+                listentry->time.tv_usec));
+    size_learn(client, resp_bindings(listentry->pdu), resp);
+
+    reqtab_remove(client, listentry);
     LIST_REMOVE(listentry, entries);
+    /* the callback may receive again, which runs the due timers */
+    timer_stop(client, listentry->timeout_id);
+    listentry->timeout_id = NULL;
     listentry->callback(client, listentry->pdu, resp, listentry->arg);
 
-    client->timeout_stop(listentry->timeout_id);
-
-    free(listentry);
+    sent_pdu_put(client, listentry);
     return (0);
 }
 
-int snmp_receive(struct snmp_client* client, int blocking) {
-    int ret;
+/*
+* Decode and deliver a packet received on the socket of a mux.
+*/
+int snmp_mux_dispatch(struct snmp_mux *mux, snmp_pdu_t *pdu, int len,
+                      const struct sockaddr *from) {
+    struct snmp_client *first;
 
-    struct timeval tv;
-    snmp_pdu_t * resp;
+    if ((first = snmp_mux_lookup(mux, from, NULL)) == NULL ||
+            client_decode(first, first, pdu, len) == -1)
+        return (-1);
+    return (snmp_deliver_packet(mux_owner(mux, first, NULL, from,
+                                          pdu->request_id), pdu));
+}
 
-    memset(&tv, 0, sizeof(tv));
+/*
+* Receive a packet and deliver it. *dret is the result of the delivery.
+*
+* The response PDU is kept on the client together with its bindings and
+* receive buffer. A callback that receives again gets a PDU of its own.
+*/
+static int receive_deliver(struct snmp_client* client, struct timeval *tv,
+                           int *dret) {
+    int ret;
+    snmp_pdu_t * resp;
+    struct snmp_client *owner;
 
-    resp = malloc(sizeof(snmp_pdu_t));
-    if (resp == NULL) {
-        seterr(client, "no memory for returning PDU");
-        return (-1) ;
+    if ((resp = client->free_resp) != NULL) {
+        client->free_resp = NULL;
+    } else {
+        resp = malloc(sizeof(snmp_pdu_t));
+        if (resp == NULL) {
+            seterr(client, "no memory for returning PDU");
+            return (-1) ;
+        }
+        snmp_pdu_init(resp);
     }
 
-    if ((ret = snmp_receive_packet(client, resp, blocking ? NULL : &tv)) <= 0) {
+    if ((ret = snmp_receive_packet(client, resp, tv, &owner)) > 0)
+        *dret = snmp_deliver_packet(owner, resp);
+
+    if (client->free_resp == NULL) {
+        snmp_pdu_clear(resp);
+        client->free_resp = resp;
+    } else {
+        snmp_pdu_free(resp);
         free(resp);
-        return (ret);
     }
-    ret = snmp_deliver_packet(client, resp);
-    snmp_pdu_free(resp);
-    free(resp);
     return (ret);
 }
 
-int snmp_dialog(struct snmp_client *client, struct snmp_v1_pdu *req, struct snmp_v1_pdu *resp) {
+/*
+* With the timer wheel of the client a blocking receive waits only until
+* the next timer is due, and expired timers are run before returning.
+*/
+int snmp_receive(struct snmp_client* client, int blocking) {
+    int ret, dret;
+    struct timeval tv, *tvp;
+    struct snmp_timer_wheel *wheel;
+
+    if (snmp_flush(client) == -1)
+        return (-1);
+
+    memset(&tv, 0, sizeof(tv));
+    tvp = &tv;
+    if (blocking && (client->wheel == NULL ||
+                     snmp_timer_next(client->wheel, &tv) == -1))
+        tvp = NULL;
+
+    if ((ret = receive_deliver(client, tvp, &dret)) > 0)
+        ret = dret;
+
+    if ((wheel = client->wheel) != NULL) {
+        (void)snmp_timer_expire(wheel);
+        /* closed by a callback, see snmp_close */
+        if (client->wheel != wheel && wheel->busy == 0) {
+            snmp_timer_fini(wheel);
+            free(wheel);
+        }
+    }
+    return (ret);
+}
+
+/*
+* Receive one packet for the event loop. 0 means that there is nothing
+* more to receive.
+*/
+int snmp_client_input(struct snmp_client *client) {
+    struct timeval tv;
+    int dret;
+
+    tv.tv_sec = 0;
+    tv.tv_usec = 0;
+    return (receive_deliver(client, &tv, &dret));
+}
+
+/*
+* Send a request and wait for the response. resp is initialized; its
+* bindings and receive buffer are used again.
+*/
+static int client_dialog(struct snmp_client *client, snmp_pdu_t *req,
+                         snmp_pdu_t *resp) {
     u_int i;
     int32_t reqid;
-    int ret;
-    struct timeval tv = client->timeout;
-    struct timeval end;
+    int ret, saved_errno;
+    struct timeval tv;
+    uint64_t sent, now, end;
     snmp_pdu_t pdu;
+    struct snmp_client *owner;
 
     /*
     * Make a copy of the request and replace the syntaxes by NULL
-    * if this is a GET,GETNEXT or GETBULK.
+    * if this is a GET,GETNEXT or GETBULK. The copy shares the bindings
+    * with the request, so they get an array of their own only if there
+    * is a value to hide.
     */
     pdu = *req;
     if (pdu.pdu_type == SNMP_PDU_GET || pdu.pdu_type == SNMP_PDU_GETNEXT ||
             pdu.pdu_type == SNMP_PDU_GETBULK) {
-        for (i = 0; i < pdu.nbindings; i++)
-            pdu.bindings[i].syntax = SNMP_SYNTAX_NULL;
+        for (i = 0; i < req->nbindings; i++)
+            if (req->bindings[i].syntax != SNMP_SYNTAX_NULL)
+                break;
+        if (i < req->nbindings) {
+            pdu.bindings = NULL;
+            pdu.maxbindings = 0;
+            if (snmp_pdu_reserve(&pdu, req->nbindings) != 0) {
+                seterr(client, "%s", strerror(errno));
+                return (-1);
+            }
+            for (i = 0; i < req->nbindings; i++)
+                pdu.bindings[i].oid = req->bindings[i].oid;
+        }
     }
 
-    for (i = 0; i <= client->retries; i++) {
-        (void)gettimeofday(&end, NULL);
-        timeradd(&end, &client->timeout, &end);
-        if ((reqid = snmp_send_packet(client, &pdu)) == -1)
-            return (-1);
+    if (pdu.pdu_type == SNMP_PDU_GETBULK)
+        bulk_fit(client, &pdu);
+
+    /* the clock is only read again after a packet that is not ours */
+    ret = -1;
+    i = 0;
+    while (i <= client->retries) {
+        sent = now = snmp_clock();
+        end = now + client_rto(client, i++);
+        if ((reqid = snmp_send_packet(client, &pdu)) == -1 ||
+                snmp_flush(client) == -1)
+            goto out;
         for (;;) {
-            (void)gettimeofday(&tv, NULL);
-            if (timercmp(&end, &tv, <=))
+            if (now >= end)
                 break;
-            timersub(&end, &tv, &tv);
-            if ((ret = snmp_receive_packet(client, resp, &tv)) == 0)
+            tv.tv_sec = (long)((end - now) / 1000000);
+            tv.tv_usec = (long)((end - now) % 1000000);
+            if ((ret = snmp_receive_packet(client, resp, &tv, &owner)) == 0)
                 /* timeout */
                 break;
 
             if (ret > 0) {
-                if (reqid == resp->request_id)
-                    return (0);
+                if (owner == client && reqid == resp->request_id) {
+                    rtt_sample(client, snmp_clock() - sent);
+                    size_learn(client, resp_bindings(&pdu), resp);
+                    if (resp->error_status != SNMP_ERR_TOOBIG ||
+                            pdu.pdu_type != SNMP_PDU_GETBULK ||
+                            pdu.error_index <= 1) {
+                        ret = 0;
+                        goto out;
+                    }
+                    /* again with half the repetitions */
+                    pdu.error_index /= 2;
+                    bulk_fit(client, &pdu);
+                    i = 0;
+                    break;
+                }
                 /* not for us */
-                (void)snmp_deliver_packet(client, resp);
+                (void)snmp_deliver_packet(owner, resp);
             }
-            if (ret < 0 && errno == EPIPE)
+            if (ret < 0 && errno == EPIPE) {
                 /* stream closed */
-                return (-1);
+                ret = -1;
+                goto out;
+            }
+            now = snmp_clock();
         }
     }
     errno = ETIMEDOUT;
     seterr(client, "retry count exceeded");
-    return (-1);
+    ret = -1;
+
+out:
+    if (pdu.bindings != req->bindings) {
+        saved_errno = errno;
+        free(pdu.bindings);
+        errno = saved_errno;
+    }
+    return (ret);
 }
 
-int snmp_discover_engine(struct snmp_client *client, char* user, char *passwd, char* privKey) {
+int snmp_dialog(struct snmp_client *client, struct snmp_v1_pdu *req, struct snmp_v1_pdu *resp) {
+    snmp_pdu_init(resp);
+    return (client_dialog(client, req, resp));
+}
+
+int snmp_dialog_reuse(struct snmp_client *client, snmp_pdu_t *req,
+                      snmp_pdu_t *resp) {
+    return (client_dialog(client, req, resp));
+}
+
+/*
+* A request of snmp_dialog_pipelined for the bindings first to
+* first + count - 1 of the request. The slot is free if reqid is -1.
+*/
+struct pipe_slot {
+    u_int		first;
+    u_int		count;
+    int32_t		reqid;
+    u_int		retries;
+    uint64_t	sent;	/* on snmp_clock */
+    uint64_t	end;
+};
+
+/*
+* Send the request of a slot, with a new request id when it is resent.
+*/
+static int pipe_send(struct snmp_client *client, snmp_pdu_t *pdu,
+                     snmp_value_t *bindings, struct pipe_slot *s,
+                     uint64_t now) {
+    pdu->bindings = bindings + s->first;
+    pdu->nbindings = s->count;
+    if ((s->reqid = snmp_send_packet(client, pdu)) == -1)
+        return (-1);
+    s->sent = now;
+    s->end = now + client_rto(client, s->retries);
+    return (0);
+}
+
+/*
+* Copy a value of a response into resp, into its arena if it has one.
+*/
+static int pipe_copy(snmp_pdu_t *resp, snmp_value_t *to,
+                     const snmp_value_t *from) {
+    if (resp->arena == NULL || from->syntax != SNMP_SYNTAX_OCTETSTRING ||
+            from->v.octetstring.len == 0)
+        return (snmp_value_copy(to, from));
+    *to = *from;
+    if ((to->v.octetstring.octets = snmp_arena_alloc(resp->arena,
+                                    from->v.octetstring.len)) == NULL) {
+        to->syntax = SNMP_SYNTAX_NULL;
+        return (-1);
+    }
+    memcpy(to->v.octetstring.octets, from->v.octetstring.octets,
+           from->v.octetstring.len);
+    return (0);
+}
+
+/*
+* Leave the bindings of a slot without value. The first error status in
+* the order of the request goes into resp, -1 is for no response.
+*/
+static void pipe_fail(snmp_pdu_t *resp, const snmp_value_t *bindings,
+                      const struct pipe_slot *s, int32_t err,
+                      int32_t error_index, int32_t *status) {
+    u_int i, idx;
+
+    for (i = s->first; i < s->first + s->count; i++) {
+        resp->bindings[i].oid = bindings[i].oid;
+        if (status != NULL)
+            status[i] = err;
+    }
+    if (err == -1)
+        return;
+    idx = s->first + 1;
+    if (error_index > 0 && (u_int)error_index <= s->count)
+        idx += error_index - 1;
+    if (resp->error_status == SNMP_ERR_NOERROR ||
+            idx < (u_int)resp->error_index) {
+        resp->error_status = err;
+        resp->error_index = idx;
+    }
+}
+
+/*
+* Put the response to a slot into resp. A response with an error or
+* with the wrong number of bindings fails the slot. Returns the number
+* of bindings without value or -1 if there is no memory.
+*/
+static int pipe_take(snmp_pdu_t *resp, const snmp_pdu_t *in,
+                     const snmp_value_t *bindings,
+                     const struct pipe_slot *s, int32_t *status) {
+    u_int i;
+
+    if (in->error_status != SNMP_ERR_NOERROR) {
+        pipe_fail(resp, bindings, s, in->error_status, in->error_index,
+                  status);
+        return (s->count);
+    }
+    if (in->nbindings != s->count) {
+        pipe_fail(resp, bindings, s, SNMP_ERR_GENERR, 0, status);
+        return (s->count);
+    }
+    for (i = 0; i < s->count; i++) {
+        if (pipe_copy(resp, &resp->bindings[s->first + i],
+                      &in->bindings[i]) == -1)
+            return (-1);
+        if (status != NULL)
+            status[s->first + i] = SNMP_ERR_NOERROR;
+    }
+    return (0);
+}
+
+/*
+* Bindings of snmp_dialog_pipelined to be sent again in smaller requests.
+*/
+struct pipe_redo {
+    struct pipe_slot	*ranges;	/* only first and count used */
+    u_int		n;
+    u_int		size;
+};
+
+/*
+* Queue the bindings of a slot again in two halves, the first half on top.
+*/
+static int pipe_split(struct pipe_redo *redo, const struct pipe_slot *s) {
+    struct pipe_slot *r;
+    u_int size;
+
+    if (redo->n + 2 > redo->size) {
+        size = redo->size == 0 ? 16 : 2 * redo->size;
+        if ((r = realloc(redo->ranges, size * sizeof(*r))) == NULL)
+            return (-1);
+        redo->ranges = r;
+        redo->size = size;
+    }
+    r = &redo->ranges[redo->n++];
+    r->first = s->first + s->count / 2;
+    r->count = s->count - s->count / 2;
+    r = &redo->ranges[redo->n++];
+    r->first = s->first;
+    r->count = s->count / 2;
+    return (0);
+}
+
+int snmp_dialog_pipelined(struct snmp_client *client, snmp_pdu_t *req,
+                          snmp_pdu_t *resp, u_int max_bindings,
+                          u_int window, int32_t *status) {
+    u_int i, next, nout, nfail, largest, cap;
+    int n, ret, saved_errno;
+    struct timeval tv;
+    uint64_t now, end;
+    snmp_pdu_t pdu, in;
+    snmp_value_t *bindings;
+    struct pipe_slot *slots, *s;
+    struct pipe_redo redo;
+    struct snmp_client *owner;
+
+    if (req->pdu_type != SNMP_PDU_GET && req->pdu_type != SNMP_PDU_GETNEXT) {
+        seterr(client, "only GET and GETNEXT can be pipelined");
+        errno = EINVAL;
+        return (-1);
+    }
+    if (max_bindings == 0)
+        max_bindings = SNMP_MAX_BINDINGS;
+    if (window > req->nbindings)
+        window = req->nbindings;
+    if (window == 0)
+        window = 1;
+
+    /*
+    * The response gets the header of the request, and the bindings
+    * their OIDs only when they fail.
+    */
+    snmp_pdu_clear(resp);
+    if (snmp_pdu_reserve(resp, req->nbindings) != 0) {
+        seterr(client, "%s", strerror(errno));
+        return (-1);
+    }
+    pdu = *resp;
+    *resp = *req;
+    resp->bindings = pdu.bindings;
+    resp->maxbindings = pdu.maxbindings;
+    resp->arena = pdu.arena;
+    resp->rxbuf = pdu.rxbuf;
+    resp->rxbuf_size = pdu.rxbuf_size;
+    resp->pdu_type = SNMP_PDU_RESPONSE;
+    resp->error_status = SNMP_ERR_NOERROR;
+    resp->error_index = 0;
+    resp->nbindings = req->nbindings;
+    for (i = 0; i < req->nbindings; i++)
+        resp->bindings[i].syntax = SNMP_SYNTAX_NULL;
+
+    /* the requests are sent with NULL values, see client_dialog */
+    bindings = req->bindings;
+    for (i = 0; i < req->nbindings; i++)
+        if (req->bindings[i].syntax != SNMP_SYNTAX_NULL)
+            break;
+    if (i < req->nbindings) {
+        if ((bindings = calloc(req->nbindings, sizeof(*bindings))) == NULL) {
+            seterr(client, "%s", strerror(errno));
+            return (-1);
+        }
+        for (i = 0; i < req->nbindings; i++)
+            bindings[i].oid = req->bindings[i].oid;
+    }
+    if ((slots = malloc(window * sizeof(*slots))) == NULL) {
+        seterr(client, "%s", strerror(errno));
+        if (bindings != req->bindings)
+            free(bindings);
+        return (-1);
+    }
+    for (s = slots; s < slots + window; s++)
+        s->reqid = -1;
+    memset(&redo, 0, sizeof(redo));
+    snmp_pdu_init(&in);
+    pdu = *req;
+
+    /*
+    * largest is the most bindings answered in one response. Requests are
+    * cut down to cap bindings after silent drops.
+    */
+    largest = 0;
+    cap = max_bindings;
+    next = nout = nfail = 0;
+    ret = -1;
+    now = snmp_clock();
+    for (;;) {
+        /*
+        * Resend the requests that timed out or give them up. A request
+        * larger than any answered may have been dropped for its size and
+        * is tried again in halves. When not even a single binding is
+        * answered, the agent is taken to be down.
+        */
+        for (s = slots; s < slots + window; s++) {
+            if (s->reqid == -1 || now < s->end)
+                continue;
+            if (s->retries++ < client->retries) {
+                if (pipe_send(client, &pdu, bindings, s, now) == -1)
+                    goto out;
+                continue;
+            }
+            if (s->count > 1 && s->count > largest) {
+                if (pipe_split(&redo, s) == -1) {
+                    seterr(client, "%s", strerror(errno));
+                    goto out;
+                }
+                size_limit(client, s->count);
+                if (cap > s->count / 2)
+                    cap = s->count / 2 > largest ? s->count / 2 : largest;
+            } else {
+                pipe_fail(resp, bindings, s, -1, 0, status);
+                nfail += s->count;
+                if (largest == 0)
+                    cap = 0;
+            }
+            s->reqid = -1;
+            nout--;
+        }
+
+        /* and keep the window full, with what was split first */
+        for (s = slots; s < slots + window && cap != 0 &&
+                (redo.n > 0 || next < req->nbindings); s++) {
+            if (s->reqid != -1)
+                continue;
+            if (redo.n > 0) {
+                s->first = redo.ranges[--redo.n].first;
+                s->count = redo.ranges[redo.n].count;
+            } else {
+                s->first = next;
+                s->count = snmp_client_fit(client, cap);
+                if (s->count > req->nbindings - next)
+                    s->count = req->nbindings - next;
+                next += s->count;
+            }
+            s->retries = 0;
+            if (pipe_send(client, &pdu, bindings, s, now) == -1)
+                goto out;
+            nout++;
+        }
+        if (nout == 0)
+            break;
+        if (snmp_flush(client) == -1)
+            goto out;
+
+        end = 0;
+        for (s = slots; s < slots + window; s++)
+            if (s->reqid != -1 && (end == 0 || s->end < end))
+                end = s->end;
+        if (now < end) {
+            tv.tv_sec = (long)((end - now) / 1000000);
+            tv.tv_usec = (long)((end - now) % 1000000);
+            if ((n = snmp_receive_packet(client, &in, &tv, &owner)) > 0) {
+                for (s = slots; s < slots + window; s++)
+                    if (s->reqid != -1 && s->reqid == in.request_id)
+                        break;
+                if (owner == client && s < slots + window &&
+                        in.pdu_type == SNMP_PDU_RESPONSE) {
+                    rtt_sample(client, snmp_clock() - s->sent);
+                    size_learn(client, s->count, &in);
+                    if (in.error_status == SNMP_ERR_TOOBIG &&
+                            s->count > 1) {
+                        /* again in halves */
+                        if (pipe_split(&redo, s) == -1) {
+                            seterr(client, "%s", strerror(errno));
+                            goto out;
+                        }
+                    } else {
+                        if ((n = pipe_take(resp, &in, bindings, s,
+                                           status)) == -1) {
+                            seterr(client, "%s", strerror(errno));
+                            goto out;
+                        }
+                        nfail += n;
+                        if (n == 0 && s->count > largest)
+                            largest = s->count;
+                    }
+                    s->reqid = -1;
+                    nout--;
+                } else
+                    /* not for us */
+                    (void)snmp_deliver_packet(owner, &in);
+            } else if (n < 0 && errno == EPIPE) {
+                /* stream closed */
+                goto out;
+            }
+        }
+        now = snmp_clock();
+    }
+    /* what is left when the agent is down */
+    while (redo.n > 0) {
+        pipe_fail(resp, bindings, &redo.ranges[--redo.n], -1, 0, status);
+        nfail += redo.ranges[redo.n].count;
+    }
+    if (next < req->nbindings) {
+        s = slots;
+        s->first = next;
+        s->count = req->nbindings - next;
+        pipe_fail(resp, bindings, s, -1, 0, status);
+        nfail += s->count;
+    }
+    if (nfail > 0)
+        seterr(client, "%u of %u bindings failed", nfail, req->nbindings);
+    ret = (int)nfail;
+
+out:
+    saved_errno = errno;
+    snmp_pdu_free(&in);
+    free(slots);
+    free(redo.ranges);
+    if (bindings != req->bindings)
+        free(bindings);
+    errno = saved_errno;
+    return (ret);
+}
+
+static int discover_engine(struct snmp_client *client, char* user, char *passwd, char* privKey,
+                           snmp_pdu_t *req, snmp_pdu_t *resp) {
 
     char sec_name[SNMP_ADM_STR32_SIZ];
     enum snmp_authentication cap;
     enum snmp_privacy cpp;
-    snmp_pdu_t req, resp;
 
     if (client->version != SNMP_V3)
         seterr(client, "wrong version");
@@ -1596,25 +3044,25 @@ int snmp_discover_engine(struct snmp_client *client, char* user, char *passwd, c
     memcpy(sec_name, client->user.sec_name, sizeof(client->user.sec_name));
     memset(client->user.sec_name, 0, sizeof(client->user.sec_name));
 
-    snmp_pdu_create(client, &req, SNMP_PDU_GET);
+    snmp_pdu_reset(client, req, SNMP_PDU_GET);
 
-    if (snmp_dialog(client, &req, &resp) == -1)
+    if (snmp_dialog_reuse(client, req, resp) == -1)
         return (-1);
 
-    if (resp.version != req.version) {
+    if (resp->version != req->version) {
         seterr(client, "wrong version");
         return (-1);
     }
 
-    if (resp.error_status != SNMP_ERR_NOERROR) {
-        seterr(client, "Error %d in responce", resp.error_status);
+    if (resp->error_status != SNMP_ERR_NOERROR) {
+        seterr(client, "Error %d in responce", resp->error_status);
         return (-1);
     }
 
-    client->engine.engine_len = resp.engine.engine_len;
-    client->engine.max_msg_size = resp.engine.max_msg_size;
-    memcpy(client->engine.engine_id, resp.engine.engine_id,
-           resp.engine.engine_len);
+    client->engine.engine_len = resp->engine.engine_len;
+    client->engine.max_msg_size = resp->engine.max_msg_size;
+    memcpy(client->engine.engine_id, resp->engine.engine_id,
+           resp->engine.engine_len);
 
     if(NULL != user) {
         strlcpy(client->user.sec_name, user, sizeof(client->user.sec_name));
@@ -1647,11 +3095,11 @@ int snmp_discover_engine(struct snmp_client *client, char* user, char *passwd, c
             return (-1);
     }
 
-    if (resp.engine.engine_boots != 0)
-        client->engine.engine_boots = resp.engine.engine_boots;
+    if (resp->engine.engine_boots != 0)
+        client->engine.engine_boots = resp->engine.engine_boots;
 
-    if (resp.engine.engine_time != 0) {
-        client->engine.engine_time = resp.engine.engine_time;
+    if (resp->engine.engine_time != 0) {
+        client->engine.engine_time = resp->engine.engine_time;
 
 
         client->user.auth_proto = cap;
@@ -1660,25 +3108,25 @@ int snmp_discover_engine(struct snmp_client *client, char* user, char *passwd, c
         return (0);
     }
 
-    snmp_pdu_create(client, &req, SNMP_PDU_GET);
-    req.engine.engine_boots = 0;
-    req.engine.engine_time = 0;
+    snmp_pdu_reset(client, req, SNMP_PDU_GET);
+    req->engine.engine_boots = 0;
+    req->engine.engine_time = 0;
 
-    if (snmp_dialog(client, &req, &resp) == -1)
+    if (snmp_dialog_reuse(client, req, resp) == -1)
         return (-1);
 
-    if (resp.version != req.version) {
+    if (resp->version != req->version) {
         seterr(client, "wrong version");
         return (-1);
     }
 
-    if (resp.error_status != SNMP_ERR_NOERROR) {
-        seterr(client, "Error %d in responce", resp.error_status);
+    if (resp->error_status != SNMP_ERR_NOERROR) {
+        seterr(client, "Error %d in responce", resp->error_status);
         return (-1);
     }
 
-    client->engine.engine_boots = resp.engine.engine_boots;
-    client->engine.engine_time = resp.engine.engine_time;
+    client->engine.engine_boots = resp->engine.engine_boots;
+    client->engine.engine_time = resp->engine.engine_time;
 
     client->user.auth_proto = cap;
     client->user.priv_proto = cpp;
@@ -1686,6 +3134,18 @@ int snmp_discover_engine(struct snmp_client *client, char* user, char *passwd, c
     return (0);
 }
 
+int snmp_discover_engine(struct snmp_client *client, char* user, char *passwd, char* privKey) {
+    snmp_pdu_t req, resp;
+    int ret;
+
+    snmp_pdu_init(&req);
+    snmp_pdu_init(&resp);
+    ret = discover_engine(client, user, passwd, privKey, &req, &resp);
+    snmp_pdu_free(&req);
+    snmp_pdu_free(&resp);
+    return (ret);
+}
+
 int snmp_client_set_host(struct snmp_client *cl, const char *h) {
     char *np;
 
@@ -190,7 +190,12 @@ enum snmp_code snmp_pdu_encrypt(const snmp_pdu_t *pdu) {
     else if (err == 0)
         return (SNMP_CODE_OK);
 
-    if (EVP_EncryptInit(&ctx, ctype, pdu->user.priv_key, iv) != 1)
+    /*
+     * The scoped PDU is already padded and usually ends at the end of
+     * the buffer, so the cipher must not append a padding block.
+     */
+    if (EVP_EncryptInit(&ctx, ctype, pdu->user.priv_key, iv) != 1 ||
+            EVP_CIPHER_CTX_set_padding(&ctx, 0) != 1)
         return (SNMP_CODE_FAILED);
 
     if (EVP_EncryptUpdate(&ctx, pdu->scoped_ptr, &olen, pdu->scoped_ptr,
@@ -0,0 +1,313 @@
+/*
+ * Event loop for many client sessions.
+ *
+ * The loop waits with epoll on the sockets of its clients and runs the
+ * retransmission timers of all of them on one timer wheel. Timer records
+ * are reused, so a running loop does not allocate once it has seen the
+ * largest number of outstanding requests.
+ */
+#include "bsnmp/config.h"
+#include <sys/types.h>
+#ifdef _WIN32
+#include "compat/sys/queue.h"
+#else
+#include <sys/queue.h>
+#endif
+#ifdef __GNUC__
+#include <sys/time.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+#ifdef HAVE_EPOLL
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#elif defined(HAVE_INTTYPES_H)
+#include <inttypes.h>
+#endif
+
+#include "bsnmp/asn1.h"
+#include "bsnmp/snmp.h"
+#include "bsnmp/client.h"
+#include "bsnmp/loop.h"
+#include "bsnmp/mux.h"
+#include "support.h"
+#include "priv.h"
+
+#define LOOP_MAXEVENTS	256	/* events handled per wait */
+#define LOOP_DRAIN	64	/* packets received per event */
+
+/*
+* The socket of a mux is registered once for all its clients. Its events
+* carry the mux with the low bit set to tell them from those of clients.
+*/
+#define LOOP_MUX(m)	((void *)((char *)(m) + 1))
+#define LOOP_IS_MUX(p)	(((uintptr_t)(p) & 1) != 0)
+#define LOOP_MUX_PTR(p)	((struct snmp_mux *)((char *)(p) - 1))
+
+static void seterr(struct snmp_loop *loop, const char *fmt, ...) {
+    va_list ap;
+
+    va_start(ap, fmt);
+    vsnprintf(loop->error, sizeof(loop->error), fmt, ap);
+    va_end(ap);
+}
+
+void *snmp_loop_timer_start(struct snmp_loop *loop, const struct timeval *tv,
+                            snmp_timeout_cb_f func, struct snmp_client *client,
+                            void *arg) {
+    void *id;
+
+    if ((id = snmp_timer_start(&loop->timers, tv, func, client, arg)) == NULL)
+        seterr(loop, "%s", strerror(errno));
+    return (id);
+}
+
+void snmp_loop_timer_stop(struct snmp_loop *loop, void *id) {
+    snmp_timer_stop(&loop->timers, id);
+}
+
+int snmp_loop_init(struct snmp_loop *loop) {
+#ifdef HAVE_EPOLL
+    struct epoll_event ev;
+#endif
+
+    memset(loop, 0, sizeof(*loop));
+    LIST_INIT(&loop->clients);
+    LIST_INIT(&loop->flush);
+    snmp_timer_init(&loop->timers);
+    loop->fd = -1;
+    loop->wakefd = -1;
+
+#ifdef HAVE_EPOLL
+    if ((loop->events = malloc(LOOP_MAXEVENTS *
+                               sizeof(struct epoll_event))) == NULL) {
+        seterr(loop, "%s", strerror(errno));
+        return (-1);
+    }
+    loop->maxevents = LOOP_MAXEVENTS;
+    if ((loop->fd = epoll_create(LOOP_MAXEVENTS)) == -1) {
+        seterr(loop, "epoll_create: %s", strerror(errno));
+        free(loop->events);
+        loop->events = NULL;
+        return (-1);
+    }
+
+    /* its events carry the loop itself */
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = loop;
+    if ((loop->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1 ||
+            epoll_ctl(loop->fd, EPOLL_CTL_ADD, loop->wakefd, &ev) == -1) {
+        seterr(loop, "eventfd: %s", strerror(errno));
+        snmp_loop_close(loop);
+        return (-1);
+    }
+    return (0);
+#else
+    errno = ENOSYS;
+    seterr(loop, "%s", strerror(errno));
+    return (-1);
+#endif
+}
+
+void snmp_loop_close(struct snmp_loop *loop) {
+    while (!LIST_EMPTY(&loop->clients))
+        snmp_loop_remove(loop, LIST_FIRST(&loop->clients));
+    snmp_timer_fini(&loop->timers);
+
+    if (loop->fd != -1)
+        (void)closesocket(loop->fd);
+    loop->fd = -1;
+    if (loop->wakefd != -1)
+        (void)close(loop->wakefd);
+    loop->wakefd = -1;
+    free(loop->events);
+    loop->events = NULL;
+}
+
+int snmp_loop_add(struct snmp_loop *loop, struct snmp_client *client) {
+#ifdef HAVE_EPOLL
+    struct epoll_event ev;
+    struct snmp_mux *mux;
+
+    if (client->fd == -1 || client->loop != NULL) {
+        seterr(loop, "client not open or already in a loop");
+        errno = EINVAL;
+        return (-1);
+    }
+    if (!LIST_EMPTY(&client->sent_pdus)) {
+        /* their timers run elsewhere */
+        seterr(loop, "client has outstanding requests");
+        errno = EBUSY;
+        return (-1);
+    }
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = client;
+    if (client->mux_peer != NULL) {
+        mux = client->mux;
+        if (mux->loop != NULL && mux->loop != loop) {
+            seterr(loop, "mux is in another loop");
+            errno = EINVAL;
+            return (-1);
+        }
+        ev.data.ptr = LOOP_MUX(mux);
+        if (mux->nloop == 0 &&
+                epoll_ctl(loop->fd, EPOLL_CTL_ADD, mux->fd, &ev) == -1) {
+            seterr(loop, "epoll_ctl: %s", strerror(errno));
+            return (-1);
+        }
+        mux->loop = loop;
+        mux->nloop++;
+    } else if (epoll_ctl(loop->fd, EPOLL_CTL_ADD, client->fd, &ev) == -1) {
+        seterr(loop, "epoll_ctl: %s", strerror(errno));
+        return (-1);
+    }
+    client->loop = loop;
+    LIST_INSERT_HEAD(&loop->clients, client, loop_entries);
+    loop->nclients++;
+    return (0);
+#else
+    (void)client;
+    errno = ENOSYS;
+    seterr(loop, "%s", strerror(errno));
+    return (-1);
+#endif
+}
+
+/*
+* Give the client back. Its outstanding requests stay on the client but
+* are not retransmitted any more. This may be called from a callback,
+* the client must then not be freed before snmp_loop_run_once returns.
+*/
+void snmp_loop_remove(struct snmp_loop *loop, struct snmp_client *client) {
+#ifdef HAVE_EPOLL
+    struct epoll_event ev, *events = loop->events;
+    struct sent_pdu *p;
+    void *ptr = client;
+    int j;
+
+    if (client->loop != loop)
+        return;
+    (void)snmp_flush(client);
+
+    memset(&ev, 0, sizeof(ev));
+    if (client->mux_peer == NULL)
+        (void)epoll_ctl(loop->fd, EPOLL_CTL_DEL, client->fd, &ev);
+    else if (--client->mux->nloop == 0) {
+        /* the last client of the mux */
+        (void)epoll_ctl(loop->fd, EPOLL_CTL_DEL, client->mux->fd, &ev);
+        client->mux->loop = NULL;
+        ptr = LOOP_MUX(client->mux);
+    }
+
+    /* forget pending events and timers of the client */
+    for (j = 0; j < loop->nevents; j++)
+        if (events[j].data.ptr == ptr)
+            events[j].data.ptr = NULL;
+    snmp_timer_stop_client(&loop->timers, client);
+    LIST_FOREACH(p, &client->sent_pdus, entries)
+        p->timeout_id = NULL;
+
+    LIST_REMOVE(client, loop_entries);
+    client->loop = NULL;
+    loop->nclients--;
+#else
+    (void)loop;
+    (void)client;
+#endif
+}
+
+int snmp_loop_run_once(struct snmp_loop *loop, int timeout) {
+#ifdef HAVE_EPOLL
+    struct epoll_event *events = loop->events;
+    struct snmp_client *client;
+    struct timeval tv;
+    uint64_t wake;
+    int i, n, k, ms;
+
+    if (snmp_timer_next(&loop->timers, &tv) == 0) {
+        ms = (int)(tv.tv_sec * 1000 + (tv.tv_usec + 999) / 1000);
+        if (timeout < 0 || ms < timeout)
+            timeout = ms;
+    }
+
+    /* errors are left in the client, the requests are retried */
+    while ((client = LIST_FIRST(&loop->flush)) != NULL)
+        (void)snmp_flush(client);
+
+    if ((n = epoll_wait(loop->fd, events, loop->maxevents, timeout)) == -1) {
+        if (errno != EINTR) {
+            seterr(loop, "epoll_wait: %s", strerror(errno));
+            return (-1);
+        }
+        n = 0;
+    }
+
+    loop->nevents = n;
+    for (i = 0; i < loop->nevents && !loop->stop; i++) {
+        if (events[i].data.ptr == NULL)
+            continue;
+        if (events[i].data.ptr == loop) {
+            (void)read(loop->wakefd, &wake, sizeof(wake));
+            continue;
+        }
+        if (LOOP_IS_MUX(events[i].data.ptr)) {
+            (void)snmp_mux_input(LOOP_MUX_PTR(events[i].data.ptr));
+            continue;
+        }
+        client = events[i].data.ptr;
+        for (k = 0; k < LOOP_DRAIN && client->loop == loop; k++)
+            if (snmp_client_input(client) <= 0)
+                break;
+    }
+    loop->nevents = 0;
+
+    if (!loop->stop)
+        (void)snmp_timer_expire(&loop->timers);
+    return (n);
+#else
+    (void)timeout;
+    errno = ENOSYS;
+    seterr(loop, "%s", strerror(errno));
+    return (-1);
+#endif
+}
+
+int snmp_loop_run(struct snmp_loop *loop) {
+    loop->stop = 0;
+    while (loop->timers.count > 0 && !loop->stop)
+        if (snmp_loop_run_once(loop, -1) == -1)
+            return (-1);
+    loop->stop = 0;
+    return (0);
+}
+
+void snmp_loop_break(struct snmp_loop *loop) {
+    loop->stop = 1;
+}
+
+int snmp_loop_wakeup(struct snmp_loop *loop) {
+#ifdef HAVE_EPOLL
+    uint64_t one = 1;
+
+    /* EAGAIN: the counter is full, the loop wakes up anyway */
+    if (write(loop->wakefd, &one, sizeof(one)) == -1 && errno != EAGAIN)
+        return (-1);
+    return (0);
+#else
+    (void)loop;
+    errno = ENOSYS;
+    return (-1);
+#endif
+}
@@ -0,0 +1,373 @@
+/*
+ * Unconnected UDP socket shared by many client sessions, see bsnmp/mux.h.
+ *
+ * The mux keeps the addresses of its clients in a hash table. A response
+ * is looked up by its source address there and handed to the client
+ * that sent the request, see snmp_mux_dispatch in client.c.
+ */
+#include "bsnmp/config.h"
+#include <sys/types.h>
+#ifdef _WIN32
+#include "compat/sys/queue.h"
+#else
+#include <sys/queue.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#endif
+#ifdef __GNUC__
+#include <sys/time.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#elif defined(HAVE_INTTYPES_H)
+#include <inttypes.h>
+#endif
+
+#include "bsnmp/asn1.h"
+#include "bsnmp/snmp.h"
+#include "bsnmp/client.h"
+#include "bsnmp/loop.h"
+#include "bsnmp/mux.h"
+#include "support.h"
+#include "priv.h"
+
+#define MUX_MIN		64	/* initial hash table size */
+#define MUX_DRAIN	256	/* packets received per snmp_mux_input */
+#define MUX_BUFSIZ	65536	/* largest datagram */
+
+#ifdef _WIN32
+#define MUX_AGAIN()	(WSAGetLastError() == WSAEWOULDBLOCK)
+#else
+#define MUX_AGAIN()	(errno == EAGAIN || errno == EWOULDBLOCK || \
+			 errno == EINTR)
+#endif
+
+static void seterr(struct snmp_mux *mux, const char *fmt, ...) {
+    va_list ap;
+
+    va_start(ap, fmt);
+    vsnprintf(mux->error, sizeof(mux->error), fmt, ap);
+    va_end(ap);
+}
+
+/*
+* FNV-1a of the address and port.
+*/
+static uint32_t mux_hash(const struct sockaddr *sa) {
+    const u_char *p;
+    size_t i, len;
+    u_short port;
+    uint32_t h = 2166136261U;
+
+    switch (sa->sa_family) {
+
+    case AF_INET:
+        p = (const u_char *)&((const struct sockaddr_in *)sa)->sin_addr;
+        len = sizeof(struct in_addr);
+        port = ((const struct sockaddr_in *)sa)->sin_port;
+        break;
+#ifdef AF_INET6
+    case AF_INET6:
+        p = (const u_char *)&((const struct sockaddr_in6 *)sa)->sin6_addr;
+        len = sizeof(struct in6_addr);
+        port = ((const struct sockaddr_in6 *)sa)->sin6_port;
+        break;
+#endif
+    default:
+        return (0);
+    }
+    for (i = 0; i < len; i++)
+        h = (h ^ p[i]) * 16777619U;
+    h = (h ^ (port & 0xff)) * 16777619U;
+    h = (h ^ (port >> 8)) * 16777619U;
+    return (h);
+}
+
+static int mux_same(const struct sockaddr *a, const struct sockaddr *b) {
+    if (a->sa_family != b->sa_family)
+        return (0);
+    switch (a->sa_family) {
+
+    case AF_INET:
+        return (((const struct sockaddr_in *)a)->sin_port ==
+                ((const struct sockaddr_in *)b)->sin_port &&
+                memcmp(&((const struct sockaddr_in *)a)->sin_addr,
+                       &((const struct sockaddr_in *)b)->sin_addr,
+                       sizeof(struct in_addr)) == 0);
+#ifdef AF_INET6
+    case AF_INET6:
+        return (((const struct sockaddr_in6 *)a)->sin6_port ==
+                ((const struct sockaddr_in6 *)b)->sin6_port &&
+                memcmp(&((const struct sockaddr_in6 *)a)->sin6_addr,
+                       &((const struct sockaddr_in6 *)b)->sin6_addr,
+                       sizeof(struct in6_addr)) == 0);
+#endif
+    }
+    return (0);
+}
+
+/*
+* Double the hash table once there are as many clients as buckets.
+*/
+static int mux_grow(struct snmp_mux *mux) {
+    struct snmp_mux_peer **peers, *p;
+    u_int i, size;
+
+    if (mux->npeers < mux->size)
+        return (0);
+    size = mux->size == 0 ? MUX_MIN : 2 * mux->size;
+    if ((peers = calloc(size, sizeof(*peers))) == NULL)
+        return (-1);
+    for (i = 0; i < mux->size; i++)
+        while ((p = mux->peers[i]) != NULL) {
+            mux->peers[i] = p->next;
+            p->next = peers[p->hash & (size - 1)];
+            peers[p->hash & (size - 1)] = p;
+        }
+    free(mux->peers);
+    mux->peers = peers;
+    mux->size = size;
+    return (0);
+}
+
+int snmp_mux_open(struct snmp_mux *mux, int family) {
+    return (snmp_mux_open_port(mux, family, 0, 0));
+}
+
+int snmp_mux_open_port(struct snmp_mux *mux, int family, u_short port,
+                       int reuse) {
+    struct sockaddr_storage ss;
+    socklen_t len;
+    int on = 1;
+
+    memset(mux, 0, sizeof(*mux));
+    mux->family = family;
+
+    memset(&ss, 0, sizeof(ss));
+    ss.ss_family = family;
+    switch (family) {
+
+    case AF_INET:
+        len = sizeof(struct sockaddr_in);
+        ((struct sockaddr_in *)&ss)->sin_port = htons(port);
+        break;
+#ifdef AF_INET6
+    case AF_INET6:
+        len = sizeof(struct sockaddr_in6);
+        ((struct sockaddr_in6 *)&ss)->sin6_port = htons(port);
+        break;
+#endif
+    default:
+        errno = EAFNOSUPPORT;
+        seterr(mux, "%s", strerror(errno));
+        mux->fd = -1;
+        return (-1);
+    }
+
+    if ((mux->fd = socket(family, SOCK_DGRAM, 0)) == -1) {
+        seterr(mux, "socket: %s", strerror(errno));
+        return (-1);
+    }
+#ifdef SO_REUSEPORT
+    if (reuse && setsockopt(mux->fd, SOL_SOCKET, SO_REUSEPORT,
+                            (const char *)&on, sizeof(on)) == -1) {
+        seterr(mux, "SO_REUSEPORT: %s", strerror(errno));
+        (void)closesocket(mux->fd);
+        mux->fd = -1;
+        return (-1);
+    }
+#else
+    if (reuse) {
+        errno = ENOPROTOOPT;
+        seterr(mux, "SO_REUSEPORT: %s", strerror(errno));
+        (void)closesocket(mux->fd);
+        mux->fd = -1;
+        return (-1);
+    }
+    (void)on;
+#endif
+    if (bind(mux->fd, (struct sockaddr *)&ss, len) == -1 ||
+            socket_set_blocking(mux->fd, 0) == -1) {
+        seterr(mux, "bind: %s", strerror(errno));
+        (void)closesocket(mux->fd);
+        mux->fd = -1;
+        return (-1);
+    }
+    return (0);
+}
+
+void snmp_mux_close(struct snmp_mux *mux) {
+    struct snmp_mux_peer *p;
+    struct snmp_client *client;
+    u_int i;
+
+    for (i = 0; i < mux->size; i++)
+        while ((p = mux->peers[i]) != NULL) {
+            client = p->client;
+            if (client->loop != NULL)
+                snmp_loop_remove(client->loop, client);
+            snmp_mux_detach(client);
+            client->fd = -1;
+        }
+    free(mux->peers);
+    mux->peers = NULL;
+    mux->size = 0;
+
+    if (mux->fd != -1)
+        (void)closesocket(mux->fd);
+    mux->fd = -1;
+    free(mux->txbuf);
+    mux->txbuf = NULL;
+    mux->txbuf_size = 0;
+    if (mux->resp != NULL) {
+        snmp_pdu_free(mux->resp);
+        free(mux->resp);
+        mux->resp = NULL;
+    }
+    snmp_mutex_free(mux->lock);
+    mux->lock = NULL;
+}
+
+/*
+* Make the client send to and receive from addr on the socket of the mux.
+*/
+int snmp_mux_attach(struct snmp_mux *mux, struct snmp_client *client,
+                    const struct sockaddr *addr, size_t addrlen) {
+    struct snmp_mux_peer *p;
+
+    if (addrlen > sizeof(p->addr) || addr->sa_family != mux->family) {
+        errno = EAFNOSUPPORT;
+        return (-1);
+    }
+    if (mux_grow(mux) == -1 || (p = malloc(sizeof(*p))) == NULL)
+        return (-1);
+    p->client = client;
+    p->hash = mux_hash(addr);
+    p->addrlen = (socklen_t)addrlen;
+    memset(&p->addr, 0, sizeof(p->addr));
+    memcpy(&p->addr, addr, addrlen);
+
+    p->next = mux->peers[p->hash & (mux->size - 1)];
+    mux->peers[p->hash & (mux->size - 1)] = p;
+    mux->npeers++;
+
+    client->mux_peer = p;
+    client->fd = mux->fd;
+    return (0);
+}
+
+void snmp_mux_detach(struct snmp_client *client) {
+    struct snmp_mux *mux = client->mux;
+    struct snmp_mux_peer *p = client->mux_peer, **pp;
+
+    if (p == NULL)
+        return;
+    for (pp = &mux->peers[p->hash & (mux->size - 1)]; *pp != p;
+            pp = &(*pp)->next)
+        ;
+    *pp = p->next;
+    mux->npeers--;
+    free(p);
+    client->mux_peer = NULL;
+}
+
+/*
+* The first client talking to addr or, with after set, the next one after
+* that client. NULL if there is none.
+*/
+struct snmp_client *snmp_mux_lookup(struct snmp_mux *mux,
+                                    const struct sockaddr *addr,
+                                    struct snmp_client *after) {
+    struct snmp_mux_peer *p;
+    uint32_t h;
+
+    if (after != NULL) {
+        h = after->mux_peer->hash;
+        p = after->mux_peer->next;
+    } else {
+        if (mux->size == 0)
+            return (NULL);
+        h = mux_hash(addr);
+        p = mux->peers[h & (mux->size - 1)];
+    }
+    for (; p != NULL; p = p->next)
+        if (p->hash == h && mux_same((struct sockaddr *)&p->addr, addr))
+            return (p->client);
+    return (NULL);
+}
+
+/*
+* The encoding buffer of the clients, grown to the largest txbuflen.
+*/
+u_char *snmp_mux_txbuf(struct snmp_mux *mux, size_t size) {
+    if (mux->txbuf_size < size) {
+        free(mux->txbuf);
+        mux->txbuf_size = 0;
+        if ((mux->txbuf = malloc(size)) == NULL)
+            return (NULL);
+        mux->txbuf_size = size;
+    }
+    return (mux->txbuf);
+}
+
+/*
+* Like receive_deliver in client.c the response PDU is kept for the next
+* call, and a callback that calls this again gets one of its own.
+*/
+int snmp_mux_input(struct snmp_mux *mux) {
+    struct sockaddr_storage from;
+    socklen_t fromlen;
+    snmp_pdu_t *resp;
+    int n, len;
+
+    if ((resp = mux->resp) != NULL) {
+        mux->resp = NULL;
+    } else {
+        if ((resp = malloc(sizeof(*resp))) == NULL) {
+            seterr(mux, "no memory for returning PDU");
+            return (-1);
+        }
+        snmp_pdu_init(resp);
+    }
+    if (resp->rxbuf == NULL) {
+        if ((resp->rxbuf = malloc(MUX_BUFSIZ)) == NULL) {
+            seterr(mux, "no memory for returning PDU");
+            free(resp);
+            return (-1);
+        }
+        resp->rxbuf_size = MUX_BUFSIZ;
+    }
+
+    for (n = 0; n < MUX_DRAIN; n++) {
+        snmp_pdu_clear(resp);
+        fromlen = sizeof(from);
+        if ((len = recvfrom(mux->fd, (char *)resp->rxbuf,
+                            (int)resp->rxbuf_size, 0,
+                            (struct sockaddr *)&from, &fromlen)) == -1) {
+            if (!MUX_AGAIN()) {
+                seterr(mux, "recvfrom: %s", strerror(errno));
+                n = -1;
+            }
+            break;
+        }
+        /* unknown senders and bad packets are dropped */
+        (void)snmp_mux_dispatch(mux, resp, len, (struct sockaddr *)&from);
+    }
+
+    snmp_pdu_clear(resp);
+    if (mux->resp == NULL) {
+        mux->resp = resp;
+    } else {
+        snmp_pdu_free(resp);
+        free(resp);
+    }
+    return (n);
+}
@@ -32,6 +32,10 @@
  */
 
 enum asn_err snmp_binding_encode(asn_buf_t *, const snmp_value_t *);
+enum asn_err snmp_binding_encode_rev(asn_buf_t *, const snmp_value_t *);
+enum snmp_code snmp_pdu_encode_rev_start(snmp_pdu_t *, asn_buf_t *, u_char **);
+enum snmp_code snmp_pdu_encode_vars_rev(asn_buf_t *, snmp_pdu_t *);
+enum snmp_code snmp_pdu_encode_rev_finish(snmp_pdu_t *, asn_buf_t *, u_char *);
 enum snmp_code snmp_pdu_encode_header(asn_buf_t *, snmp_pdu_t *);
 enum snmp_code snmp_fix_encoding(asn_buf_t *, snmp_pdu_t *);
 enum asn_err snmp_parse_pdus_hdr(asn_buf_t *b, snmp_pdu_t *pdu,
@@ -41,6 +45,26 @@ enum snmp_code snmp_pdu_calc_digest(const snmp_pdu_t *, uint8_t *);
 enum snmp_code snmp_pdu_encrypt(const snmp_pdu_t *);
 enum snmp_code snmp_pdu_decrypt(const snmp_pdu_t *);
 
+struct snmp_client;
+int snmp_client_input(struct snmp_client *);
+void snmp_pdu_set_header(struct snmp_client *, snmp_pdu_t *);
+
+/* clients on a shared socket, see mux.c */
+struct snmp_mux;
+struct sockaddr;
+int snmp_mux_attach(struct snmp_mux *, struct snmp_client *,
+                    const struct sockaddr *, size_t);
+void snmp_mux_detach(struct snmp_client *);
+struct snmp_client *snmp_mux_lookup(struct snmp_mux *,
+                                    const struct sockaddr *,
+                                    struct snmp_client *);
+u_char *snmp_mux_txbuf(struct snmp_mux *, size_t);
+int snmp_mux_dispatch(struct snmp_mux *, snmp_pdu_t *, int,
+                      const struct sockaddr *);
+
+/* microseconds on the monotonic clock */
+uint64_t snmp_clock(void);
+
 #define DEFAULT_HOST "localhost"
 #define DEFAULT_PORT "snmp"
 #define DEFAULT_LOCAL "/var/run/snmp.sock"
@@ -0,0 +1,311 @@
+/*
+ * Cache of resolved agent addresses, see bsnmp/resolve.h.
+ *
+ * The entries are kept in a hash table with linear probing like the
+ * outstanding requests of a client. They are never removed, an expired
+ * entry is resolved again in place. The lock is not held while
+ * getaddrinfo runs, so lookups of different names do not wait for each
+ * other; two threads resolving the same name at once both store it.
+ */
+#include "bsnmp/config.h"
+#include <sys/types.h>
+#ifdef _WIN32
+#include "compat/sys/queue.h"
+#else
+#include <sys/queue.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <pthread.h>
+#endif
+#ifdef __GNUC__
+#include <sys/time.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#elif defined(HAVE_INTTYPES_H)
+#include <inttypes.h>
+#endif
+
+#include "bsnmp/asn1.h"
+#include "bsnmp/snmp.h"
+#include "bsnmp/client.h"
+#include "bsnmp/resolve.h"
+#include "support.h"
+#include "priv.h"
+
+#define RESOLVE_MIN	64	/* initial hash table size */
+#define RESOLVE_THREADS	64	/* most threads of snmp_resolver_fill */
+
+struct snmp_resolve_entry {
+    uint32_t		hash;
+    int			family;
+    int			error;		/* of getaddrinfo, 0 if resolved */
+    uint64_t		expires;	/* on snmp_clock */
+    socklen_t		addrlen;
+    struct sockaddr_storage	addr;
+    char			*port;
+    char			host[1];	/* and the port after it */
+};
+
+static void seterr(struct snmp_resolver *r, const char *fmt, ...) {
+    va_list ap;
+
+    va_start(ap, fmt);
+    vsnprintf(r->error, sizeof(r->error), fmt, ap);
+    va_end(ap);
+}
+
+/* FNV-1a */
+static uint32_t resolve_hash(const char *host, const char *port,
+                             int family) {
+    uint32_t h = 2166136261U;
+
+    for (; *host != '\0'; host++)
+        h = (h ^ (u_char)*host) * 16777619U;
+    h = (h ^ 0xff) * 16777619U;
+    for (; *port != '\0'; port++)
+        h = (h ^ (u_char)*port) * 16777619U;
+    return ((h ^ (uint32_t)family) * 16777619U);
+}
+
+static struct snmp_resolve_entry *resolve_find(struct snmp_resolver *r,
+        const char *host, const char *port, int family, uint32_t hash) {
+    struct snmp_resolve_entry *e;
+    u_int mask = r->size - 1;
+    u_int i;
+
+    for (i = hash & mask; (e = r->tab[i]) != NULL; i = (i + 1) & mask)
+        if (e->hash == hash && e->family == family &&
+                strcmp(e->host, host) == 0 && strcmp(e->port, port) == 0)
+            return (e);
+    return (NULL);
+}
+
+static void resolve_insert(struct snmp_resolver *r,
+                           struct snmp_resolve_entry *e) {
+    u_int mask = r->size - 1;
+    u_int i;
+
+    for (i = e->hash & mask; r->tab[i] != NULL; i = (i + 1) & mask)
+        ;
+    r->tab[i] = e;
+    r->used++;
+}
+
+/* make room for one more entry, keeping the table at most half full */
+static int resolve_reserve(struct snmp_resolver *r) {
+    struct snmp_resolve_entry **old = r->tab;
+    u_int i, oldsize = r->size;
+
+    if (2 * (r->used + 1) <= oldsize)
+        return (0);
+    if ((r->tab = calloc(2 * oldsize, sizeof(*old))) == NULL) {
+        r->tab = old;
+        return (-1);
+    }
+    r->size = 2 * oldsize;
+    r->used = 0;
+    for (i = 0; i < oldsize; i++)
+        if (old[i] != NULL)
+            resolve_insert(r, old[i]);
+    free(old);
+    return (0);
+}
+
+/*
+ * Put a result into the cache. It is only a cache, when there is no
+ * memory the result is not kept.
+ */
+static void resolve_store(struct snmp_resolver *r, const char *host,
+                          const char *port, int family, uint32_t hash,
+                          int error, const struct sockaddr_storage *addr,
+                          socklen_t addrlen) {
+    struct snmp_resolve_entry *e;
+    size_t hlen, plen;
+
+    if ((e = resolve_find(r, host, port, family, hash)) == NULL) {
+        hlen = strlen(host);
+        plen = strlen(port);
+        if (resolve_reserve(r) == -1 ||
+                (e = malloc(sizeof(*e) + hlen + plen + 1)) == NULL)
+            return;
+        e->hash = hash;
+        e->family = family;
+        memcpy(e->host, host, hlen + 1);
+        e->port = e->host + hlen + 1;
+        memcpy(e->port, port, plen + 1);
+        resolve_insert(r, e);
+    }
+    e->error = error;
+    e->expires = snmp_clock() + r->ttl;
+    e->addrlen = addrlen;
+    if (error == 0)
+        memcpy(&e->addr, addr, addrlen);
+}
+
+int snmp_resolver_init(struct snmp_resolver *r, u_int ttl) {
+    memset(r, 0, sizeof(*r));
+    r->ttl = (uint64_t)ttl * 1000000;
+    if ((r->tab = calloc(RESOLVE_MIN, sizeof(*r->tab))) == NULL ||
+            (r->lock = snmp_mutex_new()) == NULL) {
+        seterr(r, "%s", strerror(errno));
+        free(r->tab);
+        r->tab = NULL;
+        return (-1);
+    }
+    r->size = RESOLVE_MIN;
+    return (0);
+}
+
+void snmp_resolver_close(struct snmp_resolver *r) {
+    u_int i;
+
+    for (i = 0; i < r->size; i++)
+        free(r->tab[i]);
+    free(r->tab);
+    r->tab = NULL;
+    r->size = 0;
+    r->used = 0;
+    if (r->lock != NULL)
+        snmp_mutex_free(r->lock);
+    r->lock = NULL;
+}
+
+int snmp_resolver_lookup(struct snmp_resolver *r, const char *host,
+                         const char *port, int family,
+                         struct sockaddr_storage *addr, socklen_t *addrlen) {
+    struct snmp_resolve_entry *e;
+    struct addrinfo hints, *res;
+    uint32_t hash = resolve_hash(host, port, family);
+    socklen_t len = 0;
+    int error;
+
+    snmp_mutex_lock(r->lock);
+    if ((e = resolve_find(r, host, port, family, hash)) != NULL &&
+            e->expires > snmp_clock()) {
+        if ((error = e->error) == 0) {
+            memcpy(addr, &e->addr, e->addrlen);
+            *addrlen = e->addrlen;
+        }
+        snmp_mutex_unlock(r->lock);
+        return (error);
+    }
+    snmp_mutex_unlock(r->lock);
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = family;
+    hints.ai_socktype = SOCK_DGRAM;
+    if ((error = getaddrinfo(host, port, &hints, &res)) == 0) {
+        len = (socklen_t)res->ai_addrlen;
+        memcpy(addr, res->ai_addr, len);
+        *addrlen = len;
+        freeaddrinfo(res);
+    }
+
+    snmp_mutex_lock(r->lock);
+    resolve_store(r, host, port, family, hash, error, addr, len);
+    snmp_mutex_unlock(r->lock);
+    return (error);
+}
+
+/* the list of snmp_resolver_fill, worked off by all its threads */
+struct resolve_work {
+    struct snmp_resolver	*r;
+    const char *const	*hosts;
+    u_int			n;
+    const char		*port;
+    int			family;
+    u_int			next;
+    u_int			failed;
+};
+
+static void resolve_run(struct resolve_work *w) {
+    struct sockaddr_storage addr;
+    socklen_t addrlen;
+    u_int i;
+
+    for (;;) {
+        snmp_mutex_lock(w->r->lock);
+        i = w->next++;
+        snmp_mutex_unlock(w->r->lock);
+        if (i >= w->n)
+            break;
+        if (snmp_resolver_lookup(w->r, w->hosts[i], w->port, w->family,
+                                 &addr, &addrlen) != 0) {
+            snmp_mutex_lock(w->r->lock);
+            w->failed++;
+            snmp_mutex_unlock(w->r->lock);
+        }
+    }
+}
+
+#ifdef _WIN32
+typedef HANDLE resolve_thread_t;
+
+static DWORD WINAPI resolve_thread(LPVOID arg) {
+    resolve_run(arg);
+    return (0);
+}
+
+static int resolve_start(resolve_thread_t *t, struct resolve_work *w) {
+    return ((*t = CreateThread(NULL, 0, resolve_thread, w, 0,
+                               NULL)) == NULL ? -1 : 0);
+}
+
+static void resolve_join(resolve_thread_t t) {
+    (void)WaitForSingleObject(t, INFINITE);
+    (void)CloseHandle(t);
+}
+#else
+typedef pthread_t resolve_thread_t;
+
+static void *resolve_thread(void *arg) {
+    resolve_run(arg);
+    return (NULL);
+}
+
+static int resolve_start(resolve_thread_t *t, struct resolve_work *w) {
+    return (pthread_create(t, NULL, resolve_thread, w) != 0 ? -1 : 0);
+}
+
+static void resolve_join(resolve_thread_t t) {
+    (void)pthread_join(t, NULL);
+}
+#endif
+
+/*
+* The calling thread resolves as well, so with one thread or when no
+* other can be started this still works, only slower.
+*/
+int snmp_resolver_fill(struct snmp_resolver *r, const char *const *hosts,
+                       u_int n, const char *port, int family,
+                       u_int nthreads) {
+    resolve_thread_t threads[RESOLVE_THREADS];
+    struct resolve_work w;
+    u_int i, started;
+
+    memset(&w, 0, sizeof(w));
+    w.r = r;
+    w.hosts = hosts;
+    w.n = n;
+    w.port = port;
+    w.family = family;
+
+    if (nthreads > RESOLVE_THREADS)
+        nthreads = RESOLVE_THREADS;
+    if (nthreads > n)
+        nthreads = n;
+    for (started = 0; started + 1 < nthreads; started++)
+        if (resolve_start(&threads[started], &w) == -1)
+            break;
+    resolve_run(&w);
+    for (i = 0; i < started; i++)
+        resolve_join(threads[i]);
+    return ((int)w.failed);
+}
@@ -0,0 +1,588 @@
+/*
+ * Client sessions spread over several threads, see bsnmp/shard.h.
+ *
+ * Each shard is a thread running a snmp_loop with the clients of its
+ * snmp_mux. Other threads hand it requests through a bounded queue after
+ * Dmitry Vyukov: producers claim a slot by advancing tail with a compare
+ * and swap and publish it through the sequence number of the slot, the
+ * shard takes them in order without atomic writes. The loop is only
+ * woken up with its eventfd when the shard is about to sleep.
+ */
+#include "bsnmp/config.h"
+#include <sys/types.h>
+#ifdef _WIN32
+#include "compat/sys/queue.h"
+#else
+#include <sys/queue.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#endif
+#ifdef __GNUC__
+#include <sys/time.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+#ifdef HAVE_EPOLL
+#include <pthread.h>
+#include <sched.h>
+#include <linux/filter.h>
+#endif
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#elif defined(HAVE_INTTYPES_H)
+#include <inttypes.h>
+#endif
+
+#include "bsnmp/asn1.h"
+#include "bsnmp/snmp.h"
+#include "bsnmp/client.h"
+#include "bsnmp/loop.h"
+#include "bsnmp/mux.h"
+#include "bsnmp/resolve.h"
+#include "bsnmp/shard.h"
+#include "support.h"
+#include "priv.h"
+
+#define SHARD_QUEUE	4096	/* requests queued per shard, power of 2 */
+#define SHARD_CACHELINE	64
+
+#ifdef HAVE_EPOLL
+
+/* a queued request, or a call when pdu is NULL */
+struct shard_item {
+    u_long			seq;
+    struct snmp_client	*client;
+    snmp_pdu_t		*pdu;
+    snmp_send_cb_f		func;
+    snmp_shards_call_f	call;
+    void			*arg;
+};
+
+/*
+* The loop comes first, a client finds its shard through client->loop.
+*/
+struct snmp_shard {
+    struct snmp_loop	loop;
+    struct snmp_mux		mux;
+    struct snmp_shards	*shards;
+    u_int			id;
+    pthread_t		thread;
+    int			running;
+
+    struct shard_item	*queue;		/* SHARD_QUEUE slots */
+
+    /* written by the producers */
+    char			pad0[SHARD_CACHELINE];
+    u_long			tail;
+    int			sleeping;	/* waiting or about to */
+    int			stop;
+
+    /* written by the shard only */
+    char			pad1[SHARD_CACHELINE];
+    u_long			head;
+};
+
+/* the shard the calling thread runs */
+static SNMP_THREAD_LOCAL struct snmp_shard *current;
+
+static void seterr(struct snmp_shards *shards, const char *fmt, ...) {
+    va_list ap;
+
+    va_start(ap, fmt);
+    vsnprintf(shards->error, sizeof(shards->error), fmt, ap);
+    va_end(ap);
+}
+
+/*
+* The shard of an opened client, NULL if it is not on one.
+*/
+static struct snmp_shard *client_shard(struct snmp_client *client) {
+    struct snmp_shard *shard = (struct snmp_shard *)client->loop;
+
+    if (shard == NULL || client->mux != &shard->mux)
+        return (NULL);
+    return (shard);
+}
+
+static int shard_put(struct snmp_shard *shard, const struct shard_item *it) {
+    struct shard_item *slot;
+    u_long pos, seq;
+
+    pos = __atomic_load_n(&shard->tail, __ATOMIC_RELAXED);
+    for (;;) {
+        slot = &shard->queue[pos & (SHARD_QUEUE - 1)];
+        seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        if (seq == pos) {
+            if (__atomic_compare_exchange_n(&shard->tail, &pos, pos + 1, 0,
+                                            __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED))
+                break;
+        } else if ((long)(seq - pos) < 0) {
+            errno = EAGAIN;
+            return (-1);
+        } else {
+            pos = __atomic_load_n(&shard->tail, __ATOMIC_RELAXED);
+        }
+    }
+    slot->client = it->client;
+    slot->pdu = it->pdu;
+    slot->func = it->func;
+    slot->call = it->call;
+    slot->arg = it->arg;
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_SEQ_CST);
+
+    /* only the first one to see the shard going to sleep wakes it up */
+    if (__atomic_load_n(&shard->sleeping, __ATOMIC_SEQ_CST) &&
+            __atomic_exchange_n(&shard->sleeping, 0, __ATOMIC_SEQ_CST))
+        (void)snmp_loop_wakeup(&shard->loop);
+    return (0);
+}
+
+/*
+* Take the next item off the queue, 0 if there is none.
+*/
+static int shard_take(struct snmp_shard *shard, struct shard_item *it) {
+    struct shard_item *slot = &shard->queue[shard->head & (SHARD_QUEUE - 1)];
+
+    if (__atomic_load_n(&slot->seq, __ATOMIC_SEQ_CST) != shard->head + 1)
+        return (0);
+    *it = *slot;
+    __atomic_store_n(&slot->seq, shard->head + SHARD_QUEUE,
+                     __ATOMIC_RELEASE);
+    shard->head++;
+    return (1);
+}
+
+/*
+* Send or run what is queued, at most one queue full so that responses
+* and timers are not held up.
+*/
+static void shard_drain(struct snmp_shard *shard) {
+    struct shard_item it;
+    u_int n;
+
+    for (n = 0; n < SHARD_QUEUE && shard_take(shard, &it); n++) {
+        if (it.pdu == NULL) {
+            it.call(it.client, it.arg);
+            continue;
+        }
+        snmp_pdu_set_header(it.client, it.pdu);
+        if (snmp_pdu_send(it.client, it.pdu, it.func, it.arg) == -1)
+            it.func(it.client, it.pdu, NULL, it.arg);
+    }
+}
+
+static void shard_pin(struct snmp_shard *shard) {
+#if defined(__linux__) && defined(CPU_SET)
+    cpu_set_t set;
+    long ncpu;
+
+    if ((ncpu = sysconf(_SC_NPROCESSORS_ONLN)) <= 0)
+        return;
+    CPU_ZERO(&set);
+    CPU_SET(shard->id % ncpu, &set);
+    (void)pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+    (void)shard;
+#endif
+}
+
+static void *shard_run(void *arg) {
+    struct snmp_shard *shard = arg;
+    struct shard_item *slot;
+    int timeout;
+
+    current = shard;
+    if (shard->shards->pin)
+        shard_pin(shard);
+    while (!__atomic_load_n(&shard->stop, __ATOMIC_SEQ_CST)) {
+        shard_drain(shard);
+
+        /* sleep only if nothing came in after the flag was seen */
+        __atomic_store_n(&shard->sleeping, 1, __ATOMIC_SEQ_CST);
+        slot = &shard->queue[shard->head & (SHARD_QUEUE - 1)];
+        timeout = -1;
+        if (__atomic_load_n(&slot->seq, __ATOMIC_SEQ_CST) ==
+                shard->head + 1) {
+            __atomic_store_n(&shard->sleeping, 0, __ATOMIC_SEQ_CST);
+            timeout = 0;
+        }
+        if (__atomic_load_n(&shard->stop, __ATOMIC_SEQ_CST))
+            break;
+        /* errors are left in the loop, they are those of epoll_wait */
+        if (snmp_loop_run_once(&shard->loop, timeout) == -1)
+            break;
+        __atomic_store_n(&shard->sleeping, 0, __ATOMIC_SEQ_CST);
+    }
+    return (NULL);
+}
+
+/*
+* Have the kernel give a datagram on the common port to the shard of its
+* source address, the last 32 bits of it modulo the number of shards.
+* The sockets of the group are numbered in the order they were bound.
+*/
+static int shards_steer(struct snmp_shards *shards) {
+#ifdef SO_ATTACH_REUSEPORT_CBPF
+    struct sock_filter code[3];
+    struct sock_fprog prog;
+
+    memset(code, 0, sizeof(code));
+    code[0].code = BPF_LD | BPF_W | BPF_ABS;
+    code[0].k = SKF_NET_OFF + (shards->family == AF_INET ? 12 : 20);
+    code[1].code = BPF_ALU | BPF_MOD | BPF_K;
+    code[1].k = shards->n;
+    code[2].code = BPF_RET | BPF_A;
+    prog.len = 3;
+    prog.filter = code;
+    if (setsockopt(shards->shard[0].mux.fd, SOL_SOCKET,
+                   SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) == -1) {
+        seterr(shards, "SO_ATTACH_REUSEPORT_CBPF: %s", strerror(errno));
+        return (-1);
+    }
+    return (0);
+#else
+    errno = ENOPROTOOPT;
+    seterr(shards, "SO_ATTACH_REUSEPORT_CBPF: %s", strerror(errno));
+    return (-1);
+#endif
+}
+
+/* the shard whose sessions talk to addr, like the filter of shards_steer */
+static int shards_index(struct snmp_shards *shards,
+                        const struct sockaddr *addr) {
+    const u_char *a;
+    uint32_t w;
+
+    if (addr->sa_family == AF_INET)
+        a = (const u_char *)&((const struct sockaddr_in *)addr)->sin_addr;
+    else
+        a = (const u_char *)
+            &((const struct sockaddr_in6 *)addr)->sin6_addr + 12;
+    w = (uint32_t)a[0] << 24 | (uint32_t)a[1] << 16 |
+        (uint32_t)a[2] << 8 | a[3];
+    return ((int)(w % shards->n));
+}
+
+static int shards_pick(struct snmp_shards *shards,
+                       struct snmp_client *client, const char *host,
+                       const char *port) {
+    struct addrinfo hints, *res;
+    struct sockaddr_storage addr;
+    socklen_t addrlen;
+    int error, i;
+
+    if (client->resolver != NULL) {
+        if ((error = snmp_resolver_lookup(client->resolver, host, port,
+                                          shards->family, &addr,
+                                          &addrlen)) != 0) {
+            seterr(shards, "%s: %s", host, gai_strerror(error));
+            return (-1);
+        }
+        return (shards_index(shards, (struct sockaddr *)&addr));
+    }
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = shards->family;
+    hints.ai_socktype = SOCK_DGRAM;
+    if ((error = getaddrinfo(host, port, &hints, &res)) != 0) {
+        seterr(shards, "%s: %s", host, gai_strerror(error));
+        return (-1);
+    }
+    i = shards_index(shards, res->ai_addr);
+    freeaddrinfo(res);
+    return (i);
+}
+
+int snmp_shards_init(struct snmp_shards *shards, u_int n, int family,
+                     u_short port) {
+    struct snmp_shard *shard;
+    u_int i;
+
+    memset(shards, 0, sizeof(*shards));
+    shards->family = family;
+    shards->port = port;
+    if (n == 0) {
+        errno = EINVAL;
+        seterr(shards, "no shards");
+        return (-1);
+    }
+    if ((shards->shard = calloc(n, sizeof(*shard))) == NULL) {
+        seterr(shards, "%s", strerror(errno));
+        return (-1);
+    }
+
+    for (i = 0; i < n; i++) {
+        shard = &shards->shard[i];
+        shard->shards = shards;
+        shard->id = i;
+        shard->mux.fd = -1;
+        if ((shard->queue = calloc(SHARD_QUEUE,
+                                   sizeof(*shard->queue))) == NULL) {
+            seterr(shards, "%s", strerror(errno));
+            goto fail;
+        }
+        for (shard->tail = 0; shard->tail < SHARD_QUEUE; shard->tail++)
+            shard->queue[shard->tail].seq = shard->tail;
+        shard->tail = 0;
+        shards->n++;
+
+        if (snmp_loop_init(&shard->loop) == -1) {
+            seterr(shards, "%s", shard->loop.error);
+            goto fail;
+        }
+        if (snmp_mux_open_port(&shard->mux, family, port, port != 0) == -1) {
+            seterr(shards, "%s", shard->mux.error);
+            goto fail;
+        }
+    }
+    if (port != 0 && n > 1 && shards_steer(shards) == -1)
+        goto fail;
+    return (0);
+
+  fail:
+    snmp_shards_close(shards);
+    return (-1);
+}
+
+/* put an opened client into the loop of shard i */
+static int shards_add(struct snmp_shards *shards, struct snmp_client *client,
+                      int i) {
+    if (snmp_loop_add(&shards->shard[i].loop, client) == -1) {
+        seterr(shards, "%s", shards->shard[i].loop.error);
+        snmp_close(client);
+        client->mux = NULL;
+        return (-1);
+    }
+    return (0);
+}
+
+int snmp_shards_open(struct snmp_shards *shards, struct snmp_client *client,
+                     const char *host, const char *port,
+                     const char *read_community,
+                     const char *write_community) {
+    int i;
+
+    if (shards->started) {
+        errno = EBUSY;
+        seterr(shards, "shards are running");
+        return (-1);
+    }
+    if (shards->port == 0 || shards->n == 1)
+        i = shards->next++ % shards->n;
+    else if ((i = shards_pick(shards, client,
+                              host != NULL ? host : client->chost,
+                              port != NULL ? port : client->cport)) == -1)
+        return (-1);
+
+    client->mux = &shards->shard[i].mux;
+    if (snmp_open(client, host, port, read_community, write_community) != 0) {
+        client->mux = NULL;
+        seterr(shards, "%s", client->error);
+        return (-1);
+    }
+    return (shards_add(shards, client, i));
+}
+
+int snmp_shards_open_addr(struct snmp_shards *shards,
+                          struct snmp_client *client,
+                          const struct sockaddr *addr, socklen_t addrlen,
+                          const char *read_community,
+                          const char *write_community) {
+    int i;
+
+    if (shards->started) {
+        errno = EBUSY;
+        seterr(shards, "shards are running");
+        return (-1);
+    }
+    if (shards->port == 0 || shards->n == 1)
+        i = shards->next++ % shards->n;
+    else
+        i = shards_index(shards, addr);
+
+    client->mux = &shards->shard[i].mux;
+    if (snmp_open_addr(client, addr, addrlen, read_community,
+                       write_community) != 0) {
+        client->mux = NULL;
+        seterr(shards, "%s", client->error);
+        return (-1);
+    }
+    return (shards_add(shards, client, i));
+}
+
+int snmp_shards_start(struct snmp_shards *shards) {
+    struct snmp_shard *shard;
+    u_int i;
+
+    for (i = 0; i < shards->n; i++) {
+        shard = &shards->shard[i];
+        shard->stop = 0;
+        shard->running = 1;
+        if ((errno = pthread_create(&shard->thread, NULL, shard_run,
+                                    shard)) != 0) {
+            shard->running = 0;
+            seterr(shards, "pthread_create: %s", strerror(errno));
+            snmp_shards_stop(shards);
+            return (-1);
+        }
+    }
+    shards->started = 1;
+    return (0);
+}
+
+int snmp_shards_send(struct snmp_client *client, snmp_pdu_t *pdu,
+                     snmp_send_cb_f func, void *arg) {
+    struct snmp_shard *shard;
+    struct shard_item it;
+
+    if ((shard = client_shard(client)) == NULL) {
+        errno = EINVAL;
+        return (-1);
+    }
+    if (shard == current) {
+        snmp_pdu_set_header(client, pdu);
+        return (snmp_pdu_send(client, pdu, func, arg) == -1 ? -1 : 0);
+    }
+
+    it.client = client;
+    it.pdu = pdu;
+    it.func = func;
+    it.call = NULL;
+    it.arg = arg;
+    return (shard_put(shard, &it));
+}
+
+int snmp_shards_call(struct snmp_client *client, snmp_shards_call_f func,
+                     void *arg) {
+    struct snmp_shard *shard;
+    struct shard_item it;
+
+    if ((shard = client_shard(client)) == NULL) {
+        errno = EINVAL;
+        return (-1);
+    }
+    it.client = client;
+    it.pdu = NULL;
+    it.func = NULL;
+    it.call = func;
+    it.arg = arg;
+    return (shard_put(shard, &it));
+}
+
+void snmp_shards_stop(struct snmp_shards *shards) {
+    struct snmp_shard *shard;
+    u_int i;
+
+    for (i = 0; i < shards->n; i++) {
+        shard = &shards->shard[i];
+        if (!shard->running)
+            continue;
+        __atomic_store_n(&shard->stop, 1, __ATOMIC_SEQ_CST);
+        (void)snmp_loop_wakeup(&shard->loop);
+        (void)pthread_join(shard->thread, NULL);
+        shard->running = 0;
+    }
+    shards->started = 0;
+}
+
+void snmp_shards_close(struct snmp_shards *shards) {
+    struct snmp_shard *shard;
+    u_int i;
+
+    snmp_shards_stop(shards);
+    for (i = 0; i < shards->n; i++) {
+        shard = &shards->shard[i];
+        if (shard->mux.fd != -1)
+            snmp_mux_close(&shard->mux);
+        snmp_loop_close(&shard->loop);
+        free(shard->queue);
+    }
+    free(shards->shard);
+    shards->shard = NULL;
+    shards->n = 0;
+}
+
+#else /* !HAVE_EPOLL */
+
+int snmp_shards_init(struct snmp_shards *shards, u_int n, int family,
+                     u_short port) {
+    memset(shards, 0, sizeof(*shards));
+    (void)n;
+    (void)family;
+    (void)port;
+    errno = ENOSYS;
+    snprintf(shards->error, sizeof(shards->error), "%s", strerror(errno));
+    return (-1);
+}
+
+int snmp_shards_open(struct snmp_shards *shards, struct snmp_client *client,
+                     const char *host, const char *port,
+                     const char *read_community,
+                     const char *write_community) {
+    (void)client;
+    (void)host;
+    (void)port;
+    (void)read_community;
+    (void)write_community;
+    errno = ENOSYS;
+    snprintf(shards->error, sizeof(shards->error), "%s", strerror(errno));
+    return (-1);
+}
+
+int snmp_shards_open_addr(struct snmp_shards *shards,
+                          struct snmp_client *client,
+                          const struct sockaddr *addr, socklen_t addrlen,
+                          const char *read_community,
+                          const char *write_community) {
+    (void)client;
+    (void)addr;
+    (void)addrlen;
+    (void)read_community;
+    (void)write_community;
+    errno = ENOSYS;
+    snprintf(shards->error, sizeof(shards->error), "%s", strerror(errno));
+    return (-1);
+}
+
+int snmp_shards_start(struct snmp_shards *shards) {
+    errno = ENOSYS;
+    snprintf(shards->error, sizeof(shards->error), "%s", strerror(errno));
+    return (-1);
+}
+
+int snmp_shards_send(struct snmp_client *client, snmp_pdu_t *pdu,
+                     snmp_send_cb_f func, void *arg) {
+    (void)client;
+    (void)pdu;
+    (void)func;
+    (void)arg;
+    errno = ENOSYS;
+    return (-1);
+}
+
+int snmp_shards_call(struct snmp_client *client, snmp_shards_call_f func,
+                     void *arg) {
+    (void)client;
+    (void)func;
+    (void)arg;
+    errno = ENOSYS;
+    return (-1);
+}
+
+void snmp_shards_stop(struct snmp_shards *shards) {
+    (void)shards;
+}
+
+void snmp_shards_close(struct snmp_shards *shards) {
+    (void)shards;
+}
+
+#endif /* HAVE_EPOLL */
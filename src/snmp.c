@@ -54,6 +54,7 @@
 #include <string.h>
 #include <ctype.h>
 #ifndef _WIN32
+#include <netinet/in.h>
 #include <netdb.h>
 #endif
 #include <errno.h>
@@ -65,6 +66,7 @@
 
 static void snmp_error_func(const char *, ...);
 static void snmp_printf_func(const char *, ...);
+static int arena_owns(const snmp_arena_t *, const u_char *);
 
 void (*snmp_error)(const char *, ...) = snmp_error_func;
 void (*snmp_printf)(const char *, ...) = snmp_printf_func;
@@ -139,33 +141,30 @@ const char* snmp_get_error(enum snmp_code code) {
     return error_strings[code].str;
 }
 /*
-* Get the next variable binding from the list.
-* ASN errors on the sequence or the OID are always fatal.
+* Allocate memory for a value, from the arena if there is one.
 */
-static enum asn_err get_var_binding(asn_buf_t *b, snmp_value_t *binding) {
-    u_char type;
-    asn_len_t len, trailer;
-    enum asn_err err;
-
-    if (asn_get_sequence(b, &len) != ASN_ERR_OK) {
-        snmp_error("cannot parse varbind header");
-        return (ASN_ERR_FAILED);
-    }
+static void *value_alloc(snmp_arena_t *arena, size_t len) {
+    if (arena != NULL)
+        return (snmp_arena_alloc(arena, len));
+    return (malloc(len));
+}
 
-    /* temporary truncate the length so that the parser does not
-    * eat up bytes behind the sequence in the case the encoding is
-    * wrong of inner elements. */
-    trailer = b->asn_len - len;
-    b->asn_len = len;
+/*
+* Check whether p points into the receive buffer of the PDU.
+*/
+static int pdu_owns_buffer(const snmp_pdu_t *pdu, const u_char *p) {
+    return (pdu->rxbuf != NULL && p >= pdu->rxbuf &&
+            p <= pdu->rxbuf + pdu->rxbuf_size);
+}
 
-    if (asn_get_objid(b, &binding->oid) != ASN_ERR_OK) {
-        snmp_error("cannot parse binding objid");
-        return (ASN_ERR_FAILED);
-    }
-    if (asn_get_header(b, &type, &len) != ASN_ERR_OK) {
-        snmp_error("cannot parse binding value header");
-        return (ASN_ERR_FAILED);
-    }
+/*
+* Decode the value of a binding with the given tag and length. If pdu is
+* given, octet strings go into its receive buffer or arena.
+*/
+static enum asn_err get_var_value(asn_buf_t *b, u_char type, asn_len_t len,
+                                  snmp_value_t *binding, const snmp_pdu_t *pdu) {
+    enum asn_err err;
+    snmp_arena_t *arena = pdu != NULL ? pdu->arena : NULL;
 
     switch (type) {
 
@@ -181,7 +180,14 @@ static enum asn_err get_var_binding(asn_buf_t *b, snmp_value_t *binding) {
 
     case ASN_TYPE_OCTETSTRING:
         binding->syntax = SNMP_SYNTAX_OCTETSTRING;
-        binding->v.octetstring.octets = malloc(len);
+        if (pdu != NULL && pdu_owns_buffer(pdu, b->asn_cptr)) {
+            binding->v.octetstring.octets = NULL;
+            binding->v.octetstring.len = len;
+            err = asn_get_octetstring_ref(b, len,
+                                          &binding->v.octetstring.octets);
+            break;
+        }
+        binding->v.octetstring.octets = value_alloc(arena, len);
         if (binding->v.octetstring.octets == NULL) {
             snmp_error("%s", strerror(errno));
             return (ASN_ERR_FAILED);
@@ -191,7 +197,8 @@ static enum asn_err get_var_binding(asn_buf_t *b, snmp_value_t *binding) {
                                       binding->v.octetstring.octets,
                                       &binding->v.octetstring.len);
         if (ASN_ERR_STOPPED(err)) {
-            free(binding->v.octetstring.octets);
+            if (arena == NULL)
+                free(binding->v.octetstring.octets);
             binding->v.octetstring.octets = NULL;
         }
         break;
@@ -248,6 +255,40 @@ static enum asn_err get_var_binding(asn_buf_t *b, snmp_value_t *binding) {
         break;
     }
 
+    return (err);
+}
+
+/*
+* Get the next variable binding from the list.
+* ASN errors on the sequence or the OID are always fatal.
+*/
+static enum asn_err get_var_binding(asn_buf_t *b, snmp_value_t *binding,
+                                    const snmp_pdu_t *pdu) {
+    u_char type;
+    asn_len_t len, trailer;
+    enum asn_err err;
+
+    if (asn_get_sequence(b, &len) != ASN_ERR_OK) {
+        snmp_error("cannot parse varbind header");
+        return (ASN_ERR_FAILED);
+    }
+
+    /* temporary truncate the length so that the parser does not
+    * eat up bytes behind the sequence in the case the encoding is
+    * wrong of inner elements. */
+    trailer = b->asn_len - len;
+    b->asn_len = len;
+
+    if (asn_get_objid(b, &binding->oid) != ASN_ERR_OK) {
+        snmp_error("cannot parse binding objid");
+        return (ASN_ERR_FAILED);
+    }
+    if (asn_get_header(b, &type, &len) != ASN_ERR_OK) {
+        snmp_error("cannot parse binding value header");
+        return (ASN_ERR_FAILED);
+    }
+
+    err = get_var_value(b, type, len, binding, pdu);
     if (ASN_ERR_STOPPED(err)) {
         snmp_error("cannot parse binding value");
         return (err);
@@ -323,15 +364,14 @@ static enum asn_err parse_pdus(asn_buf_t *b, snmp_pdu_t *pdu, int32_t *ip) {
 
     trailer = b->asn_len - len;
 
-    v = pdu->bindings;
     err = ASN_ERR_OK;
     while (b->asn_len != 0) {
-        if (pdu->nbindings == SNMP_MAX_BINDINGS) {
-            snmp_error("too many bindings (> %u) in PDU",
-                       SNMP_MAX_BINDINGS);
+        if (snmp_pdu_reserve(pdu, pdu->nbindings + 1) != 0) {
+            snmp_error("no memory for %u bindings", pdu->nbindings + 1);
             return (ASN_ERR_FAILED);
         }
-        err1 = get_var_binding(b, v);
+        v = &pdu->bindings[pdu->nbindings];
+        err1 = get_var_binding(b, v, pdu);
         if (ASN_ERR_STOPPED(err1))
             return (ASN_ERR_FAILED);
         if (err1 != ASN_ERR_OK && err == ASN_ERR_OK) {
@@ -339,7 +379,6 @@ static enum asn_err parse_pdus(asn_buf_t *b, snmp_pdu_t *pdu, int32_t *ip) {
             *ip = pdu->nbindings + 1;
         }
         pdu->nbindings++;
-        v++;
     }
 
     b->asn_len = trailer;
@@ -605,10 +644,15 @@ enum snmp_code snmp_pdu_decode_header(asn_buf_t *b, snmp_pdu_t *pdu) {
     return (SNMP_CODE_OK);
 }
 
-enum snmp_code snmp_pdu_decode_scoped(asn_buf_t *b, snmp_pdu_t *pdu, int32_t *ip) {
+/*
+* Decode the scoped PDU up to and including the PDU header. On return
+* b->asn_len is truncated to the PDU and the rest of the message length
+* is stored in trailerp.
+*/
+static enum snmp_code decode_scoped_hdr(asn_buf_t *b, snmp_pdu_t *pdu,
+                                        asn_len_t *trailerp) {
     u_char type;
-    asn_len_t len, trailer;
-    enum asn_err err;
+    asn_len_t len;
 
     if (pdu->version == SNMP_V3) {
         if (asn_get_sequence(b, &len) != ASN_ERR_OK) {
@@ -674,9 +718,20 @@ enum snmp_code snmp_pdu_decode_scoped(asn_buf_t *b, snmp_pdu_t *pdu, int32_t *ip
         return (SNMP_CODE_FAILED);
     }
 
-    trailer = b->asn_len - len;
+    *trailerp = b->asn_len - len;
     b->asn_len = len;
 
+    return (SNMP_CODE_OK);
+}
+
+enum snmp_code snmp_pdu_decode_scoped(asn_buf_t *b, snmp_pdu_t *pdu, int32_t *ip) {
+    asn_len_t trailer;
+    enum snmp_code code;
+    enum asn_err err;
+
+    if ((code = decode_scoped_hdr(b, pdu, &trailer)) != SNMP_CODE_OK)
+        return (code);
+
     err = parse_pdus(b, pdu, ip);
     if (ASN_ERR_STOPPED(err))
         return (SNMP_CODE_FAILED);
@@ -689,6 +744,128 @@ enum snmp_code snmp_pdu_decode_scoped(asn_buf_t *b, snmp_pdu_t *pdu, int32_t *ip
     return (SNMP_CODE_OK);
 }
 
+/*
+* Decode a message like snmp_pdu_decode, but leave the variable bindings
+* in the buffer. Only the framing and the header fields are checked and
+* put into pdu, the bindings can then be walked with snmp_varbind_next.
+* The cursor points into b, so the buffer must stay valid while the
+* cursor is used. For encrypted messages this is the decrypted buffer.
+*/
+enum snmp_code snmp_pdu_decode_lazy(asn_buf_t *b, snmp_pdu_t *pdu,
+                                    snmp_varbind_cursor_t *cur) {
+    asn_len_t len, trailer;
+    enum snmp_code code;
+
+    if ((code = snmp_pdu_decode_header(b, pdu)) != SNMP_CODE_OK) {
+        if (code == SNMP_CODE_BADENC && pdu->version == SNMP_Verr)
+            return (SNMP_CODE_BADVERS);
+        return (code);
+    }
+
+    if (pdu->version == SNMP_V3) {
+        if (pdu->security_model != SNMP_SECMODEL_USM)
+            return (SNMP_CODE_FAILED);
+        if ((code = snmp_pdu_decode_secmode(b, pdu)) != SNMP_CODE_OK)
+            return (code);
+    }
+
+    if ((code = decode_scoped_hdr(b, pdu, &trailer)) != SNMP_CODE_OK)
+        return (code);
+
+    if (ASN_ERR_STOPPED(snmp_parse_pdus_hdr(b, pdu, &len)))
+        return (SNMP_CODE_FAILED);
+
+    pdu->vars_ptr = b->asn_ptr;
+    cur->vars.asn_cptr = b->asn_cptr;
+    cur->vars.asn_len = len;
+
+    b->asn_cptr += len;
+    b->asn_len -= len;
+    if (b->asn_len != 0)
+        snmp_error("ignoring trailing junk after pdu");
+
+    b->asn_len = trailer;
+
+    return (SNMP_CODE_OK);
+}
+
+/*
+* Get the next binding from a cursor. Only the framing of the binding is
+* checked, vb gets the contents octets of the name and the tag and the
+* contents octets of the value. Returns:
+*   -1		if there are ASN.1 errors
+*    0		if there are no more bindings
+*   +1		if a binding was returned
+*/
+int snmp_varbind_next(snmp_varbind_cursor_t *cur, snmp_varbind_raw_t *vb) {
+    asn_buf_t b;
+    asn_len_t len;
+    u_char type;
+
+    if (cur->vars.asn_len == 0)
+        return (0);
+
+    if (asn_get_sequence(&cur->vars, &len) != ASN_ERR_OK) {
+        snmp_error("cannot parse varbind header");
+        return (-1);
+    }
+    b.asn_cptr = cur->vars.asn_cptr;
+    b.asn_len = len;
+    cur->vars.asn_cptr += len;
+    cur->vars.asn_len -= len;
+
+    if (asn_get_header(&b, &type, &vb->oid_len) != ASN_ERR_OK ||
+            type != ASN_TYPE_OBJID || vb->oid_len > b.asn_len) {
+        snmp_error("cannot parse binding objid");
+        cur->vars.asn_len = 0;
+        return (-1);
+    }
+    vb->oid = b.asn_cptr;
+    b.asn_cptr += vb->oid_len;
+    b.asn_len -= vb->oid_len;
+
+    if (asn_get_header(&b, &vb->type, &vb->value_len) != ASN_ERR_OK ||
+            vb->value_len > b.asn_len) {
+        snmp_error("cannot parse binding value header");
+        cur->vars.asn_len = 0;
+        return (-1);
+    }
+    vb->value = b.asn_cptr;
+
+    if (b.asn_len != vb->value_len)
+        snmp_error("ignoring junk at end of binding");
+
+    return (1);
+}
+
+/*
+* Decode the name of a binding returned by snmp_varbind_next.
+*/
+enum asn_err snmp_varbind_get_oid(const snmp_varbind_raw_t *vb, asn_oid_t *oid) {
+    asn_buf_t b;
+
+    b.asn_cptr = vb->oid;
+    b.asn_len = vb->oid_len;
+    return (asn_get_objid_raw(&b, vb->oid_len, oid));
+}
+
+/*
+* Decode a binding returned by snmp_varbind_next into a snmp_value_t.
+* Octet strings are allocated and must be freed with snmp_value_free.
+*/
+enum asn_err snmp_varbind_decode(const snmp_varbind_raw_t *vb,
+                                 snmp_value_t *value) {
+    asn_buf_t b;
+    enum asn_err err;
+
+    if ((err = snmp_varbind_get_oid(vb, &value->oid)) != ASN_ERR_OK)
+        return (err);
+
+    b.asn_cptr = vb->value;
+    b.asn_len = vb->value_len;
+    return (get_var_value(&b, vb->type, vb->value_len, value, NULL));
+}
+
 enum snmp_code snmp_pdu_decode_secmode(asn_buf_t *b, snmp_pdu_t *pdu) {
     u_char type;
     enum snmp_code code;
@@ -900,6 +1077,21 @@ static enum asn_err snmp_pdu_fix_padd(asn_buf_t *b, snmp_pdu_t *pdu) {
     return (ASN_ERR_OK);
 }
 
+/*
+* Compute the digest over the complete message described by outer_ptr and
+* outer_len and put it into the message.
+*/
+static enum snmp_code snmp_pdu_sign(snmp_pdu_t *pdu) {
+    if (snmp_pdu_calc_digest(pdu, pdu->msg_digest) != SNMP_CODE_OK)
+        return (SNMP_CODE_FAILED);
+
+    if ((pdu->flags & SNMP_MSG_AUTH_FLAG) != 0)
+        memcpy(pdu->digest_ptr, pdu->msg_digest,
+               sizeof(pdu->msg_digest));
+
+    return (SNMP_CODE_OK);
+}
+
 enum snmp_code snmp_fix_encoding(asn_buf_t *b, snmp_pdu_t *pdu) {
     size_t moved = 0;
     enum snmp_code code;
@@ -933,15 +1125,8 @@ enum snmp_code snmp_fix_encoding(asn_buf_t *b, snmp_pdu_t *pdu) {
     pdu->outer_len = b->asn_ptr - pdu->outer_ptr;
     pdu->digest_ptr -= moved;
 
-    if (pdu->version == SNMP_V3) {
-        if ((code = snmp_pdu_calc_digest(pdu, pdu->msg_digest)) !=
-                SNMP_CODE_OK)
-            return (SNMP_CODE_FAILED);
-
-        if ((pdu->flags & SNMP_MSG_AUTH_FLAG) != 0)
-            memcpy(pdu->digest_ptr, pdu->msg_digest,
-                   sizeof(pdu->msg_digest));
-    }
+    if (pdu->version == SNMP_V3)
+        return (snmp_pdu_sign(pdu));
 
     return (SNMP_CODE_OK);
 }
@@ -1033,138 +1218,482 @@ enum asn_err snmp_binding_encode(asn_buf_t *b, const snmp_value_t *binding) {
 }
 
 /*
-* Encode an PDU.
+* Encode a binding tail-first. This is the reverse of snmp_binding_encode,
+* b must be set up for the asn_rput functions.
 */
-enum snmp_code snmp_pdu_encode(snmp_pdu_t *pdu, asn_buf_t *resp_b) {
-    u_int idx;
-    enum snmp_code err;
-
-    if ((err = snmp_pdu_encode_header(resp_b, pdu)) != SNMP_CODE_OK)
-        return (err);
-    for (idx = 0; idx < pdu->nbindings; idx++)
-        if ((err = snmp_binding_encode(resp_b, &pdu->bindings[idx]))
-                != ASN_ERR_OK)
-            return (SNMP_CODE_FAILED);
-
-    return (snmp_fix_encoding(resp_b, pdu));
-}
-
-static void dump_binding(const snmp_value_t *b) {
-    u_int i;
-    char buf[ASN_OIDSTRLEN];
+enum asn_err snmp_binding_encode_rev(asn_buf_t *b, const snmp_value_t *binding) {
+    u_char *end = b->asn_ptr;
+    enum asn_err err;
+    asn_buf_t save = *b;
 
-    snmp_printf("%s=", asn_oid2str_r(&b->oid, buf));
-    switch (b->syntax) {
+    switch (binding->syntax) {
 
     case SNMP_SYNTAX_NULL:
-        snmp_printf("NULL");
+        err = asn_rput_null(b);
         break;
 
     case SNMP_SYNTAX_INTEGER:
-        snmp_printf("INTEGER %d", b->v.integer);
+        err = asn_rput_integer(b, binding->v.integer);
         break;
 
     case SNMP_SYNTAX_OCTETSTRING:
-        snmp_printf("OCTET STRING %lu:", b->v.octetstring.len);
-        for (i = 0; i < b->v.octetstring.len; i++)
-            snmp_printf(" %02x", b->v.octetstring.octets[i]);
+        err = asn_rput_octetstring(b, binding->v.octetstring.octets,
+                                   binding->v.octetstring.len);
         break;
 
     case SNMP_SYNTAX_OID:
-        snmp_printf("OID %s", asn_oid2str_r(&b->v.oid, buf));
+        err = asn_rput_objid(b, &binding->v.oid);
         break;
 
     case SNMP_SYNTAX_IPADDRESS:
-        snmp_printf("IPADDRESS %u.%u.%u.%u", b->v.ipaddress[0],
-                    b->v.ipaddress[1], b->v.ipaddress[2], b->v.ipaddress[3]);
+        err = asn_rput_ipaddress(b, binding->v.ipaddress);
         break;
 
-    case SNMP_SYNTAX_COUNTER:
-        snmp_printf("COUNTER %u", b->v.uint32);
+    case SNMP_SYNTAX_TIMETICKS:
+        err = asn_rput_uint32(b, ASN_APP_TIMETICKS, binding->v.uint32);
         break;
 
-    case SNMP_SYNTAX_GAUGE:
-        snmp_printf("GAUGE %u", b->v.uint32);
+    case SNMP_SYNTAX_COUNTER:
+        err = asn_rput_uint32(b, ASN_APP_COUNTER, binding->v.uint32);
         break;
 
-    case SNMP_SYNTAX_TIMETICKS:
-        snmp_printf("TIMETICKS %u", b->v.uint32);
+    case SNMP_SYNTAX_GAUGE:
+        err = asn_rput_uint32(b, ASN_APP_GAUGE, binding->v.uint32);
         break;
 
     case SNMP_SYNTAX_COUNTER64:
-        snmp_printf("COUNTER64 %lld", b->v.counter64);
+        err = asn_rput_counter64(b, binding->v.counter64);
         break;
 
     case SNMP_SYNTAX_NOSUCHOBJECT:
-        snmp_printf("NoSuchObject");
+        err = asn_rput_exception(b, ASN_EXCEPT_NOSUCHOBJECT);
         break;
 
     case SNMP_SYNTAX_NOSUCHINSTANCE:
-        snmp_printf("NoSuchInstance");
+        err = asn_rput_exception(b, ASN_EXCEPT_NOSUCHINSTANCE);
         break;
 
     case SNMP_SYNTAX_ENDOFMIBVIEW:
-        snmp_printf("EndOfMibView");
+        err = asn_rput_exception(b, ASN_EXCEPT_ENDOFMIBVIEW);
         break;
 
     default:
-        snmp_printf("UNKNOWN SYNTAX %u", b->syntax);
+        err = ASN_ERR_FAILED;
         break;
     }
+
+    if (err == ASN_ERR_OK)
+        err = asn_rput_objid(b, &binding->oid);
+    if (err == ASN_ERR_OK)
+        err = asn_rput_seqhdr(b, (ASN_TYPE_SEQUENCE |
+                                  ASN_TYPE_CONSTRUCTED), end);
+    if (err != ASN_ERR_OK) {
+        *b = save;
+        return (err);
+    }
+
+    return (ASN_ERR_OK);
 }
 
-static __inline void dump_bindings(const snmp_pdu_t *pdu) {
-    u_int i;
+/*
+* Tail-first variant of pdu_encode_secparams.
+*/
+static enum snmp_code pdu_encode_secparams_rev(asn_buf_t *b, snmp_pdu_t *pdu) {
+    u_char *end = b->asn_ptr;
+    u_char *digest_end;
 
-    for (i = 0; i < pdu->nbindings; i++) {
-        snmp_printf(" [%u]: ", i);
-        dump_binding(&pdu->bindings[i]);
-        snmp_printf("\n");
+    if ((pdu->flags & SNMP_MSG_PRIV_FLAG) != 0) {
+        if (asn_rput_octetstring(b, (u_char *)pdu->msg_salt,
+                                 sizeof(pdu->msg_salt)) != ASN_ERR_OK)
+            return (SNMP_CODE_FAILED);
+    } else {
+        if (asn_rput_octetstring(b, (u_char *)pdu->msg_salt, 0)
+                != ASN_ERR_OK)
+            return (SNMP_CODE_FAILED);
     }
-}
 
-static __inline void dump_notrap(const snmp_pdu_t *pdu) {
-    snmp_printf(" request_id=%d", pdu->request_id);
-    snmp_printf(" error_status=%d", pdu->error_status);
-    snmp_printf(" error_index=%d\n", pdu->error_index);
-    dump_bindings(pdu);
-}
+    pdu->digest_ptr = NULL;
+    if ((pdu->flags & SNMP_MSG_AUTH_FLAG) != 0) {
+        digest_end = b->asn_ptr;
+        if (asn_rput_octetstring(b, (u_char *)pdu->msg_digest,
+                                 sizeof(pdu->msg_digest)) != ASN_ERR_OK)
+            return (SNMP_CODE_FAILED);
+        pdu->digest_ptr = digest_end - sizeof(pdu->msg_digest);
+    } else {
+        if (asn_rput_octetstring(b, (u_char *)pdu->msg_digest, 0)
+                != ASN_ERR_OK)
+            return (SNMP_CODE_FAILED);
+    }
 
-void snmp_pdu_dump(const snmp_pdu_t *pdu) {
-    char buf[ASN_OIDSTRLEN];
-    const char *vers;
-    static const char *types[9];
-
-    types[SNMP_PDU_GET]      =	"GET";
-    types[SNMP_PDU_GETNEXT]  =	"GETNEXT";
-    types[SNMP_PDU_RESPONSE] =	"RESPONSE";
-    types[SNMP_PDU_SET]      =	"SET";
-    types[SNMP_PDU_TRAP]     =	"TRAPv1";
-    types[SNMP_PDU_GETBULK]  =	"GETBULK";
-    types[SNMP_PDU_INFORM]   =	"INFORM";
-    types[SNMP_PDU_TRAP2]    =	"TRAPv2";
-    types[SNMP_PDU_REPORT]   =	"REPORT";
+    if (asn_rput_octetstring(b, (u_char *)pdu->user.sec_name,
+                             strlen(pdu->user.sec_name)) != ASN_ERR_OK)
+        return (SNMP_CODE_FAILED);
 
-    if (pdu->version == SNMP_V1)
-        vers = "SNMPv1";
-    else if (pdu->version == SNMP_V2c)
-        vers = "SNMPv2c";
-    else if (pdu->version == SNMP_V3)
-        vers = "SNMPv3";
-    else
-        vers = "v?";
+    if (asn_rput_integer(b, pdu->engine.engine_time) != ASN_ERR_OK)
+        return (SNMP_CODE_FAILED);
 
-    switch (pdu->pdu_type) {
-    case SNMP_PDU_TRAP:
-        snmp_printf("%s %s '%s'", types[pdu->pdu_type], vers, pdu->community);
-        snmp_printf(" enterprise=%s", asn_oid2str_r(&pdu->enterprise, buf));
-        snmp_printf(" agent_addr=%u.%u.%u.%u", pdu->agent_addr[0],
-                    pdu->agent_addr[1], pdu->agent_addr[2], pdu->agent_addr[3]);
-        snmp_printf(" generic_trap=%d", pdu->generic_trap);
-        snmp_printf(" specific_trap=%d", pdu->specific_trap);
-        snmp_printf(" time-stamp=%u\n", pdu->time_stamp);
-        dump_bindings(pdu);
-        break;
+    if (asn_rput_integer(b, pdu->engine.engine_boots) != ASN_ERR_OK)
+        return (SNMP_CODE_FAILED);
+
+    if (asn_rput_octetstring(b, (u_char *)pdu->engine.engine_id,
+                             pdu->engine.engine_len) != ASN_ERR_OK)
+        return (SNMP_CODE_FAILED);
+
+    if (asn_rput_seqhdr(b, (ASN_TYPE_SEQUENCE|ASN_TYPE_CONSTRUCTED),
+                        end) != ASN_ERR_OK ||
+            asn_rput_seqhdr(b, ASN_TYPE_OCTETSTRING, end) != ASN_ERR_OK)
+        return (SNMP_CODE_FAILED);
+
+    return (SNMP_CODE_OK);
+}
+
+/*
+* Prepare b for the tail-first encoding of pdu: check the version, move
+* b->asn_ptr to the end of the buffer and reserve room for the DES padding.
+* The end of the scoped PDU is returned in endp.
+*/
+enum snmp_code snmp_pdu_encode_rev_start(snmp_pdu_t *pdu, asn_buf_t *b,
+        u_char **endp) {
+    if (pdu->version != SNMP_V1 && pdu->version != SNMP_V2c &&
+            pdu->version != SNMP_V3)
+        return (SNMP_CODE_BADVERS);
+
+    if (pdu->version == SNMP_V3) {
+        if (pdu->security_model != SNMP_SECMODEL_USM)
+            return (SNMP_CODE_FAILED);
+        if (pdu->pdu_type != SNMP_PDU_RESPONSE &&
+                pdu->pdu_type != SNMP_PDU_TRAP &&
+                pdu->pdu_type != SNMP_PDU_TRAP2 &&
+                pdu->pdu_type != SNMP_PDU_REPORT)
+            pdu->flags |= SNMP_MSG_REPORT_FLAG;
+    }
+
+    pdu->digest_ptr = NULL;
+    pdu->encrypted_ptr = NULL;
+    pdu->scoped_ptr = NULL;
+
+    b->asn_ptr += b->asn_len;
+    if (pdu->version == SNMP_V3 && pdu->user.priv_proto == SNMP_PRIV_DES) {
+        if (b->asn_len < 7)
+            return (SNMP_CODE_FAILED);
+        b->asn_ptr -= 7;
+        b->asn_len -= 7;
+    }
+    *endp = b->asn_ptr;
+
+    return (SNMP_CODE_OK);
+}
+
+/*
+* Encode the variable bindings list of pdu tail-first in front of
+* b->asn_ptr.
+*/
+enum snmp_code snmp_pdu_encode_vars_rev(asn_buf_t *b, snmp_pdu_t *pdu) {
+    u_char *end = b->asn_ptr;
+    u_int idx;
+
+    for (idx = pdu->nbindings; idx > 0; idx--)
+        if (snmp_binding_encode_rev(b, &pdu->bindings[idx - 1])
+                != ASN_ERR_OK)
+            return (SNMP_CODE_FAILED);
+
+    if (asn_rput_seqhdr(b, (ASN_TYPE_SEQUENCE|ASN_TYPE_CONSTRUCTED),
+                        end) != ASN_ERR_OK)
+        return (SNMP_CODE_FAILED);
+    pdu->vars_ptr = b->asn_ptr;
+
+    return (SNMP_CODE_OK);
+}
+
+/*
+* Encode everything around an already encoded variable bindings list
+* that starts at b->asn_ptr. end is the value returned by
+* snmp_pdu_encode_rev_start. On return the encoded message starts at
+* pdu->outer_ptr and is pdu->outer_len bytes long.
+*/
+enum snmp_code snmp_pdu_encode_rev_finish(snmp_pdu_t *pdu, asn_buf_t *b,
+        u_char *end) {
+    int32_t version;
+    u_char *seq_end;
+    asn_len_t padlen;
+
+    if (pdu->version == SNMP_V1)
+        version = 0;
+    else if (pdu->version == SNMP_V2c)
+        version = 1;
+    else if (pdu->version == SNMP_V3)
+        version = 3;
+    else
+        return (SNMP_CODE_BADVERS);
+
+    pdu->vars_ptr = b->asn_ptr;
+
+    if (pdu->pdu_type == SNMP_PDU_TRAP) {
+        if (pdu->version != SNMP_V1 ||
+                asn_rput_timeticks(b, pdu->time_stamp) != ASN_ERR_OK ||
+                asn_rput_integer(b, pdu->specific_trap) != ASN_ERR_OK ||
+                asn_rput_integer(b, pdu->generic_trap) != ASN_ERR_OK ||
+                asn_rput_ipaddress(b, pdu->agent_addr) != ASN_ERR_OK ||
+                asn_rput_objid(b, &pdu->enterprise) != ASN_ERR_OK)
+            return (SNMP_CODE_FAILED);
+    } else {
+        if (pdu->version == SNMP_V1 && (pdu->pdu_type == SNMP_PDU_GETBULK ||
+                                        pdu->pdu_type == SNMP_PDU_INFORM ||
+                                        pdu->pdu_type == SNMP_PDU_TRAP2 ||
+                                        pdu->pdu_type == SNMP_PDU_REPORT))
+            return (SNMP_CODE_FAILED);
+
+        if (asn_rput_integer(b, pdu->error_index) != ASN_ERR_OK ||
+                asn_rput_integer(b, pdu->error_status) != ASN_ERR_OK ||
+                asn_rput_integer(b, pdu->request_id) != ASN_ERR_OK)
+            return (SNMP_CODE_FAILED);
+    }
+
+    if (asn_rput_seqhdr(b, (ASN_TYPE_CONSTRUCTED | ASN_CLASS_CONTEXT |
+                            pdu->pdu_type), end) != ASN_ERR_OK)
+        return (SNMP_CODE_FAILED);
+    pdu->pdu_ptr = b->asn_ptr;
+
+    if (pdu->version == SNMP_V3) {
+        /*  View-based Access Conntrol information */
+        if (asn_rput_octetstring(b, (u_char *)pdu->context_name,
+                                 strlen(pdu->context_name)) != ASN_ERR_OK)
+            return (SNMP_CODE_FAILED);
+
+        if (asn_rput_octetstring(b, (u_char *)pdu->context_engine,
+                                 pdu->context_engine_len) != ASN_ERR_OK)
+            return (SNMP_CODE_FAILED);
+
+        if (asn_rput_seqhdr(b, (ASN_TYPE_SEQUENCE |
+                                ASN_TYPE_CONSTRUCTED), end) != ASN_ERR_OK)
+            return (SNMP_CODE_FAILED);
+        pdu->scoped_ptr = b->asn_ptr;
+        pdu->scoped_len = end - pdu->scoped_ptr;
+
+        /* the padding goes into the space reserved above */
+        if (pdu->user.priv_proto == SNMP_PRIV_DES &&
+                pdu->scoped_len % 8 != 0) {
+            padlen = 8 - (pdu->scoped_len % 8);
+            memset(end, 0, padlen);
+            end += padlen;
+            pdu->scoped_len += padlen;
+        }
+
+        if (snmp_pdu_encrypt(pdu) != SNMP_CODE_OK)
+            return (SNMP_CODE_FAILED);
+
+        if (pdu->user.priv_proto != SNMP_PRIV_NOPRIV) {
+            if (asn_rput_seqhdr(b, ASN_TYPE_OCTETSTRING, end) != ASN_ERR_OK)
+                return (SNMP_CODE_FAILED);
+            pdu->encrypted_ptr = b->asn_ptr;
+        }
+
+        if (pdu_encode_secparams_rev(b, pdu) != SNMP_CODE_OK)
+            return (SNMP_CODE_FAILED);
+
+        seq_end = b->asn_ptr;
+        if (asn_rput_integer(b, pdu->security_model) != ASN_ERR_OK)
+            return (SNMP_CODE_FAILED);
+
+        if (asn_rput_octetstring(b, (u_char *)&pdu->flags, 1)
+                != ASN_ERR_OK)
+            return (SNMP_CODE_FAILED);
+
+        if (asn_rput_integer(b, pdu->engine.max_msg_size) != ASN_ERR_OK)
+            return (SNMP_CODE_FAILED);
+
+        if (asn_rput_integer(b, pdu->identifier) != ASN_ERR_OK)
+            return (SNMP_CODE_FAILED);
+
+        if (asn_rput_seqhdr(b, (ASN_TYPE_SEQUENCE |
+                                ASN_TYPE_CONSTRUCTED), seq_end) != ASN_ERR_OK)
+            return (SNMP_CODE_FAILED);
+    } else {
+        if (asn_rput_octetstring(b, (u_char *)pdu->community,
+                                 strlen(pdu->community)) != ASN_ERR_OK)
+            return (SNMP_CODE_FAILED);
+    }
+
+    if (asn_rput_integer(b, version) != ASN_ERR_OK)
+        return (SNMP_CODE_FAILED);
+
+    if (asn_rput_seqhdr(b, (ASN_TYPE_SEQUENCE|ASN_TYPE_CONSTRUCTED),
+                        end) != ASN_ERR_OK)
+        return (SNMP_CODE_FAILED);
+
+    pdu->outer_ptr = b->asn_ptr;
+    pdu->outer_len = end - pdu->outer_ptr;
+
+    if (pdu->version == SNMP_V3)
+        return (snmp_pdu_sign(pdu));
+
+    return (SNMP_CODE_OK);
+}
+
+/*
+* Encode a PDU tail-first into the end of b. The bindings are written
+* first, then the headers from the inside to the outside, so each length
+* is known when it is written and nothing has to be moved. On return the
+* encoded message starts at pdu->outer_ptr and is pdu->outer_len bytes
+* long, b->asn_ptr points to its start. For DES privacy up to 7 bytes at
+* the end of the buffer are reserved for the padding and may stay unused.
+*/
+enum snmp_code snmp_pdu_encode_rev(snmp_pdu_t *pdu, asn_buf_t *b) {
+    enum snmp_code err;
+    u_char *end;
+
+    if ((err = snmp_pdu_encode_rev_start(pdu, b, &end)) != SNMP_CODE_OK)
+        return (err);
+
+    if ((err = snmp_pdu_encode_vars_rev(b, pdu)) != SNMP_CODE_OK)
+        return (err);
+
+    return (snmp_pdu_encode_rev_finish(pdu, b, end));
+}
+
+/*
+* Encode an PDU. The message is encoded tail-first into the free part of
+* resp_b and then relocated to its start in one go, so that the result
+* is the same as with the forward encoder. Callers that can send from
+* anywhere in the buffer should use snmp_pdu_encode_rev directly.
+*/
+enum snmp_code snmp_pdu_encode(snmp_pdu_t *pdu, asn_buf_t *resp_b) {
+    asn_buf_t b = *resp_b;
+    enum snmp_code err;
+    ptrdiff_t delta;
+
+    if ((err = snmp_pdu_encode_rev(pdu, &b)) != SNMP_CODE_OK)
+        return (err);
+
+    delta = resp_b->asn_ptr - pdu->outer_ptr;
+    if (delta != 0) {
+        memmove(resp_b->asn_ptr, pdu->outer_ptr, pdu->outer_len);
+        pdu->outer_ptr += delta;
+        pdu->pdu_ptr += delta;
+        pdu->vars_ptr += delta;
+        if (pdu->scoped_ptr != NULL)
+            pdu->scoped_ptr += delta;
+        if (pdu->encrypted_ptr != NULL)
+            pdu->encrypted_ptr += delta;
+        if (pdu->digest_ptr != NULL)
+            pdu->digest_ptr += delta;
+    }
+    resp_b->asn_ptr += pdu->outer_len;
+    resp_b->asn_len -= pdu->outer_len;
+
+    return (SNMP_CODE_OK);
+}
+
+static void dump_binding(const snmp_value_t *b) {
+    u_int i;
+    char buf[ASN_OIDSTRLEN];
+
+    snmp_printf("%s=", asn_oid2str_r(&b->oid, buf));
+    switch (b->syntax) {
+
+    case SNMP_SYNTAX_NULL:
+        snmp_printf("NULL");
+        break;
+
+    case SNMP_SYNTAX_INTEGER:
+        snmp_printf("INTEGER %d", b->v.integer);
+        break;
+
+    case SNMP_SYNTAX_OCTETSTRING:
+        snmp_printf("OCTET STRING %lu:", b->v.octetstring.len);
+        for (i = 0; i < b->v.octetstring.len; i++)
+            snmp_printf(" %02x", b->v.octetstring.octets[i]);
+        break;
+
+    case SNMP_SYNTAX_OID:
+        snmp_printf("OID %s", asn_oid2str_r(&b->v.oid, buf));
+        break;
+
+    case SNMP_SYNTAX_IPADDRESS:
+        snmp_printf("IPADDRESS %u.%u.%u.%u", b->v.ipaddress[0],
+                    b->v.ipaddress[1], b->v.ipaddress[2], b->v.ipaddress[3]);
+        break;
+
+    case SNMP_SYNTAX_COUNTER:
+        snmp_printf("COUNTER %u", b->v.uint32);
+        break;
+
+    case SNMP_SYNTAX_GAUGE:
+        snmp_printf("GAUGE %u", b->v.uint32);
+        break;
+
+    case SNMP_SYNTAX_TIMETICKS:
+        snmp_printf("TIMETICKS %u", b->v.uint32);
+        break;
+
+    case SNMP_SYNTAX_COUNTER64:
+        snmp_printf("COUNTER64 %lld", b->v.counter64);
+        break;
+
+    case SNMP_SYNTAX_NOSUCHOBJECT:
+        snmp_printf("NoSuchObject");
+        break;
+
+    case SNMP_SYNTAX_NOSUCHINSTANCE:
+        snmp_printf("NoSuchInstance");
+        break;
+
+    case SNMP_SYNTAX_ENDOFMIBVIEW:
+        snmp_printf("EndOfMibView");
+        break;
+
+    default:
+        snmp_printf("UNKNOWN SYNTAX %u", b->syntax);
+        break;
+    }
+}
+
+static __inline void dump_bindings(const snmp_pdu_t *pdu) {
+    u_int i;
+
+    for (i = 0; i < pdu->nbindings; i++) {
+        snmp_printf(" [%u]: ", i);
+        dump_binding(&pdu->bindings[i]);
+        snmp_printf("\n");
+    }
+}
+
+static __inline void dump_notrap(const snmp_pdu_t *pdu) {
+    snmp_printf(" request_id=%d", pdu->request_id);
+    snmp_printf(" error_status=%d", pdu->error_status);
+    snmp_printf(" error_index=%d\n", pdu->error_index);
+    dump_bindings(pdu);
+}
+
+void snmp_pdu_dump(const snmp_pdu_t *pdu) {
+    char buf[ASN_OIDSTRLEN];
+    const char *vers;
+    /* by SNMP_PDU_GET ... SNMP_PDU_REPORT */
+    static const char *const types[9] = {
+        "GET", "GETNEXT", "RESPONSE", "SET", "TRAPv1", "GETBULK",
+        "INFORM", "TRAPv2", "REPORT"
+    };
+
+    if (pdu->version == SNMP_V1)
+        vers = "SNMPv1";
+    else if (pdu->version == SNMP_V2c)
+        vers = "SNMPv2c";
+    else if (pdu->version == SNMP_V3)
+        vers = "SNMPv3";
+    else
+        vers = "v?";
+
+    switch (pdu->pdu_type) {
+    case SNMP_PDU_TRAP:
+        snmp_printf("%s %s '%s'", types[pdu->pdu_type], vers, pdu->community);
+        snmp_printf(" enterprise=%s", asn_oid2str_r(&pdu->enterprise, buf));
+        snmp_printf(" agent_addr=%u.%u.%u.%u", pdu->agent_addr[0],
+                    pdu->agent_addr[1], pdu->agent_addr[2], pdu->agent_addr[3]);
+        snmp_printf(" generic_trap=%d", pdu->generic_trap);
+        snmp_printf(" specific_trap=%d", pdu->specific_trap);
+        snmp_printf(" time-stamp=%u\n", pdu->time_stamp);
+        dump_bindings(pdu);
+        break;
 
     case SNMP_PDU_GET:
     case SNMP_PDU_GETNEXT:
@@ -1208,6 +1737,194 @@ void snmp_pdu_init(snmp_pdu_t *pdu) {
     memset(pdu, 0, sizeof(*pdu));
 }
 
+/*
+* Make room for n bindings. The array grows at least geometrically and new
+* entries are zeroed. Returns 0 if ok, -1 if out of memory; the PDU is not
+* changed in that case.
+*/
+int snmp_pdu_reserve(snmp_pdu_t *pdu, u_int n) {
+    snmp_value_t *b;
+    u_int max;
+
+    if (n <= pdu->maxbindings)
+        return (0);
+
+    max = pdu->maxbindings < 8 ? 8 : pdu->maxbindings * 2;
+    if (max < n)
+        max = n;
+    if (max > (size_t)-1 / sizeof(*b))
+        return (-1);
+    if ((b = realloc(pdu->bindings, max * sizeof(*b))) == NULL)
+        return (-1);
+    memset(b + pdu->maxbindings, 0,
+           (max - pdu->maxbindings) * sizeof(*b));
+    pdu->bindings = b;
+    pdu->maxbindings = max;
+    return (0);
+}
+
+/*
+* Free the values of a PDU except for those in its arena or receive
+* buffer. A PDU with an arena may also hold values of its own, when it
+* is reused for a request.
+*/
+static void pdu_values_free(snmp_pdu_t *pdu) {
+    snmp_value_t *v;
+    u_int i;
+
+    for (i = 0; i < pdu->nbindings; i++) {
+        v = &pdu->bindings[i];
+        if (!(v->syntax == SNMP_SYNTAX_OCTETSTRING &&
+                (pdu_owns_buffer(pdu, v->v.octetstring.octets) ||
+                 (pdu->arena != NULL &&
+                  arena_owns(pdu->arena, v->v.octetstring.octets)))))
+            snmp_value_free(v);
+        v->syntax = SNMP_SYNTAX_NULL;
+    }
+    if (pdu->arena != NULL)
+        snmp_arena_reset(pdu->arena);
+}
+
+/*
+* Free the values and reset the PDU to the state left by snmp_pdu_init,
+* but keep the bindings array for the next message.
+*/
+void snmp_pdu_clear(snmp_pdu_t *pdu) {
+    snmp_value_t *b = pdu->bindings;
+    u_int max = pdu->maxbindings;
+    snmp_arena_t *arena = pdu->arena;
+    u_char *rxbuf = pdu->rxbuf;
+    size_t rxbuf_size = pdu->rxbuf_size;
+    u_int i;
+
+    pdu_values_free(pdu);
+    for (i = 0; i < pdu->nbindings; i++)
+        b[i].oid.len = 0;
+    memset(pdu, 0, sizeof(*pdu));
+    pdu->bindings = b;
+    pdu->maxbindings = max;
+    pdu->arena = arena;
+    pdu->rxbuf = rxbuf;
+    pdu->rxbuf_size = rxbuf_size;
+}
+
+/*
+* Arena blocks are aligned like malloc'ed memory would be for the values
+* we put there.
+*/
+#define ARENA_ALIGN	8
+#define ARENA_MINBLOCK	1024
+
+struct arena_block {
+    struct arena_block	*next;
+    size_t		size;
+    uint64_t		data[1];
+};
+
+/*
+* Set up an arena. If buf is not NULL, the arena starts out with that
+* block, which stays owned by the caller.
+*/
+void snmp_arena_init(snmp_arena_t *arena, void *buf, size_t size) {
+    memset(arena, 0, sizeof(*arena));
+    if (buf != NULL) {
+        arena->base = buf;
+        arena->size = size;
+    }
+    arena->cur = arena->base;
+    arena->left = arena->size;
+}
+
+/*
+* Hand out len bytes. Returns NULL if out of memory.
+*/
+void *snmp_arena_alloc(snmp_arena_t *arena, size_t len) {
+    struct arena_block *blk;
+    size_t bsize;
+    void *p;
+
+    len = (len + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    if (len == 0)
+        len = ARENA_ALIGN;
+
+    if (len > arena->left) {
+        bsize = arena->used > arena->size ? arena->used : arena->size;
+        if (bsize < ARENA_MINBLOCK)
+            bsize = ARENA_MINBLOCK;
+        if (bsize < len)
+            bsize = len;
+        blk = malloc(offsetof(struct arena_block, data) + bsize);
+        if (blk == NULL)
+            return (NULL);
+        blk->next = arena->blocks;
+        blk->size = bsize;
+        arena->blocks = blk;
+        arena->cur = (u_char *)blk->data;
+        arena->left = bsize;
+    }
+    p = arena->cur;
+    arena->cur += len;
+    arena->left -= len;
+    arena->used += len;
+    return (p);
+}
+
+/*
+* Check whether p was handed out by the arena.
+*/
+static int arena_owns(const snmp_arena_t *arena, const u_char *p) {
+    const struct arena_block *blk;
+
+    if (p == NULL)
+        return (0);
+    if (arena->base != NULL && p >= arena->base &&
+            p < arena->base + arena->size)
+        return (1);
+    for (blk = arena->blocks; blk != NULL; blk = blk->next)
+        if (p >= (const u_char *)blk->data &&
+                p < (const u_char *)blk->data + blk->size)
+            return (1);
+    return (0);
+}
+
+static void arena_free_blocks(snmp_arena_t *arena) {
+    struct arena_block *blk;
+
+    while ((blk = arena->blocks) != NULL) {
+        arena->blocks = blk->next;
+        free(blk);
+    }
+}
+
+/*
+* Release everything handed out. If overflow blocks were needed, the
+* first block is replaced by one that holds all of it.
+*/
+void snmp_arena_reset(snmp_arena_t *arena) {
+    u_char *base;
+
+    if (arena->blocks != NULL) {
+        arena_free_blocks(arena);
+        if ((base = malloc(arena->used)) != NULL) {
+            if (arena->owned)
+                free(arena->base);
+            arena->base = base;
+            arena->size = arena->used;
+            arena->owned = 1;
+        }
+    }
+    arena->cur = arena->base;
+    arena->left = arena->size;
+    arena->used = 0;
+}
+
+void snmp_arena_free(snmp_arena_t *arena) {
+    arena_free_blocks(arena);
+    if (arena->owned)
+        free(arena->base);
+    snmp_arena_init(arena, NULL, 0);
+}
+
 void snmp_value_free(snmp_value_t *value) {
     if (value->syntax == SNMP_SYNTAX_OCTETSTRING)
         free(value->v.octetstring.octets);
@@ -1234,6 +1951,189 @@ int snmp_value_copy(snmp_value_t *to, const snmp_value_t *from)
     return (0);
 }
 
+/*
+* Copy a value into its compact form. Octet strings are copied.
+*/
+int snmp_value2cvalue(snmp_cvalue_t *to, const snmp_value_t *from) {
+    if (asn_oid2coid(&to->oid, &from->oid) != 0)
+        return (-1);
+    to->syntax = from->syntax;
+
+    switch (from->syntax) {
+
+    case SNMP_SYNTAX_OCTETSTRING:
+        if ((to->v.octetstring.len = from->v.octetstring.len) == 0)
+            to->v.octetstring.octets = NULL;
+        else {
+            to->v.octetstring.octets = malloc(to->v.octetstring.len);
+            if (to->v.octetstring.octets == NULL) {
+                asn_coid_free(&to->oid);
+                return (-1);
+            }
+            (void)memcpy(to->v.octetstring.octets,
+                         from->v.octetstring.octets, to->v.octetstring.len);
+        }
+        break;
+
+    case SNMP_SYNTAX_OID:
+        if (asn_oid2coid(&to->v.oid, &from->v.oid) != 0) {
+            asn_coid_free(&to->oid);
+            return (-1);
+        }
+        break;
+
+    case SNMP_SYNTAX_INTEGER:
+        to->v.integer = from->v.integer;
+        break;
+
+    case SNMP_SYNTAX_IPADDRESS:
+        memcpy(to->v.ipaddress, from->v.ipaddress,
+               sizeof(to->v.ipaddress));
+        break;
+
+    case SNMP_SYNTAX_COUNTER64:
+        to->v.counter64 = from->v.counter64;
+        break;
+
+    default:
+        to->v.uint32 = from->v.uint32;
+        break;
+    }
+    return (0);
+}
+
+/*
+* Expand a compact value. Octet strings are copied.
+*/
+static int cvalue2value(snmp_value_t *to, const snmp_cvalue_t *from,
+                        snmp_arena_t *arena) {
+    asn_coid2oid(&to->oid, &from->oid);
+    to->syntax = from->syntax;
+
+    switch (from->syntax) {
+
+    case SNMP_SYNTAX_OCTETSTRING:
+        if ((to->v.octetstring.len = from->v.octetstring.len) == 0)
+            to->v.octetstring.octets = NULL;
+        else {
+            to->v.octetstring.octets = value_alloc(arena,
+                                                   to->v.octetstring.len);
+            if (to->v.octetstring.octets == NULL)
+                return (-1);
+            (void)memcpy(to->v.octetstring.octets,
+                         from->v.octetstring.octets, to->v.octetstring.len);
+        }
+        break;
+
+    case SNMP_SYNTAX_OID:
+        asn_coid2oid(&to->v.oid, &from->v.oid);
+        break;
+
+    case SNMP_SYNTAX_INTEGER:
+        to->v.integer = from->v.integer;
+        break;
+
+    case SNMP_SYNTAX_IPADDRESS:
+        memcpy(to->v.ipaddress, from->v.ipaddress,
+               sizeof(to->v.ipaddress));
+        break;
+
+    case SNMP_SYNTAX_COUNTER64:
+        to->v.counter64 = from->v.counter64;
+        break;
+
+    default:
+        to->v.uint32 = from->v.uint32;
+        break;
+    }
+    return (0);
+}
+
+int snmp_cvalue2value(snmp_value_t *to, const snmp_cvalue_t *from) {
+    return (cvalue2value(to, from, NULL));
+}
+
+void snmp_cvalue_free(snmp_cvalue_t *value) {
+    asn_coid_free(&value->oid);
+    if (value->syntax == SNMP_SYNTAX_OCTETSTRING)
+        free(value->v.octetstring.octets);
+    else if (value->syntax == SNMP_SYNTAX_OID)
+        asn_coid_free(&value->v.oid);
+    value->syntax = SNMP_SYNTAX_NULL;
+}
+
+/*
+* Copy the request fields and the bindings of a PDU into a compact PDU.
+* The security and community fields are not kept; a PDU that is to be
+* sent is started with snmp_pdu_create of the client before the compact
+* one is expanded into it.
+*/
+int snmp_pdu2cpdu(snmp_cpdu_t *to, const snmp_pdu_t *from) {
+    u_int i;
+
+    to->version = from->version;
+    to->pdu_type = from->pdu_type;
+    to->request_id = from->request_id;
+    to->error_status = from->error_status;
+    to->error_index = from->error_index;
+    to->nbindings = 0;
+    to->bindings = NULL;
+
+    if (from->nbindings == 0)
+        return (0);
+    to->bindings = malloc(from->nbindings * sizeof(to->bindings[0]));
+    if (to->bindings == NULL)
+        return (-1);
+
+    for (i = 0; i < from->nbindings; i++) {
+        if (snmp_value2cvalue(&to->bindings[i], &from->bindings[i]) != 0) {
+            snmp_cpdu_free(to);
+            return (-1);
+        }
+        to->nbindings++;
+    }
+    return (0);
+}
+
+/*
+* Expand a compact PDU. Only the fields kept by snmp_pdu2cpdu and the
+* bindings are set, the rest of the PDU is left alone.
+*/
+int snmp_cpdu2pdu(snmp_pdu_t *to, const snmp_cpdu_t *from) {
+    u_int i;
+
+    if (snmp_pdu_reserve(to, from->nbindings) != 0)
+        return (-1);
+
+    to->version = from->version;
+    to->pdu_type = from->pdu_type;
+    to->request_id = from->request_id;
+    to->error_status = from->error_status;
+    to->error_index = from->error_index;
+    to->nbindings = 0;
+
+    for (i = 0; i < from->nbindings; i++) {
+        if (cvalue2value(&to->bindings[i], &from->bindings[i],
+                         to->arena) != 0) {
+            snmp_pdu_free(to);
+            to->nbindings = 0;
+            return (-1);
+        }
+        to->nbindings++;
+    }
+    return (0);
+}
+
+void snmp_cpdu_free(snmp_cpdu_t *pdu) {
+    u_int i;
+
+    for (i = 0; i < pdu->nbindings; i++)
+        snmp_cvalue_free(&pdu->bindings[i]);
+    free(pdu->bindings);
+    pdu->bindings = NULL;
+    pdu->nbindings = 0;
+}
+
 void snmp_pdu_init_secparams(snmp_pdu_t *pdu) {
     int32_t rval;
 
@@ -1261,11 +2161,20 @@ void snmp_pdu_init_secparams(snmp_pdu_t *pdu) {
     }
 }
 
+/*
+* Free the values, the bindings array and the receive buffer. The PDU can
+* be used again afterwards, the array is reallocated as needed. An
+* attached arena is reset but stays attached.
+*/
 void snmp_pdu_free(snmp_pdu_t *pdu) {
-    u_int i;
-
-    for (i = 0; i < pdu->nbindings; i++)
-        snmp_value_free(&pdu->bindings[i]);
+    pdu_values_free(pdu);
+    free(pdu->bindings);
+    pdu->bindings = NULL;
+    pdu->nbindings = 0;
+    pdu->maxbindings = 0;
+    free(pdu->rxbuf);
+    pdu->rxbuf = NULL;
+    pdu->rxbuf_size = 0;
 }
 
 /*
@@ -1413,18 +2322,16 @@ octs[len++] = (C);
     }
 
     case SNMP_SYNTAX_OID: {
-        u_long subid;
+        asn_subid_t subid;
 
         v->oid.len = 0;
 
         for (;;) {
             if (v->oid.len == ASN_MAXOIDLEN)
                 return (-1);
-            subid = strtoul(str, &end, 10);
-            str = end;
-            if (subid > ASN_MAXID)
+            if (asn_str2subid(str, &subid, &str) != ASN_ERR_OK)
                 return (-1);
-            v->oid.subs[v->oid.len++] = (asn_subid_t)subid;
+            v->oid.subs[v->oid.len++] = subid;
             if (*str == '\0')
                 break;
             if (*str != '.')
@@ -1435,7 +2342,8 @@ octs[len++] = (C);
     }
 
     case SNMP_SYNTAX_IPADDRESS: {
-        struct hostent *he;
+        struct addrinfo hints, *res;
+        const u_char *a;
         u_long ip[4];
         int n;
 
@@ -1450,15 +2358,15 @@ octs[len++] = (C);
             return (0);
         }
 
-        if ((he = gethostbyname(str)) == NULL)
+        /* not gethostbyname, its result is shared by all threads */
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_DGRAM;
+        if (getaddrinfo(str, NULL, &hints, &res) != 0)
             return (-1);
-        if (he->h_addrtype != AF_INET)
-            return (-1);
-
-        v->ipaddress[0] = he->h_addr[0];
-        v->ipaddress[1] = he->h_addr[1];
-        v->ipaddress[2] = he->h_addr[2];
-        v->ipaddress[3] = he->h_addr[3];
+        a = (const u_char *)&((struct sockaddr_in *)res->ai_addr)->sin_addr;
+        memcpy(v->ipaddress, a, sizeof(v->ipaddress));
+        freeaddrinfo(res);
         return (0);
     }
 
@@ -1484,13 +2392,39 @@ octs[len++] = (C);
     return -1;
 }
 
+#define SINK_MSGLEN	512	/* longest message given to a sink */
+
+static SNMP_THREAD_LOCAL const struct snmp_sinks *sinks;
+
+const struct snmp_sinks *snmp_set_sinks(const struct snmp_sinks *s) {
+    const struct snmp_sinks *old = sinks;
+
+    sinks = s;
+    return (old);
+}
+
+int snmp_sink_vprintf(int error, const char *fmt, va_list ap) {
+    char msg[SINK_MSGLEN];
+    void (*f)(void *, const char *);
+
+    if (sinks == NULL)
+        return (0);
+    if ((f = error ? sinks->error : sinks->print) != NULL) {
+        vsnprintf(msg, sizeof(msg), fmt, ap);
+        f(sinks->arg, msg);
+    }
+    return (1);
+}
+
 static void snmp_error_func(const char *fmt, ...) {
     va_list ap;
 
     va_start(ap, fmt);
-    fprintf(stderr, "SNMP: ");
-    vfprintf(stderr, fmt, ap);
-    fprintf(stderr, "\n");
+    if (!snmp_sink_vprintf(1, fmt, ap)) {
+        fprintf(stderr, "SNMP: ");
+        vfprintf(stderr, fmt, ap);
+        fprintf(stderr, "\n");
+    }
     va_end(ap);
 }
 
@@ -1498,7 +2432,8 @@ static void snmp_printf_func(const char *fmt, ...) {
     va_list ap;
 
     va_start(ap, fmt);
-    vfprintf(stderr, fmt, ap);
+    if (!snmp_sink_vprintf(0, fmt, ap))
+        vfprintf(stderr, fmt, ap);
     va_end(ap);
 }
 
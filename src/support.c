@@ -39,6 +39,7 @@
 #include <sys/timeb.h>
 #ifndef _WIN32
  #include <fcntl.h>
+ #include <pthread.h>
 #endif
 
 #include "support.h"
@@ -86,6 +87,66 @@ int socket_set_blocking(socket_t fd, int blocking) {
     return 0;
 }
 
+struct snmp_mutex {
+#ifdef _WIN32
+    CRITICAL_SECTION	cs;
+#else
+    pthread_mutex_t	m;
+#endif
+};
+
+struct snmp_mutex *snmp_mutex_new(void) {
+    struct snmp_mutex *mtx;
+#ifndef _WIN32
+    pthread_mutexattr_t attr;
+#endif
+
+    if ((mtx = malloc(sizeof(*mtx))) == NULL)
+        return (NULL);
+#ifdef _WIN32
+    InitializeCriticalSection(&mtx->cs);
+#else
+    if (pthread_mutexattr_init(&attr) != 0) {
+        free(mtx);
+        return (NULL);
+    }
+    (void)pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    if ((errno = pthread_mutex_init(&mtx->m, &attr)) != 0) {
+        free(mtx);
+        mtx = NULL;
+    }
+    (void)pthread_mutexattr_destroy(&attr);
+#endif
+    return (mtx);
+}
+
+void snmp_mutex_free(struct snmp_mutex *mtx) {
+    if (mtx == NULL)
+        return;
+#ifdef _WIN32
+    DeleteCriticalSection(&mtx->cs);
+#else
+    (void)pthread_mutex_destroy(&mtx->m);
+#endif
+    free(mtx);
+}
+
+void snmp_mutex_lock(struct snmp_mutex *mtx) {
+#ifdef _WIN32
+    EnterCriticalSection(&mtx->cs);
+#else
+    (void)pthread_mutex_lock(&mtx->m);
+#endif
+}
+
+void snmp_mutex_unlock(struct snmp_mutex *mtx) {
+#ifdef _WIN32
+    LeaveCriticalSection(&mtx->cs);
+#else
+    (void)pthread_mutex_unlock(&mtx->m);
+#endif
+}
+
 
 
 #ifndef HAVE_GETTIMEOFDAY
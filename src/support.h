@@ -36,6 +36,7 @@
 
 #include "bsnmp/config.h"
 #include <stdlib.h>
+#include <stdarg.h>
 #ifdef __GNUC__
 #include <sys/time.h>
 #ifdef linux
@@ -57,6 +58,36 @@ int gettimeofday(struct timeval *tv, struct timezone *tz);
 
 int socket_set_blocking(socket_t fd, int blocking);
 
+/* storage of which every thread has its own copy */
+#if defined(_MSC_VER)
+#define SNMP_THREAD_LOCAL	__declspec(thread)
+#elif defined(__GNUC__)
+#define SNMP_THREAD_LOCAL	__thread
+#else
+#define SNMP_THREAD_LOCAL
+#endif
+
+/* unused function arguments, from sys/cdefs.h on the BSDs */
+#ifndef __unused
+#if defined(__GNUC__)
+#define __unused	__attribute__((__unused__))
+#else
+#define __unused
+#endif
+#endif
+
+/* recursive mutex, see snmp_client_lock */
+struct snmp_mutex *snmp_mutex_new(void);
+void snmp_mutex_free(struct snmp_mutex *);
+void snmp_mutex_lock(struct snmp_mutex *);
+void snmp_mutex_unlock(struct snmp_mutex *);
+
+/*
+ * Give output of the default error and print functions to the sinks of
+ * the calling thread. Returns 0 if the thread has none set.
+ */
+int snmp_sink_vprintf(int _error, const char *_fmt, va_list);
+
 
 
 /**
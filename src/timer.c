@@ -0,0 +1,236 @@
+/*
+ * Hierarchical timer wheel, see bsnmp/timer.h.
+ *
+ * The wheel is advanced one tick at a time up to the current time. A
+ * tick runs the timers in its level 0 slot; every 64 ticks the next slot
+ * of level 1 is spread over level 0, every 4096 ticks the next slot of
+ * level 2 over the levels below and so on. A wheel without timers jumps
+ * straight to the current time.
+ */
+#include "bsnmp/config.h"
+#include <sys/types.h>
+#ifdef _WIN32
+#include "compat/sys/queue.h"
+#else
+#include <sys/queue.h>
+#endif
+#ifdef __GNUC__
+#include <sys/time.h>
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#elif defined(HAVE_INTTYPES_H)
+#include <inttypes.h>
+#endif
+
+#include "bsnmp/asn1.h"
+#include "bsnmp/snmp.h"
+#include "bsnmp/client.h"
+#include "bsnmp/timer.h"
+#include "priv.h"
+
+#define TIMER_MASK	(SNMP_TIMER_SLOTS - 1)
+#define TIMER_RANGE	((uint64_t)1 << (SNMP_TIMER_BITS * SNMP_TIMER_LEVELS))
+
+/*
+* Microseconds on a clock that is not set back.
+*/
+uint64_t snmp_clock(void) {
+#ifdef CLOCK_MONOTONIC
+    struct timespec ts;
+
+    (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+#else
+    struct timeval tv;
+
+    (void)gettimeofday(&tv, NULL);
+    return ((uint64_t)tv.tv_sec * 1000000 + tv.tv_usec);
+#endif
+}
+
+/* the current tick, rounded down */
+static uint64_t timer_tick(void) {
+    return (snmp_clock() / 1000);
+}
+
+/*
+* Put a timer into the slot for its expiry, relative to the next tick of
+* the wheel.
+*/
+static void timer_insert(struct snmp_timer_wheel *w, struct snmp_timer *t) {
+    uint64_t expires = t->expires;
+    uint64_t delta;
+    u_int level;
+
+    if (expires < w->now)
+        expires = t->expires = w->now;
+    delta = expires - w->now;
+    if (delta >= TIMER_RANGE) {
+        /* wait in the last slot and come round again */
+        expires = w->now + TIMER_RANGE - 1;
+        delta = TIMER_RANGE - 1;
+    }
+    for (level = 0; level < SNMP_TIMER_LEVELS - 1; level++)
+        if (delta < (uint64_t)1 << (SNMP_TIMER_BITS * (level + 1)))
+            break;
+    LIST_INSERT_HEAD(&w->slots[level][(expires >> (SNMP_TIMER_BITS * level)) &
+                                      TIMER_MASK], t, link);
+}
+
+static void timer_cascade(struct snmp_timer_wheel *w,
+                          struct snmp_timer_list *slot) {
+    struct snmp_timer_list list;
+    struct snmp_timer *t;
+
+    LIST_INIT(&list);
+    while ((t = LIST_FIRST(slot)) != NULL) {
+        LIST_REMOVE(t, link);
+        LIST_INSERT_HEAD(&list, t, link);
+    }
+    while ((t = LIST_FIRST(&list)) != NULL) {
+        LIST_REMOVE(t, link);
+        timer_insert(w, t);
+    }
+}
+
+void snmp_timer_init(struct snmp_timer_wheel *w) {
+    u_int level, i;
+
+    memset(w, 0, sizeof(*w));
+    for (level = 0; level < SNMP_TIMER_LEVELS; level++)
+        for (i = 0; i < SNMP_TIMER_SLOTS; i++)
+            LIST_INIT(&w->slots[level][i]);
+    LIST_INIT(&w->free);
+    w->now = timer_tick();
+}
+
+void snmp_timer_fini(struct snmp_timer_wheel *w) {
+    struct snmp_timer *t;
+    u_int level, i;
+
+    for (level = 0; level < SNMP_TIMER_LEVELS; level++)
+        for (i = 0; i < SNMP_TIMER_SLOTS; i++)
+            while ((t = LIST_FIRST(&w->slots[level][i])) != NULL) {
+                LIST_REMOVE(t, link);
+                free(t);
+            }
+    while ((t = LIST_FIRST(&w->free)) != NULL) {
+        LIST_REMOVE(t, link);
+        free(t);
+    }
+    w->count = 0;
+}
+
+void *snmp_timer_start(struct snmp_timer_wheel *w, const struct timeval *tv,
+                       snmp_timeout_cb_f func, struct snmp_client *client,
+                       void *arg) {
+    struct snmp_timer *t;
+
+    if ((t = LIST_FIRST(&w->free)) != NULL) {
+        LIST_REMOVE(t, link);
+    } else if ((t = malloc(sizeof(*t))) == NULL) {
+        return (NULL);
+    }
+
+    t->expires = (snmp_clock() + (uint64_t)tv->tv_sec * 1000000 +
+                  tv->tv_usec + 999) / 1000;
+    t->func = func;
+    t->client = client;
+    t->arg = arg;
+    timer_insert(w, t);
+    w->count++;
+
+    return (t);
+}
+
+void snmp_timer_stop(struct snmp_timer_wheel *w, void *id) {
+    struct snmp_timer *t = id;
+
+    LIST_REMOVE(t, link);
+    LIST_INSERT_HEAD(&w->free, t, link);
+    w->count--;
+}
+
+void snmp_timer_stop_client(struct snmp_timer_wheel *w,
+                            struct snmp_client *client) {
+    struct snmp_timer *t, *next;
+    u_int level, i;
+
+    for (level = 0; level < SNMP_TIMER_LEVELS && w->count > 0; level++)
+        for (i = 0; i < SNMP_TIMER_SLOTS; i++)
+            for (t = LIST_FIRST(&w->slots[level][i]); t != NULL; t = next) {
+                next = LIST_NEXT(t, link);
+                if (t->client == client)
+                    snmp_timer_stop(w, t);
+            }
+}
+
+int snmp_timer_next(const struct snmp_timer_wheel *w, struct timeval *tv) {
+    uint64_t tick, now;
+    u_int i;
+
+    if (w->count == 0)
+        return (-1);
+
+    /* the next busy slot of level 0 or the next cascade */
+    tick = w->now;
+    for (i = 0; i < SNMP_TIMER_SLOTS; i++, tick++)
+        if ((tick & TIMER_MASK) == 0 ||
+                !LIST_EMPTY(&w->slots[0][tick & TIMER_MASK]))
+            break;
+
+    now = snmp_clock();
+    if (tick * 1000 <= now) {
+        tv->tv_sec = 0;
+        tv->tv_usec = 0;
+    } else {
+        now = tick * 1000 - now;
+        tv->tv_sec = (long)(now / 1000000);
+        tv->tv_usec = (long)(now % 1000000);
+    }
+    return (0);
+}
+
+u_int snmp_timer_expire(struct snmp_timer_wheel *w) {
+    struct snmp_timer_list *slot;
+    struct snmp_timer *t;
+    snmp_timeout_cb_f func;
+    struct snmp_client *client;
+    void *arg;
+    uint64_t now;
+    u_int level, idx, n = 0;
+
+    w->busy++;
+    now = timer_tick();
+    while (w->now <= now) {
+        if (w->count == 0) {
+            w->now = now + 1;
+            break;
+        }
+        if ((w->now & TIMER_MASK) == 0)
+            for (level = 1; level < SNMP_TIMER_LEVELS; level++) {
+                idx = (w->now >> (SNMP_TIMER_BITS * level)) & TIMER_MASK;
+                timer_cascade(w, &w->slots[level][idx]);
+                if (idx != 0)
+                    break;
+            }
+
+        /* callbacks may start timers for this tick */
+        slot = &w->slots[0][w->now & TIMER_MASK];
+        while ((t = LIST_FIRST(slot)) != NULL) {
+            func = t->func;
+            client = t->client;
+            arg = t->arg;
+            snmp_timer_stop(w, t);
+            func(client, arg);
+            n++;
+        }
+        w->now++;
+    }
+    w->busy--;
+    return (n);
+}
@@ -0,0 +1,422 @@
+/*
+ * The client must not allocate once it is warmed up, run by make test.
+ *
+ * The agent side is a plain UDP socket served from the same thread, like
+ * in bench/client_bench.c. GETs of 1, 20 and 100 bindings are sent with
+ * snmp_pdu_send and snmp_pdu_send_tmpl and received with snmp_receive,
+ * with the timeout hooks of the application and with the timer wheel of
+ * the client. After the warm-up no request may allocate on the client
+ * side. A table fetched with snmp_table_fetch_async allocates its rows
+ * only, the same whether it comes in one response or in one per row.
+ * Counting needs glibc, the test is skipped elsewhere.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include "bsnmp/config.h"
+#if defined(__GLIBC__) && !defined(_WIN32)
+#include <unistd.h>
+#include <arpa/inet.h>
+#include "bsnmp/asn1.h"
+#include "bsnmp/snmp.h"
+#include "bsnmp/client.h"
+
+#define WARMUP		100
+#define ROUNDS		1000
+#define BUFSIZ_AGENT	65536
+#define NROWS		50
+
+/*
+ * Allocation counting.
+ */
+extern void *__libc_malloc(size_t);
+extern void *__libc_calloc(size_t, size_t);
+extern void *__libc_realloc(void *, size_t);
+
+static unsigned long allocs;
+static int in_agent;
+
+void *
+malloc(size_t size) {
+    if (!in_agent)
+        allocs++;
+    return (__libc_malloc(size));
+}
+
+void *
+calloc(size_t n, size_t size) {
+    if (!in_agent)
+        allocs++;
+    return (__libc_calloc(n, size));
+}
+
+void *
+realloc(void *ptr, size_t size) {
+    if (!in_agent)
+        allocs++;
+    return (__libc_realloc(ptr, size));
+}
+
+static const asn_subid_t if_descr[] = { 1, 3, 6, 1, 2, 1, 2, 2, 1, 2 };
+
+/* ifIndex of the ifTable, the value of row N is N */
+struct if_row {
+    TAILQ_ENTRY(if_row) link;
+    uint64_t	found;
+    int32_t	index;
+    int32_t	ifindex;
+};
+TAILQ_HEAD(if_rows, if_row);
+
+static const struct snmp_table if_table = {
+    { 8, { 1, 3, 6, 1, 2, 1, 2, 2 } },
+    { 0, { 0 } },
+    1,
+    sizeof(struct if_row),
+    1,
+    (uint64_t)1 << 1,
+    {
+        { 0, SNMP_SYNTAX_INTEGER, offsetof(struct if_row, index) },
+        { 1, SNMP_SYNTAX_INTEGER, offsetof(struct if_row, ifindex) },
+        { 0, SNMP_SYNTAX_NULL, 0 }
+    }
+};
+
+static struct snmp_client client;
+static snmp_pdu_t req;
+static struct snmp_pdu_tmpl tmpl;
+static u_long answered;
+
+static void
+fail(const char *what, const char *why) {
+    fprintf(stderr, "alloc_test: %s: %s\n", what, why);
+    exit(1);
+}
+
+/*
+ * The agent. It answers every binding of a GET with the same interface
+ * name, and GETBULKs with at most agent_rows rows of ifIndex.
+ */
+static int agent_fd = -1;
+static u_char agent_rxbuf[BUFSIZ_AGENT];
+static u_char agent_txbuf[BUFSIZ_AGENT];
+static snmp_pdu_t agent_pdu;
+static snmp_arena_t agent_arena;
+static u_int agent_rows;
+
+static void
+agent_open(char *port, size_t size) {
+    struct sockaddr_in sin;
+    socklen_t len;
+
+    if ((agent_fd = socket(AF_INET, SOCK_DGRAM, 0)) == -1)
+        fail("agent", strerror(errno));
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    len = sizeof(sin);
+    if (bind(agent_fd, (struct sockaddr *)&sin, sizeof(sin)) == -1 ||
+            getsockname(agent_fd, (struct sockaddr *)&sin, &len) == -1)
+        fail("agent", strerror(errno));
+    snprintf(port, size, "%u", ntohs(sin.sin_port));
+
+    snmp_pdu_init(&agent_pdu);
+    snmp_arena_init(&agent_arena, NULL, 0);
+    agent_pdu.arena = &agent_arena;
+}
+
+static int
+agent_bulk(snmp_pdu_t *pdu) {
+    asn_oid_t start;
+    snmp_value_t *v;
+    u_int n, reps;
+
+    start = pdu->bindings[0].oid;
+    reps = pdu->error_index < (int32_t)agent_rows ?
+           (u_int)pdu->error_index : agent_rows;
+    if (reps == 0 || snmp_pdu_reserve(pdu, reps) != 0)
+        return (-1);
+
+    /* the client asks for the table first, then for the last row */
+    n = start.len == if_table.table.len + 3 ?
+        start.subs[start.len - 1] + 1 : 1;
+
+    for (pdu->nbindings = 0; pdu->nbindings < reps; n++) {
+        v = &pdu->bindings[pdu->nbindings++];
+        if (n > NROWS) {
+            v->oid = start;
+            v->syntax = SNMP_SYNTAX_ENDOFMIBVIEW;
+            break;
+        }
+        v->oid = if_table.table;
+        v->oid.subs[v->oid.len++] = 1;
+        v->oid.subs[v->oid.len++] = 1;
+        v->oid.subs[v->oid.len++] = n;
+        v->syntax = SNMP_SYNTAX_INTEGER;
+        v->v.integer = (int32_t)n;
+    }
+    pdu->error_status = SNMP_ERR_NOERROR;
+    pdu->error_index = 0;
+    return (0);
+}
+
+static int
+agent_serve(void) {
+    static u_char descr[] = "GigabitEthernet0/0/17";
+    struct sockaddr_in from;
+    socklen_t fromlen;
+    asn_buf_t b;
+    int32_t ip;
+    ssize_t n;
+    u_int i;
+
+    fromlen = sizeof(from);
+    if ((n = recvfrom(agent_fd, agent_rxbuf, sizeof(agent_rxbuf), 0,
+                      (struct sockaddr *)&from, &fromlen)) <= 0)
+        return (-1);
+
+    snmp_pdu_clear(&agent_pdu);
+    b.asn_ptr = agent_rxbuf;
+    b.asn_len = n;
+    if (snmp_pdu_decode(&b, &agent_pdu, &ip) != SNMP_CODE_OK)
+        return (-1);
+
+    if (agent_pdu.pdu_type == SNMP_PDU_GETBULK) {
+        if (agent_bulk(&agent_pdu) != 0)
+            return (-1);
+    } else
+        for (i = 0; i < agent_pdu.nbindings; i++) {
+            agent_pdu.bindings[i].syntax = SNMP_SYNTAX_OCTETSTRING;
+            agent_pdu.bindings[i].v.octetstring.octets = descr;
+            agent_pdu.bindings[i].v.octetstring.len = sizeof(descr) - 1;
+        }
+    agent_pdu.pdu_type = SNMP_PDU_RESPONSE;
+    b.asn_ptr = agent_txbuf;
+    b.asn_len = sizeof(agent_txbuf);
+    if (snmp_pdu_encode_rev(&agent_pdu, &b) != SNMP_CODE_OK)
+        return (-1);
+    /* the values belong to us, not to the PDU */
+    for (i = 0; i < agent_pdu.nbindings; i++)
+        agent_pdu.bindings[i].syntax = SNMP_SYNTAX_NULL;
+
+    if (sendto(agent_fd, agent_pdu.outer_ptr, agent_pdu.outer_len, 0,
+               (struct sockaddr *)&from, fromlen) == -1)
+        return (-1);
+    return (0);
+}
+
+/*
+ * Timeout hooks of an application. Requests are answered right away, so
+ * the timers are never fired.
+ */
+static void *
+timeout_start(struct timeval *tv, snmp_timeout_cb_f cb, void *arg) {
+    static int id;
+
+    (void)tv;
+    (void)cb;
+    (void)arg;
+    return (&id);
+}
+
+static void
+timeout_stop(void *id) {
+    (void)id;
+}
+
+static void
+response(struct snmp_client *c, snmp_pdu_t *pdu, snmp_pdu_t *resp,
+         void *arg) {
+    (void)c;
+    (void)pdu;
+    (void)arg;
+    if (resp != NULL && resp->nbindings == req.nbindings &&
+            resp->bindings[0].syntax == SNMP_SYNTAX_OCTETSTRING)
+        answered++;
+}
+
+static void
+op_get(const char *name, int use_tmpl) {
+    int32_t id;
+    int ret;
+
+    if (use_tmpl)
+        id = snmp_pdu_send_tmpl(&client, &tmpl, response, NULL);
+    else
+        id = snmp_pdu_send(&client, &req, response, NULL);
+    if (id == -1)
+        fail(name, client.error);
+    in_agent = 1;
+    ret = agent_serve();
+    in_agent = 0;
+    if (ret != 0)
+        fail(name, "agent failed");
+    if (snmp_receive(&client, 1) != 0)
+        fail(name, client.error);
+}
+
+static void
+make_get(u_int nbindings) {
+    snmp_value_t *v;
+    u_int i;
+
+    snmp_pdu_reset(&client, &req, SNMP_PDU_GET);
+    if (snmp_pdu_reserve(&req, nbindings) != 0)
+        fail("get", "no memory");
+    for (i = 0; i < nbindings; i++) {
+        v = &req.bindings[req.nbindings++];
+        v->oid.len = sizeof(if_descr) / sizeof(if_descr[0]);
+        memcpy(v->oid.subs, if_descr, sizeof(if_descr));
+        v->oid.subs[v->oid.len++] = i + 1;
+        v->syntax = SNMP_SYNTAX_NULL;
+    }
+}
+
+static void
+run(const char *name, int use_tmpl) {
+    unsigned long a;
+    u_int i;
+
+    answered = 0;
+    for (i = 0; i < WARMUP; i++)
+        op_get(name, use_tmpl);
+    a = allocs;
+    for (i = 0; i < ROUNDS; i++)
+        op_get(name, use_tmpl);
+    a = allocs - a;
+
+    if (answered != WARMUP + ROUNDS)
+        fail(name, "requests not answered");
+    if (a != 0) {
+        fprintf(stderr, "alloc_test: %s: %lu allocations in %u requests\n",
+                name, a, ROUNDS);
+        exit(1);
+    }
+}
+
+static void
+table_done(void *list, void *arg, int res) {
+    (void)list;
+    *(int *)arg = res == 0 ? 1 : -1;
+}
+
+/*
+ * Fetch the ifTable with rows rows per response, and return the
+ * allocations it took.
+ */
+static unsigned long
+fetch_table(const char *name, u_int rows) {
+    struct if_rows list;
+    struct if_row *r;
+    unsigned long a;
+    int done, ret;
+    int32_t n;
+
+    agent_rows = rows;
+    a = allocs;
+    done = 0;
+    if (snmp_table_fetch_async(&client, &if_table, &list, table_done,
+                               &done) != 0)
+        fail(name, client.error);
+    while (done == 0) {
+        in_agent = 1;
+        ret = agent_serve();
+        in_agent = 0;
+        if (ret != 0)
+            fail(name, "agent failed");
+        if (snmp_receive(&client, 1) != 0)
+            fail(name, client.error);
+    }
+    a = allocs - a;
+    if (done != 1)
+        fail(name, client.error);
+
+    n = 0;
+    while ((r = TAILQ_FIRST(&list)) != NULL) {
+        if (r->index != ++n || r->ifindex != n)
+            fail(name, "wrong row");
+        TAILQ_REMOVE(&list, r, link);
+        free(r);
+    }
+    if (n != NROWS)
+        fail(name, "rows missing");
+    return (a);
+}
+
+static void
+table_test(const char *timers) {
+    unsigned long one, each;
+    char name[64];
+    u_int i;
+
+    sprintf(name, "%s: table", timers);
+    for (i = 0; i < 10; i++) {
+        (void)fetch_table(name, NROWS + 1);
+        (void)fetch_table(name, 1);
+    }
+    one = fetch_table(name, NROWS + 1);
+    each = fetch_table(name, 1);
+    if (each != one) {
+        fprintf(stderr, "alloc_test: %s: %lu allocations in one response, "
+                "%lu in %u\n", name, one, each, NROWS + 1);
+        exit(1);
+    }
+}
+
+static void
+client_test(const char *timers, int hooks) {
+    static const u_int sizes[] = { 1, 20, 100 };
+    char port[16], name[64];
+    u_int i;
+
+    agent_open(port, sizeof(port));
+    snmp_client_init(&client);
+    client.dump_pdus = 0;
+    if (hooks) {
+        client.timeout_start = timeout_start;
+        client.timeout_stop = timeout_stop;
+    }
+    if (snmp_open(&client, "127.0.0.1", port, NULL, NULL) != 0)
+        fail("open", client.error);
+    snmp_pdu_init(&req);
+
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        make_get(sizes[i]);
+        sprintf(name, "%s: get_%u", timers, sizes[i]);
+        run(name, 0);
+
+        if (snmp_pdu_compile(&client, &req, &tmpl) != 0)
+            fail("compile", client.error);
+        sprintf(name, "%s: get_tmpl_%u", timers, sizes[i]);
+        run(name, 1);
+        snmp_pdu_tmpl_free(&tmpl);
+    }
+    table_test(timers);
+
+    snmp_pdu_free(&req);
+    snmp_close(&client);
+    (void)close(agent_fd);
+    snmp_pdu_free(&agent_pdu);
+    snmp_arena_free(&agent_arena);
+    printf("%s: ok\n", timers);
+}
+
+int
+main(void) {
+    client_test("hooks", 1);
+    client_test("wheel", 0);
+    printf("ok\n");
+    return (0);
+}
+
+#else /* !__GLIBC__ || _WIN32 */
+
+int
+main(void) {
+    printf("alloc_test: allocations are counted with glibc only\n");
+    return (0);
+}
+
+#endif
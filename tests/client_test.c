@@ -0,0 +1,498 @@
+/*
+ * Regression tests of the client against an agent on loopback, run by
+ * make test.
+ *
+ *	nested		a response callback that receives again while the
+ *			timer of its request is due
+ *	rto		the adaptive retransmission timeout against an agent
+ *			that loses requests: clamped to rto_min and rto_max
+ *			and doubled with each retry
+ *	toobig		GETBULKs with snmp_dialog_reuse against an agent with
+ *			small messages: the repetitions are halved until the
+ *			response fits, and later requests ask for no more
+ *			than snmp_client_fit learned from the responses
+ *
+ * The agent runs on a thread of its own and answers GETs; the value of
+ * ...1.N.0 is N * 7. A GETBULK gets all repetitions, the value of the
+ * binding ...1.N.R is R. The agent can be told to drop requests and to
+ * answer tooBig when a response has too many bindings, and notes when
+ * each request arrived. The program exits with 1 on the first wrong
+ * result.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "bsnmp/config.h"
+#ifndef _WIN32
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include "bsnmp/asn1.h"
+#include "bsnmp/snmp.h"
+#include "bsnmp/client.h"
+
+#define BUFSIZ_AGENT	65536
+#define NARRIVED	16
+#define MAXREQ		16	/* bindings of a GETBULK */
+
+static const asn_subid_t base[] = { 1, 3, 6, 1, 4, 1, 12325, 1 };
+
+static char port[16];
+static int agent_fd;
+
+/* what the agent does, under the lock */
+static struct {
+    pthread_mutex_t	lock;
+    u_int		drop;		/* requests to drop */
+    u_int		maxbindings;	/* of a response, 0 for any */
+    u_int		ntoobig;	/* tooBig answers */
+    u_int		narrived;
+    uint64_t	arrived[NARRIVED];	/* in microseconds */
+} agent = { PTHREAD_MUTEX_INITIALIZER, 0, 0, 0, 0, { 0 } };
+
+static void
+fail(const char *what, const char *why) {
+    fprintf(stderr, "client_test: %s: %s\n", what, why);
+    exit(1);
+}
+
+static uint64_t
+now_us(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+}
+
+static void
+agent_set(u_int drop, u_int maxbindings) {
+    pthread_mutex_lock(&agent.lock);
+    agent.drop = drop;
+    agent.maxbindings = maxbindings;
+    agent.ntoobig = 0;
+    agent.narrived = 0;
+    pthread_mutex_unlock(&agent.lock);
+}
+
+/* a request arrived, returns whether to drop it */
+static int
+agent_arrived(void) {
+    int drop;
+
+    pthread_mutex_lock(&agent.lock);
+    if (agent.narrived < NARRIVED)
+        agent.arrived[agent.narrived] = now_us();
+    agent.narrived++;
+    if ((drop = agent.drop > 0))
+        agent.drop--;
+    pthread_mutex_unlock(&agent.lock);
+    return (drop);
+}
+
+/*
+ * Answer a GETBULK with all repetitions or tooBig. Returns -1 if the
+ * request cannot be answered.
+ */
+static int
+agent_bulk(snmp_pdu_t *pdu) {
+    static asn_oid_t oids[MAXREQ];
+    u_int i, r, n, nonrep, reps, max;
+    snmp_value_t *v;
+
+    n = pdu->nbindings;
+    nonrep = pdu->error_status < 0 ? 0 : (u_int)pdu->error_status;
+    reps = pdu->error_index < 0 ? 0 : (u_int)pdu->error_index;
+    if (n > MAXREQ || nonrep > n)
+        return (-1);
+    pdu->error_status = SNMP_ERR_NOERROR;
+    pdu->error_index = 0;
+
+    pthread_mutex_lock(&agent.lock);
+    max = agent.maxbindings;
+    if (max != 0 && nonrep + (n - nonrep) * reps > max) {
+        agent.ntoobig++;
+        pthread_mutex_unlock(&agent.lock);
+        pdu->error_status = SNMP_ERR_TOOBIG;
+        pdu->nbindings = 0;
+        return (0);
+    }
+    pthread_mutex_unlock(&agent.lock);
+
+    for (i = 0; i < n; i++)
+        oids[i] = pdu->bindings[i].oid;
+    if (snmp_pdu_reserve(pdu, nonrep + (n - nonrep) * reps) != 0)
+        return (-1);
+    pdu->nbindings = 0;
+    for (i = 0; i < n; i++) {
+        for (r = 0; r < (i < nonrep ? 1 : reps); r++) {
+            v = &pdu->bindings[pdu->nbindings++];
+            v->oid = oids[i];
+            if (v->oid.len < ASN_MAXOIDLEN)
+                v->oid.subs[v->oid.len++] = r + 1;
+            v->syntax = SNMP_SYNTAX_INTEGER;
+            v->v.integer = r + 1;
+        }
+    }
+    return (0);
+}
+
+/*
+ * The agent, it stops on a datagram of one byte.
+ */
+static void *
+agent_run(void *arg) {
+    static u_char rxbuf[BUFSIZ_AGENT], txbuf[BUFSIZ_AGENT];
+    struct sockaddr_in from;
+    socklen_t fromlen;
+    snmp_pdu_t pdu;
+    asn_buf_t b;
+    u_int i;
+    int32_t ip;
+    ssize_t n;
+
+    (void)arg;
+    snmp_pdu_init(&pdu);
+    for (;;) {
+        fromlen = sizeof(from);
+        if ((n = recvfrom(agent_fd, rxbuf, sizeof(rxbuf), 0,
+                          (struct sockaddr *)&from, &fromlen)) <= 1)
+            break;
+        if (agent_arrived())
+            continue;
+        snmp_pdu_clear(&pdu);
+        b.asn_ptr = rxbuf;
+        b.asn_len = n;
+        if (snmp_pdu_decode(&b, &pdu, &ip) != SNMP_CODE_OK)
+            continue;
+        if (pdu.pdu_type == SNMP_PDU_GETBULK) {
+            if (agent_bulk(&pdu) == -1)
+                continue;
+        } else {
+            for (i = 0; i < pdu.nbindings; i++) {
+                pdu.bindings[i].syntax = SNMP_SYNTAX_INTEGER;
+                pdu.bindings[i].v.integer =
+                    pdu.bindings[i].oid.subs[pdu.bindings[i].oid.len - 2] *
+                    7;
+            }
+        }
+        pdu.pdu_type = SNMP_PDU_RESPONSE;
+        b.asn_ptr = txbuf;
+        b.asn_len = sizeof(txbuf);
+        if (snmp_pdu_encode(&pdu, &b) == SNMP_CODE_OK)
+            (void)sendto(agent_fd, txbuf, b.asn_ptr - txbuf, 0,
+                         (struct sockaddr *)&from, fromlen);
+    }
+    snmp_pdu_free(&pdu);
+    return (NULL);
+}
+
+static void
+agent_start(pthread_t *tid) {
+    struct sockaddr_in sin;
+    socklen_t len;
+
+    if ((agent_fd = socket(AF_INET, SOCK_DGRAM, 0)) == -1)
+        fail("agent", strerror(errno));
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    len = sizeof(sin);
+    if (bind(agent_fd, (struct sockaddr *)&sin, sizeof(sin)) == -1 ||
+            getsockname(agent_fd, (struct sockaddr *)&sin, &len) == -1)
+        fail("agent", strerror(errno));
+    snprintf(port, sizeof(port), "%u", ntohs(sin.sin_port));
+    if (pthread_create(tid, NULL, agent_run, NULL) != 0)
+        fail("agent", "pthread_create");
+}
+
+static void
+agent_stop(pthread_t tid) {
+    struct sockaddr_in sin;
+    int fd;
+
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    sin.sin_port = htons((u_short)atoi(port));
+    if ((fd = socket(AF_INET, SOCK_DGRAM, 0)) == -1 ||
+            sendto(fd, "", 1, 0, (struct sockaddr *)&sin, sizeof(sin)) != 1)
+        fail("agent", strerror(errno));
+    (void)close(fd);
+    (void)pthread_join(tid, NULL);
+    (void)close(agent_fd);
+}
+
+static void
+client_open(struct snmp_client *client) {
+    snmp_client_init(client);
+    client->dump_pdus = 0;
+    if (snmp_open(client, "127.0.0.1", port, NULL, NULL) != 0)
+        fail("open", client->error);
+}
+
+static void
+make_get(struct snmp_client *client, snmp_pdu_t *pdu, u_int n) {
+    snmp_pdu_reset(client, pdu, SNMP_PDU_GET);
+    pdu->bindings[0].oid.len = sizeof(base) / sizeof(base[0]);
+    memcpy(pdu->bindings[0].oid.subs, base, sizeof(base));
+    pdu->bindings[0].oid.subs[pdu->bindings[0].oid.len++] = n;
+    pdu->bindings[0].oid.subs[pdu->bindings[0].oid.len++] = 0;
+    pdu->bindings[0].syntax = SNMP_SYNTAX_NULL;
+    pdu->nbindings = 1;
+}
+
+static void
+sleep_ms(u_int ms) {
+    struct timespec ts;
+
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (long)(ms % 1000) * 1000000;
+    while (nanosleep(&ts, &ts) == -1 && errno == EINTR)
+        ;
+}
+
+/*
+ * The response arrives when the timer of its request is due already, and
+ * the callback receives again, which runs the timers. The request must
+ * not time out from under its own callback.
+ */
+static u_int nested_calls;
+static u_int nested_timeouts;
+
+static void
+nested_cb(struct snmp_client *client, snmp_pdu_t *pdu, snmp_pdu_t *resp,
+          void *arg) {
+    (void)pdu;
+    (void)arg;
+    nested_calls++;
+    if (resp == NULL)
+        nested_timeouts++;
+    (void)snmp_receive(client, 0);
+}
+
+static void
+nested_test(void) {
+    struct snmp_client client;
+    snmp_pdu_t req;
+
+    client_open(&client);
+    client.timeout.tv_sec = 0;
+    client.timeout.tv_usec = 10000;
+    client.retries = 0;
+    snmp_pdu_init(&req);
+    if (snmp_pdu_reserve(&req, 1) != 0)
+        fail("nested", "no memory");
+    make_get(&client, &req, 3);
+
+    if (snmp_pdu_send(&client, &req, nested_cb, NULL) == -1)
+        fail("nested", client.error);
+    if (snmp_flush(&client) == -1)
+        fail("nested", client.error);
+    sleep_ms(30);
+    (void)snmp_receive(&client, 1);
+    /* anything left would fire now */
+    sleep_ms(30);
+    (void)snmp_receive(&client, 0);
+
+    if (nested_calls != 1)
+        fail("nested", "callback not run exactly once");
+    if (nested_timeouts != 0)
+        fail("nested", "answered request timed out");
+    if (!LIST_EMPTY(&client.sent_pdus))
+        fail("nested", "request still outstanding");
+    snmp_pdu_free(&req);
+    snmp_close(&client);
+    printf("nested: ok\n");
+}
+
+/*
+ * The first request is answered at once, which gives a round trip time
+ * far below rto_min. The next three sends of a request are lost, they
+ * must be 20, 40 and 50 ms apart: rto_min, doubled, and held at rto_max.
+ * Then a request is lost altogether and times out after two sends.
+ */
+static int rto_timeouts;
+
+static void
+rto_cb(struct snmp_client *client, snmp_pdu_t *pdu, snmp_pdu_t *resp,
+       void *arg) {
+    (void)client;
+    (void)pdu;
+    (void)arg;
+    if (resp == NULL)
+        rto_timeouts++;
+}
+
+static void
+check_gap(u_int i, uint64_t min, uint64_t max) {
+    uint64_t gap = agent.arrived[i] - agent.arrived[i - 1];
+
+    if (gap < min || gap >= max) {
+        fprintf(stderr, "client_test: rto: send %u after %lu us, "
+                "not in [%lu, %lu)\n", i, (u_long)gap, (u_long)min,
+                (u_long)max);
+        exit(1);
+    }
+}
+
+static void
+rto_test(void) {
+    struct snmp_client client;
+    snmp_pdu_t req, resp;
+    uint64_t start, t;
+
+    client_open(&client);
+    client.timeout.tv_sec = 1;
+    client.retries = 3;
+    client.adaptive_rto = 1;
+    client.rto_min.tv_sec = 0;
+    client.rto_min.tv_usec = 20000;
+    client.rto_max.tv_sec = 0;
+    client.rto_max.tv_usec = 50000;
+    snmp_pdu_init(&req);
+    if (snmp_pdu_reserve(&req, 1) != 0)
+        fail("rto", "no memory");
+
+    /* snmp_dialog initializes the response itself */
+    memset(&resp, 0xa5, sizeof(resp));
+    make_get(&client, &req, 5);
+    if (snmp_dialog(&client, &req, &resp) != 0)
+        fail("rto", client.error);
+    if (client.srtt == 0 || client.srtt >= 20000)
+        fail("rto", "no round trip time measured");
+
+    agent_set(3, 0);
+    make_get(&client, &req, 6);
+    if (snmp_dialog_reuse(&client, &req, &resp) != 0)
+        fail("rto", client.error);
+    if (resp.nbindings != 1 || resp.bindings[0].v.integer != 6 * 7)
+        fail("rto", "wrong value");
+    pthread_mutex_lock(&agent.lock);
+    if (agent.narrived != 4)
+        fail("rto", "not sent four times");
+    check_gap(1, 20000, 40000);
+    check_gap(2, 40000, 80000);
+    check_gap(3, 50000, 80000);
+    pthread_mutex_unlock(&agent.lock);
+
+    /* the same on the timer wheel, where the first send counts as a retry */
+    agent_set(2, 0);
+    client.retries = 2;
+    make_get(&client, &req, 7);
+    start = now_us();
+    if (snmp_pdu_send(&client, &req, rto_cb, NULL) == -1)
+        fail("rto", client.error);
+    while (rto_timeouts == 0 && now_us() - start < 2000000)
+        (void)snmp_receive(&client, 1);
+    t = now_us() - start;
+    if (t < 60000 || t >= 500000)
+        fail("rto", "request timed out at the wrong time");
+    pthread_mutex_lock(&agent.lock);
+    if (agent.narrived != 2)
+        fail("rto", "not sent twice");
+    check_gap(1, 20000, 40000);
+    pthread_mutex_unlock(&agent.lock);
+
+    snmp_pdu_free(&req);
+    snmp_pdu_free(&resp);
+    snmp_close(&client);
+    printf("rto: ok\n");
+}
+
+/*
+ * A GETBULK of 100 repetitions against an agent that sends at most 30
+ * bindings, with sizes unknown at first: it is halved twice. Later
+ * requests ask for no more repetitions than fit as the sizes are learned,
+ * until the agent does not answer tooBig any more.
+ */
+static void
+bulk_dialog(struct snmp_client *client, snmp_pdu_t *req, snmp_pdu_t *resp,
+            u_int *ntoobig) {
+    u_int i;
+
+    snmp_pdu_reset(client, req, SNMP_PDU_GETBULK);
+    req->bindings[0].oid.len = sizeof(base) / sizeof(base[0]);
+    memcpy(req->bindings[0].oid.subs, base, sizeof(base));
+    req->bindings[0].syntax = SNMP_SYNTAX_NULL;
+    req->nbindings = 1;
+    req->error_status = 0;
+    req->error_index = 100;
+
+    agent_set(0, 30);
+    if (snmp_dialog_reuse(client, req, resp) != 0)
+        fail("toobig", client->error);
+    if (resp->error_status != SNMP_ERR_NOERROR || resp->nbindings == 0 ||
+            resp->nbindings > 30)
+        fail("toobig", "wrong response");
+    for (i = 0; i < resp->nbindings; i++)
+        if (resp->bindings[i].syntax != SNMP_SYNTAX_INTEGER ||
+                resp->bindings[i].v.integer != (int32_t)(i + 1))
+            fail("toobig", "wrong value");
+    pthread_mutex_lock(&agent.lock);
+    *ntoobig = agent.ntoobig;
+    pthread_mutex_unlock(&agent.lock);
+}
+
+static void
+toobig_test(void) {
+    struct snmp_client client;
+    snmp_pdu_t req, resp;
+    u_int ntoobig, last, fit, i;
+
+    client_open(&client);
+    client.timeout.tv_sec = 1;
+    client.retries = 1;
+    snmp_pdu_init(&req);
+    snmp_pdu_init(&resp);
+    if (snmp_pdu_reserve(&req, 1) != 0)
+        fail("toobig", "no memory");
+
+    if (snmp_client_fit(&client, 100) != 100)
+        fail("toobig", "fit without sizes");
+    bulk_dialog(&client, &req, &resp, &ntoobig);
+    if (ntoobig != 2 || resp.nbindings != 25)
+        fail("toobig", "not halved to 25 repetitions");
+    if (client.binding_size == 0)
+        fail("toobig", "binding size not learned");
+
+    last = 100;
+    for (i = 0; i < 8; i++) {
+        bulk_dialog(&client, &req, &resp, &ntoobig);
+        fit = snmp_client_fit(&client, 100);
+        if (fit > last || ntoobig > 2)
+            fail("toobig", "sizes not learned");
+        last = fit;
+    }
+    if (ntoobig != 0 || last > 30)
+        fail("toobig", "request still too big");
+
+    snmp_pdu_free(&req);
+    snmp_pdu_free(&resp);
+    snmp_close(&client);
+    printf("toobig: ok\n");
+}
+
+int
+main(void) {
+    pthread_t agent;
+
+    agent_start(&agent);
+    nested_test();
+    rto_test();
+    toobig_test();
+    agent_stop(agent);
+    printf("ok\n");
+    return (0);
+}
+
+#else /* _WIN32 */
+
+int
+main(void) {
+    printf("client_test: not on Windows\n");
+    return (0);
+}
+
+#endif
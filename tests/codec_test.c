@@ -0,0 +1,360 @@
+/*
+ * Regression tests of the codec, run by make test.
+ *
+ *	oids2str	asn_oids2str with empty and the longest OIDs, into
+ *			buffers that fit exactly or are one byte short
+ *	cpdu		a PDU through snmp_pdu2cpdu and snmp_cpdu2pdu, with
+ *			OIDs inline and allocated and OID values of both
+ *	arena		a PDU with an arena that decodes responses and is
+ *			reused for a SET with a copied value, which must be
+ *			freed by snmp_pdu_clear (seen with glibc only)
+ *
+ * Every buffer is followed by a guard byte. The program exits with 1 on
+ * the first wrong result.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bsnmp/config.h"
+#include "bsnmp/asn1.h"
+#include "bsnmp/snmp.h"
+
+#define GUARD	'#'
+#define LONG_STRING	1500
+
+/*
+ * Seeing what is freed.
+ */
+#ifdef __GLIBC__
+extern void __libc_free(void *);
+
+static const void *watched;
+static int watched_freed;
+
+void
+free(void *ptr) {
+    if (ptr != NULL && ptr == watched)
+        watched_freed = 1;
+    __libc_free(ptr);
+}
+#endif
+
+static void
+fail(const char *what, const char *why) {
+    fprintf(stderr, "codec_test: %s: %s\n", what, why);
+    exit(1);
+}
+
+/*
+ * Format n oids into a buffer of size bytes. nfit of them must fit and
+ * give the text want.
+ */
+static void
+check_oids2str(const asn_oid_t *oids, u_int n, size_t size, u_int nfit,
+               const char *want) {
+    char *buf;
+    size_t len = size;
+
+    if ((buf = malloc(size + 1)) == NULL)
+        fail("oids2str", "no memory");
+    memset(buf, 'x', size);
+    buf[size] = GUARD;
+    if (asn_oids2str(oids, n, ' ', buf, &len) != nfit)
+        fail("oids2str", "wrong number of oids");
+    if (buf[size] != GUARD)
+        fail("oids2str", "wrote past the buffer");
+    if (len != strlen(want) || (size > 0 && strcmp(buf, want) != 0))
+        fail("oids2str", "wrong text");
+    free(buf);
+}
+
+static void
+oids2str_test(void) {
+    static const asn_subid_t subs[] = { 1, 3, 6 };
+    asn_oid_t oids[3], longest;
+    char *want;
+    size_t len;
+    u_int i;
+
+    memset(oids, 0, sizeof(oids));
+    oids[1].len = sizeof(subs) / sizeof(subs[0]);
+    memcpy(oids[1].subs, subs, sizeof(subs));
+
+    /* an empty OID needs the separator and the NUL */
+    check_oids2str(&oids[0], 1, 0, 0, "");
+    check_oids2str(&oids[0], 1, 1, 0, "");
+    check_oids2str(&oids[0], 1, 2, 1, " ");
+
+    check_oids2str(&oids[1], 1, 6, 0, "");
+    check_oids2str(&oids[1], 1, 7, 1, "1.3.6 ");
+
+    check_oids2str(oids, 3, 8, 2, " 1.3.6 ");
+    check_oids2str(oids, 3, 9, 3, " 1.3.6  ");
+
+    /* the longest text, around the bound of the direct path */
+    longest.len = ASN_MAXOIDLEN;
+    for (i = 0; i < ASN_MAXOIDLEN; i++)
+        longest.subs[i] = ASN_MAXID;
+    len = ASN_MAXOIDLEN * 11;
+    if ((want = malloc(len + 1)) == NULL)
+        fail("oids2str", "no memory");
+    for (i = 0; i < ASN_MAXOIDLEN; i++)
+        memcpy(want + i * 11, "4294967295.", 11);
+    want[len - 1] = ' ';
+    want[len] = '\0';
+    check_oids2str(&longest, 1, len, 0, "");
+    check_oids2str(&longest, 1, len + 1, 1, want);
+    check_oids2str(&longest, 1, len + 2, 1, want);
+    free(want);
+
+    printf("oids2str: ok\n");
+}
+
+/* an OID of len subids counting up from first */
+static void
+make_oid(asn_oid_t *oid, u_int len, asn_subid_t first) {
+    u_int i;
+
+    oid->len = len;
+    for (i = 0; i < len; i++)
+        oid->subs[i] = first + i;
+}
+
+static void
+check_value(const snmp_value_t *a, const snmp_value_t *b) {
+    int same;
+
+    if (asn_compare_oid(&a->oid, &b->oid) != 0 || a->syntax != b->syntax)
+        fail("cpdu", "binding changed");
+    switch (a->syntax) {
+
+    case SNMP_SYNTAX_NULL:
+        same = 1;
+        break;
+
+    case SNMP_SYNTAX_OCTETSTRING:
+        same = a->v.octetstring.len == b->v.octetstring.len &&
+               (a->v.octetstring.len == 0 ||
+                memcmp(a->v.octetstring.octets, b->v.octetstring.octets,
+                       a->v.octetstring.len) == 0);
+        break;
+
+    case SNMP_SYNTAX_OID:
+        same = asn_compare_oid(&a->v.oid, &b->v.oid) == 0;
+        break;
+
+    case SNMP_SYNTAX_INTEGER:
+        same = a->v.integer == b->v.integer;
+        break;
+
+    case SNMP_SYNTAX_IPADDRESS:
+        same = memcmp(a->v.ipaddress, b->v.ipaddress,
+                      sizeof(a->v.ipaddress)) == 0;
+        break;
+
+    case SNMP_SYNTAX_COUNTER64:
+        same = a->v.counter64 == b->v.counter64;
+        break;
+
+    default:
+        same = a->v.uint32 == b->v.uint32;
+        break;
+    }
+    if (!same)
+        fail("cpdu", "value changed");
+}
+
+static void
+cpdu_test(void) {
+    static const u_char descr[] = "GigabitEthernet0/0/17";
+    static const u_char ip[4] = { 192, 0, 2, 1 };
+    snmp_pdu_t pdu, back;
+    snmp_cpdu_t c;
+    snmp_value_t *v;
+    u_int i;
+
+    snmp_pdu_init(&pdu);
+    pdu.version = SNMP_V2c;
+    pdu.pdu_type = SNMP_PDU_SET;
+    pdu.request_id = 4711;
+    pdu.error_status = SNMP_ERR_NOERROR;
+    pdu.error_index = 0;
+    if (snmp_pdu_reserve(&pdu, 8) != 0)
+        fail("cpdu", "no memory");
+    v = pdu.bindings;
+
+    make_oid(&v[0].oid, 10, 1);
+    v[0].syntax = SNMP_SYNTAX_INTEGER;
+    v[0].v.integer = -17;
+
+    make_oid(&v[1].oid, ASN_COID_INLINE, 2);
+    v[1].syntax = SNMP_SYNTAX_OCTETSTRING;
+    v[1].v.octetstring.len = sizeof(descr) - 1;
+    if ((v[1].v.octetstring.octets = malloc(sizeof(descr) - 1)) == NULL)
+        fail("cpdu", "no memory");
+    memcpy(v[1].v.octetstring.octets, descr, sizeof(descr) - 1);
+
+    make_oid(&v[2].oid, ASN_COID_INLINE + 1, 3);
+    v[2].syntax = SNMP_SYNTAX_COUNTER64;
+    v[2].v.counter64 = (uint64_t)1 << 40;
+
+    make_oid(&v[3].oid, ASN_MAXOIDLEN, 4);
+    v[3].syntax = SNMP_SYNTAX_IPADDRESS;
+    memcpy(v[3].v.ipaddress, ip, sizeof(ip));
+
+    /* OID values inline, allocated and of the longest length */
+    make_oid(&v[4].oid, 9, 5);
+    v[4].syntax = SNMP_SYNTAX_OID;
+    make_oid(&v[4].v.oid, ASN_COID_INLINE, 50);
+
+    make_oid(&v[5].oid, 9, 6);
+    v[5].syntax = SNMP_SYNTAX_OID;
+    make_oid(&v[5].v.oid, 40, 60);
+
+    make_oid(&v[6].oid, ASN_COID_INLINE + 1, 7);
+    v[6].syntax = SNMP_SYNTAX_OID;
+    make_oid(&v[6].v.oid, ASN_MAXOIDLEN, 70);
+
+    make_oid(&v[7].oid, 1, 8);
+    v[7].syntax = SNMP_SYNTAX_NULL;
+    pdu.nbindings = 8;
+
+    if (snmp_pdu2cpdu(&c, &pdu) != 0)
+        fail("cpdu", "snmp_pdu2cpdu failed");
+    if (c.nbindings != pdu.nbindings)
+        fail("cpdu", "bindings lost");
+
+    /* the fields that are not kept stay as they are */
+    snmp_pdu_init(&back);
+    strcpy(back.community, "public");
+    if (snmp_cpdu2pdu(&back, &c) != 0)
+        fail("cpdu", "snmp_cpdu2pdu failed");
+    if (strcmp(back.community, "public") != 0)
+        fail("cpdu", "community changed");
+    if (back.version != pdu.version || back.pdu_type != pdu.pdu_type ||
+            back.request_id != pdu.request_id ||
+            back.error_status != pdu.error_status ||
+            back.error_index != pdu.error_index ||
+            back.nbindings != pdu.nbindings)
+        fail("cpdu", "header changed");
+    for (i = 0; i < pdu.nbindings; i++)
+        check_value(&pdu.bindings[i], &back.bindings[i]);
+
+    /* each has copies of its own */
+    snmp_pdu_free(&pdu);
+    snmp_cpdu_free(&c);
+    snmp_pdu_free(&back);
+
+    printf("cpdu: ok\n");
+}
+
+/* a response of two octet strings, one short and one long */
+static size_t
+make_response(u_char *buf, size_t size) {
+    static u_char descr[] = "GigabitEthernet0/0/17";
+    static u_char alias[LONG_STRING];
+    snmp_pdu_t pdu;
+    asn_buf_t b;
+
+    snmp_pdu_init(&pdu);
+    strcpy(pdu.community, "public");
+    pdu.version = SNMP_V2c;
+    pdu.pdu_type = SNMP_PDU_RESPONSE;
+    pdu.request_id = 4711;
+    if (snmp_pdu_reserve(&pdu, 2) != 0)
+        fail("arena", "no memory");
+    memset(alias, 'a', sizeof(alias));
+    make_oid(&pdu.bindings[0].oid, 10, 1);
+    pdu.bindings[0].syntax = SNMP_SYNTAX_OCTETSTRING;
+    pdu.bindings[0].v.octetstring.octets = descr;
+    pdu.bindings[0].v.octetstring.len = sizeof(descr) - 1;
+    make_oid(&pdu.bindings[1].oid, 10, 2);
+    pdu.bindings[1].syntax = SNMP_SYNTAX_OCTETSTRING;
+    pdu.bindings[1].v.octetstring.octets = alias;
+    pdu.bindings[1].v.octetstring.len = sizeof(alias);
+    pdu.nbindings = 2;
+
+    b.asn_ptr = buf;
+    b.asn_len = size;
+    if (snmp_pdu_encode(&pdu, &b) != SNMP_CODE_OK)
+        fail("arena", "snmp_pdu_encode failed");
+    /* the values are static */
+    pdu.bindings[0].syntax = SNMP_SYNTAX_NULL;
+    pdu.bindings[1].syntax = SNMP_SYNTAX_NULL;
+    snmp_pdu_free(&pdu);
+    return (b.asn_ptr - buf);
+}
+
+static void
+decode_response(snmp_pdu_t *pdu, u_char *buf, size_t len) {
+    asn_buf_t b;
+    int32_t ip;
+
+    snmp_pdu_clear(pdu);
+    b.asn_ptr = buf;
+    b.asn_len = len;
+    if (snmp_pdu_decode(&b, pdu, &ip) != SNMP_CODE_OK)
+        fail("arena", "snmp_pdu_decode failed");
+    if (pdu->nbindings != 2 ||
+            pdu->bindings[1].syntax != SNMP_SYNTAX_OCTETSTRING ||
+            pdu->bindings[1].v.octetstring.len != LONG_STRING ||
+            pdu->bindings[1].v.octetstring.octets[LONG_STRING - 1] != 'a')
+        fail("arena", "wrong response");
+}
+
+static void
+arena_test(void) {
+    static u_char alias[] = "uplink";
+    static u_char buf[4096];
+    snmp_pdu_t pdu;
+    snmp_arena_t arena;
+    snmp_value_t v;
+    size_t len;
+    u_int i;
+
+    len = make_response(buf, sizeof(buf));
+    snmp_pdu_init(&pdu);
+    snmp_arena_init(&arena, NULL, 0);
+    pdu.arena = &arena;
+
+    /* in overflow blocks first, then in the first block */
+    for (i = 0; i < 3; i++)
+        decode_response(&pdu, buf, len);
+
+    /* a SET in the same PDU */
+    snmp_pdu_clear(&pdu);
+    pdu.version = SNMP_V2c;
+    pdu.pdu_type = SNMP_PDU_SET;
+    make_oid(&v.oid, 10, 3);
+    v.syntax = SNMP_SYNTAX_OCTETSTRING;
+    v.v.octetstring.octets = alias;
+    v.v.octetstring.len = sizeof(alias) - 1;
+    if (snmp_value_copy(&pdu.bindings[0], &v) != 0)
+        fail("arena", "no memory");
+    pdu.nbindings = 1;
+#ifdef __GLIBC__
+    watched = pdu.bindings[0].v.octetstring.octets;
+    watched_freed = 0;
+#endif
+    snmp_pdu_clear(&pdu);
+#ifdef __GLIBC__
+    watched = NULL;
+    if (!watched_freed)
+        fail("arena", "copied value not freed");
+#endif
+
+    decode_response(&pdu, buf, len);
+    snmp_pdu_free(&pdu);
+    snmp_arena_free(&arena);
+
+    printf("arena: ok\n");
+}
+
+int
+main(void) {
+    oids2str_test();
+    cpdu_test();
+    arena_test();
+    printf("ok\n");
+    return (0);
+}
@@ -0,0 +1,281 @@
+/*
+ * Tests of bsnmp/coro.hpp against an agent on loopback, run by make test.
+ *
+ *	get		a GET awaited in a coroutine
+ *	walk		a subtree of ten bindings walked with GETBULK
+ *	timeout		a GET the agent does not answer throws bsnmp::error
+ *
+ * The agent runs on a thread of its own and sends every response twice,
+ * so bsnmp::run sees a duplicate after each one. The value of ...1.N.0
+ * is N * 7 for N from 1 to 10; requests for ...1.99.0 are dropped. The
+ * program exits with 1 on the first wrong result.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <exception>
+#ifndef _WIN32
+#include <pthread.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include "bsnmp/coro.hpp"
+
+#define BUFSIZ_AGENT	65536
+#define NROWS		10
+#define LOST		99
+
+static const asn_subid_t base[] = { 1, 3, 6, 1, 4, 1, 12325, 1 };
+
+static char port[16];
+static int agent_fd;
+
+static void
+fail(const char *what, const char *why) {
+    fprintf(stderr, "coro_test: %s: %s\n", what, why);
+    exit(1);
+}
+
+static asn_oid_t
+table(void) {
+    asn_oid_t o;
+
+    o.len = sizeof(base) / sizeof(base[0]);
+    memcpy(o.subs, base, sizeof(base));
+    return (o);
+}
+
+/* the OID of row n, ...1.n.0 */
+static asn_oid_t
+row(u_int n) {
+    asn_oid_t o = table();
+
+    o.subs[o.len++] = n;
+    o.subs[o.len++] = 0;
+    return (o);
+}
+
+/* the row after an OID, 0 for none */
+static u_int
+next_row(const asn_oid_t *o) {
+    asn_oid_t r;
+    u_int n;
+
+    for (n = 1; n <= NROWS; n++) {
+        r = row(n);
+        if (asn_compare_oid(&r, o) > 0)
+            return (n);
+    }
+    return (0);
+}
+
+/* row n or, for 0, the end of the MIB after oid */
+static void
+set_row(snmp_value_t *v, u_int n, const asn_oid_t *oid) {
+    if (n == 0) {
+        v->oid = *oid;
+        v->syntax = SNMP_SYNTAX_ENDOFMIBVIEW;
+        return;
+    }
+    v->oid = row(n);
+    v->syntax = SNMP_SYNTAX_INTEGER;
+    v->v.integer = (int32_t)(n * 7);
+}
+
+/*
+ * Answer a request in place. GETBULKs have one binding here. Returns -1
+ * for requests to drop.
+ */
+static int
+agent_answer(snmp_pdu_t *pdu) {
+    asn_oid_t start;
+    u_int i, n, reps;
+
+    if (pdu->nbindings == 0)
+        return (-1);
+    if (pdu->pdu_type == SNMP_PDU_GETBULK) {
+        start = pdu->bindings[0].oid;
+        reps = pdu->error_index < 1 ? 1 : (u_int)pdu->error_index;
+        if (snmp_pdu_reserve(pdu, reps) != 0)
+            return (-1);
+        pdu->nbindings = 0;
+        for (i = 0, n = next_row(&start); i < reps; i++) {
+            set_row(&pdu->bindings[pdu->nbindings++], n, &start);
+            if (n == 0)
+                break;
+            n = n < NROWS ? n + 1 : 0;
+        }
+    } else {
+        for (i = 0; i < pdu->nbindings; i++) {
+            n = pdu->bindings[i].oid.subs[pdu->bindings[i].oid.len - 2];
+            if (n == LOST)
+                return (-1);
+            pdu->bindings[i].syntax = SNMP_SYNTAX_INTEGER;
+            pdu->bindings[i].v.integer = (int32_t)(n * 7);
+        }
+    }
+    pdu->pdu_type = SNMP_PDU_RESPONSE;
+    pdu->error_status = SNMP_ERR_NOERROR;
+    pdu->error_index = 0;
+    return (0);
+}
+
+/*
+ * The agent, it stops on a datagram of one byte.
+ */
+static void *
+agent_run(void *) {
+    static u_char rxbuf[BUFSIZ_AGENT], txbuf[BUFSIZ_AGENT];
+    struct sockaddr_in from;
+    socklen_t fromlen;
+    snmp_pdu_t pdu;
+    asn_buf_t b;
+    int32_t ip;
+    ssize_t n;
+
+    snmp_pdu_init(&pdu);
+    for (;;) {
+        fromlen = sizeof(from);
+        if ((n = recvfrom(agent_fd, rxbuf, sizeof(rxbuf), 0,
+                          (struct sockaddr *)&from, &fromlen)) <= 1)
+            break;
+        snmp_pdu_clear(&pdu);
+        b.asn_ptr = rxbuf;
+        b.asn_len = n;
+        if (snmp_pdu_decode(&b, &pdu, &ip) != SNMP_CODE_OK ||
+                agent_answer(&pdu) == -1)
+            continue;
+        b.asn_ptr = txbuf;
+        b.asn_len = sizeof(txbuf);
+        if (snmp_pdu_encode(&pdu, &b) != SNMP_CODE_OK)
+            continue;
+        for (int i = 0; i < 2; i++)
+            (void)sendto(agent_fd, txbuf, b.asn_ptr - txbuf, 0,
+                         (struct sockaddr *)&from, fromlen);
+    }
+    snmp_pdu_free(&pdu);
+    return (nullptr);
+}
+
+static void
+agent_start(pthread_t *tid) {
+    struct sockaddr_in sin;
+    socklen_t len;
+
+    if ((agent_fd = socket(AF_INET, SOCK_DGRAM, 0)) == -1)
+        fail("agent", strerror(errno));
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    len = sizeof(sin);
+    if (bind(agent_fd, (struct sockaddr *)&sin, sizeof(sin)) == -1 ||
+            getsockname(agent_fd, (struct sockaddr *)&sin, &len) == -1)
+        fail("agent", strerror(errno));
+    snprintf(port, sizeof(port), "%u", ntohs(sin.sin_port));
+    if (pthread_create(tid, nullptr, agent_run, nullptr) != 0)
+        fail("agent", "pthread_create");
+}
+
+static void
+agent_stop(pthread_t tid) {
+    struct sockaddr_in sin;
+    int fd;
+
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    sin.sin_port = htons((u_short)atoi(port));
+    if ((fd = socket(AF_INET, SOCK_DGRAM, 0)) == -1 ||
+            sendto(fd, "", 1, 0, (struct sockaddr *)&sin, sizeof(sin)) != 1)
+        fail("agent", strerror(errno));
+    (void)close(fd);
+    (void)pthread_join(tid, nullptr);
+    (void)close(agent_fd);
+}
+
+static bsnmp::task<int32_t>
+get_one(snmp_client *client, u_int n) {
+    const asn_oid_t o = row(n);
+    bsnmp::pdu resp = co_await bsnmp::get(client, o);
+
+    if (resp->nbindings != 1 ||
+            resp->bindings[0].syntax != SNMP_SYNTAX_INTEGER)
+        throw bsnmp::error("wrong response");
+    co_return (resp->bindings[0].v.integer);
+}
+
+static bsnmp::task<u_int>
+get_all(snmp_client *client) {
+    u_int n;
+
+    for (n = 1; n <= NROWS; n++)
+        if (co_await get_one(client, n) != (int32_t)(n * 7))
+            throw bsnmp::error("wrong value");
+    co_return (n - 1);
+}
+
+static bsnmp::task<u_int>
+walk_all(snmp_client *client) {
+    u_int seen = 0;
+
+    co_return (co_await bsnmp::walk(client, table(),
+    [&seen](const snmp_value_t &v) {
+        if (v.syntax != SNMP_SYNTAX_INTEGER ||
+                v.v.integer != (int32_t)(++seen * 7))
+            fail("walk", "wrong value");
+    }));
+}
+
+static bsnmp::task<bool>
+get_lost(snmp_client *client) {
+    try {
+        (void)co_await get_one(client, LOST);
+    } catch (const bsnmp::error &) {
+        co_return (true);
+    }
+    co_return (false);
+}
+
+int
+main() {
+    snmp_client client;
+    pthread_t agent;
+
+    agent_start(&agent);
+    snmp_client_init(&client);
+    client.dump_pdus = 0;
+    client.timeout.tv_sec = 0;
+    client.timeout.tv_usec = 50000;
+    client.retries = 0;
+    if (snmp_open(&client, "127.0.0.1", port, nullptr, nullptr) != 0)
+        fail("open", client.error);
+
+    try {
+        if (bsnmp::run(&client, get_all(&client)) != NROWS)
+            fail("get", "rows missing");
+        printf("get: ok\n");
+        if (bsnmp::run(&client, walk_all(&client)) != NROWS)
+            fail("walk", "rows missing");
+        printf("walk: ok\n");
+        if (!bsnmp::run(&client, get_lost(&client)))
+            fail("timeout", "answered");
+        printf("timeout: ok\n");
+    } catch (const std::exception &e) {
+        fail("run", e.what());
+    }
+
+    snmp_close(&client);
+    agent_stop(agent);
+    printf("ok\n");
+    return (0);
+}
+
+#else /* _WIN32 */
+
+int
+main() {
+    printf("coro_test: not on Windows\n");
+    return (0);
+}
+
+#endif
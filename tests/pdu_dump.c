@@ -14,6 +14,8 @@ asn_subid_t oid2[] = {2,3,4,5,6,7,8,9,10,11,12,13};
 void append_bindings(snmp_pdu_t* pdu, asn_subid_t* oid
 	, u_int oid_len, enum snmp_syntax syntax ) {
 
+	if (snmp_pdu_reserve(pdu, pdu->nbindings + 1) != 0)
+		return;
 	pdu->bindings[pdu->nbindings].oid.len = oid_len;
 	memcpy(pdu->bindings[pdu->nbindings].oid.subs, oid, oid_len*sizeof(oid[0]));
 	pdu->bindings[pdu->nbindings].syntax = syntax;
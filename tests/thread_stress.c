@@ -0,0 +1,536 @@
+/*
+ * Stress test of the thread contract of the client, to be run under
+ * ThreadSanitizer (make test-threads).
+ *
+ * An agent thread answers GETs on loopback; the value of ...1.N.0 is
+ * N * 7. Then
+ *
+ *	parallel	every thread has a client of its own and sinks of
+ *			its own, dumps all PDUs and formats OIDs
+ *	shared		worker threads share one client under its lock,
+ *			with snmp_dialog and with asynchronous requests
+ *			whose responses any of them may receive
+ *	mux		workers share the clients of one mux
+ *	shards		workers submit requests of clients that run on
+ *			shards, the callbacks run on the shards
+ *	resolver	workers open their clients through one address
+ *			cache that was filled by several threads
+ *
+ * Every response is checked and the program exits with 1 on the first
+ * wrong one or when a thread saw output of another.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "bsnmp/config.h"
+#ifndef _WIN32
+#include <poll.h>
+#include <sched.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include "bsnmp/asn1.h"
+#include "bsnmp/snmp.h"
+#include "bsnmp/client.h"
+#include "bsnmp/mux.h"
+#include "bsnmp/shard.h"
+#include "bsnmp/resolve.h"
+
+#define NTHREADS	8
+#define NITER		300
+#define NMUX		4	/* clients of the mux */
+#define NSHARDS		4
+#define BUFSIZ_AGENT	65536
+
+static const asn_subid_t base[] = { 1, 3, 6, 1, 4, 1, 12325, 1 };
+
+static char port[16];
+static int agent_fd;
+
+static void
+fail(const char *what, const char *why) {
+    fprintf(stderr, "thread_stress: %s: %s\n", what, why);
+    exit(1);
+}
+
+/*
+ * The agent, it stops on a datagram of one byte.
+ */
+static void *
+agent_run(void *arg) {
+    static u_char rxbuf[BUFSIZ_AGENT], txbuf[BUFSIZ_AGENT];
+    struct sockaddr_in from;
+    socklen_t fromlen;
+    snmp_pdu_t pdu;
+    asn_buf_t b;
+    u_int i;
+    int32_t ip;
+    ssize_t n;
+
+    (void)arg;
+    snmp_pdu_init(&pdu);
+    for (;;) {
+        fromlen = sizeof(from);
+        if ((n = recvfrom(agent_fd, rxbuf, sizeof(rxbuf), 0,
+                          (struct sockaddr *)&from, &fromlen)) <= 1)
+            break;
+        snmp_pdu_clear(&pdu);
+        b.asn_ptr = rxbuf;
+        b.asn_len = n;
+        if (snmp_pdu_decode(&b, &pdu, &ip) != SNMP_CODE_OK)
+            continue;
+        pdu.pdu_type = SNMP_PDU_RESPONSE;
+        for (i = 0; i < pdu.nbindings; i++) {
+            pdu.bindings[i].syntax = SNMP_SYNTAX_INTEGER;
+            pdu.bindings[i].v.integer =
+                pdu.bindings[i].oid.subs[pdu.bindings[i].oid.len - 2] * 7;
+        }
+        b.asn_ptr = txbuf;
+        b.asn_len = sizeof(txbuf);
+        if (snmp_pdu_encode(&pdu, &b) == SNMP_CODE_OK)
+            (void)sendto(agent_fd, txbuf, b.asn_ptr - txbuf, 0,
+                         (struct sockaddr *)&from, fromlen);
+    }
+    snmp_pdu_free(&pdu);
+    return (NULL);
+}
+
+static void
+agent_start(pthread_t *tid) {
+    struct sockaddr_in sin;
+    socklen_t len;
+    int rcvbuf = 1024 * 1024;
+
+    if ((agent_fd = socket(AF_INET, SOCK_DGRAM, 0)) == -1)
+        fail("agent", strerror(errno));
+    (void)setsockopt(agent_fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf,
+                     sizeof(rcvbuf));
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    len = sizeof(sin);
+    if (bind(agent_fd, (struct sockaddr *)&sin, sizeof(sin)) == -1 ||
+            getsockname(agent_fd, (struct sockaddr *)&sin, &len) == -1)
+        fail("agent", strerror(errno));
+    snprintf(port, sizeof(port), "%u", ntohs(sin.sin_port));
+    if (pthread_create(tid, NULL, agent_run, NULL) != 0)
+        fail("agent", "pthread_create");
+}
+
+static void
+agent_stop(pthread_t tid) {
+    struct sockaddr_in sin;
+    int fd;
+
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    sin.sin_port = htons((u_short)atoi(port));
+    if ((fd = socket(AF_INET, SOCK_DGRAM, 0)) == -1 ||
+            sendto(fd, "", 1, 0, (struct sockaddr *)&sin, sizeof(sin)) != 1)
+        fail("agent", strerror(errno));
+    (void)close(fd);
+    (void)pthread_join(tid, NULL);
+    (void)close(agent_fd);
+}
+
+static void
+client_open(struct snmp_client *client, struct snmp_mux *mux) {
+    snmp_client_init(client);
+    client->dump_pdus = 0;
+    client->timeout.tv_sec = 1;
+    client->mux = mux;
+    if (snmp_open(client, "127.0.0.1", port, NULL, NULL) != 0)
+        fail("open", client->error);
+}
+
+static void
+make_get(struct snmp_client *client, snmp_pdu_t *pdu, u_int n) {
+    snmp_pdu_reset(client, pdu, SNMP_PDU_GET);
+    pdu->bindings[0].oid.len = sizeof(base) / sizeof(base[0]);
+    memcpy(pdu->bindings[0].oid.subs, base, sizeof(base));
+    pdu->bindings[0].oid.subs[pdu->bindings[0].oid.len++] = n;
+    pdu->bindings[0].oid.subs[pdu->bindings[0].oid.len++] = 0;
+    pdu->bindings[0].syntax = SNMP_SYNTAX_NULL;
+    pdu->nbindings = 1;
+}
+
+static void
+check_resp(const snmp_pdu_t *resp, u_int n) {
+    if (resp->nbindings != 1 ||
+            resp->bindings[0].syntax != SNMP_SYNTAX_INTEGER ||
+            resp->bindings[0].v.integer != (int32_t)(n * 7))
+        fail("response", "wrong value");
+}
+
+/*
+ * One GET with snmp_dialog.
+ */
+static void
+get_dialog(struct snmp_client *client, u_int n) {
+    snmp_pdu_t req, resp;
+
+    snmp_pdu_init(&req);
+    snmp_pdu_init(&resp);
+    if (snmp_pdu_reserve(&req, 1) != 0)
+        fail("get", "no memory");
+    make_get(client, &req, n);
+    if (snmp_dialog(client, &req, &resp) != 0)
+        fail("dialog", client->error);
+    check_resp(&resp, n);
+    snmp_pdu_free(&req);
+    snmp_pdu_free(&resp);
+}
+
+/* sinks of a thread, counting what it gets */
+struct counts {
+    u_long	errors;
+    u_long	printed;
+    pthread_t	owner;
+};
+
+static void
+count_error(void *arg, const char *msg) {
+    struct counts *c = arg;
+
+    if (!pthread_equal(c->owner, pthread_self()))
+        fail("sinks", "error of another thread");
+    (void)msg;
+    c->errors++;
+}
+
+static void
+count_print(void *arg, const char *msg) {
+    struct counts *c = arg;
+
+    if (!pthread_equal(c->owner, pthread_self()))
+        fail("sinks", "output of another thread");
+    c->printed += strlen(msg);
+}
+
+static void *
+parallel_run(void *arg) {
+    static const u_char garbage[] = { 0x30, 0x10, 0x02, 0x01 };
+    u_int id = (u_int)(size_t)arg, i;
+    struct snmp_client client;
+    struct snmp_sinks sinks;
+    struct counts counts;
+    char buf[ASN_OIDSTRLEN];
+    snmp_pdu_t pdu;
+    asn_oid_t oid;
+    asn_buf_t b;
+    int32_t ip;
+
+    memset(&counts, 0, sizeof(counts));
+    counts.owner = pthread_self();
+    sinks.error = count_error;
+    sinks.print = count_print;
+    sinks.arg = &counts;
+    (void)snmp_set_sinks(&sinks);
+
+    client_open(&client, NULL);
+    client.dump_pdus = 1;
+    oid.len = sizeof(base) / sizeof(base[0]);
+    memcpy(oid.subs, base, sizeof(base));
+    oid.subs[oid.len++] = 0;
+    for (i = 0; i < NITER; i++) {
+        get_dialog(&client, id * 100000 + i);
+
+        oid.subs[oid.len - 1] = id * 100000 + i;
+        if (strcmp(asn_oid2str(&oid), asn_oid2str_r(&oid, buf)) != 0)
+            fail("asn_oid2str", "buffer shared between threads");
+    }
+    snmp_close(&client);
+
+    snmp_pdu_init(&pdu);
+    b.asn_cptr = garbage;
+    b.asn_len = sizeof(garbage);
+    if (snmp_pdu_decode(&b, &pdu, &ip) == SNMP_CODE_OK)
+        fail("decode", "garbage accepted");
+    snmp_pdu_free(&pdu);
+
+    (void)snmp_set_sinks(NULL);
+    if (counts.printed == 0 || counts.errors == 0)
+        fail("sinks", "output went elsewhere");
+    return (NULL);
+}
+
+/* one client shared by the workers */
+struct shared {
+    struct snmp_client	*client;
+    u_int			id;
+};
+
+struct async {
+    u_int	n;
+    int	done;
+};
+
+static void
+async_cb(struct snmp_client *client, snmp_pdu_t *req, snmp_pdu_t *resp,
+         void *arg) {
+    struct async *a = arg;
+
+    (void)client;
+    (void)req;
+    if (resp == NULL)
+        fail("async", "timeout");
+    check_resp(resp, a->n);
+    a->done = 1;
+}
+
+/*
+ * One GET sent asynchronously. The response may be received by any of
+ * the workers, each takes the lock only for one snmp_receive.
+ */
+static void
+get_async(struct snmp_client *client, u_int n) {
+    struct async a;
+    snmp_pdu_t req;
+    int done;
+
+    snmp_pdu_init(&req);
+    if (snmp_pdu_reserve(&req, 1) != 0)
+        fail("get", "no memory");
+    a.n = n;
+    a.done = 0;
+
+    snmp_client_lock(client);
+    make_get(client, &req, n);
+    if (snmp_pdu_send(client, &req, async_cb, &a) == -1)
+        fail("send", client->error);
+    snmp_client_unlock(client);
+
+    for (;;) {
+        snmp_client_lock(client);
+        if (snmp_receive(client, 0) == -1)
+            fail("receive", client->error);
+        done = a.done;
+        snmp_client_unlock(client);
+        if (done)
+            break;
+        (void)sched_yield();
+    }
+    snmp_pdu_free(&req);
+}
+
+static void *
+shared_run(void *arg) {
+    struct shared *s = arg;
+    u_int i, n;
+
+    for (i = 0; i < NITER; i++) {
+        n = s->id * 100000 + i;
+        if (i % 2 == 0) {
+            snmp_client_lock(s->client);
+            get_dialog(s->client, n);
+            snmp_client_unlock(s->client);
+        } else {
+            get_async(s->client, n);
+        }
+    }
+    return (NULL);
+}
+
+static void
+run(const char *name, void *(*func)(void *), void **args) {
+    pthread_t tids[NTHREADS];
+    u_int i;
+
+    for (i = 0; i < NTHREADS; i++)
+        if (pthread_create(&tids[i], NULL, func, args[i]) != 0)
+            fail(name, "pthread_create");
+    for (i = 0; i < NTHREADS; i++)
+        (void)pthread_join(tids[i], NULL);
+    printf("%s: %u threads, %u requests each\n", name, NTHREADS, NITER);
+}
+
+static struct snmp_resolver resolver;
+
+static void *
+resolver_run(void *arg) {
+    u_int id = (u_int)(size_t)arg, i;
+    struct snmp_client client;
+
+    for (i = 0; i < NITER; i++) {
+        snmp_client_init(&client);
+        client.dump_pdus = 0;
+        client.timeout.tv_sec = 1;
+        client.resolver = &resolver;
+        if (snmp_open(&client, i % 2 ? "localhost" : "127.0.0.1", port,
+                      NULL, NULL) != 0)
+            fail("resolver", client.error);
+        get_dialog(&client, id * 100000 + i);
+        snmp_close(&client);
+    }
+    return (NULL);
+}
+
+static void
+resolver_test(void) {
+    static const char *const hosts[] = { "127.0.0.1", "localhost" };
+    void *args[NTHREADS];
+    u_int i;
+
+    if (snmp_resolver_init(&resolver, 60) != 0)
+        fail("resolver", resolver.error);
+    if (snmp_resolver_fill(&resolver, hosts, 2, port, AF_INET, 2) != 0)
+        fail("resolver", "fill failed");
+    for (i = 0; i < NTHREADS; i++)
+        args[i] = (void *)(size_t)i;
+    run("resolver", resolver_run, args);
+    snmp_resolver_close(&resolver);
+}
+
+#ifdef HAVE_EPOLL
+/* a request handed to a shard, it is freed by the callback */
+struct shard_get {
+    snmp_pdu_t	pdu;
+    u_int		n;
+};
+
+static struct snmp_client shard_clients[NMUX];
+static u_long shard_done;
+
+static void
+shard_cb(struct snmp_client *client, snmp_pdu_t *req, snmp_pdu_t *resp,
+         void *arg) {
+    struct shard_get *g = arg;
+
+    (void)req;
+    if (resp == NULL)
+        fail("shards", client->error);
+    check_resp(resp, g->n);
+    snmp_pdu_free(&g->pdu);
+    free(g);
+    (void)__atomic_add_fetch(&shard_done, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * The PDUs are built without the client, the shard fills in the header.
+ */
+static void *
+shards_run(void *arg) {
+    u_int id = (u_int)(size_t)arg, i;
+    struct snmp_client *client;
+    struct shard_get *g;
+
+    for (i = 0; i < NITER; i++) {
+        if ((g = malloc(sizeof(*g))) == NULL)
+            fail("shards", "no memory");
+        snmp_pdu_init(&g->pdu);
+        if (snmp_pdu_reserve(&g->pdu, 1) != 0)
+            fail("shards", "no memory");
+        g->n = id * 100000 + i;
+        g->pdu.pdu_type = SNMP_PDU_GET;
+        g->pdu.bindings[0].oid.len = sizeof(base) / sizeof(base[0]);
+        memcpy(g->pdu.bindings[0].oid.subs, base, sizeof(base));
+        g->pdu.bindings[0].oid.subs[g->pdu.bindings[0].oid.len++] = g->n;
+        g->pdu.bindings[0].oid.subs[g->pdu.bindings[0].oid.len++] = 0;
+        g->pdu.bindings[0].syntax = SNMP_SYNTAX_NULL;
+        g->pdu.nbindings = 1;
+
+        client = &shard_clients[(id + i) % NMUX];
+        while (snmp_shards_send(client, &g->pdu, shard_cb, g) == -1) {
+            if (errno != EAGAIN)
+                fail("shards", strerror(errno));
+            (void)sched_yield();
+        }
+    }
+    return (NULL);
+}
+
+static void
+shards_test(void) {
+    void *args[NTHREADS];
+    struct snmp_shards shards;
+    u_int i;
+    int ms;
+
+    if (snmp_shards_init(&shards, NSHARDS, AF_INET, 0) != 0)
+        fail("shards", shards.error);
+    for (i = 0; i < NMUX; i++) {
+        snmp_client_init(&shard_clients[i]);
+        shard_clients[i].dump_pdus = 0;
+        shard_clients[i].timeout.tv_sec = 1;
+        if (snmp_shards_open(&shards, &shard_clients[i], "127.0.0.1", port,
+                             NULL, NULL) != 0)
+            fail("shards", shards.error);
+    }
+    if (snmp_shards_start(&shards) != 0)
+        fail("shards", shards.error);
+    for (i = 0; i < NTHREADS; i++)
+        args[i] = (void *)(size_t)i;
+    run("shards", shards_run, args);
+    for (ms = 0; __atomic_load_n(&shard_done, __ATOMIC_ACQUIRE) !=
+            (u_long)NTHREADS * NITER; ms++) {
+        if (ms == 10000)
+            fail("shards", "requests lost");
+        (void)poll(NULL, 0, 1);
+    }
+    snmp_shards_close(&shards);
+    for (i = 0; i < NMUX; i++)
+        snmp_close(&shard_clients[i]);
+}
+#endif /* HAVE_EPOLL */
+
+int
+main(void) {
+    struct snmp_client client, mux_clients[NMUX];
+    struct shared shared[NTHREADS];
+    void *args[NTHREADS];
+    struct snmp_mux mux;
+    pthread_t agent;
+    u_int i;
+
+    agent_start(&agent);
+
+    for (i = 0; i < NTHREADS; i++)
+        args[i] = (void *)(size_t)i;
+    run("parallel", parallel_run, args);
+
+    client_open(&client, NULL);
+    if (snmp_client_lock_init(&client) != 0)
+        fail("lock", client.error);
+    for (i = 0; i < NTHREADS; i++) {
+        shared[i].client = &client;
+        shared[i].id = i;
+        args[i] = &shared[i];
+    }
+    run("shared", shared_run, args);
+    snmp_close(&client);
+
+    if (snmp_mux_open(&mux, AF_INET) != 0)
+        fail("mux", mux.error);
+    for (i = 0; i < NMUX; i++) {
+        client_open(&mux_clients[i], &mux);
+        if (snmp_client_lock_init(&mux_clients[i]) != 0)
+            fail("lock", mux_clients[i].error);
+    }
+    for (i = 0; i < NTHREADS; i++)
+        shared[i].client = &mux_clients[i % NMUX];
+    run("mux", shared_run, args);
+    for (i = 0; i < NMUX; i++)
+        snmp_close(&mux_clients[i]);
+    snmp_mux_close(&mux);
+
+#ifdef HAVE_EPOLL
+    shards_test();
+#endif
+    resolver_test();
+
+    agent_stop(agent);
+    printf("ok\n");
+    return (0);
+}
+
+#else /* _WIN32 */
+
+int
+main(void) {
+    printf("thread_stress: not on Windows\n");
+    return (0);
+}
+
+#endif